@@ -24,6 +24,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <stdexcept>
 #include <iomanip>
+#include <string.h>
+#include <Misc/FunctionCalls.h>
 #include <Misc/PrintInteger.h>
 #include <Misc/ThrowStdErr.h>
 #include <Misc/MessageLogger.h>
@@ -593,15 +595,27 @@ BathymetrySaverTool::BathymetrySaverTool(const Vrui::ToolFactory* factory,const
 	:Vrui::Tool(factory,inputAssignment),
 	 configuration(BathymetrySaverTool::factory->configuration),
 	 bathymetryBuffer(new GLfloat[BathymetrySaverTool::factory->gridSize[1]*BathymetrySaverTool::factory->gridSize[0]]),
-	 requestPending(false)
+	 bathymetryReadbackFunction(Misc::createFunctionCall(this,&BathymetrySaverTool::bathymetryReadbackCallback)),
+	 requestPending(false),bathymetryReady(false)
 	{
 	}
 
 BathymetrySaverTool::~BathymetrySaverTool(void)
 	{
+	/* Cancel any pending bathymetry request: */
+	factory->waterTable->cancelReadbacks(bathymetryReadbackFunction);
+	delete bathymetryReadbackFunction;
+	
 	delete[] bathymetryBuffer;
 	}
 
+void BathymetrySaverTool::bathymetryReadbackCallback(const GLfloat* bathymetry)
+	{
+	/* Copy the bathymetry grid and hand it to the frame method: */
+	memcpy(bathymetryBuffer,bathymetry,factory->gridSize[1]*factory->gridSize[0]*sizeof(GLfloat));
+	bathymetryReady=true;
+	}
+
 void BathymetrySaverTool::configure(const Misc::ConfigurationFileSection& configFileSection)
 	{
 	/* Override private configuration data from given configuration file section: */
@@ -624,13 +638,17 @@ void BathymetrySaverTool::buttonCallback(int buttonSlotIndex,Vrui::InputDevice::
 	if(cbData->newButtonState)
 		{
 		/* Request a bathymetry grid from the water table: */
-		requestPending=factory->waterTable->requestBathymetry(bathymetryBuffer);
+		if(!requestPending)
+			{
+			bathymetryReady=false;
+			requestPending=factory->waterTable->requestBathymetry(bathymetryReadbackFunction);
+			}
 		}
 	}
 
 void BathymetrySaverTool::frame(void)
 	{
-	if(requestPending&&factory->waterTable->haveBathymetry())
+	if(requestPending&&bathymetryReady)
 		{
 		try
 			{
@@ -31,7 +31,12 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "Types.h"
 
 /* Forward declarations: */
+namespace Misc {
+template <class ParameterParam>
+class FunctionCall;
+}
 class WaterTable2;
+typedef Misc::FunctionCall<const GLfloat*> GridReadbackFunction;
 class Sandbox;
 class BathymetrySaverTool;
 
@@ -89,9 +94,12 @@ class BathymetrySaverTool:public Vrui::Tool,public Vrui::Application::Tool<Sandb
 	static BathymetrySaverToolFactory* factory; // Pointer to the factory object for this class
 	BathymetrySaverToolFactory::Configuration configuration; // Configuration of this tool
 	GLfloat* bathymetryBuffer; // Bathymetry grid buffer
+	GridReadbackFunction* bathymetryReadbackFunction; // Function receiving requested bathymetry grids from the water table
 	bool requestPending; // Flag if this tool has a pending request to retrieve a bathymetry grid
+	volatile bool bathymetryReady; // Flag if the requested bathymetry grid has arrived in the bathymetry buffer
 	
 	/* Private methods: */
+	void bathymetryReadbackCallback(const GLfloat* bathymetry); // Callback receiving a requested bathymetry grid from the water table
 	void writeDEMFile(void) const; // Writes the bathymetry grid to a file in USGS DEM format
 	void postUpdate(void) const; // Sends an update message to a web server
 	
@@ -0,0 +1,574 @@
+/***********************************************************************
+ContourExtractor - Class to extract topographic contour lines from
+filtered depth frames as line geometry using marching squares in a set
+of background threads, and to render them as lines of a fixed width.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "ContourExtractor.h"
+
+#include <utility>
+#include <algorithm>
+#include <Math/Math.h>
+#include <Math/Constants.h>
+#include <GL/GLVertexArrayParts.h>
+#include <GL/Extensions/GLARBVertexBufferObject.h>
+#include <GL/GLContextData.h>
+#include <GL/GLTransformationWrappers.h>
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+inline ContourExtractor::Vertex interpolateEdge(const Point& p0,Scalar e0,const Point& p1,Scalar e1,Scalar level) // Returns the point on the given cell edge at which the elevation crosses the given level
+	{
+	Scalar t=(level-e0)/(e1-e0);
+	ContourExtractor::Vertex result;
+	for(int i=0;i<3;++i)
+		result.position[i]=GLfloat(p0[i]+(p1[i]-p0[i])*t);
+	return result;
+	}
+
+inline Misc::UInt64 edgeKey(unsigned int pixelIndex,int axis,int level) // Returns a key identifying the crossing of the given contour level with the cell edge leaving the given depth image pixel along the given axis
+	{
+	return (Misc::UInt64(Misc::UInt32(level))<<32)|Misc::UInt64(pixelIndex*2U+(unsigned int)(axis));
+	}
+
+}
+
+/*******************************************
+Methods of class ContourExtractor::DataItem:
+*******************************************/
+
+ContourExtractor::DataItem::DataItem(void)
+	:vertexBuffer(0),vertexBufferVersion(0),numVertices(0)
+	{
+	/* Initialize all required extensions: */
+	GLARBVertexBufferObject::initExtension();
+	
+	/* Allocate the vertex buffer: */
+	glGenBuffersARB(1,&vertexBuffer);
+	}
+
+ContourExtractor::DataItem::~DataItem(void)
+	{
+	/* Release all allocated buffers: */
+	glDeleteBuffersARB(1,&vertexBuffer);
+	}
+
+/*********************************
+Methods of class ContourExtractor:
+*********************************/
+
+void ContourExtractor::stitchPolylines(const std::vector<ContourExtractor::Vertex>& vertices,const std::vector<ContourExtractor::Polyline>& polylines,std::vector<ContourExtractor::Vertex>& stitchedVertices,std::vector<ContourExtractor::Polyline>& stitchedPolylines)
+	{
+	/* Sort the ends of all polylines by key: */
+	unsigned int numEnds=(unsigned int)(polylines.size())*2U;
+	std::vector<std::pair<Misc::UInt64,unsigned int> > ends;
+	ends.reserve(numEnds);
+	for(unsigned int i=0;i<numEnds;++i)
+		ends.push_back(std::make_pair(polylines[i/2U].ends[i%2U],i));
+	std::sort(ends.begin(),ends.end());
+	
+	/* Link pairs of ends sharing a key; a contour level crosses a cell edge only once, so a key is shared by at most two ends: */
+	const unsigned int noLink=~0U;
+	std::vector<unsigned int> links(numEnds,noLink);
+	for(unsigned int i=0;i+1<numEnds;++i)
+		if(ends[i].first==ends[i+1].first)
+			{
+			links[ends[i].second]=ends[i+1].second;
+			links[ends[i+1].second]=ends[i].second;
+			++i;
+			}
+	
+	/* Walk all chains of linked polylines: */
+	std::vector<bool> visited(polylines.size(),false);
+	for(unsigned int start=0;start<polylines.size();++start)
+		{
+		if(visited[start])
+			continue;
+		
+		/* Walk backwards from the polyline's first end to the beginning of its chain, or once around a closed chain: */
+		unsigned int end=start*2U;
+		while(links[end]!=noLink&&links[end]/2U!=start)
+			end=links[end]^1U;
+		
+		/* Walk forward along the chain, appending the vertices of each polyline in traversal order: */
+		Polyline stitched;
+		stitched.firstVertex=(unsigned int)(stitchedVertices.size());
+		stitched.level=polylines[end/2U].level;
+		stitched.ends[0]=polylines[end/2U].ends[end%2U];
+		while(true)
+			{
+			const Polyline& pl=polylines[end/2U];
+			visited[end/2U]=true;
+			
+			/* Skip the polyline's first vertex after the first polyline, as it is bit-identical to the chain's last vertex: */
+			unsigned int skip=stitchedVertices.size()>stitched.firstVertex?1U:0U;
+			if(end%2U==0U)
+				{
+				for(unsigned int i=skip;i<pl.numVertices;++i)
+					stitchedVertices.push_back(vertices[pl.firstVertex+i]);
+				}
+			else
+				{
+				for(unsigned int i=pl.numVertices-skip;i>0;--i)
+					stitchedVertices.push_back(vertices[pl.firstVertex+i-1]);
+				}
+			stitched.ends[1]=pl.ends[(end%2U)^1U];
+			
+			/* Continue with the polyline linked to this polyline's other end until the chain ends or closes: */
+			unsigned int next=links[end^1U];
+			if(next==noLink||visited[next/2U])
+				break;
+			end=next;
+			}
+		stitched.numVertices=(unsigned int)(stitchedVertices.size())-stitched.firstVertex;
+		stitchedPolylines.push_back(stitched);
+		}
+	}
+
+void ContourExtractor::extractTile(ContourExtractor::Tile& tile,const float* frame,Scalar lineSpacing) const
+	{
+	tile.segmentVertices.clear();
+	tile.segments.clear();
+	
+	/* Calculate the camera-space positions and scaled elevations of all pixels touched by the tile's cells: */
+	unsigned int width=tile.cellMax[0]-tile.cellMin[0]+1;
+	unsigned int height=tile.cellMax[1]-tile.cellMin[1]+1;
+	std::vector<Point> positions(width*height);
+	std::vector<Scalar> elevations(width*height);
+	Scalar elevationScale=Scalar(1)/lineSpacing;
+	std::vector<Point>::iterator pIt=positions.begin();
+	std::vector<Scalar>::iterator eIt=elevations.begin();
+	for(unsigned int y=tile.cellMin[1];y<=tile.cellMax[1];++y)
+		{
+		const float* ppPtr=pixelPositions+(y*depthFrameSize[0]+tile.cellMin[0])*2;
+		const float* fPtr=frame+(y*depthFrameSize[0]+tile.cellMin[0]);
+		for(unsigned int x=tile.cellMin[0];x<=tile.cellMax[0];++x,ppPtr+=2,++fPtr,++pIt,++eIt)
+			{
+			*pIt=depthProjection.transform(Point(Scalar(ppPtr[0]),Scalar(ppPtr[1]),Scalar(*fPtr)));
+			*eIt=basePlane.calcDistance(*pIt)*elevationScale;
+			}
+		}
+	
+	/* Run marching squares on all cells of the tile: */
+	for(unsigned int y=0;y<height-1;++y)
+		for(unsigned int x=0;x<width-1;++x)
+			{
+			/* Get the cell's corners in counter-clockwise order: */
+			unsigned int cornerIndices[4];
+			cornerIndices[0]=y*width+x;
+			cornerIndices[1]=cornerIndices[0]+1;
+			cornerIndices[2]=cornerIndices[1]+width;
+			cornerIndices[3]=cornerIndices[0]+width;
+			unsigned int cornerPixels[4];
+			cornerPixels[0]=(tile.cellMin[1]+y)*depthFrameSize[0]+tile.cellMin[0]+x;
+			cornerPixels[1]=cornerPixels[0]+1;
+			cornerPixels[2]=cornerPixels[1]+depthFrameSize[0];
+			cornerPixels[3]=cornerPixels[0]+depthFrameSize[0];
+			Scalar e[4];
+			Scalar eMin=Math::Constants<Scalar>::max;
+			Scalar eMax=-Math::Constants<Scalar>::max;
+			for(int i=0;i<4;++i)
+				{
+				e[i]=elevations[cornerIndices[i]];
+				if(eMin>e[i])
+					eMin=e[i];
+				if(eMax<e[i])
+					eMax=e[i];
+				}
+			
+			/* Extract the segments of all contour levels crossing the cell: */
+			int levelMax=int(Math::floor(eMax));
+			for(int level=int(Math::floor(eMin))+1;level<=levelMax;++level)
+				{
+				Scalar l(level);
+				
+				/* Find the cell edges crossed by the contour level: */
+				int edges[4];
+				int numEdges=0;
+				for(int i=0;i<4;++i)
+					if((e[i]>=l)!=(e[(i+1)%4]>=l))
+						edges[numEdges++]=i;
+				if(numEdges==4)
+					{
+					/* Resolve the saddle point using the cell's center elevation: */
+					Scalar eCenter=(e[0]+e[1]+e[2]+e[3])*Scalar(0.25);
+					if((eCenter>=l)!=(e[0]>=l))
+						{
+						/* Cut off corners 0 and 2: */
+						edges[0]=3;
+						edges[1]=0;
+						edges[2]=1;
+						edges[3]=2;
+						}
+					}
+				
+				/* Create one segment for every pair of crossed edges: */
+				for(int i=0;i<numEdges;i+=2)
+					{
+					Polyline segment;
+					segment.firstVertex=(unsigned int)(tile.segmentVertices.size());
+					segment.numVertices=2;
+					segment.level=level;
+					for(int j=0;j<2;++j)
+						{
+						/* Interpolate from the edge's lower-left corner so that both cells sharing the edge create bit-identical vertices: */
+						int i0=edges[i+j];
+						int c0=i0<2?i0:(i0+1)%4;
+						int c1=i0<2?(i0+1)%4:i0;
+						tile.segmentVertices.push_back(interpolateEdge(positions[cornerIndices[c0]],e[c0],positions[cornerIndices[c1]],e[c1],l));
+						segment.ends[j]=edgeKey(cornerPixels[c0],i0%2,level);
+						}
+					tile.segments.push_back(segment);
+					}
+				}
+			}
+	
+	/* Stitch the tile's segments into polylines: */
+	tile.vertices.clear();
+	tile.polylines.clear();
+	stitchPolylines(tile.segmentVertices,tile.segments,tile.vertices,tile.polylines);
+	}
+
+void ContourExtractor::processTiles(unsigned int threadIndex)
+	{
+	/* Process all tile rows assigned to this thread: */
+	unsigned int numThreads=numWorkerThreads+1;
+	for(unsigned int ty=threadIndex;ty<numTiles[1];ty+=numThreads)
+		for(unsigned int tx=0;tx<numTiles[0];++tx)
+			{
+			Tile& tile=tiles[ty*numTiles[0]+tx];
+			
+			/* Check if any pixel touched by the tile's cells changed since the previous job: */
+			bool changed=jobPreviousFrame==0;
+			for(unsigned int y=tile.cellMin[1];y<=tile.cellMax[1]&&!changed;++y)
+				{
+				const float* fPtr=jobFrame+(y*depthFrameSize[0]+tile.cellMin[0]);
+				const float* pfPtr=jobPreviousFrame+(y*depthFrameSize[0]+tile.cellMin[0]);
+				for(unsigned int x=tile.cellMin[0];x<=tile.cellMax[0]&&!changed;++x,++fPtr,++pfPtr)
+					changed=*fPtr!=*pfPtr;
+				}
+			
+			/* Rebuild the tile's contour line segments if it changed: */
+			if(changed)
+				extractTile(tile,jobFrame,jobLineSpacing);
+			}
+	}
+
+void* ContourExtractor::extractorThreadMethod(void)
+	{
+	unsigned int lastInputFrameVersion=0;
+	Kinect::FrameBuffer previousFrame;
+	bool havePreviousFrame=false;
+	Scalar previousLineSpacing(0);
+	unsigned int linesVersion=0;
+	
+	while(true)
+		{
+		Kinect::FrameBuffer frame;
+		Scalar lineSpacing;
+		{
+		Threads::MutexCond::Lock inputLock(inputCond);
+		
+		/* Wait until a new frame arrives or the program shuts down: */
+		while(runExtractorThread&&lastInputFrameVersion==inputFrameVersion)
+			inputCond.wait(inputLock);
+		
+		/* Bail out if the program is shutting down: */
+		if(!runExtractorThread)
+			break;
+		
+		/* Work on the new frame: */
+		frame=inputFrame;
+		lineSpacing=inputLineSpacing;
+		lastInputFrameVersion=inputFrameVersion;
+		}
+		PipelineTrace::Scope extractScope(traceRing,"Extract contour lines",PipelineTrace::getFrameId(frame.timeStamp));
+		
+		/* Hand the extraction job to the worker threads; all tiles must be rebuilt if the contour line spacing changed: */
+		{
+		Threads::MutexCond::Lock jobLock(jobCond);
+		jobFrame=frame.getData<float>();
+		jobPreviousFrame=havePreviousFrame&&previousLineSpacing==lineSpacing?previousFrame.getData<float>():0;
+		jobLineSpacing=lineSpacing;
+		numPendingWorkers=numWorkerThreads;
+		++jobVersion;
+		jobCond.broadcast();
+		}
+		
+		/* Process this thread's share of the tiles: */
+		processTiles(0);
+		
+		/* Wait until all worker threads have finished: */
+		{
+		Threads::MutexCond::Lock jobLock(jobCond);
+		while(numPendingWorkers>0)
+			jobCond.wait(jobLock);
+		}
+		
+		/* Collect the contour line polylines of all tiles: */
+		tileVertices.clear();
+		tilePolylines.clear();
+		for(std::vector<Tile>::iterator tIt=tiles.begin();tIt!=tiles.end();++tIt)
+			{
+			unsigned int vertexOffset=(unsigned int)(tileVertices.size());
+			tileVertices.insert(tileVertices.end(),tIt->vertices.begin(),tIt->vertices.end());
+			for(std::vector<Polyline>::iterator plIt=tIt->polylines.begin();plIt!=tIt->polylines.end();++plIt)
+				{
+				tilePolylines.push_back(*plIt);
+				tilePolylines.back().firstVertex+=vertexOffset;
+				}
+			}
+		
+		/* Stitch the tiles' polylines across tile boundaries into a new output buffer: */
+		ContourLines& newLines=extractedLines.startNewValue();
+		newLines.version=++linesVersion;
+		newLines.vertices.clear();
+		newLines.polylines.clear();
+		stitchPolylines(tileVertices,tilePolylines,newLines.vertices,newLines.polylines);
+		extractedLines.postNewValue();
+		
+		/* Remember the processed frame to detect changed tiles in the next frame: */
+		previousFrame=frame;
+		havePreviousFrame=true;
+		previousLineSpacing=lineSpacing;
+		}
+	
+	return 0;
+	}
+
+void* ContourExtractor::workerThreadMethod(unsigned int threadIndex)
+	{
+	unsigned int lastJobVersion=0;
+	
+	while(true)
+		{
+		{
+		Threads::MutexCond::Lock jobLock(jobCond);
+		
+		/* Wait until a new job arrives or the program shuts down: */
+		while(runExtractorThread&&lastJobVersion==jobVersion)
+			jobCond.wait(jobLock);
+		
+		/* Bail out if the program is shutting down: */
+		if(!runExtractorThread)
+			break;
+		
+		lastJobVersion=jobVersion;
+		}
+		
+		/* Process this thread's share of the tiles: */
+		processTiles(threadIndex);
+		
+		/* Notify the main extraction thread if this was the last worker to finish: */
+		{
+		Threads::MutexCond::Lock jobLock(jobCond);
+		if(--numPendingWorkers==0)
+			jobCond.broadcast();
+		}
+		}
+	
+	return 0;
+	}
+
+ContourExtractor::ContourExtractor(const unsigned int sDepthFrameSize[2],const Kinect::FrameSource::IntrinsicParameters& ips,const Plane& sBasePlane,Scalar sLineSpacing,unsigned int sNumThreads)
+	:depthProjection(ips.depthProjection),basePlane(sBasePlane),pixelPositions(0),
+	 inputFrameVersion(0),inputLineSpacing(sLineSpacing),runExtractorThread(false),
+	 jobVersion(0),numPendingWorkers(0),jobFrame(0),jobPreviousFrame(0),jobLineSpacing(sLineSpacing),
+	 numWorkerThreads(sNumThreads>1?sNumThreads-1:0),workerThreads(0),
+	 traceRing(0),
+	 lineWidth(2.0f),lineColor(0.0f,0.0f,0.0f,1.0f)
+	{
+	/* Copy the depth frame size: */
+	for(int i=0;i<2;++i)
+		depthFrameSize[i]=sDepthFrameSize[i];
+	
+	/* Calculate the undistorted depth image-space positions of all pixel centers: */
+	pixelPositions=new float[depthFrameSize[1]*depthFrameSize[0]*2];
+	float* ppPtr=pixelPositions;
+	for(unsigned int y=0;y<depthFrameSize[1];++y)
+		for(unsigned int x=0;x<depthFrameSize[0];++x,ppPtr+=2)
+			{
+			if(ips.depthLensDistortion.isIdentity())
+				{
+				ppPtr[0]=float(x)+0.5f;
+				ppPtr[1]=float(y)+0.5f;
+				}
+			else
+				{
+				/* Undistort the pixel center: */
+				Kinect::LensDistortion::Point dp(Kinect::LensDistortion::Scalar(x)+Kinect::LensDistortion::Scalar(0.5),Kinect::LensDistortion::Scalar(y)+Kinect::LensDistortion::Scalar(0.5));
+				Kinect::LensDistortion::Point up=ips.depthLensDistortion.undistortPixel(dp);
+				ppPtr[0]=float(up[0]);
+				ppPtr[1]=float(up[1]);
+				}
+			}
+	
+	/* Cover the depth image's cells with square tiles: */
+	const unsigned int tileSize=32;
+	for(int i=0;i<2;++i)
+		numTiles[i]=(depthFrameSize[i]-1+tileSize-1)/tileSize;
+	tiles.resize(numTiles[1]*numTiles[0]);
+	std::vector<Tile>::iterator tIt=tiles.begin();
+	for(unsigned int ty=0;ty<numTiles[1];++ty)
+		for(unsigned int tx=0;tx<numTiles[0];++tx,++tIt)
+			{
+			tIt->cellMin[0]=tx*tileSize;
+			tIt->cellMax[0]=Math::min((tx+1)*tileSize,depthFrameSize[0]-1);
+			tIt->cellMin[1]=ty*tileSize;
+			tIt->cellMax[1]=Math::min((ty+1)*tileSize,depthFrameSize[1]-1);
+			}
+	
+	/* Start the worker threads and the main extraction thread: */
+	runExtractorThread=true;
+	if(numWorkerThreads>0)
+		{
+		workerThreads=new Threads::Thread[numWorkerThreads];
+		for(unsigned int i=0;i<numWorkerThreads;++i)
+			workerThreads[i].start(this,&ContourExtractor::workerThreadMethod,i+1);
+		}
+	extractorThread.start(this,&ContourExtractor::extractorThreadMethod);
+	}
+
+ContourExtractor::~ContourExtractor(void)
+	{
+	/* Shut down the main extraction thread: */
+	{
+	Threads::MutexCond::Lock inputLock(inputCond);
+	runExtractorThread=false;
+	inputCond.signal();
+	}
+	extractorThread.join();
+	
+	/* Shut down the worker threads: */
+	{
+	Threads::MutexCond::Lock jobLock(jobCond);
+	jobCond.broadcast();
+	}
+	for(unsigned int i=0;i<numWorkerThreads;++i)
+		workerThreads[i].join();
+	delete[] workerThreads;
+	
+	delete[] pixelPositions;
+	}
+
+void ContourExtractor::initContext(GLContextData& contextData) const
+	{
+	/* Create a data item and add it to the context: */
+	DataItem* dataItem=new DataItem;
+	contextData.addDataItem(this,dataItem);
+	}
+
+void ContourExtractor::setTraceRing(PipelineTrace::Ring* newTraceRing)
+	{
+	traceRing=newTraceRing;
+	}
+
+void ContourExtractor::setLineSpacing(Scalar newLineSpacing)
+	{
+	Threads::MutexCond::Lock inputLock(inputCond);
+	inputLineSpacing=newLineSpacing;
+	
+	/* Re-extract the contour lines from the most recent frame: */
+	if(inputFrameVersion!=0)
+		{
+		++inputFrameVersion;
+		inputCond.signal();
+		}
+	}
+
+void ContourExtractor::setLineWidth(GLfloat newLineWidth)
+	{
+	lineWidth=newLineWidth;
+	}
+
+void ContourExtractor::setLineColor(const GLColor<GLfloat,4>& newLineColor)
+	{
+	lineColor=newLineColor;
+	}
+
+void ContourExtractor::setDepthImage(const Kinect::FrameBuffer& newDepthImage)
+	{
+	/* Post the new frame into the input buffer and wake up the main extraction thread: */
+	Threads::MutexCond::Lock inputLock(inputCond);
+	inputFrame=newDepthImage;
+	++inputFrameVersion;
+	inputCond.signal();
+	}
+
+void ContourExtractor::render(const PTransform& projection,const OGTransform& modelview,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Bind the vertex buffer: */
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->vertexBuffer);
+	
+	/* Check if the vertex buffer is outdated: */
+	const ContourLines& lines=extractedLines.getLockedValue();
+	if(dataItem->vertexBufferVersion!=lines.version)
+		{
+		/* Upload the new contour line polylines: */
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB,lines.vertices.size()*sizeof(Vertex),lines.vertices.empty()?0:&lines.vertices.front(),GL_STREAM_DRAW_ARB);
+		dataItem->numVertices=GLsizei(lines.vertices.size());
+		dataItem->vertexBufferVersion=lines.version;
+		}
+	
+	if(dataItem->numVertices>0)
+		{
+		/* Set up OpenGL state: */
+		glPushAttrib(GL_CURRENT_BIT|GL_DEPTH_BUFFER_BIT|GL_ENABLE_BIT|GL_LINE_BIT|GL_VIEWPORT_BIT);
+		glDisable(GL_LIGHTING);
+		glLineWidth(lineWidth);
+		glColor(lineColor);
+		
+		/* Pull the lines slightly towards the viewer so that they are not hidden by the surface they lie on: */
+		glDepthFunc(GL_LEQUAL);
+		glDepthRange(0.0,0.9999);
+		
+		/* Load the projection and modelview matrices: */
+		glMatrixMode(GL_PROJECTION);
+		glPushMatrix();
+		glLoadMatrix(projection);
+		glMatrixMode(GL_MODELVIEW);
+		glPushMatrix();
+		glLoadMatrix(modelview);
+		
+		/* Draw the contour line polylines: */
+		GLVertexArrayParts::enable(Vertex::getPartsMask());
+		glVertexPointer(static_cast<const Vertex*>(0));
+		for(std::vector<Polyline>::const_iterator plIt=lines.polylines.begin();plIt!=lines.polylines.end();++plIt)
+			glDrawArrays(GL_LINE_STRIP,plIt->firstVertex,plIt->numVertices);
+		GLVertexArrayParts::disable(Vertex::getPartsMask());
+		
+		/* Restore OpenGL state: */
+		glPopMatrix();
+		glMatrixMode(GL_PROJECTION);
+		glPopMatrix();
+		glMatrixMode(GL_MODELVIEW);
+		glPopAttrib();
+		}
+	
+	/* Unbind the vertex buffer: */
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB,0);
+	}
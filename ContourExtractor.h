@@ -0,0 +1,166 @@
+/***********************************************************************
+ContourExtractor - Class to extract topographic contour lines from
+filtered depth frames as line geometry using marching squares in a set
+of background threads, and to render them as lines of a fixed width.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef CONTOUREXTRACTOR_INCLUDED
+#define CONTOUREXTRACTOR_INCLUDED
+
+#include <vector>
+#include <Misc/SizedTypes.h>
+#include <Threads/Thread.h>
+#include <Threads/MutexCond.h>
+#include <Threads/TripleBuffer.h>
+#include <GL/gl.h>
+#include <GL/GLColor.h>
+#include <GL/GLObject.h>
+#include <GL/GLGeometryVertex.h>
+#include <Kinect/FrameBuffer.h>
+#include <Kinect/FrameSource.h>
+
+#include "Types.h"
+#include "PipelineTrace.h"
+
+class ContourExtractor:public GLObject
+	{
+	/* Embedded classes: */
+	public:
+	typedef GLGeometry::Vertex<void,0,void,0,void,GLfloat,3> Vertex; // Type for contour line vertices in camera space
+	
+	struct Polyline // Structure describing a connected contour line stored as a range of consecutive vertices
+		{
+		/* Elements: */
+		public:
+		unsigned int firstVertex; // Index of the polyline's first vertex
+		unsigned int numVertices; // Number of vertices in the polyline; closed polylines repeat their first vertex at the end
+		int level; // Contour level of the polyline, as a multiple of the contour line spacing
+		Misc::UInt64 ends[2]; // Keys identifying the depth image cell edges and contour level at the polyline's first and last vertices
+		};
+	
+	struct ContourLines // Structure holding the contour lines extracted from one depth frame
+		{
+		/* Elements: */
+		public:
+		unsigned int version; // Version number of the contour lines
+		std::vector<Vertex> vertices; // Camera-space vertices of all contour line polylines
+		std::vector<Polyline> polylines; // Contour line polylines
+		
+		/* Constructors and destructors: */
+		ContourLines(void) // Creates an empty set of contour lines
+			:version(0)
+			{
+			}
+		};
+	
+	private:
+	struct DataItem:public GLObject::DataItem
+		{
+		/* Elements: */
+		public:
+		GLuint vertexBuffer; // ID of vertex buffer object holding the contour line polylines
+		unsigned int vertexBufferVersion; // Version number of the contour lines in the vertex buffer
+		GLsizei numVertices; // Number of vertices in the vertex buffer
+		
+		/* Constructors and destructors: */
+		DataItem(void);
+		virtual ~DataItem(void);
+		};
+	
+	struct Tile // Structure holding the contour lines extracted inside a square block of depth image cells
+		{
+		/* Elements: */
+		public:
+		unsigned int cellMin[2],cellMax[2]; // Range of depth image cells covered by the tile, as [min, max) per dimension
+		std::vector<Vertex> segmentVertices; // Contour line segments extracted inside the tile, as pairs of vertices, before stitching
+		std::vector<Polyline> segments; // Contour line segments extracted inside the tile, before stitching
+		std::vector<Vertex> vertices; // Vertices of the contour line polylines extracted inside the tile
+		std::vector<Polyline> polylines; // Contour line polylines extracted inside the tile; open polylines end on the tile's boundary
+		};
+	
+	/* Elements: */
+	unsigned int depthFrameSize[2]; // Size of incoming depth frames
+	PTransform depthProjection; // Projective transformation from depth image space to camera space
+	Plane basePlane; // Base plane relative to which contour line elevations are measured
+	float* pixelPositions; // Undistorted depth image-space positions of all pixel centers, as interleaved x, y pairs
+	
+	Threads::MutexCond inputCond; // Condition variable to signal arrival of a new input frame or a change of contour line spacing
+	Kinect::FrameBuffer inputFrame; // The most recent input frame
+	unsigned int inputFrameVersion; // Version number of input frame
+	Scalar inputLineSpacing; // Most recently requested elevation distance between adjacent contour lines
+	volatile bool runExtractorThread; // Flag to keep the background extraction threads running
+	Threads::Thread extractorThread; // The main background extraction thread
+	
+	unsigned int numTiles[2]; // Number of tiles along each depth image axis
+	std::vector<Tile> tiles; // Tiles covering the depth image, in row-major order
+	Threads::MutexCond jobCond; // Condition variable to hand extraction jobs to the worker threads and to signal their completion
+	unsigned int jobVersion; // Version number of the current extraction job
+	unsigned int numPendingWorkers; // Number of worker threads that have not yet finished the current extraction job
+	const float* jobFrame; // Depth frame processed by the current extraction job
+	const float* jobPreviousFrame; // Depth frame processed by the previous extraction job, or null if all tiles must be rebuilt
+	Scalar jobLineSpacing; // Contour line spacing used by the current extraction job
+	unsigned int numWorkerThreads; // Number of worker threads helping the main extraction thread
+	Threads::Thread* workerThreads; // Array of worker threads
+	
+	std::vector<Vertex> tileVertices; // Vertices of the contour line polylines of all tiles, to be stitched across tile boundaries
+	std::vector<Polyline> tilePolylines; // Contour line polylines of all tiles, to be stitched across tile boundaries
+	Threads::TripleBuffer<ContourLines> extractedLines; // Triple buffer of extracted contour lines
+	PipelineTrace::Ring* traceRing; // Ring buffer receiving the main extraction thread's trace events, or null
+	
+	GLfloat lineWidth; // Width of rendered contour lines in pixels
+	GLColor<GLfloat,4> lineColor; // Color of rendered contour lines
+	
+	/* Private methods: */
+	static void stitchPolylines(const std::vector<Vertex>& vertices,const std::vector<Polyline>& polylines,std::vector<Vertex>& stitchedVertices,std::vector<Polyline>& stitchedPolylines); // Joins the given polylines at shared end keys into maximal polylines, appended to the given output lists
+	void extractTile(Tile& tile,const float* frame,Scalar lineSpacing) const; // Extracts all contour line segments inside the given tile from the given depth frame and stitches them into polylines
+	void processTiles(unsigned int threadIndex); // Rebuilds all changed tiles assigned to the given thread for the current extraction job
+	void* extractorThreadMethod(void); // Method for the main background extraction thread
+	void* workerThreadMethod(unsigned int threadIndex); // Method for a background worker thread
+	
+	/* Constructors and destructors: */
+	public:
+	ContourExtractor(const unsigned int sDepthFrameSize[2],const Kinect::FrameSource::IntrinsicParameters& ips,const Plane& sBasePlane,Scalar sLineSpacing,unsigned int sNumThreads); // Creates a contour extractor for depth frames of the given size and the given camera intrinsics, using the given number of threads
+	private:
+	ContourExtractor(const ContourExtractor& source); // Prohibit copy constructor
+	ContourExtractor& operator=(const ContourExtractor& source); // Prohibit assignment operator
+	public:
+	virtual ~ContourExtractor(void);
+	
+	/* Methods from GLObject: */
+	virtual void initContext(GLContextData& contextData) const;
+	
+	/* New methods: */
+	void setTraceRing(PipelineTrace::Ring* newTraceRing); // Sets the ring buffer receiving the main extraction thread's trace events; must be called before the first depth frame is received
+	void setLineSpacing(Scalar newLineSpacing); // Sets the elevation distance between adjacent contour lines; rebuilds all contour lines from the most recent depth frame
+	void setLineWidth(GLfloat newLineWidth); // Sets the width of rendered contour lines in pixels
+	void setLineColor(const GLColor<GLfloat,4>& newLineColor); // Sets the color of rendered contour lines
+	void setDepthImage(const Kinect::FrameBuffer& newDepthImage); // Called to receive a new filtered depth frame
+	bool lockNewContourLines(void) // Locks the most recently extracted contour lines for reading; returns true if the locked contour lines are new
+		{
+		return extractedLines.lockNewValue();
+		}
+	const ContourLines& getLockedContourLines(void) const // Returns the most recently locked contour lines
+		{
+		return extractedLines.getLockedValue();
+		}
+	void render(const PTransform& projection,const OGTransform& modelview,GLContextData& contextData) const; // Renders the most recently locked contour lines with the given projection and modelview matrices
+	};
+
+#endif
@@ -67,6 +67,14 @@ class DEM:public GLObject
 	
 	/* New methods: */
 	void load(const char* demFileName); // Loads the DEM from the given file
+	const int* getDemSize(void) const // Returns the width and height of the DEM grid
+		{
+		return demSize;
+		}
+	const float* getDem(void) const // Returns the DEM's elevation measurements in row-major order, starting at the lower-left corner
+		{
+		return dem;
+		}
 	const Scalar* getDemBox(void) const // Returns the DEM's bounding box as lower-left x, lower-left y, upper-right x, upper-right y
 		{
 		return demBox;
@@ -23,44 +23,145 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "DepthImageRenderer.h"
 
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <Misc/ThrowStdErr.h>
+#include <Math/Math.h>
 #include <GL/gl.h>
 #include <GL/GLVertexArrayParts.h>
 #include <GL/GLContextData.h>
 #include <GL/Extensions/GLARBFragmentShader.h>
 #include <GL/Extensions/GLARBMultitexture.h>
+#include <GL/Extensions/GLARBPixelBufferObject.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
 #include <GL/Extensions/GLARBTextureFloat.h>
 #include <GL/Extensions/GLARBTextureRectangle.h>
 #include <GL/Extensions/GLARBTextureRg.h>
 #include <GL/Extensions/GLARBVertexBufferObject.h>
 #include <GL/Extensions/GLARBVertexShader.h>
+#include <GL/Extensions/GLEXTFramebufferObject.h>
 #include <GL/GLTransformationWrappers.h>
 
 #include "ShaderHelper.h"
 
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+template <class IndexParam>
+void createSurfaceIndices(const unsigned int size[2],IndexParam* iPtr) // Writes the indices of a single triangle strip covering a grid of the given size into the given array
+	{
+	for(unsigned int y=1;y<size[1];++y)
+		{
+		/* Create the triangle strip between the current and previous rows: */
+		for(unsigned int x=0;x<size[0];++x,iPtr+=2)
+			{
+			iPtr[0]=IndexParam(y*size[0]+x);
+			iPtr[1]=IndexParam((y-1)*size[0]+x);
+			}
+		
+		/* Stitch the strip to the next one with degenerate triangles, preserving orientation: */
+		if(y+1<size[1])
+			{
+			iPtr[0]=iPtr[-1];
+			iPtr[1]=IndexParam((y+1)*size[0]);
+			iPtr+=2;
+			}
+		}
+	}
+
+struct TraversalBlock // Structure for a block of the depth range pyramid visited during line intersection
+	{
+	/* Elements: */
+	public:
+	unsigned int level; // Pyramid level containing the block
+	unsigned int index[2]; // Index of the block in its level
+	Scalar mu0,mu1; // Parameter interval of the depth image-space line segment inside the block
+	};
+
+void calcBlockBox(unsigned int level,const unsigned int index[2],const unsigned int depthImageSize[2],Scalar box[2][2]) // Calculates the depth image-space rectangle covered by a block of the depth range pyramid
+	{
+	for(int i=0;i<2;++i)
+		{
+		box[i][0]=Scalar(index[i]<<level)+Scalar(0.5);
+		box[i][1]=Scalar(std::min((index[i]+1U)<<level,depthImageSize[i]-1U))+Scalar(0.5);
+		}
+	}
+
+bool clipToBlock(const Point& q0,const Vector& dq,const Scalar box[2][2],const float range[2],Scalar& mu0,Scalar& mu1) // Clips the parameter interval of a depth image-space line segment to a block of the given rectangle and depth range; returns false if the segment misses the block
+	{
+	/* Clip the parameter interval against the block's rectangle: */
+	for(int i=0;i<2;++i)
+		{
+		if(dq[i]!=Scalar(0))
+			{
+			Scalar m0=(box[i][0]-q0[i])/dq[i];
+			Scalar m1=(box[i][1]-q0[i])/dq[i];
+			if(m0>m1)
+				std::swap(m0,m1);
+			if(mu0<m0)
+				mu0=m0;
+			if(mu1>m1)
+				mu1=m1;
+			}
+		else if(q0[i]<box[i][0]||q0[i]>box[i][1])
+			return false;
+		}
+	if(mu0>mu1)
+		return false;
+	
+	/* Check if the segment's depth range inside the rectangle overlaps the block's depth range: */
+	Scalar z0=q0[2]+dq[2]*mu0;
+	Scalar z1=q0[2]+dq[2]*mu1;
+	if(z0>z1)
+		std::swap(z0,z1);
+	return z1>=Scalar(range[0])&&z0<=Scalar(range[1]);
+	}
+
+Scalar calcSurfaceOffset(const float* depth,unsigned int width,const unsigned int cell[2],const Point& q) // Returns the depth difference between a depth image-space point and the bilinearly interpolated surface of the template mesh cell starting at the given pixel
+	{
+	const float* dPtr=depth+(cell[1]*width+cell[0]);
+	Scalar wx=q[0]-(Scalar(cell[0])+Scalar(0.5));
+	Scalar wy=q[1]-(Scalar(cell[1])+Scalar(0.5));
+	Scalar d0=Scalar(dPtr[0])*(Scalar(1)-wx)+Scalar(dPtr[1])*wx;
+	Scalar d1=Scalar(dPtr[width])*(Scalar(1)-wx)+Scalar(dPtr[width+1])*wx;
+	return q[2]-(d0*(Scalar(1)-wy)+d1*wy);
+	}
+
+}
+
 /*********************************************
 Methods of class DepthImageRenderer::DataItem:
 *********************************************/
 
 DepthImageRenderer::DataItem::DataItem(void)
-	:vertexBuffer(0),indexBuffer(0),
-	 depthTexture(0),depthTextureVersion(0),
-	 depthShader(0),elevationShader(0)
+	:vertexBuffer(0),indexBuffer(0),indexType(GL_UNSIGNED_INT),
+	 depthTexture(0),depthTextureVersion(0),nextDepthPixelBuffer(0),
+	 tangentTexture(0),tangentTextureVersion(0),tangentFramebuffer(0),
+	 depthShader(0),elevationShader(0),tangentShader(0)
 	{
 	/* Initialize all required extensions: */
 	GLARBFragmentShader::initExtension();
 	GLARBMultitexture::initExtension();
+	GLARBPixelBufferObject::initExtension();
 	GLARBShaderObjects::initExtension();
 	GLARBTextureFloat::initExtension();
 	GLARBTextureRectangle::initExtension();
 	GLARBTextureRg::initExtension();
 	GLARBVertexBufferObject::initExtension();
 	GLARBVertexShader::initExtension();
+	GLEXTFramebufferObject::initExtension();
 	
 	/* Allocate the buffers and textures: */
 	glGenBuffersARB(1,&vertexBuffer);
 	glGenBuffersARB(1,&indexBuffer);
 	glGenTextures(1,&depthTexture);
+	glGenBuffersARB(2,depthPixelBuffers);
+	glGenTextures(1,&tangentTexture);
+	glGenFramebuffersEXT(1,&tangentFramebuffer);
 	}
 
 DepthImageRenderer::DataItem::~DataItem(void)
@@ -69,8 +170,12 @@ DepthImageRenderer::DataItem::~DataItem(void)
 	glDeleteBuffersARB(1,&vertexBuffer);
 	glDeleteBuffersARB(1,&indexBuffer);
 	glDeleteTextures(1,&depthTexture);
+	glDeleteBuffersARB(2,depthPixelBuffers);
+	glDeleteTextures(1,&tangentTexture);
+	glDeleteFramebuffersEXT(1,&tangentFramebuffer);
 	glDeleteObjectARB(depthShader);
 	glDeleteObjectARB(elevationShader);
+	glDeleteObjectARB(tangentShader);
 	}
 
 /***********************************
@@ -78,11 +183,15 @@ Methods of class DepthImageRenderer:
 ***********************************/
 
 DepthImageRenderer::DepthImageRenderer(const unsigned int sDepthImageSize[2])
-	:depthImageVersion(0)
+	:meshDecimation(1),
+	 depthImageVersion(0)
 	{
-	/* Copy the depth image size: */
+	/* Copy the depth image size and create a full-resolution surface template: */
 	for(int i=0;i<2;++i)
+		{
 		depthImageSize[i]=sDepthImageSize[i];
+		meshSize[i]=depthImageSize[i];
+		}
 	
 	/* Initialize the depth image: */
 	depthImage=Kinect::FrameBuffer(depthImageSize[0],depthImageSize[1],depthImageSize[1]*depthImageSize[0]*sizeof(float));
@@ -91,6 +200,181 @@ DepthImageRenderer::DepthImageRenderer(const unsigned int sDepthImageSize[2])
 		for(unsigned int x=0;x<depthImageSize[0];++x,++diPtr)
 			*diPtr=0.0f;
 	++depthImageVersion;
+	
+	/* Create the depth range pyramid, halving the number of blocks per level until a single block remains: */
+	unsigned int levelSize[2];
+	for(int i=0;i<2;++i)
+		levelSize[i]=depthImageSize[i]>1?depthImageSize[i]-1:1;
+	while(true)
+		{
+		depthRangePyramid.push_back(DepthRangeLevel());
+		DepthRangeLevel& level=depthRangePyramid.back();
+		for(int i=0;i<2;++i)
+			level.size[i]=levelSize[i];
+		level.ranges.resize(size_t(levelSize[1])*size_t(levelSize[0])*2);
+		if(levelSize[0]==1&&levelSize[1]==1)
+			break;
+		for(int i=0;i<2;++i)
+			levelSize[i]=(levelSize[i]+1)/2;
+		}
+	unsigned int rect[2][2];
+	for(int i=0;i<2;++i)
+		{
+		rect[i][0]=0;
+		rect[i][1]=depthImageSize[i]-1;
+		}
+	updateDepthRangePyramid(rect);
+	
+	/* Start tracking surface changes with the next depth image: */
+	firstDirtyVersion=depthImageVersion+1;
+	}
+
+void DepthImageRenderer::drawSurface(const DepthImageRenderer::DataItem* dataItem,unsigned int firstRow,unsigned int lastRow) const
+	{
+	/* Convert the depth image row range to the smallest covering range of template vertex rows: */
+	firstRow=firstRow/meshDecimation;
+	lastRow=Math::min((lastRow+meshDecimation-1)/meshDecimation,meshSize[1]-1);
+	if(firstRow>=lastRow)
+		return;
+	
+	/* Draw the row pairs' triangle strips and the degenerate triangles stitching them together in one call: */
+	size_t rowStride=meshSize[0]*2+2;
+	size_t indexSize=dataItem->indexType==GL_UNSIGNED_SHORT?sizeof(GLushort):sizeof(GLuint);
+	const char* indexPtr=static_cast<const char*>(0)+size_t(firstRow)*rowStride*indexSize;
+	glDrawElements(GL_TRIANGLE_STRIP,GLsizei(size_t(lastRow-firstRow)*rowStride-2),dataItem->indexType,indexPtr);
+	}
+
+void DepthImageRenderer::updateDepthTexture(DepthImageRenderer::DataItem* dataItem) const
+	{
+	/* Check if the texture is outdated: */
+	if(dataItem->depthTextureVersion!=depthImageVersion)
+		{
+		/* Orphan the next pixel buffer so that writing into it does not wait for a previous transfer, and copy the new depth image into it: */
+		size_t depthImageBytes=size_t(depthImageSize[1])*size_t(depthImageSize[0])*sizeof(GLfloat);
+		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,dataItem->depthPixelBuffers[dataItem->nextDepthPixelBuffer]);
+		glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB,depthImageBytes,0,GL_STREAM_DRAW_ARB);
+		void* pbPtr=glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,GL_WRITE_ONLY_ARB);
+		if(pbPtr!=0)
+			{
+			memcpy(pbPtr,depthImage.getData<GLfloat>(),depthImageBytes);
+			glUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB);
+			
+			/* Source the texture update from the pixel buffer; the transfer proceeds asynchronously: */
+			glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,depthImageSize[0],depthImageSize[1],GL_LUMINANCE,GL_FLOAT,0);
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,0);
+			dataItem->nextDepthPixelBuffer=1-dataItem->nextDepthPixelBuffer;
+			}
+		else
+			{
+			/* Fall back to uploading the new depth texture directly: */
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,0);
+			glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,depthImageSize[0],depthImageSize[1],GL_LUMINANCE,GL_FLOAT,depthImage.getData<GLfloat>());
+			}
+		
+		/* Mark the depth texture as current: */
+		dataItem->depthTextureVersion=depthImageVersion;
+		}
+	}
+
+void DepthImageRenderer::updateTangentTexture(DepthImageRenderer::DataItem* dataItem) const
+	{
+	/* Check if the texture is outdated: */
+	if(dataItem->tangentTextureVersion!=depthImageVersion)
+		{
+		/* Save relevant OpenGL state: */
+		glPushAttrib(GL_ENABLE_BIT|GL_VIEWPORT_BIT);
+		GLint currentFrameBuffer;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+		GLhandleARB currentShader=glGetHandleARB(GL_PROGRAM_OBJECT_ARB);
+		GLint currentTextureUnit;
+		glGetIntegerv(GL_ACTIVE_TEXTURE_ARB,&currentTextureUnit);
+		
+		/* Bind the tangent plane frame buffer: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->tangentFramebuffer);
+		glViewport(0,0,depthImageSize[0],depthImageSize[1]);
+		glDisable(GL_BLEND);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_SCISSOR_TEST);
+		
+		/* Bind the tangent plane shader and the up-to-date depth image texture to the currently active texture unit: */
+		glUseProgramObjectARB(dataItem->tangentShader);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->depthTexture);
+		updateDepthTexture(dataItem);
+		glUniform1iARB(dataItem->tangentShaderUniforms[0],currentTextureUnit-GL_TEXTURE0_ARB);
+		
+		/* Calculate the tangent planes of all depth image pixels: */
+		glBegin(GL_QUADS);
+		glVertex2i(0,0);
+		glVertex2i(depthImageSize[0],0);
+		glVertex2i(depthImageSize[0],depthImageSize[1]);
+		glVertex2i(0,depthImageSize[1]);
+		glEnd();
+		
+		/* Restore OpenGL state: */
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		glUseProgramObjectARB(currentShader);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+		glPopAttrib();
+		
+		/* Mark the tangent plane texture as current: */
+		dataItem->tangentTextureVersion=depthImageVersion;
+		}
+	}
+
+void DepthImageRenderer::updateDepthRangePyramid(const unsigned int rect[2][2])
+	{
+	/* Calculate the range of template mesh cells touching a changed pixel: */
+	unsigned int blockRect[2][2];
+	for(int i=0;i<2;++i)
+		{
+		blockRect[i][0]=rect[i][0]>0?rect[i][0]-1:0;
+		blockRect[i][1]=std::min(rect[i][1],depthImageSize[i]>1?depthImageSize[i]-2:0U);
+		}
+	
+	/* Update the depth ranges of the changed template mesh cells from their four corner pixels: */
+	if(depthImageSize[0]>1&&depthImageSize[1]>1)
+		{
+		DepthRangeLevel& l0=depthRangePyramid[0];
+		const float* depth=depthImage.getData<float>();
+		for(unsigned int y=blockRect[1][0];y<=blockRect[1][1];++y)
+			for(unsigned int x=blockRect[0][0];x<=blockRect[0][1];++x)
+				{
+				const float* dPtr=depth+(y*depthImageSize[0]+x);
+				float* rPtr=&l0.ranges[(size_t(y)*l0.size[0]+x)*2];
+				rPtr[0]=std::min(std::min(dPtr[0],dPtr[1]),std::min(dPtr[depthImageSize[0]],dPtr[depthImageSize[0]+1]));
+				rPtr[1]=std::max(std::max(dPtr[0],dPtr[1]),std::max(dPtr[depthImageSize[0]],dPtr[depthImageSize[0]+1]));
+				}
+		}
+	
+	/* Propagate the changed depth ranges up the pyramid: */
+	for(size_t levelIndex=1;levelIndex<depthRangePyramid.size();++levelIndex)
+		{
+		const DepthRangeLevel& child=depthRangePyramid[levelIndex-1];
+		DepthRangeLevel& level=depthRangePyramid[levelIndex];
+		for(int i=0;i<2;++i)
+			{
+			blockRect[i][0]>>=1;
+			blockRect[i][1]>>=1;
+			}
+		for(unsigned int y=blockRect[1][0];y<=blockRect[1][1];++y)
+			for(unsigned int x=blockRect[0][0];x<=blockRect[0][1];++x)
+				{
+				/* Combine the ranges of the up to four child blocks: */
+				float* rPtr=&level.ranges[(size_t(y)*level.size[0]+x)*2];
+				rPtr[0]=Math::Constants<float>::max;
+				rPtr[1]=-Math::Constants<float>::max;
+				for(unsigned int cy=y*2;cy<=y*2+1&&cy<child.size[1];++cy)
+					for(unsigned int cx=x*2;cx<=x*2+1&&cx<child.size[0];++cx)
+						{
+						const float* crPtr=&child.ranges[(size_t(cy)*child.size[0]+cx)*2];
+						if(rPtr[0]>crPtr[0])
+							rPtr[0]=crPtr[0];
+						if(rPtr[1]<crPtr[1])
+							rPtr[1]=crPtr[1];
+						}
+				}
+		}
 	}
 
 void DepthImageRenderer::initContext(GLContextData& contextData) const
@@ -99,16 +383,18 @@ void DepthImageRenderer::initContext(GLContextData& contextData) const
 	DataItem* dataItem=new DataItem;
 	contextData.addDataItem(this,dataItem);
 	
-	/* Upload the grid of template vertices into the vertex buffer: */
+	/* Upload the grid of template vertices into the vertex buffer; the last vertex row and column always cover the last depth image row and column: */
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->vertexBuffer);
-	glBufferDataARB(GL_ARRAY_BUFFER_ARB,depthImageSize[1]*depthImageSize[0]*sizeof(Vertex),0,GL_STATIC_DRAW_ARB);
+	glBufferDataARB(GL_ARRAY_BUFFER_ARB,meshSize[1]*meshSize[0]*sizeof(Vertex),0,GL_STATIC_DRAW_ARB);
 	Vertex* vPtr=static_cast<Vertex*>(glMapBufferARB(GL_ARRAY_BUFFER_ARB,GL_WRITE_ONLY_ARB));
 	if(lensDistortion.isIdentity())
 		{
 		/* Create uncorrected pixel positions: */
-		for(unsigned int y=0;y<depthImageSize[1];++y)
-			for(unsigned int x=0;x<depthImageSize[0];++x,++vPtr)
+		for(unsigned int my=0;my<meshSize[1];++my)
+			for(unsigned int mx=0;mx<meshSize[0];++mx,++vPtr)
 				{
+				unsigned int x=Math::min(mx*meshDecimation,depthImageSize[0]-1);
+				unsigned int y=Math::min(my*meshDecimation,depthImageSize[1]-1);
 				vPtr->position[0]=Scalar(x)+Scalar(0.5);
 				vPtr->position[1]=Scalar(y)+Scalar(0.5);
 				}
@@ -116,10 +402,12 @@ void DepthImageRenderer::initContext(GLContextData& contextData) const
 	else
 		{
 		/* Create lens distortion-corrected pixel positions: */
-		for(unsigned int y=0;y<depthImageSize[1];++y)
-			for(unsigned int x=0;x<depthImageSize[0];++x,++vPtr)
+		for(unsigned int my=0;my<meshSize[1];++my)
+			for(unsigned int mx=0;mx<meshSize[0];++mx,++vPtr)
 				{
 				/* Undistort the image point: */
+				unsigned int x=Math::min(mx*meshDecimation,depthImageSize[0]-1);
+				unsigned int y=Math::min(my*meshDecimation,depthImageSize[1]-1);
 				Kinect::LensDistortion::Point dp(Kinect::LensDistortion::Scalar(x)+Kinect::LensDistortion::Scalar(0.5),Kinect::LensDistortion::Scalar(y)+Kinect::LensDistortion::Scalar(0.5));
 				Kinect::LensDistortion::Point up=lensDistortion.undistortPixel(dp);
 				
@@ -131,16 +419,17 @@ void DepthImageRenderer::initContext(GLContextData& contextData) const
 	glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB,0);
 	
-	/* Upload the surface's triangle indices into the index buffer: */
+	/* Upload the surface's stitched triangle strip into the index buffer, using 16-bit indices if possible: */
+	dataItem->indexType=meshSize[1]*meshSize[0]<=65536U?GL_UNSIGNED_SHORT:GL_UNSIGNED_INT;
+	size_t indexSize=dataItem->indexType==GL_UNSIGNED_SHORT?sizeof(GLushort):sizeof(GLuint);
+	size_t numIndices=size_t(meshSize[1]-1)*(meshSize[0]*2+2)-2;
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB,dataItem->indexBuffer);
-	glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB,(depthImageSize[1]-1)*depthImageSize[0]*2*sizeof(GLuint),0,GL_STATIC_DRAW_ARB);
-	GLuint* iPtr=static_cast<GLuint*>(glMapBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB,GL_WRITE_ONLY_ARB));
-	for(unsigned int y=1;y<depthImageSize[1];++y)
-		for(unsigned int x=0;x<depthImageSize[0];++x,iPtr+=2)
-			{
-			iPtr[0]=GLuint(y*depthImageSize[0]+x);
-			iPtr[1]=GLuint((y-1)*depthImageSize[0]+x);
-			}
+	glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB,numIndices*indexSize,0,GL_STATIC_DRAW_ARB);
+	void* iPtr=glMapBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB,GL_WRITE_ONLY_ARB);
+	if(dataItem->indexType==GL_UNSIGNED_SHORT)
+		createSurfaceIndices(meshSize,static_cast<GLushort*>(iPtr));
+	else
+		createSurfaceIndices(meshSize,static_cast<GLuint*>(iPtr));
 	glUnmapBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB);
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB,0);
 	
@@ -153,6 +442,24 @@ void DepthImageRenderer::initContext(GLContextData& contextData) const
 	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_LUMINANCE32F_ARB,depthImageSize[0],depthImageSize[1],0,GL_LUMINANCE,GL_FLOAT,0);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 	
+	/* Initialize the tangent plane texture: */
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->tangentTexture);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
+	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_RG32F,depthImageSize[0],depthImageSize[1],0,GL_RG,GL_FLOAT,0);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	
+	/* Attach the tangent plane texture to the tangent plane frame buffer: */
+	GLint currentFrameBuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->tangentFramebuffer);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,GL_COLOR_ATTACHMENT0_EXT,GL_TEXTURE_RECTANGLE_ARB,dataItem->tangentTexture,0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	glReadBuffer(GL_NONE);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+	
 	/* Create the depth rendering shader: */
 	dataItem->depthShader=linkVertexAndFragmentShader("SurfaceDepthShader");
 	dataItem->depthShaderUniforms[0]=glGetUniformLocationARB(dataItem->depthShader,"depthSampler");
@@ -164,6 +471,30 @@ void DepthImageRenderer::initContext(GLContextData& contextData) const
 	dataItem->elevationShaderUniforms[1]=glGetUniformLocationARB(dataItem->elevationShader,"basePlaneDic");
 	dataItem->elevationShaderUniforms[2]=glGetUniformLocationARB(dataItem->elevationShader,"weightDic");
 	dataItem->elevationShaderUniforms[3]=glGetUniformLocationARB(dataItem->elevationShader,"projectionModelviewDepthProjection");
+	
+	/* Create the tangent plane calculation shader with a simple vertex shader rendering quads in depth image pixel space: */
+	{
+	static const char* vertexShaderSourceTemplate="void main(){gl_Position=vec4(gl_Vertex.x*%f-1.0,gl_Vertex.y*%f-1.0,0.0,1.0);}";
+	char vertexShaderSource[256];
+	snprintf(vertexShaderSource,sizeof(vertexShaderSource),vertexShaderSourceTemplate,2.0/double(depthImageSize[0]),2.0/double(depthImageSize[1]));
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("SurfaceTangentShader");
+	dataItem->tangentShader=source.link();
+	dataItem->tangentShaderUniforms[0]=glGetUniformLocationARB(dataItem->tangentShader,"depthSampler");
+	}
+	}
+
+void DepthImageRenderer::setMeshDecimation(unsigned int newMeshDecimation)
+	{
+	/* Accept only the supported decimation levels: */
+	if(newMeshDecimation!=1&&newMeshDecimation!=2&&newMeshDecimation!=4)
+		Misc::throwStdErr("DepthImageRenderer::setMeshDecimation: Unsupported mesh decimation level %u",newMeshDecimation);
+	meshDecimation=newMeshDecimation;
+	
+	/* Calculate the size of the decimated surface template, which always includes the last depth image row and column: */
+	for(int i=0;i<2;++i)
+		meshSize[i]=(depthImageSize[i]+meshDecimation-2)/meshDecimation+1;
 	}
 
 void DepthImageRenderer::setDepthProjection(const PTransform& newDepthProjection)
@@ -222,9 +553,108 @@ void DepthImageRenderer::setBasePlane(const Plane& newBasePlane)
 
 void DepthImageRenderer::setDepthImage(const Kinect::FrameBuffer& newDepthImage)
 	{
-	/* Update the depth image: */
+	/* Find the bounding rectangle of all pixels that differ from the current depth image: */
+	unsigned int rect[2][2]; // Pixel rectangle as [dimension][min, max]
+	for(int i=0;i<2;++i)
+		{
+		rect[i][0]=depthImageSize[i];
+		rect[i][1]=0;
+		}
+	const float* odPtr=depthImage.getData<float>();
+	const float* ndPtr=newDepthImage.getData<float>();
+	for(unsigned int y=0;y<depthImageSize[1];++y)
+		for(unsigned int x=0;x<depthImageSize[0];++x,++odPtr,++ndPtr)
+			if(*ndPtr!=*odPtr)
+				{
+				if(rect[0][0]>x)
+					rect[0][0]=x;
+				if(rect[0][1]<x)
+					rect[0][1]=x;
+				if(rect[1][0]>y)
+					rect[1][0]=y;
+				rect[1][1]=y;
+				}
+	
+	/* Bail out if the new depth image is identical to the current one: */
+	if(rect[0][0]>rect[0][1])
+		return;
+	
+	/* Grow the rectangle by one pixel to include all triangles touching a changed vertex: */
+	for(int i=0;i<2;++i)
+		{
+		if(rect[i][0]>0)
+			--rect[i][0];
+		if(rect[i][1]<depthImageSize[i]-1)
+			++rect[i][1];
+		}
+	
+	/* Calculate the range of old and new depth values inside the rectangle: */
+	float depthMin=Math::Constants<float>::max;
+	float depthMax=-Math::Constants<float>::max;
+	for(unsigned int y=rect[1][0];y<=rect[1][1];++y)
+		{
+		const float* odRowPtr=depthImage.getData<float>()+y*depthImageSize[0];
+		const float* ndRowPtr=newDepthImage.getData<float>()+y*depthImageSize[0];
+		for(unsigned int x=rect[0][0];x<=rect[0][1];++x)
+			{
+			if(depthMin>odRowPtr[x])
+				depthMin=odRowPtr[x];
+			if(depthMax<odRowPtr[x])
+				depthMax=odRowPtr[x];
+			if(depthMin>ndRowPtr[x])
+				depthMin=ndRowPtr[x];
+			if(depthMax<ndRowPtr[x])
+				depthMax=ndRowPtr[x];
+			}
+		}
+	
+	/* Calculate the range of template vertex positions inside the rectangle: */
+	Scalar pixelMin[2],pixelMax[2];
+	for(int i=0;i<2;++i)
+		{
+		pixelMin[i]=Scalar(rect[i][0])+Scalar(0.5);
+		pixelMax[i]=Scalar(rect[i][1])+Scalar(0.5);
+		}
+	if(!lensDistortion.isIdentity())
+		{
+		/* Undistort the rectangle's boundary, which bounds the undistorted image of the rectangle: */
+		for(int i=0;i<2;++i)
+			{
+			pixelMin[i]=Math::Constants<Scalar>::max;
+			pixelMax[i]=-Math::Constants<Scalar>::max;
+			}
+		for(unsigned int y=rect[1][0];y<=rect[1][1];++y)
+			{
+			/* Visit all pixels of the first and last rows, and the first and last pixels of all other rows: */
+			unsigned int xStep=y==rect[1][0]||y==rect[1][1]?1U:Math::max(rect[0][1]-rect[0][0],1U);
+			for(unsigned int x=rect[0][0];x<=rect[0][1];x+=xStep)
+				{
+				Kinect::LensDistortion::Point dp(Kinect::LensDistortion::Scalar(x)+Kinect::LensDistortion::Scalar(0.5),Kinect::LensDistortion::Scalar(y)+Kinect::LensDistortion::Scalar(0.5));
+				Kinect::LensDistortion::Point up=lensDistortion.undistortPixel(dp);
+				for(int i=0;i<2;++i)
+					{
+					if(pixelMin[i]>Scalar(up[i]))
+						pixelMin[i]=Scalar(up[i]);
+					if(pixelMax[i]<Scalar(up[i]))
+						pixelMax[i]=Scalar(up[i]);
+					}
+				}
+			}
+		}
+	
+	/* Unproject the corners of the changed region in depth image space into camera space: */
+	Box dirtyBox=Box::empty;
+	for(int i=0;i<8;++i)
+		{
+		Point dp(i&0x1?pixelMax[0]:pixelMin[0],i&0x2?pixelMax[1]:pixelMin[1],i&0x4?Scalar(depthMax):Scalar(depthMin));
+		dirtyBox.addPoint(depthProjection.transform(dp));
+		}
+	
+	/* Update the depth image and the parts of the depth range pyramid covering the changed region: */
 	depthImage=newDepthImage;
 	++depthImageVersion;
+	dirtyBoxes[depthImageVersion%8]=dirtyBox;
+	updateDepthRangePyramid(rect);
 	}
 
 Scalar DepthImageRenderer::intersectLine(const Point& p0,const Point& p1,Scalar elevationMin,Scalar elevationMax) const
@@ -233,32 +663,172 @@ Scalar DepthImageRenderer::intersectLine(const Point& p0,const Point& p1,Scalar
 	Scalar lambda0=Scalar(0);
 	Scalar lambda1=Scalar(1);
 	
-	/* Intersect the line segment with the upper elevation plane: */
+	/* Clip the line segment against the slab between the lower and upper elevation planes: */
 	Scalar d0=basePlane.calcDistance(p0);
 	Scalar d1=basePlane.calcDistance(p1);
-	if(d0*d1<Scalar(0))
+	if(d0!=d1)
 		{
-		/* Calculate the intersection parameter: */
-		
-		// IMPLEMENT ME!
-		
-		return Scalar(2);
+		/* Calculate the intersection parameters: */
+		Scalar l0=(elevationMin-d0)/(d1-d0);
+		Scalar l1=(elevationMax-d0)/(d1-d0);
+		if(l0>l1)
+			std::swap(l0,l1);
+		if(lambda0<l0)
+			lambda0=l0;
+		if(lambda1>l1)
+			lambda1=l1;
 		}
-	else if(d1>Scalar(0))
+	else if(d0<elevationMin||d0>elevationMax)
 		{
 		/* Trivially reject with maximum intercept: */
 		return Scalar(2);
 		}
+	if(lambda0>=lambda1)
+		return Scalar(2);
 	
+	/* Transform the clipped line segment into depth image space, where it is still a line segment: */
+	Vector d=p1-p0;
+	Point q0=depthProjection.inverseTransform(p0+d*lambda0);
+	Vector dq=depthProjection.inverseTransform(p0+d*lambda1)-q0;
+	
+	/* Traverse the depth range pyramid from the top, descending only into blocks whose depth range the segment crosses, and visiting child blocks in the order in which the segment enters them: */
+	const float* depth=depthImage.getData<float>();
+	TraversalBlock stack[32*4];
+	int stackSize=0;
+	TraversalBlock root;
+	root.level=(unsigned int)(depthRangePyramid.size()-1);
+	root.index[0]=root.index[1]=0;
+	root.mu0=Scalar(0);
+	root.mu1=Scalar(1);
+	Scalar box[2][2];
+	calcBlockBox(root.level,root.index,depthImageSize,box);
+	if(clipToBlock(q0,dq,box,&depthRangePyramid.back().ranges[0],root.mu0,root.mu1))
+		stack[stackSize++]=root;
+	while(stackSize>0)
+		{
+		TraversalBlock block=stack[--stackSize];
+		if(block.level==0)
+			{
+			/* Intersect the segment with the template mesh cell's bilinear surface patch: */
+			Scalar f0=calcSurfaceOffset(depth,depthImageSize[0],block.index,q0+dq*block.mu0);
+			Scalar f1=calcSurfaceOffset(depth,depthImageSize[0],block.index,q0+dq*block.mu1);
+			if((f0<=Scalar(0))!=(f1<=Scalar(0))||f0==Scalar(0))
+				{
+				/* Refine the intersection point by bisection: */
+				for(int i=0;i<24;++i)
+					{
+					Scalar mu=Math::mid(block.mu0,block.mu1);
+					if((calcSurfaceOffset(depth,depthImageSize[0],block.index,q0+dq*mu)<=Scalar(0))==(f0<=Scalar(0)))
+						block.mu0=mu;
+					else
+						block.mu1=mu;
+					}
+				
+				/* Return the intersection point's parameter along the original line segment: */
+				Point hit=depthProjection.transform(q0+dq*Math::mid(block.mu0,block.mu1));
+				return ((hit-p0)*d)/Geometry::sqr(d);
+				}
+			}
+		else
+			{
+			/* Collect all child blocks crossed by the segment, sorted by entry parameter: */
+			const DepthRangeLevel& childLevel=depthRangePyramid[block.level-1];
+			TraversalBlock children[4];
+			int numChildren=0;
+			for(unsigned int cy=block.index[1]*2;cy<=block.index[1]*2+1&&cy<childLevel.size[1];++cy)
+				for(unsigned int cx=block.index[0]*2;cx<=block.index[0]*2+1&&cx<childLevel.size[0];++cx)
+					{
+					TraversalBlock child;
+					child.level=block.level-1;
+					child.index[0]=cx;
+					child.index[1]=cy;
+					child.mu0=block.mu0;
+					child.mu1=block.mu1;
+					calcBlockBox(child.level,child.index,depthImageSize,box);
+					if(clipToBlock(q0,dq,box,&childLevel.ranges[(size_t(cy)*childLevel.size[0]+cx)*2],child.mu0,child.mu1))
+						{
+						int insert;
+						for(insert=numChildren;insert>0&&children[insert-1].mu0>child.mu0;--insert)
+							children[insert]=children[insert-1];
+						children[insert]=child;
+						++numChildren;
+						}
+					}
+			
+			/* Push the child blocks in reverse order to visit the first-entered block next: */
+			for(int i=numChildren-1;i>=0;--i)
+				stack[stackSize++]=children[i];
+			}
+		}
+	
+	/* The segment does not intersect the surface: */
 	return Scalar(2);
 	}
 
+bool DepthImageRenderer::getDirtyBox(unsigned int sinceVersion,DepthImageRenderer::Box& dirtyBox) const
+	{
+	/* Check if all changes after the given version are still tracked: */
+	if(sinceVersion+1<firstDirtyVersion||sinceVersion>depthImageVersion||depthImageVersion-sinceVersion>8)
+		return false;
+	
+	/* Combine the boxes of all changes after the given version: */
+	dirtyBox=Box::empty;
+	for(unsigned int version=sinceVersion+1;version<=depthImageVersion;++version)
+		dirtyBox.addBox(dirtyBoxes[version%8]);
+	
+	return true;
+	}
+
+void DepthImageRenderer::calcRowRange(int numPoints,const Point points[],unsigned int rowRange[2]) const
+	{
+	/* Project all points into depth image space: */
+	Scalar rowMin=Math::Constants<Scalar>::max;
+	Scalar rowMax=-Math::Constants<Scalar>::max;
+	for(int i=0;i<numPoints;++i)
+		{
+		Point dp=depthProjection.inverseTransform(points[i]);
+		Scalar row=dp[1];
+		if(!lensDistortion.isIdentity())
+			{
+			/* Find the distorted pixel row containing the undistorted point: */
+			Kinect::LensDistortion::Point up(Kinect::LensDistortion::Scalar(dp[0]),Kinect::LensDistortion::Scalar(dp[1]));
+			row=Scalar(lensDistortion.distortPixel(up)[1]);
+			}
+		if(rowMin>row)
+			rowMin=row;
+		if(rowMax<row)
+			rowMax=row;
+		}
+	
+	/* Convert the projected range to template mesh rows, with one row of slack for triangles crossing the range: */
+	rowMin=Math::floor(rowMin-Scalar(0.5))-Scalar(1);
+	rowMax=Math::ceil(rowMax-Scalar(0.5))+Scalar(1);
+	rowRange[0]=rowMin>Scalar(0)?(unsigned int)(rowMin):0U;
+	rowRange[1]=rowMax<Scalar(depthImageSize[1]-1)?(unsigned int)(rowMax):depthImageSize[1]-1;
+	if(rowRange[0]>rowRange[1])
+		rowRange[0]=rowRange[1];
+	}
+
 void DepthImageRenderer::uploadDepthProjection(GLint location) const
 	{
 	/* Upload the matrix to OpenGL: */
 	glUniformMatrix4fvARB(location,1,GL_FALSE,depthProjectionMatrix);
 	}
 
+void DepthImageRenderer::uploadDepthImage(GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	if(dataItem->depthTextureVersion!=depthImageVersion)
+		{
+		/* Start streaming the new depth image into the depth texture: */
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->depthTexture);
+		updateDepthTexture(dataItem);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		}
+	}
+
 void DepthImageRenderer::bindDepthTexture(GLContextData& contextData) const
 	{
 	/* Get the data item: */
@@ -267,15 +837,20 @@ void DepthImageRenderer::bindDepthTexture(GLContextData& contextData) const
 	/* Bind the depth image texture: */
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->depthTexture);
 	
-	/* Check if the texture is outdated: */
-	if(dataItem->depthTextureVersion!=depthImageVersion)
-		{
-		/* Upload the new depth texture: */
-		glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,depthImageSize[0],depthImageSize[1],GL_LUMINANCE,GL_FLOAT,depthImage.getData<GLfloat>());
-		
-		/* Mark the depth texture as current: */
-		dataItem->depthTextureVersion=depthImageVersion;
-		}
+	/* Update the texture if it is outdated: */
+	updateDepthTexture(dataItem);
+	}
+
+void DepthImageRenderer::bindTangentTexture(GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Recalculate the tangent plane texture if it is outdated: */
+	updateTangentTexture(dataItem);
+	
+	/* Bind the tangent plane texture: */
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->tangentTexture);
 	}
 
 void DepthImageRenderer::renderSurfaceTemplate(GLContextData& contextData) const
@@ -290,9 +865,7 @@ void DepthImageRenderer::renderSurfaceTemplate(GLContextData& contextData) const
 	/* Draw the surface template: */
 	GLVertexArrayParts::enable(Vertex::getPartsMask());
 	glVertexPointer(static_cast<const Vertex*>(0));
-	GLuint* indexPtr=0;
-	for(unsigned int y=1;y<depthImageSize[1];++y,indexPtr+=depthImageSize[0]*2)
-		glDrawElements(GL_QUAD_STRIP,depthImageSize[0]*2,GL_UNSIGNED_INT,indexPtr);
+	drawSurface(dataItem,0,depthImageSize[1]-1);
 	GLVertexArrayParts::disable(Vertex::getPartsMask());
 	
 	/* Unbind the vertex and index buffers: */
@@ -316,15 +889,8 @@ void DepthImageRenderer::renderDepth(const PTransform& projectionModelview,GLCon
 	glActiveTextureARB(GL_TEXTURE0_ARB);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->depthTexture);
 	
-	/* Check if the texture is outdated: */
-	if(dataItem->depthTextureVersion!=depthImageVersion)
-		{
-		/* Upload the new depth texture: */
-		glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,depthImageSize[0],depthImageSize[1],GL_LUMINANCE,GL_FLOAT,depthImage.getData<GLfloat>());
-		
-		/* Mark the depth texture as current: */
-		dataItem->depthTextureVersion=depthImageVersion;
-		}
+	/* Update the texture if it is outdated: */
+	updateDepthTexture(dataItem);
 	glUniform1iARB(dataItem->depthShaderUniforms[0],0); // Tell the shader that the depth texture is in texture unit 0
 	
 	/* Upload the combined projection, modelview, and depth projection matrix: */
@@ -335,9 +901,7 @@ void DepthImageRenderer::renderDepth(const PTransform& projectionModelview,GLCon
 	/* Draw the surface: */
 	GLVertexArrayParts::enable(Vertex::getPartsMask());
 	glVertexPointer(static_cast<const Vertex*>(0));
-	GLuint* indexPtr=0;
-	for(unsigned int y=1;y<depthImageSize[1];++y,indexPtr+=depthImageSize[0]*2)
-		glDrawElements(GL_QUAD_STRIP,depthImageSize[0]*2,GL_UNSIGNED_INT,indexPtr);
+	drawSurface(dataItem,0,depthImageSize[1]-1);
 	GLVertexArrayParts::disable(Vertex::getPartsMask());
 	
 	/* Unbind all textures and buffers: */
@@ -350,6 +914,15 @@ void DepthImageRenderer::renderDepth(const PTransform& projectionModelview,GLCon
 	}
 
 void DepthImageRenderer::renderElevation(const PTransform& projectionModelview,GLContextData& contextData) const
+	{
+	/* Render the entire surface: */
+	unsigned int rowRange[2];
+	rowRange[0]=0;
+	rowRange[1]=depthImageSize[1]-1;
+	renderElevation(projectionModelview,rowRange,contextData);
+	}
+
+void DepthImageRenderer::renderElevation(const PTransform& projectionModelview,const unsigned int rowRange[2],GLContextData& contextData) const
 	{
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
@@ -361,15 +934,8 @@ void DepthImageRenderer::renderElevation(const PTransform& projectionModelview,G
 	glActiveTextureARB(GL_TEXTURE0_ARB);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->depthTexture);
 	
-	/* Check if the texture is outdated: */
-	if(dataItem->depthTextureVersion!=depthImageVersion)
-		{
-		/* Upload the new depth texture: */
-		glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,depthImageSize[0],depthImageSize[1],GL_LUMINANCE,GL_FLOAT,depthImage.getData<GLfloat>());
-		
-		/* Mark the depth texture as current: */
-		dataItem->depthTextureVersion=depthImageVersion;
-		}
+	/* Update the texture if it is outdated: */
+	updateDepthTexture(dataItem);
 	glUniform1iARB(dataItem->elevationShaderUniforms[0],0); // Tell the shader that the depth texture is in texture unit 0
 	
 	/* Upload the base plane equation in depth image space: */
@@ -387,12 +953,10 @@ void DepthImageRenderer::renderElevation(const PTransform& projectionModelview,G
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->vertexBuffer);
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB,dataItem->indexBuffer);
 	
-	/* Draw the surface: */
+	/* Draw the surface between the given rows: */
 	GLVertexArrayParts::enable(Vertex::getPartsMask());
 	glVertexPointer(static_cast<const Vertex*>(0));
-	GLuint* indexPtr=0;
-	for(unsigned int y=1;y<depthImageSize[1];++y,indexPtr+=depthImageSize[0]*2)
-		glDrawElements(GL_QUAD_STRIP,depthImageSize[0]*2,GL_UNSIGNED_INT,indexPtr);
+	drawSurface(dataItem,rowRange[0],rowRange[1]);
 	GLVertexArrayParts::disable(Vertex::getPartsMask());
 	
 	/* Unbind all textures and buffers: */
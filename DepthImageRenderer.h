@@ -24,6 +24,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef DEPTHIMAGERENDERER_INCLUDED
 #define DEPTHIMAGERENDERER_INCLUDED
 
+#include <vector>
+#include <Geometry/Box.h>
 #include <GL/gl.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
 #include <GL/GLObject.h>
@@ -36,6 +38,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 class DepthImageRenderer:public GLObject
 	{
 	/* Embedded classes: */
+	public:
+	typedef Geometry::Box<Scalar,3> Box; // Type for bounding boxes in camera space
+	
 	private:
 	typedef GLGeometry::Vertex<void,0,void,0,void,GLfloat,2> Vertex; // Type for template vertices
 	
@@ -46,23 +51,41 @@ class DepthImageRenderer:public GLObject
 		
 		/* OpenGL state management: */
 		GLuint vertexBuffer; // ID of vertex buffer object holding surface's template vertices
-		GLuint indexBuffer; // ID of index buffer object holding surface's triangles
+		GLuint indexBuffer; // ID of index buffer object holding surface's triangles as a single stitched triangle strip
+		GLenum indexType; // Data type of the surface's triangle strip indices, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
 		GLuint depthTexture; // ID of texture object holding surface's vertex elevations in depth image space
 		unsigned int depthTextureVersion; // Version number of the depth image texture
+		GLuint depthPixelBuffers[2]; // IDs of pixel buffer objects alternately streaming new depth images into the depth texture
+		unsigned int nextDepthPixelBuffer; // Index of the pixel buffer object receiving the next depth image
+		GLuint tangentTexture; // ID of texture object holding the x and y components of the surface's tangent planes in depth image space
+		unsigned int tangentTextureVersion; // Version number of the depth image from which the tangent plane texture was calculated
+		GLuint tangentFramebuffer; // ID of frame buffer object to calculate the tangent plane texture
 		
 		/* GLSL shader management: */
 		GLhandleARB depthShader; // Shader program to render the surface's depth only
 		GLint depthShaderUniforms[2]; // Locations of the depth shader's uniform variables
 		GLhandleARB elevationShader; // Shader program to render the surface's elevation relative to a plane
 		GLint elevationShaderUniforms[4]; // Locations of the elevation shader's uniform variables
+		GLhandleARB tangentShader; // Shader program to calculate the surface's tangent planes from the depth image
+		GLint tangentShaderUniforms[1]; // Locations of the tangent plane shader's uniform variables
 		
 		/* Constructors and destructors: */
 		DataItem(void);
 		virtual ~DataItem(void);
 		};
 	
+	struct DepthRangeLevel // Structure for one level of a pyramid of depth value ranges
+		{
+		/* Elements: */
+		public:
+		unsigned int size[2]; // Number of blocks in this level; block (i, j) in level k covers the template mesh cells between depth image pixels (i*2^k, j*2^k) and ((i+1)*2^k, (j+1)*2^k)
+		std::vector<float> ranges; // Minimum and maximum depth values of all blocks in row-major order
+		};
+	
 	/* Elements: */
 	unsigned int depthImageSize[2]; // Size of depth image texture
+	unsigned int meshDecimation; // Distance between adjacent surface template vertices in depth image pixels
+	unsigned int meshSize[2]; // Number of surface template vertices along each axis
 	Kinect::LensDistortion lensDistortion; // 2D lens distortion parameters
 	PTransform depthProjection; // Projection matrix from depth image space into 3D camera space
 	GLfloat depthProjectionMatrix[16]; // Same, in GLSL-compatible format
@@ -73,6 +96,15 @@ class DepthImageRenderer:public GLObject
 	/* Transient state: */
 	Kinect::FrameBuffer depthImage; // The most recent float-pixel depth image
 	unsigned int depthImageVersion; // Version number of the depth image
+	Box dirtyBoxes[8]; // Camera-space bounding boxes of the surface changes leading to the most recent depth image versions, indexed by version number modulo 8
+	unsigned int firstDirtyVersion; // Version number of the first depth image whose surface changes were tracked
+	std::vector<DepthRangeLevel> depthRangePyramid; // Pyramid of depth value ranges of the current depth image, from single template mesh cells up to one block covering the entire depth image
+	
+	/* Private methods: */
+	void updateDepthRangePyramid(const unsigned int rect[2][2]); // Updates the depth range pyramid for a change of the current depth image inside the given pixel rectangle, as [dimension][min, max]
+	void updateDepthTexture(DataItem* dataItem) const; // Streams the current depth image into the given context's depth texture, which must be bound, if it is outdated
+	void updateTangentTexture(DataItem* dataItem) const; // Recalculates the given context's tangent plane texture from the current depth image if it is outdated
+	void drawSurface(const DataItem* dataItem,unsigned int firstRow,unsigned int lastRow) const; // Draws the part of the surface template covering the given depth image rows, inclusive, with a single draw call
 	
 	/* Constructors and destructors: */
 	public:
@@ -90,6 +122,10 @@ class DepthImageRenderer:public GLObject
 		{
 		return depthImageSize[index];
 		}
+	unsigned int getMeshDecimation(void) const // Returns the distance between adjacent surface template vertices in depth image pixels
+		{
+		return meshDecimation;
+		}
 	const PTransform& getDepthProjection(void) const // Returns the depth unprojection matrix
 		{
 		return depthProjection;
@@ -98,20 +134,30 @@ class DepthImageRenderer:public GLObject
 		{
 		return basePlane;
 		}
+	void setMeshDecimation(unsigned int newMeshDecimation); // Sets the distance between adjacent surface template vertices to 1, 2, or 4 depth image pixels; must be called before the renderer is initialized in any OpenGL context
 	void setDepthProjection(const PTransform& newDepthProjection); // Sets a new depth unprojection matrix
 	void setIntrinsics(const Kinect::FrameSource::IntrinsicParameters& ips); // Sets a new depth unprojection matrix and, if present, 2D lens distortion parameters
 	void setBasePlane(const Plane& newBasePlane); // Sets a new base plane for elevation rendering
-	void setDepthImage(const Kinect::FrameBuffer& newDepthImage); // Sets a new depth image for subsequent surface rendering
-	Scalar intersectLine(const Point& p0,const Point& p1,Scalar elevationMin,Scalar elevationMax) const; // Intersects a line segment with the current depth image in camera space; returns intersection point's parameter along line
+	void setDepthImage(const Kinect::FrameBuffer& newDepthImage); // Sets a new depth image for subsequent surface rendering; keeps the version number if the new depth image is identical to the current one
+	Scalar intersectLine(const Point& p0,const Point& p1,Scalar elevationMin,Scalar elevationMax) const; // Intersects a line segment with the current depth image in camera space, inside the given elevation range above the base plane; returns intersection point's parameter along line, or 2 if there is no intersection
 	unsigned int getDepthImageVersion(void) const // Returns the version number of the current depth image
 		{
 		return depthImageVersion;
 		}
+	double getDepthImageTimeStamp(void) const // Returns the time stamp of the current depth image
+		{
+		return depthImage.timeStamp;
+		}
+	bool getDirtyBox(unsigned int sinceVersion,Box& dirtyBox) const; // Returns a camera-space box containing all surface changes after the given version; returns false if those changes are no longer tracked
+	void calcRowRange(int numPoints,const Point points[],unsigned int rowRange[2]) const; // Calculates the range of depth image rows whose surface could intersect the convex hull of the given camera-space points
 	void uploadDepthProjection(GLint location) const; // Uploads the depth unprojection matrix into the GLSL 4x4 matrix at the given uniform location
+	void uploadDepthImage(GLContextData& contextData) const; // Starts an asynchronous transfer of a new depth image into the given context's depth texture, to overlap it with subsequent work
 	void bindDepthTexture(GLContextData& contextData) const; // Binds the up-to-date depth texture image to the currently active texture unit
-	void renderSurfaceTemplate(GLContextData& contextData) const; // Renders the template quad strip mesh using current OpenGL settings
+	void bindTangentTexture(GLContextData& contextData) const; // Binds the up-to-date texture of depth image-space surface tangent planes to the currently active texture unit; calculates it at most once per depth image version
+	void renderSurfaceTemplate(GLContextData& contextData) const; // Renders the template triangle strip mesh using current OpenGL settings
 	void renderDepth(const PTransform& projectionModelview,GLContextData& contextData) const; // Renders the surface into a pure depth buffer, for early z culling or shadow passes etc.
 	void renderElevation(const PTransform& projectionModelview,GLContextData& contextData) const; // Renders the surface's elevation relative to the base plane into the current one-component floating-point valued frame buffer
+	void renderElevation(const PTransform& projectionModelview,const unsigned int rowRange[2],GLContextData& contextData) const; // Ditto, but only renders the part of the surface between the given depth image rows, inclusive
 	};
 
 #endif
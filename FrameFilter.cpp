@@ -53,9 +53,11 @@ void* FrameFilter::filterThreadMethod(void)
 		frame=inputFrame;
 		lastInputFrameVersion=inputFrameVersion;
 		}
+		PipelineTrace::Scope filterScope(traceRing,"Filter frame",PipelineTrace::getFrameId(frame.timeStamp));
 		
 		/* Prepare a new output frame: */
 		Kinect::FrameBuffer& newOutputFrame=outputFrames.startNewValue();
+		newOutputFrame.timeStamp=frame.timeStamp;
 		
 		/* Enter the new frame into the averaging buffer and calculate the output frame's pixel values: */
 		const RawDepth* ifPtr=inputFrame.getData<RawDepth>();
@@ -212,7 +214,8 @@ FrameFilter::FrameFilter(const unsigned int sSize[2],unsigned int sNumAveragingS
 	:pixelDepthCorrection(sPixelDepthCorrection),
 	 averagingBuffer(0),
 	 statBuffer(0),
-	 outputFrameFunction(0)
+	 outputFrameFunction(0),
+	 traceRing(0)
 	{
 	/* Remember the frame size: */
 	for(int i=0;i<2;++i)
@@ -355,6 +358,11 @@ void FrameFilter::setOutputFrameFunction(FrameFilter::OutputFrameFunction* newOu
 	outputFrameFunction=newOutputFrameFunction;
 	}
 
+void FrameFilter::setTraceRing(PipelineTrace::Ring* newTraceRing)
+	{
+	traceRing=newTraceRing;
+	}
+
 void FrameFilter::receiveRawFrame(const Kinect::FrameBuffer& newFrame)
 	{
 	Threads::MutexCond::Lock inputLock(inputCond);
@@ -31,6 +31,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Kinect/FrameSource.h>
 
 #include "Types.h"
+#include "PipelineTrace.h"
 
 /* Forward declarations: */
 namespace Misc {
@@ -71,6 +72,7 @@ class FrameFilter
 	float* validBuffer; // Buffer holding the most recent stable depth value for each pixel
 	Threads::TripleBuffer<Kinect::FrameBuffer> outputFrames; // Triple buffer of output frames
 	OutputFrameFunction* outputFrameFunction; // Function called when a new output frame is ready
+	PipelineTrace::Ring* traceRing; // Ring buffer receiving the filtering thread's trace events, or null
 	
 	/* Private methods: */
 	void* filterThreadMethod(void); // Method for the background filtering thread
@@ -89,6 +91,7 @@ class FrameFilter
 	void setInstableValue(float newInstableValue); // Sets the depth value to assign to instable pixels
 	void setSpatialFilter(bool newSpatialFilter); // Sets the spatial filtering flag
 	void setOutputFrameFunction(OutputFrameFunction* newOutputFrameFunction); // Sets the output function; adopts given functor object
+	void setTraceRing(PipelineTrace::Ring* newTraceRing); // Sets the ring buffer receiving the filtering thread's trace events; must be called before the first raw frame is received
 	void receiveRawFrame(const Kinect::FrameBuffer& newFrame); // Called to receive a new raw depth frame
 	bool lockNewFrame(void) // Locks the most recently produced output frame for reading; returns true if the locked frame is new
 		{
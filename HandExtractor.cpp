@@ -250,6 +250,7 @@ void* HandExtractor::extractorThreadMethod(void)
 		frame=inputFrame;
 		lastInputFrameVersion=inputFrameVersion;
 		}
+		PipelineTrace::Scope extractScope(traceRing,"Extract hands",PipelineTrace::getFrameId(frame.timeStamp));
 		
 		/* Prepare a new output hand list: */
 		HandList& newHandList=extractedHands.startNewValue();
@@ -276,7 +277,7 @@ HandExtractor::HandExtractor(const unsigned int sDepthFrameSize[2],const HandExt
 	 snakeLength(50),snake(0),
 	 maxCornerEnterDist(28),minCenterDist(10),minCornerExitDist(32),
 	 minHandProbability(0.15f),
-	 handsExtractedFunction(0)
+	 handsExtractedFunction(0),traceRing(0)
 	{
 	/* Copy the depth frame size: */
 	for(int i=0;i<2;++i)
@@ -892,6 +893,11 @@ void HandExtractor::setHandsExtractedFunction(HandExtractor::HandsExtractedFunct
 	handsExtractedFunction=newHandsExtractedFunction;
 	}
 
+void HandExtractor::setTraceRing(PipelineTrace::Ring* newTraceRing)
+	{
+	traceRing=newTraceRing;
+	}
+
 void HandExtractor::receiveRawFrame(const Kinect::FrameBuffer& newFrame)
 	{
 	Threads::MutexCond::Lock inputLock(inputCond);
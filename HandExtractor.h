@@ -33,6 +33,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Kinect/FrameSource.h>
 
 #include "Types.h"
+#include "PipelineTrace.h"
 
 /* Forward declarations: */
 namespace Misc {
@@ -97,6 +98,7 @@ class HandExtractor
 	
 	Threads::TripleBuffer<HandList> extractedHands; // Triple buffer of lists of extracted hands
 	HandsExtractedFunction* handsExtractedFunction; // Function called when a new list of extracted hands is ready
+	PipelineTrace::Ring* traceRing; // Ring buffer receiving the extraction thread's trace events, or null
 	
 	/* Private methods: */
 	void* extractorThreadMethod(void); // Method for the background hand extraction thread
@@ -150,6 +152,7 @@ class HandExtractor
 	void setCornerDists(int newMaxCornerEnterDist,int newMinCenterDist,int newMinCornerExitDist); // Sets distances between snake's head and tail to enter and exit corner state, respectively
 	void extractHands(const DepthPixel* depthFrame,HandList& hands,Images::RGBImage* blobImage); // Extracts hands from the given depth frame
 	void setHandsExtractedFunction(HandsExtractedFunction* newHandsExtractedFunction); // Sets the output function; adopts given functor object
+	void setTraceRing(PipelineTrace::Ring* newTraceRing); // Sets the ring buffer receiving the extraction thread's trace events; must be called before the first raw frame is received
 	void receiveRawFrame(const Kinect::FrameBuffer& newFrame); // Called to receive a new raw depth frame
 	bool lockNewExtractedHands(void) // Locks the most recently produced output list of extracted hands for reading; returns true if the locked list is new
 		{
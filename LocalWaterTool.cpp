@@ -22,9 +22,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "LocalWaterTool.h"
 
-#include <Misc/FunctionCalls.h>
 #include <GL/gl.h>
-#include <GL/Extensions/GLARBVertexProgram.h>
 #include <GL/GLGeometryWrappers.h>
 #include <GL/GLTransformationWrappers.h>
 #include <Vrui/Vrui.h>
@@ -61,7 +59,6 @@ LocalWaterToolFactory* LocalWaterTool::initClass(Vrui::ToolManager& toolManager)
 
 LocalWaterTool::LocalWaterTool(const Vrui::ToolFactory* factory,const Vrui::ToolInputAssignment& inputAssignment)
 	:Vrui::Tool(factory,inputAssignment),
-	 addWaterFunction(0),
 	 adding(0.0f)
 	{
 	}
@@ -70,25 +67,6 @@ LocalWaterTool::~LocalWaterTool(void)
 	{
 	}
 
-void LocalWaterTool::initialize(void)
-	{
-	/* Register a render function with the water table: */
-	if(application->waterTable!=0)
-		{
-		addWaterFunction=Misc::createFunctionCall(this,&LocalWaterTool::addWater);
-		application->waterTable->addRenderFunction(addWaterFunction);
-		}
-	}
-
-void LocalWaterTool::deinitialize(void)
-	{
-	/* Unregister the render function from the water table: */
-	if(application->waterTable!=0)
-		application->waterTable->removeRenderFunction(addWaterFunction);
-	delete addWaterFunction;
-	addWaterFunction=0;
-	}
-
 const Vrui::ToolFactory* LocalWaterTool::getFactory(void) const
 	{
 	return factory;
@@ -104,10 +82,17 @@ void LocalWaterTool::buttonCallback(int buttonSlotIndex,Vrui::InputDevice::Butto
 	adding+=waterAmount;
 	}
 
-void LocalWaterTool::initContext(GLContextData& contextData) const
+void LocalWaterTool::frame(void)
 	{
-	/* Initialize the required OpenGL extensions: */
-	GLARBVertexProgram::initExtension();
+	if(adding!=0.0f&&application->waterTable!=0&&application->waterSpeed>0.0)
+		{
+		/* Get the current rain disk position and size in camera coordinates: */
+		Vrui::Point rainPos=Vrui::getInverseNavigationTransformation().transform(getButtonDevicePosition(0));
+		Vrui::Scalar rainRadius=Vrui::getPointPickDistance()*Vrui::Scalar(3);
+		
+		/* Submit the rain disk to the water table: */
+		application->waterTable->addWaterSource(Point(rainPos),Scalar(rainRadius),adding/application->waterSpeed);
+		}
 	}
 
 void LocalWaterTool::glRenderActionTransparent(GLContextData& contextData) const
@@ -168,34 +153,3 @@ void LocalWaterTool::glRenderActionTransparent(GLContextData& contextData) const
 	glPopMatrix();
 	glPopAttrib();
 	}
-
-void LocalWaterTool::addWater(GLContextData& contextData) const
-	{
-	if(adding!=0.0f)
-		{
-		glPushAttrib(GL_ENABLE_BIT);
-		glDisable(GL_CULL_FACE);
-		
-		/* Get the current rain disk position and size in camera coordinates: */
-		Vrui::Point rainPos=Vrui::getInverseNavigationTransformation().transform(getButtonDevicePosition(0));
-		Vrui::Scalar rainRadius=Vrui::getPointPickDistance()*Vrui::Scalar(3);
-		
-		/* Render the rain disk: */
-		Vrui::Vector z=application->waterTable->getBaseTransform().inverseTransform(Vrui::Vector(0,0,1));
-		Vrui::Vector x=Geometry::normal(z);
-		Vrui::Vector y=Geometry::cross(z,x);
-		x*=rainRadius/Geometry::mag(x);
-		y*=rainRadius/Geometry::mag(y);
-		
-		glVertexAttrib1fARB(1,adding/application->waterSpeed);
-		glBegin(GL_POLYGON);
-		for(int i=0;i<32;++i)
-			{
-			Vrui::Scalar angle=Vrui::Scalar(2)*Math::Constants<Vrui::Scalar>::pi*Vrui::Scalar(i)/Vrui::Scalar(32);
-			glVertex(rainPos+x*Math::cos(angle)+y*Math::sin(angle));
-			}
-		glEnd();
-		
-		glPopAttrib();
-		}
-	}
@@ -24,24 +24,17 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define LOCALWATERTOOL_INCLUDED
 
 #include <GL/gl.h>
-#include <GL/GLObject.h>
 #include <Vrui/Tool.h>
 #include <Vrui/GenericToolFactory.h>
 #include <Vrui/TransparentObject.h>
 #include <Vrui/Application.h>
 
 /* Forward declarations: */
-namespace Misc {
-template <class ParameterParam>
-class FunctionCall;
-}
-class GLContextData;
-typedef Misc::FunctionCall<GLContextData&> AddWaterFunction;
 class Sandbox;
 class LocalWaterTool;
 typedef Vrui::GenericToolFactory<LocalWaterTool> LocalWaterToolFactory;
 
-class LocalWaterTool:public Vrui::Tool,public Vrui::Application::Tool<Sandbox>,public GLObject,public Vrui::TransparentObject
+class LocalWaterTool:public Vrui::Tool,public Vrui::Application::Tool<Sandbox>,public Vrui::TransparentObject
 	{
 	friend class Vrui::GenericToolFactory<LocalWaterTool>;
 	
@@ -49,7 +42,6 @@ class LocalWaterTool:public Vrui::Tool,public Vrui::Application::Tool<Sandbox>,p
 	private:
 	static LocalWaterToolFactory* factory; // Pointer to the factory object for this class
 	
-	const AddWaterFunction* addWaterFunction; // Render function registered with the water table
 	GLfloat adding; // Amount of data added or removed from the water table
 	
 	/* Constructors and destructors: */
@@ -59,19 +51,12 @@ class LocalWaterTool:public Vrui::Tool,public Vrui::Application::Tool<Sandbox>,p
 	virtual ~LocalWaterTool(void);
 	
 	/* Methods from class Vrui::Tool: */
-	virtual void initialize(void);
-	virtual void deinitialize(void);
 	virtual const Vrui::ToolFactory* getFactory(void) const;
 	virtual void buttonCallback(int buttonSlotIndex,Vrui::InputDevice::ButtonCallbackData* cbData);
-	
-	/* Methods from class GLObject: */
-	virtual void initContext(GLContextData& contextData) const;
+	virtual void frame(void);
 	
 	/* Methods from class Vrui::TransparentObject: */
 	virtual void glRenderActionTransparent(GLContextData& contextData) const;
-	
-	/* New methods: */
-	void addWater(GLContextData& contextData) const; // Function to render geometry that adds water to the water table
 	};
 
 #endif
@@ -0,0 +1,125 @@
+/***********************************************************************
+OffscreenGLContext - Class to represent an OpenGL context rendering into
+a GLX pixel buffer, to run OpenGL code in background threads or without
+an on-screen window.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "OffscreenGLContext.h"
+
+#include <Misc/ThrowStdErr.h>
+#include <GL/GLExtensionManager.h>
+#include <GL/GLContextData.h>
+
+/***********************************
+Methods of class OffscreenGLContext:
+***********************************/
+
+void OffscreenGLContext::init(const char* displayName,GLXContext shareContext)
+	{
+	/* Open a private connection to the X server so that the context can be used from any thread without X11 locking: */
+	display=XOpenDisplay(displayName);
+	if(display==0)
+		Misc::throwStdErr("OffscreenGLContext: Unable to open display %s",displayName!=0?displayName:"(default)");
+	
+	/* Find a frame buffer configuration supporting pixel buffers: */
+	static const int configAttribs[]=
+		{
+		GLX_DRAWABLE_TYPE,GLX_PBUFFER_BIT,
+		GLX_RENDER_TYPE,GLX_RGBA_BIT,
+		GLX_RED_SIZE,8,GLX_GREEN_SIZE,8,GLX_BLUE_SIZE,8,
+		None
+		};
+	int numConfigs=0;
+	GLXFBConfig* configs=glXChooseFBConfig(display,DefaultScreen(display),configAttribs,&numConfigs);
+	if(configs==0||numConfigs==0)
+		{
+		XCloseDisplay(display);
+		Misc::throwStdErr("OffscreenGLContext: No pixel buffer-capable visual on display %s",displayName!=0?displayName:"(default)");
+		}
+	
+	/* Create a minimal pixel buffer; all real rendering goes to frame buffer objects: */
+	static const int pbufferAttribs[]=
+		{
+		GLX_PBUFFER_WIDTH,1,
+		GLX_PBUFFER_HEIGHT,1,
+		None
+		};
+	pbuffer=glXCreatePbuffer(display,configs[0],pbufferAttribs);
+	
+	/* Create the OpenGL context: */
+	context=glXCreateNewContext(display,configs[0],GLX_RGBA_TYPE,shareContext,True);
+	XFree(configs);
+	if(context==0)
+		{
+		glXDestroyPbuffer(display,pbuffer);
+		XCloseDisplay(display);
+		Misc::throwStdErr("OffscreenGLContext: Unable to create OpenGL context");
+		}
+	
+	/* Create the context's extension manager and context data object: */
+	extensionManager=new GLExtensionManager;
+	contextData=new GLContextData(101);
+	}
+
+OffscreenGLContext::OffscreenGLContext(const char* displayName)
+	:display(0),context(0),pbuffer(None),
+	 extensionManager(0),contextData(0)
+	{
+	init(displayName,0);
+	}
+
+OffscreenGLContext::OffscreenGLContext(const char* displayName,GLXContext shareContext)
+	:display(0),context(0),pbuffer(None),
+	 extensionManager(0),contextData(0)
+	{
+	init(displayName,shareContext);
+	}
+
+OffscreenGLContext::~OffscreenGLContext(void)
+	{
+	/* Delete all per-context state while the context is still current: */
+	makeCurrent();
+	delete contextData;
+	release();
+	delete extensionManager;
+	
+	/* Destroy the context and its drawable: */
+	glXDestroyContext(display,context);
+	glXDestroyPbuffer(display,pbuffer);
+	XCloseDisplay(display);
+	}
+
+void OffscreenGLContext::makeCurrent(void)
+	{
+	/* Bind the context to the pixel buffer: */
+	if(!glXMakeContextCurrent(display,pbuffer,pbuffer,context))
+		Misc::throwStdErr("OffscreenGLContext::makeCurrent: Unable to make context current");
+	
+	/* Install the context's extension manager and context data object: */
+	GLExtensionManager::makeCurrent(extensionManager);
+	GLContextData::makeCurrent(contextData);
+	}
+
+void OffscreenGLContext::release(void)
+	{
+	GLContextData::makeCurrent(0);
+	GLExtensionManager::makeCurrent(0);
+	glXMakeContextCurrent(display,None,None,0);
+	}
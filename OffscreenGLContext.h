@@ -0,0 +1,63 @@
+/***********************************************************************
+OffscreenGLContext - Class to represent an OpenGL context rendering into
+a GLX pixel buffer, to run OpenGL code in background threads or without
+an on-screen window.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef OFFSCREENGLCONTEXT_INCLUDED
+#define OFFSCREENGLCONTEXT_INCLUDED
+
+#include <X11/Xlib.h>
+#include <GL/gl.h>
+#include <GL/glx.h>
+
+/* Forward declarations: */
+class GLExtensionManager;
+class GLContextData;
+
+class OffscreenGLContext
+	{
+	/* Elements: */
+	private:
+	Display* display; // Private connection to the X server hosting the context
+	GLXContext context; // The OpenGL context
+	GLXPbuffer pbuffer; // Small pixel buffer serving as the context's drawable; all real rendering goes to frame buffer objects
+	GLExtensionManager* extensionManager; // Extension manager for the context
+	GLContextData* contextData; // Context data object to hold the per-context state of GLObjects initialized in the context
+	
+	/* Private methods: */
+	void init(const char* displayName,GLXContext shareContext); // Creates the context, optionally sharing display lists and texture objects with the given context
+	
+	/* Constructors and destructors: */
+	public:
+	OffscreenGLContext(const char* displayName); // Creates a stand-alone context on the X server of the given name (uses DISPLAY if null)
+	OffscreenGLContext(const char* displayName,GLXContext shareContext); // Creates a context sharing texture and buffer objects with the given context
+	~OffscreenGLContext(void); // Destroys the context; must be called from the thread in which the context is current, if any
+	
+	/* Methods: */
+	void makeCurrent(void); // Makes the context current in the calling thread
+	void release(void); // Releases the context from the calling thread
+	GLContextData& getContextData(void) // Returns the context's context data object
+		{
+		return *contextData;
+		}
+	};
+
+#endif
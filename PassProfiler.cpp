@@ -0,0 +1,315 @@
+/***********************************************************************
+PassProfiler - Class to measure the GPU time spent in the individual
+rendering and simulation passes of the Augmented Reality Sandbox using
+timer queries, without stalling the OpenGL pipeline.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "PassProfiler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <Math/Math.h>
+#include <GL/GLContextData.h>
+#include <GL/Extensions/GLARBOcclusionQuery.h>
+#include <GL/Extensions/GLARBTimerQuery.h>
+
+/***************************************
+Methods of class PassProfiler::DataItem:
+***************************************/
+
+PassProfiler::DataItem::DataItem(void)
+	:haveTimerQuery(GLARBOcclusionQuery::isSupported()&&GLARBTimerQuery::isSupported()),
+	 currentSlot(0)
+	{
+	/* Initialize the required extensions: */
+	if(haveTimerQuery)
+		{
+		GLARBOcclusionQuery::initExtension();
+		GLARBTimerQuery::initExtension();
+		}
+	
+	for(unsigned int i=0;i<numFrameSlots;++i)
+		{
+		frameSlots[i].numIntervals=0;
+		frameSlots[i].lastQueryIndex=0;
+		}
+	}
+
+PassProfiler::DataItem::~DataItem(void)
+	{
+	/* Delete all query objects: */
+	for(unsigned int i=0;i<numFrameSlots;++i)
+		if(!frameSlots[i].queryObjects.empty())
+			glDeleteQueriesARB(GLsizei(frameSlots[i].queryObjects.size()),&frameSlots[i].queryObjects.front());
+	}
+
+/*****************************
+Methods of class PassProfiler:
+*****************************/
+
+void PassProfiler::collectFrame(PassProfiler::FrameSlot& slot) const
+	{
+	/* Accumulate the GPU time and number of invocations of each pass: */
+	GLuint64 passTimes[NUM_PASSES];
+	unsigned int passCalls[NUM_PASSES];
+	for(int i=0;i<NUM_PASSES;++i)
+		{
+		passTimes[i]=0;
+		passCalls[i]=0;
+		}
+	for(unsigned int i=0;i<slot.numIntervals;++i)
+		{
+		GLuint64 timestamps[2];
+		for(int j=0;j<2;++j)
+			glGetQueryObjectui64v(slot.queryObjects[i*2+j],GL_QUERY_RESULT_ARB,&timestamps[j]);
+		if(timestamps[1]>timestamps[0])
+			passTimes[slot.passes[i]]+=timestamps[1]-timestamps[0];
+		++passCalls[slot.passes[i]];
+		}
+	
+	/* Add the frame's results to the rolling windows of all passes that ran during the frame: */
+	Threads::Mutex::Lock windowLock(windowMutex);
+	for(int i=0;i<NUM_PASSES;++i)
+		if(passCalls[i]!=0)
+			{
+			PassWindow& w=windows[i];
+			w.times[w.next]=float(double(passTimes[i])*1.0e-6);
+			w.calls[w.next]=passCalls[i];
+			w.next=(w.next+1)%windowSize;
+			if(w.numSamples<windowSize)
+				++w.numSamples;
+			}
+	++numFrames;
+	}
+
+PassProfiler::PassProfiler(void)
+	:numFrames(0),numDroppedFrames(0)
+	{
+	for(int i=0;i<NUM_PASSES;++i)
+		{
+		windows[i].numSamples=0;
+		windows[i].next=0;
+		}
+	}
+
+void PassProfiler::initContext(GLContextData& contextData) const
+	{
+	/* Create a data item and add it to the context: */
+	DataItem* dataItem=new DataItem;
+	contextData.addDataItem(this,dataItem);
+	
+	if(!dataItem->haveTimerQuery)
+		std::cerr<<"PassProfiler: OpenGL context does not support timestamp queries; GPU pass profiling is disabled"<<std::endl;
+	}
+
+const char* PassProfiler::getPassName(PassProfiler::Pass pass)
+	{
+	static const char* passNames[NUM_PASSES]=
+		{
+		"Water bathymetry","Water step","Water derivative","Water Euler step","Water Runge-Kutta step",
+		"Water local time step","Water refined patch","Water statistics","Water boundary","Water add",
+		"Surface pixel corners","Surface render","Water render"
+		};
+	return passNames[pass];
+	}
+
+void PassProfiler::begin(PassProfiler::Pass pass,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	if(!dataItem->haveTimerQuery)
+		return;
+	
+	/* Allocate a new interval in the current frame slot, creating query objects if the pool is exhausted: */
+	FrameSlot& slot=dataItem->frameSlots[dataItem->currentSlot];
+	unsigned int interval=slot.numIntervals++;
+	if(slot.queryObjects.size()<size_t(slot.numIntervals)*2)
+		{
+		GLuint newQueryObjects[2];
+		glGenQueriesARB(2,newQueryObjects);
+		for(int i=0;i<2;++i)
+			slot.queryObjects.push_back(newQueryObjects[i]);
+		slot.passes.push_back(pass);
+		}
+	slot.passes[interval]=pass;
+	
+	/* Issue the interval's start timestamp: */
+	glQueryCounter(slot.queryObjects[interval*2+0],GL_TIMESTAMP);
+	slot.lastQueryIndex=interval*2+0;
+	dataItem->openIntervals.push_back(interval);
+	}
+
+void PassProfiler::end(PassProfiler::Pass pass,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	if(!dataItem->haveTimerQuery||dataItem->openIntervals.empty())
+		return;
+	
+	/* Issue the most recently started interval's end timestamp if it belongs to the given pass: */
+	FrameSlot& slot=dataItem->frameSlots[dataItem->currentSlot];
+	unsigned int interval=dataItem->openIntervals.back();
+	if(slot.passes[interval]==pass)
+		{
+		glQueryCounter(slot.queryObjects[interval*2+1],GL_TIMESTAMP);
+		slot.lastQueryIndex=interval*2+1;
+		dataItem->openIntervals.pop_back();
+		}
+	}
+
+void PassProfiler::finishFrame(GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	if(!dataItem->haveTimerQuery)
+		return;
+	
+	/* Discard the current frame if it left unbalanced intervals: */
+	if(!dataItem->openIntervals.empty())
+		{
+		dataItem->frameSlots[dataItem->currentSlot].numIntervals=0;
+		dataItem->openIntervals.clear();
+		}
+	
+	/* Advance to the oldest frame slot: */
+	dataItem->currentSlot=(dataItem->currentSlot+1)%numFrameSlots;
+	FrameSlot& slot=dataItem->frameSlots[dataItem->currentSlot];
+	if(slot.numIntervals!=0)
+		{
+		/* Collect the oldest frame if its last issued timestamp has arrived, which with nested intervals is not necessarily the last interval's end; never wait for the GPU: */
+		GLint available=0;
+		glGetQueryObjectivARB(slot.queryObjects[slot.lastQueryIndex],GL_QUERY_RESULT_AVAILABLE_ARB,&available);
+		if(available)
+			collectFrame(slot);
+		else
+			{
+			Threads::Mutex::Lock windowLock(windowMutex);
+			++numDroppedFrames;
+			}
+		
+		/* Reuse the frame slot for the next frame: */
+		slot.numIntervals=0;
+		}
+	}
+
+PassProfiler::Statistics PassProfiler::getStatistics(PassProfiler::Pass pass) const
+	{
+	Statistics result;
+	result.numSamples=0;
+	result.mean=result.median=result.p95=result.max=0.0;
+	result.callsPerFrame=0.0;
+	for(unsigned int i=0;i<numHistogramBins;++i)
+		result.histogram[i]=0;
+	
+	/* Copy the pass's rolling window: */
+	std::vector<float> times;
+	unsigned int totalCalls=0;
+	{
+	Threads::Mutex::Lock windowLock(windowMutex);
+	const PassWindow& w=windows[pass];
+	times.insert(times.end(),w.times,w.times+w.numSamples);
+	for(unsigned int i=0;i<w.numSamples;++i)
+		totalCalls+=w.calls[i];
+	}
+	if(times.empty())
+		return result;
+	
+	/* Calculate the mean and the logarithmic histogram: */
+	result.numSamples=(unsigned int)(times.size());
+	double sum=0.0;
+	for(std::vector<float>::iterator tIt=times.begin();tIt!=times.end();++tIt)
+		{
+		sum+=double(*tIt);
+		int bin=0;
+		if(*tIt>=1.0f/64.0f)
+			{
+			bin=int(Math::floor(Math::log(double(*tIt))/Math::log(2.0)))+7;
+			if(bin>=int(numHistogramBins))
+				bin=int(numHistogramBins)-1;
+			}
+		++result.histogram[bin];
+		}
+	result.mean=sum/double(result.numSamples);
+	result.callsPerFrame=double(totalCalls)/double(result.numSamples);
+	
+	/* Calculate the order statistics: */
+	std::sort(times.begin(),times.end());
+	result.median=double(times[times.size()/2]);
+	result.p95=double(times[std::min(times.size()-1,(times.size()*95)/100)]);
+	result.max=double(times.back());
+	
+	return result;
+	}
+
+unsigned int PassProfiler::getNumFrames(void) const
+	{
+	Threads::Mutex::Lock windowLock(windowMutex);
+	return numFrames;
+	}
+
+unsigned int PassProfiler::getNumDroppedFrames(void) const
+	{
+	Threads::Mutex::Lock windowLock(windowMutex);
+	return numDroppedFrames;
+	}
+
+void PassProfiler::printReport(std::ostream& os) const
+	{
+	os<<"GPU pass profile over "<<getNumFrames()<<" frames ("<<getNumDroppedFrames()<<" dropped), times in ms per frame:"<<std::endl;
+	std::ios::fmtflags oldFlags=os.flags();
+	std::streamsize oldPrecision=os.precision();
+	os<<std::fixed<<std::setprecision(3);
+	for(int i=0;i<NUM_PASSES;++i)
+		{
+		Statistics stats=getStatistics(Pass(i));
+		if(stats.numSamples==0)
+			continue;
+		
+		/* Print the pass's statistics: */
+		os<<std::setw(24)<<std::left<<getPassName(Pass(i))<<std::right;
+		os<<" frames "<<std::setw(3)<<stats.numSamples;
+		os<<", calls "<<std::setw(7)<<stats.callsPerFrame;
+		os<<", mean "<<std::setw(8)<<stats.mean;
+		os<<", median "<<std::setw(8)<<stats.median;
+		os<<", p95 "<<std::setw(8)<<stats.p95;
+		os<<", max "<<std::setw(8)<<stats.max<<std::endl;
+		
+		/* Print the pass's histogram from below 1/64 ms to 64 ms and above: */
+		os<<std::setw(24)<<""<<" histogram";
+		for(unsigned int bin=0;bin<numHistogramBins;++bin)
+			os<<' '<<stats.histogram[bin];
+		os<<std::endl;
+		}
+	os.flags(oldFlags);
+	os.precision(oldPrecision);
+	}
+
+void PassProfiler::reset(void)
+	{
+	Threads::Mutex::Lock windowLock(windowMutex);
+	for(int i=0;i<NUM_PASSES;++i)
+		{
+		windows[i].numSamples=0;
+		windows[i].next=0;
+		}
+	numFrames=0;
+	numDroppedFrames=0;
+	}
@@ -0,0 +1,156 @@
+/***********************************************************************
+PassProfiler - Class to measure the GPU time spent in the individual
+rendering and simulation passes of the Augmented Reality Sandbox using
+timer queries, without stalling the OpenGL pipeline.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef PASSPROFILER_INCLUDED
+#define PASSPROFILER_INCLUDED
+
+#include <vector>
+#include <iosfwd>
+#include <Threads/Mutex.h>
+#include <GL/gl.h>
+#include <GL/GLObject.h>
+
+class PassProfiler:public GLObject
+	{
+	/* Embedded classes: */
+	public:
+	enum Pass // Enumerated type for the profiled passes
+		{
+		WATER_BATHYMETRY=0, // Updating the water table's bathymetry grid from the depth image
+		WATER_STEP, // One complete water simulation step
+		WATER_DERIVATIVE, // Calculating the temporal derivative and maximum step size
+		WATER_EULER_STEP, // Tentative Euler integration step
+		WATER_RUNGE_KUTTA_STEP, // Final Runge-Kutta integration step
+		WATER_LOCAL_TIME_STEP, // Integration step with local time stepping
+		WATER_PATCH, // Prolongation, integration, and coupling of the refined patch
+		WATER_STATISTICS, // Gathering water flow statistics
+		WATER_BOUNDARY, // Enforcing the dry boundary condition
+		WATER_ADD, // Adding and removing water
+		SURFACE_PIXEL_CORNERS, // Rendering pixel-corner elevations for topographic contour lines
+		SURFACE_RENDER, // Rendering the sand surface in a single pass
+		WATER_RENDER, // Rendering the water surface
+		NUM_PASSES
+		};
+	
+	static const unsigned int numHistogramBins=14; // Number of logarithmic histogram bins, from below 1/64 ms to 64 ms and above
+	
+	struct Statistics // Structure describing the distribution of a pass's per-frame GPU time
+		{
+		/* Elements: */
+		public:
+		unsigned int numSamples; // Number of frames in which the pass ran during the rolling window
+		double mean,median,p95,max; // Mean, median, 95th percentile, and maximum GPU time per frame in milliseconds
+		double callsPerFrame; // Average number of times the pass ran per frame
+		unsigned int histogram[numHistogramBins]; // Number of frames per logarithmic time bin; bin 0 holds times below 1/64 ms, bin i covers [2^(i-7), 2^(i-6)) ms, and the last bin holds times of 64 ms and above
+		};
+	
+	class Timer // Class to time a pass for the lifetime of a timer object
+		{
+		/* Elements: */
+		private:
+		const PassProfiler* profiler; // Profiler timing the pass; NULL if profiling is disabled
+		Pass pass; // The timed pass
+		GLContextData& contextData; // OpenGL context in which the pass is timed
+		
+		/* Constructors and destructors: */
+		public:
+		Timer(const PassProfiler* sProfiler,Pass sPass,GLContextData& sContextData) // Starts timing the given pass if the given profiler is not NULL
+			:profiler(sProfiler),pass(sPass),contextData(sContextData)
+			{
+			if(profiler!=0)
+				profiler->begin(pass,contextData);
+			}
+		~Timer(void) // Stops timing the pass
+			{
+			if(profiler!=0)
+				profiler->end(pass,contextData);
+			}
+		};
+	
+	private:
+	static const unsigned int numFrameSlots=3; // Number of frames whose timer queries can be in flight at the same time
+	static const unsigned int windowSize=256; // Number of frames kept in each pass's rolling window
+	
+	struct FrameSlot // Structure holding the timer queries issued during one frame
+		{
+		/* Elements: */
+		public:
+		std::vector<GLuint> queryObjects; // Pool of timestamp query objects, two per timed pass invocation
+		std::vector<int> passes; // Pass timed by each pair of query objects
+		unsigned int numIntervals; // Number of timed pass invocations issued during the frame
+		unsigned int lastQueryIndex; // Index of the query object issued last during the frame, which completes after all others
+		};
+	
+	struct DataItem:public GLObject::DataItem
+		{
+		/* Elements: */
+		public:
+		bool haveTimerQuery; // Flag whether the OpenGL context supports timestamp queries
+		FrameSlot frameSlots[numFrameSlots]; // Ring of frames whose timer queries are issued or pending
+		unsigned int currentSlot; // Index of the frame slot receiving the current frame's queries
+		std::vector<unsigned int> openIntervals; // Stack of timed pass invocations that have been started but not yet stopped
+		
+		/* Constructors and destructors: */
+		DataItem(void);
+		virtual ~DataItem(void);
+		};
+	
+	struct PassWindow // Structure holding the rolling window of a pass's per-frame GPU times
+		{
+		/* Elements: */
+		public:
+		float times[windowSize]; // Ring buffer of per-frame GPU times in milliseconds
+		unsigned int calls[windowSize]; // Ring buffer of per-frame pass invocation counts
+		unsigned int numSamples; // Number of valid entries in the ring buffers
+		unsigned int next; // Index of the next ring buffer entry to be written
+		};
+	
+	/* Elements: */
+	mutable Threads::Mutex windowMutex; // Mutex serializing access to the rolling windows from the rendering and simulation threads
+	mutable PassWindow windows[NUM_PASSES]; // Rolling windows of all passes
+	mutable unsigned int numFrames; // Number of frames whose timer queries have been collected
+	mutable unsigned int numDroppedFrames; // Number of frames whose timer queries were discarded because their results were not yet available
+	
+	/* Private methods: */
+	void collectFrame(FrameSlot& slot) const; // Reads back the given frame slot's timer queries and adds the per-pass results to the rolling windows
+	
+	/* Constructors and destructors: */
+	public:
+	PassProfiler(void); // Creates a profiler with empty rolling windows
+	
+	/* Methods from GLObject: */
+	virtual void initContext(GLContextData& contextData) const;
+	
+	/* New methods: */
+	static const char* getPassName(Pass pass); // Returns a short name for the given pass
+	void begin(Pass pass,GLContextData& contextData) const; // Starts timing the given pass in the given OpenGL context; pass timings can be nested
+	void end(Pass pass,GLContextData& contextData) const; // Stops timing the most recently started pass, which must be the given pass
+	void finishFrame(GLContextData& contextData) const; // Ends the current frame in the given OpenGL context and collects the results of an older frame if they are available
+	Statistics getStatistics(Pass pass) const; // Returns the distribution of the given pass's per-frame GPU time over the rolling window
+	unsigned int getNumFrames(void) const; // Returns the number of frames collected so far
+	unsigned int getNumDroppedFrames(void) const; // Returns the number of frames discarded so far
+	void printReport(std::ostream& os) const; // Prints statistics and histograms of all passes to the given stream
+	void reset(void); // Clears all rolling windows
+	};
+
+#endif
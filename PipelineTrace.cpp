@@ -0,0 +1,205 @@
+/***********************************************************************
+PipelineTrace - Class to record timed events from the threads of the
+Augmented Reality Sandbox's frame processing pipeline into per-thread
+ring buffers, and to export them as a Chrome trace.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "PipelineTrace.h"
+
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <Misc/ThrowStdErr.h>
+
+namespace {
+
+/****************************
+Helper classes and functions:
+****************************/
+
+struct TracedEvent // Structure for an event copied out of a ring buffer, tagged with its thread
+	{
+	/* Elements: */
+	public:
+	PipelineTrace::Event event; // The event
+	unsigned int threadId; // ID of the thread that recorded the event
+	
+	/* Methods: */
+	bool operator<(const TracedEvent& other) const // Orders events by frame ID and begin time
+		{
+		if(event.frameId!=other.event.frameId)
+			return event.frameId<other.event.frameId;
+		return event.beginTime<other.event.beginTime;
+		}
+	};
+
+void writeString(std::ostream& os,const char* string) // Writes a string as a quoted JSON string
+	{
+	os<<'"';
+	for(const char* sPtr=string;*sPtr!='\0';++sPtr)
+		{
+		if(*sPtr=='"'||*sPtr=='\\')
+			os<<'\\';
+		os<<*sPtr;
+		}
+	os<<'"';
+	}
+
+}
+
+/************************************
+Methods of class PipelineTrace::Ring:
+************************************/
+
+PipelineTrace::Ring::Ring(const PipelineTrace& sTrace,const char* sThreadName,unsigned int sThreadId,unsigned int sCapacity)
+	:trace(sTrace),threadName(sThreadName),threadId(sThreadId),
+	 capacity(sCapacity),events(new Event[capacity]),
+	 numEvents(0)
+	{
+	}
+
+PipelineTrace::Ring::~Ring(void)
+	{
+	delete[] events;
+	}
+
+/******************************
+Methods of class PipelineTrace:
+******************************/
+
+PipelineTrace::PipelineTrace(unsigned int sRingCapacity)
+	:ringCapacity(sRingCapacity>0?sRingCapacity:1U),startTime(0)
+	{
+	/* Start the trace's clock: */
+	startTime=getTime();
+	}
+
+PipelineTrace::~PipelineTrace(void)
+	{
+	/* Delete all ring buffers: */
+	for(std::vector<Ring*>::iterator rIt=rings.begin();rIt!=rings.end();++rIt)
+		delete *rIt;
+	}
+
+Misc::UInt64 PipelineTrace::getTime(void) const
+	{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return Misc::UInt64(now.tv_sec)*1000000U+Misc::UInt64(now.tv_nsec/1000)-startTime;
+	}
+
+PipelineTrace::Ring* PipelineTrace::createRing(const char* threadName)
+	{
+	Threads::Mutex::Lock ringsLock(ringsMutex);
+	Ring* result=new Ring(*this,threadName,(unsigned int)(rings.size())+1U,ringCapacity);
+	rings.push_back(result);
+	return result;
+	}
+
+void PipelineTrace::writeChromeTrace(const char* fileName) const
+	{
+	/* Copy the most recent events out of all ring buffers without blocking the recording threads: */
+	std::vector<TracedEvent> events;
+	std::vector<std::pair<unsigned int,std::string> > threadNames;
+	{
+	Threads::Mutex::Lock ringsLock(ringsMutex);
+	for(std::vector<Ring*>::const_iterator rIt=rings.begin();rIt!=rings.end();++rIt)
+		{
+		const Ring& r=**rIt;
+		threadNames.push_back(std::make_pair(r.threadId,r.threadName));
+		
+		/* Copy all events that are currently in the ring buffer: */
+		unsigned int end=r.numEvents;
+		__sync_synchronize();
+		unsigned int begin=end>r.capacity?end-r.capacity:0U;
+		size_t firstCopied=events.size();
+		for(unsigned int i=begin;i!=end;++i)
+			{
+			TracedEvent te;
+			te.event=r.events[i%r.capacity];
+			te.threadId=r.threadId;
+			events.push_back(te);
+			}
+		
+		/* Discard copied events that the recording thread overwrote or started overwriting in the meantime: */
+		__sync_synchronize();
+		unsigned int newEnd=r.numEvents;
+		if(newEnd-begin>=r.capacity)
+			{
+			unsigned int numOverwritten=std::min(newEnd-begin-r.capacity+1U,end-begin);
+			events.erase(events.begin()+firstCopied,events.begin()+(firstCopied+numOverwritten));
+			}
+		}
+	}
+	
+	/* Sort the events by frame ID and time to connect the stages that processed the same frame: */
+	std::sort(events.begin(),events.end());
+	
+	/* Open the trace file: */
+	std::ofstream file(fileName);
+	if(!file)
+		Misc::throwStdErr("PipelineTrace::writeChromeTrace: Unable to open trace file %s",fileName);
+	file<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":["<<std::endl;
+	
+	/* Write the thread names: */
+	bool first=true;
+	for(std::vector<std::pair<unsigned int,std::string> >::iterator tnIt=threadNames.begin();tnIt!=threadNames.end();++tnIt)
+		{
+		if(!first)
+			file<<','<<std::endl;
+		file<<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"<<tnIt->first<<",\"args\":{\"name\":";
+		writeString(file,tnIt->second.c_str());
+		file<<"}}";
+		first=false;
+		}
+	
+	/* Write all events as complete events, and link the events of each frame by a flow: */
+	for(std::vector<TracedEvent>::iterator eIt=events.begin();eIt!=events.end();++eIt)
+		{
+		const Event& e=eIt->event;
+		if(!first)
+			file<<','<<std::endl;
+		file<<"{\"name\":";
+		writeString(file,e.name);
+		file<<",\"cat\":\"pipeline\",\"ph\":\"X\",\"pid\":1,\"tid\":"<<eIt->threadId;
+		file<<",\"ts\":"<<e.beginTime<<",\"dur\":"<<(e.endTime>e.beginTime?e.endTime-e.beginTime:0U);
+		if(e.frameId!=0)
+			{
+			file<<",\"args\":{\"frame\":"<<e.frameId<<"}}";
+			
+			/* Write a flow step binding to the event: */
+			bool firstInFrame=eIt==events.begin()||eIt[-1].event.frameId!=e.frameId;
+			bool lastInFrame=eIt+1==events.end()||eIt[1].event.frameId!=e.frameId;
+			if(!(firstInFrame&&lastInFrame))
+				{
+				file<<','<<std::endl;
+				file<<"{\"name\":\"frame\",\"cat\":\"pipeline\",\"ph\":\""<<(firstInFrame?'s':lastInFrame?'f':'t')<<"\",\"bp\":\"e\"";
+				file<<",\"id\":"<<e.frameId<<",\"pid\":1,\"tid\":"<<eIt->threadId<<",\"ts\":"<<e.beginTime<<'}';
+				}
+			}
+		else
+			file<<'}';
+		first=false;
+		}
+	
+	file<<std::endl<<"]}"<<std::endl;
+	if(!file)
+		Misc::throwStdErr("PipelineTrace::writeChromeTrace: Error while writing trace file %s",fileName);
+	}
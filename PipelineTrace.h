@@ -0,0 +1,136 @@
+/***********************************************************************
+PipelineTrace - Class to record timed events from the threads of the
+Augmented Reality Sandbox's frame processing pipeline into per-thread
+ring buffers, and to export them as a Chrome trace.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef PIPELINETRACE_INCLUDED
+#define PIPELINETRACE_INCLUDED
+
+#include <string>
+#include <vector>
+#include <Misc/SizedTypes.h>
+#include <Threads/Mutex.h>
+
+class PipelineTrace
+	{
+	/* Embedded classes: */
+	public:
+	struct Event // Structure for a timed event
+		{
+		/* Elements: */
+		public:
+		const char* name; // Name of the event; must be a string literal
+		Misc::UInt64 frameId; // ID of the depth frame processed during the event, or 0
+		Misc::UInt64 beginTime,endTime; // Begin and end time of the event in microseconds since the trace was created
+		};
+	
+	class Ring // Class for a ring buffer of events written by a single thread
+		{
+		friend class PipelineTrace;
+		
+		/* Elements: */
+		private:
+		const PipelineTrace& trace; // Trace owning the ring buffer
+		std::string threadName; // Name of the thread writing to the ring buffer
+		unsigned int threadId; // Trace-wide ID of the thread
+		unsigned int capacity; // Number of events held in the ring buffer
+		Event* events; // Ring buffer of events
+		volatile unsigned int numEvents; // Total number of events written to the ring buffer
+		
+		/* Constructors and destructors: */
+		Ring(const PipelineTrace& sTrace,const char* sThreadName,unsigned int sThreadId,unsigned int sCapacity);
+		~Ring(void);
+		
+		/* Methods: */
+		public:
+		const std::string& getThreadName(void) const // Returns the name of the ring's thread
+			{
+			return threadName;
+			}
+		Misc::UInt64 getTime(void) const // Returns the current time of the ring's trace
+			{
+			return trace.getTime();
+			}
+		void record(const char* name,Misc::UInt64 frameId,Misc::UInt64 beginTime,Misc::UInt64 endTime) // Records an event; must only be called by the ring's thread
+			{
+			/* Write the event into the next slot, then publish it: */
+			Event& e=events[numEvents%capacity];
+			e.name=name;
+			e.frameId=frameId;
+			e.beginTime=beginTime;
+			e.endTime=endTime;
+			__sync_synchronize();
+			numEvents=numEvents+1;
+			}
+		};
+	
+	class Scope // Class to record an event covering the lifetime of a scope object
+		{
+		/* Elements: */
+		private:
+		Ring* ring; // Ring buffer receiving the event, or null if tracing is disabled
+		const char* name; // Name of the event
+		Misc::UInt64 frameId; // ID of the depth frame processed during the event, or 0
+		Misc::UInt64 beginTime; // Time at which the scope was entered
+		
+		/* Constructors and destructors: */
+		public:
+		Scope(Ring* sRing,const char* sName,Misc::UInt64 sFrameId =0) // Starts an event in the given ring buffer, if it is not null
+			:ring(sRing),name(sName),frameId(sFrameId),
+			 beginTime(ring!=0?ring->getTime():0)
+			{
+			}
+		~Scope(void) // Records the event
+			{
+			if(ring!=0)
+				ring->record(name,frameId,beginTime,ring->getTime());
+			}
+		
+		/* Methods: */
+		void setFrameId(Misc::UInt64 newFrameId) // Sets the ID of the depth frame processed during the event once it is known
+			{
+			frameId=newFrameId;
+			}
+		};
+	
+	/* Elements: */
+	private:
+	unsigned int ringCapacity; // Number of events held in each thread's ring buffer
+	Misc::UInt64 startTime; // Monotonic clock time at which the trace was created in microseconds
+	mutable Threads::Mutex ringsMutex; // Mutex protecting the list of ring buffers
+	std::vector<Ring*> rings; // List of ring buffers of all traced threads
+	
+	/* Constructors and destructors: */
+	public:
+	PipelineTrace(unsigned int sRingCapacity); // Creates an empty trace holding the given number of most recent events per thread
+	~PipelineTrace(void); // Destroys the trace and all its ring buffers
+	
+	/* Methods: */
+	static Misc::UInt64 getFrameId(double timeStamp) // Returns the trace ID of the depth frame with the given time stamp
+		{
+		return Misc::UInt64(timeStamp*1.0e6+0.5)+1U;
+		}
+	Misc::UInt64 getTime(void) const; // Returns the current time in microseconds since the trace was created
+	Ring* createRing(const char* threadName); // Creates a ring buffer for a thread of the given name
+	void writeChromeTrace(const char* fileName) const; // Writes the most recent events of all threads to a Chrome trace event file of the given name; can be called while threads are recording; throws exception if the file cannot be written
+	};
+
+#endif
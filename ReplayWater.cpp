@@ -0,0 +1,338 @@
+/***********************************************************************
+ReplayWater - Utility to replay a recording of the inputs that drove a
+water flow simulation in the Augmented Reality Sandbox without a 3D
+camera or display, to compare the cost and results of solver variants
+on identical scenes.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <Misc/SizedTypes.h>
+#include <Misc/Timer.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
+#include <IO/OStream.h>
+#include <Math/Math.h>
+#include <GL/gl.h>
+#include <GL/Extensions/GLARBTextureRectangle.h>
+#include <GL/GLContextData.h>
+
+#include "OffscreenGLContext.h"
+#include "WaterTable2.h"
+#include "WaterStateFile.h"
+#include "WaterRecording.h"
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+Misc::UInt64 calcChecksum(const GLfloat* grid,size_t numValues)
+	{
+	/* Calculate the 64-bit FNV-1a hash of the grid's bytes: */
+	Misc::UInt64 result=14695981039346656037ULL;
+	const unsigned char* gPtr=reinterpret_cast<const unsigned char*>(grid);
+	const unsigned char* gEnd=gPtr+numValues*sizeof(GLfloat);
+	for(;gPtr!=gEnd;++gPtr)
+		{
+		result^=Misc::UInt64(*gPtr);
+		result*=1099511628211ULL;
+		}
+	return result;
+	}
+
+void printUsage(void)
+	{
+	std::cout<<"Usage: ReplayWater [option 1] ... [option n] <water recording file name>"<<std::endl;
+	std::cout<<"  Options:"<<std::endl;
+	std::cout<<"  -h"<<std::endl;
+	std::cout<<"     Prints this help message"<<std::endl;
+	std::cout<<"  -ft <simulation time per frame>"<<std::endl;
+	std::cout<<"     Advances the simulation by the given fixed simulation time in"<<std::endl;
+	std::cout<<"     seconds in every frame, instead of by the recorded frame times"<<std::endl;
+	std::cout<<"     Default: recorded frame times"<<std::endl;
+	std::cout<<"  -nf <number of frames>"<<std::endl;
+	std::cout<<"     Replays at most the given number of frames"<<std::endl;
+	std::cout<<"     Default: all recorded frames"<<std::endl;
+	std::cout<<"  -tf <timing file name>"<<std::endl;
+	std::cout<<"     Writes the number of simulation steps and the wall-clock time of"<<std::endl;
+	std::cout<<"     each replayed frame to the given file in CSV format"<<std::endl;
+	std::cout<<"     Default: no timing file"<<std::endl;
+	std::cout<<"  -sws <water state file name>"<<std::endl;
+	std::cout<<"     Saves the bathymetry and water state at the end of the replay to"<<std::endl;
+	std::cout<<"     the water state file of the given name"<<std::endl;
+	std::cout<<"     Default: none"<<std::endl;
+	std::cout<<"  -whp"<<std::endl;
+	std::cout<<"     Stores the water simulation's temporal derivative and intermediate"<<std::endl;
+	std::cout<<"     quantity grids in half precision"<<std::endl;
+	std::cout<<"     Default: as recorded"<<std::endl;
+	std::cout<<"  -wfp"<<std::endl;
+	std::cout<<"     Stores all water simulation grids in full precision"<<std::endl;
+	std::cout<<"     Default: as recorded"<<std::endl;
+	std::cout<<"  -wfs"<<std::endl;
+	std::cout<<"     Runs the water simulation's temporal derivative calculations inside"<<std::endl;
+	std::cout<<"     the integration step passes"<<std::endl;
+	std::cout<<"     Default: as recorded"<<std::endl;
+	std::cout<<"  -wmp"<<std::endl;
+	std::cout<<"     Runs the water simulation's temporal derivative calculations in"<<std::endl;
+	std::cout<<"     separate passes"<<std::endl;
+	std::cout<<"     Default: as recorded"<<std::endl;
+	std::cout<<"  -wlt <max levels>"<<std::endl;
+	std::cout<<"     Lets tiles of the water grid halve the simulation step size up to"<<std::endl;
+	std::cout<<"     the given number of times to satisfy their own stability limits"<<std::endl;
+	std::cout<<"     Default: as recorded"<<std::endl;
+	std::cout<<"  -display <X display name>"<<std::endl;
+	std::cout<<"     Selects the X server on which to create the OpenGL context"<<std::endl;
+	std::cout<<"     Default: DISPLAY environment variable"<<std::endl;
+	}
+
+}
+
+int main(int argc,char* argv[])
+	{
+	/* Process command line parameters: */
+	const char* recordingFileName=0;
+	GLfloat fixedTimeBudget=0.0f;
+	unsigned int maxNumFrames=~0U;
+	const char* timingFileName=0;
+	const char* saveStateFileName=0;
+	int halfPrecision=-1; // -1: as recorded
+	int fusedSteps=-1; // -1: as recorded
+	int localTimeSteppingLevels=-1; // -1: as recorded
+	const char* displayName=0;
+	for(int i=1;i<argc;++i)
+		{
+		if(argv[i][0]=='-')
+			{
+			if(strcasecmp(argv[i]+1,"h")==0)
+				{
+				printUsage();
+				return 0;
+				}
+			else if(strcasecmp(argv[i]+1,"ft")==0&&i+1<argc)
+				{
+				++i;
+				fixedTimeBudget=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"nf")==0&&i+1<argc)
+				{
+				++i;
+				maxNumFrames=(unsigned int)(atoi(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"tf")==0&&i+1<argc)
+				{
+				++i;
+				timingFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"sws")==0&&i+1<argc)
+				{
+				++i;
+				saveStateFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"whp")==0)
+				halfPrecision=1;
+			else if(strcasecmp(argv[i]+1,"wfp")==0)
+				halfPrecision=0;
+			else if(strcasecmp(argv[i]+1,"wfs")==0)
+				fusedSteps=1;
+			else if(strcasecmp(argv[i]+1,"wmp")==0)
+				fusedSteps=0;
+			else if(strcasecmp(argv[i]+1,"wlt")==0&&i+1<argc)
+				{
+				++i;
+				localTimeSteppingLevels=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"display")==0&&i+1<argc)
+				{
+				++i;
+				displayName=argv[i];
+				}
+			else
+				std::cerr<<"Ignoring unrecognized command line option "<<argv[i]<<std::endl;
+			}
+		else if(recordingFileName==0)
+			recordingFileName=argv[i];
+		else
+			std::cerr<<"Ignoring extra command line argument "<<argv[i]<<std::endl;
+		}
+	if(recordingFileName==0)
+		{
+		printUsage();
+		return 1;
+		}
+	
+	try
+		{
+		/* Open the recording: */
+		WaterRecording recording(recordingFileName);
+		const GLsizei* size=recording.getSize();
+		
+		/* Create an OpenGL context to run the simulation: */
+		OffscreenGLContext context(displayName);
+		context.makeCurrent();
+		GLContextData& contextData=context.getContextData();
+		
+		/* Create an offline water table with the recorded layout, and the recorded settings unless overridden: */
+		WaterTable2 waterTable(size[0],size[1],recording.getCellSize());
+		waterTable.setElevationRange(recording.getElevationRange()[0],recording.getElevationRange()[1]);
+		waterTable.setHalfPrecision(halfPrecision>=0?halfPrecision!=0:recording.getHalfPrecision());
+		waterTable.setFusedSteps(fusedSteps>=0?fusedSteps!=0:recording.getFusedSteps());
+		waterTable.setLocalTimeSteppingLevels(localTimeSteppingLevels>=0?(unsigned int)(localTimeSteppingLevels):recording.getLocalTimeSteppingLevels());
+		waterTable.initContext(contextData);
+		
+		/* Start from the recorded initial state: */
+		waterTable.restoreState(recording.getBathymetry(),recording.getQuantity(),contextData);
+		
+		/* Open the optional timing file: */
+		IO::OStream* timingFile=0;
+		if(timingFileName!=0)
+			{
+			timingFile=new IO::OStream(IO::openFile(timingFileName,IO::File::WriteOnly));
+			*timingFile<<"Frame,Recorded frame time (ms),Simulation time,Steps,Bathymetry update,Water sources,Wall time (ms)"<<std::endl;
+			}
+		
+		/* Replay all recorded frames: */
+		std::cout<<"Replaying "<<recordingFileName<<" on a "<<size[0]<<" x "<<size[1]<<" grid"<<std::endl;
+		WaterRecording::Frame frame;
+		std::vector<double> frameWallTimes;
+		double simulationTime=0.0;
+		unsigned int numSteps=0;
+		unsigned int numBathymetryUpdates=0;
+		unsigned int numOutOfTimeFrames=0;
+		glFinish();
+		Misc::Timer timer;
+		while(frameWallTimes.size()<maxNumFrames&&recording.readFrame(frame))
+			{
+			/* Don't count reading the frame or writing the timing file against the frame's cost: */
+			timer.elapse();
+			
+			/* Apply the frame's simulation parameters and water sources exactly as recorded: */
+			waterTable.setAttenuation(frame.attenuation);
+			waterTable.setWaterDeposit(frame.waterDeposit);
+			waterTable.setDryBoundary(frame.dryBoundary);
+			for(std::vector<WaterRecording::WaterSource>::const_iterator wsIt=frame.waterSources.begin();wsIt!=frame.waterSources.end();++wsIt)
+				waterTable.addWaterSource(Point(wsIt->center[0],wsIt->center[1],wsIt->center[2]),Scalar(wsIt->radius),wsIt->rate);
+			waterTable.postWaterSources();
+			
+			/* Update the bathymetry grid if it changed in the recorded frame: */
+			if(frame.bathymetryChanged)
+				{
+				waterTable.updateBathymetry(&frame.bathymetry.front(),contextData);
+				++numBathymetryUpdates;
+				}
+			
+			/* Run the frame's simulation steps in the same way as the Augmented Reality Sandbox: */
+			GLfloat totalTimeStep=fixedTimeBudget>0.0f?fixedTimeBudget:frame.timeBudget;
+			GLfloat frameTimeStep=totalTimeStep;
+			unsigned int frameNumSteps=0;
+			while(frameNumSteps<frame.maxNumSteps&&totalTimeStep>1.0e-8f)
+				{
+				waterTable.setMaxStepSize(totalTimeStep);
+				GLfloat timeStep=waterTable.runSimulationStep(false,contextData);
+				totalTimeStep-=timeStep;
+				++frameNumSteps;
+				}
+			if(totalTimeStep>1.0e-8f)
+				{
+				if(frame.forceFinalStep)
+					{
+					/* Force the final step to avoid simulation slow-down: */
+					waterTable.setMaxStepSize(totalTimeStep);
+					GLfloat timeStep=waterTable.runSimulationStep(true,contextData);
+					totalTimeStep-=timeStep;
+					++frameNumSteps;
+					}
+				else
+					++numOutOfTimeFrames;
+				}
+			simulationTime+=double(frameTimeStep-totalTimeStep);
+			numSteps+=frameNumSteps;
+			
+			/* Wait for the frame to finish on the GPU and log its cost: */
+			glFinish();
+			timer.elapse();
+			frameWallTimes.push_back(timer.getTime());
+			if(timingFile!=0)
+				*timingFile<<frameWallTimes.size()<<','<<frame.frameTime*1000.0<<','<<simulationTime<<','<<frameNumSteps<<','<<(frame.bathymetryChanged?1:0)<<','<<frame.waterSources.size()<<','<<timer.getTime()*1000.0<<std::endl;
+			
+			}
+		
+		/* Print per-frame cost statistics: */
+		size_t numFrames=frameWallTimes.size();
+		std::cout<<"Replayed "<<numFrames<<" frames with "<<numSteps<<" steps, "<<numBathymetryUpdates<<" bathymetry updates, and "<<simulationTime<<" s simulation time"<<std::endl;
+		if(numOutOfTimeFrames>0)
+			std::cout<<numOutOfTimeFrames<<" frames ran out of simulation steps before covering their simulation time"<<std::endl;
+		if(numFrames>0)
+			{
+			double totalWallTime=0.0;
+			for(std::vector<double>::iterator fwtIt=frameWallTimes.begin();fwtIt!=frameWallTimes.end();++fwtIt)
+				totalWallTime+=*fwtIt;
+			std::sort(frameWallTimes.begin(),frameWallTimes.end());
+			std::cout<<std::setprecision(4);
+			std::cout<<"Frame cost: mean "<<totalWallTime*1000.0/double(numFrames)<<" ms, ";
+			std::cout<<"median "<<frameWallTimes[numFrames/2]*1000.0<<" ms, ";
+			std::cout<<"95th percentile "<<frameWallTimes[(numFrames*95)/100]*1000.0<<" ms, ";
+			std::cout<<"max "<<frameWallTimes.back()*1000.0<<" ms"<<std::endl;
+			if(numSteps>0)
+				std::cout<<"Step cost: mean "<<totalWallTime*1000.0/double(numSteps)<<" ms"<<std::endl;
+			}
+		
+		/* Read back the final bathymetry and conserved quantity grids: */
+		std::vector<GLfloat> finalBathymetry(size_t(size[1]-1)*size_t(size[0]-1));
+		std::vector<GLfloat> finalQuantity(size_t(size[1])*size_t(size[0])*3);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		waterTable.bindBathymetryTexture(contextData);
+		glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,&finalBathymetry.front());
+		waterTable.bindQuantityTexture(contextData);
+		glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB,GL_FLOAT,&finalQuantity.front());
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		
+		/* Print checksums of the final state to compare replays: */
+		std::cout<<std::hex<<std::setfill('0');
+		std::cout<<"Final bathymetry checksum "<<std::setw(16)<<calcChecksum(&finalBathymetry.front(),finalBathymetry.size())<<std::endl;
+		std::cout<<"Final water state checksum "<<std::setw(16)<<calcChecksum(&finalQuantity.front(),finalQuantity.size())<<std::endl;
+		std::cout<<std::dec<<std::setfill(' ');
+		
+		if(saveStateFileName!=0)
+			{
+			/* Save the final state for closer inspection: */
+			WaterStateFile::write(saveStateFileName,waterTable,&finalBathymetry.front(),&finalQuantity.front());
+			}
+		
+		/* Clean up: */
+		delete timingFile;
+		context.release();
+		}
+	catch(const std::runtime_error& err)
+		{
+		std::cerr<<"Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	
+	return 0;
+	}
@@ -32,6 +32,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <vector>
 #include <stdexcept>
 #include <iostream>
+#include <sstream>
+#include <fstream>
 #include <Misc/SizedTypes.h>
 #include <Misc/SelfDestructPointer.h>
 #include <Misc/FixedArray.h>
@@ -55,6 +57,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Geometry/GeometryValueCoders.h>
 #include <Geometry/OutputOperators.h>
 #include <GL/gl.h>
+#include <GL/glx.h>
 #include <GL/GLMaterialTemplates.h>
 #include <GL/GLColorMap.h>
 #include <GL/GLLightTracker.h>
@@ -67,6 +70,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <GL/Extensions/GLARBVertexShader.h>
 #include <GL/Extensions/GLARBFragmentShader.h>
 #include <GL/Extensions/GLARBMultitexture.h>
+#include <GL/Extensions/GLARBOcclusionQuery.h>
+#include <GL/Extensions/GLARBTimerQuery.h>
 #include <GL/GLContextData.h>
 #include <GL/GLGeometryWrappers.h>
 #include <GL/GLTransformationWrappers.h>
@@ -104,7 +109,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "DEM.h"
 #include "SurfaceRenderer.h"
 #include "WaterTable2.h"
+#include "WaterNoise.h"
+#include "WaterSimulationThread.h"
+#include "WaterStateFile.h"
+#include "WaterStateSaver.h"
+#include "WaterRecorder.h"
+#include "PassProfiler.h"
+#include "WaterGovernor.h"
 #include "HandExtractor.h"
+#include "ContourExtractor.h"
 #include "WaterRenderer.h"
 #include "GlobalWaterTool.h"
 #include "LocalWaterTool.h"
@@ -119,7 +132,9 @@ Methods of class Sandbox::DataItem:
 
 Sandbox::DataItem::DataItem(void)
 	:waterTableTime(0.0),
-	 shadowFramebufferObject(0),shadowDepthTextureObject(0)
+	 haveTimerQuery(false),waterTimerQueryPending(false),waterTimerQueryNumSteps(0),waterTimerQueryRanOutOfTime(false),
+	 shadowFramebufferObject(0),shadowDepthTextureObject(0),
+	 displayTraceRing(0)
 	{
 	/* Check if all required extensions are supported: */
 	bool supported=GLEXTFramebufferObject::isSupported();
@@ -144,11 +159,22 @@ Sandbox::DataItem::DataItem(void)
 	GLARBVertexShader::initExtension();
 	GLARBFragmentShader::initExtension();
 	GLARBMultitexture::initExtension();
+	
+	/* Initialize the optional extensions to measure frame and water simulation GPU times: */
+	haveTimerQuery=GLARBOcclusionQuery::isSupported()&&GLARBTimerQuery::isSupported();
+	if(haveTimerQuery)
+		{
+		GLARBOcclusionQuery::initExtension();
+		GLARBTimerQuery::initExtension();
+		glGenQueriesARB(4,waterTimerQueryObjects);
+		}
 	}
 
 Sandbox::DataItem::~DataItem(void)
 	{
 	/* Delete all shaders, buffers, and texture objects: */
+	if(haveTimerQuery)
+		glDeleteQueriesARB(4,waterTimerQueryObjects);
 	glDeleteFramebuffersEXT(1,&shadowFramebufferObject);
 	glDeleteTextures(1,&shadowDepthTextureObject);
 	}
@@ -162,9 +188,9 @@ Sandbox::RenderSettings::RenderSettings(void)
 	 hillshade(false),surfaceMaterial(GLMaterial::Color(1.0f,1.0f,1.0f)),
 	 useShadows(false),
 	 elevationColorMap(0),
-	 useContourLines(true),contourLineSpacing(0.75f),
-	 renderWaterSurface(false),waterOpacity(2.0f),
-	 surfaceRenderer(0),waterRenderer(0)
+	 useContourLines(true),contourLineSpacing(0.75f),contourLineWidth(0.0f),
+	 renderWaterSurface(false),waterOpacity(2.0f),advectWaterTexture(false),
+	 surfaceRenderer(0),waterRenderer(0),contourExtractor(0)
 	{
 	/* Load the default projector transformation: */
 	loadProjectorTransform(CONFIG_DEFAULTPROJECTIONMATRIXFILENAME);
@@ -175,9 +201,9 @@ Sandbox::RenderSettings::RenderSettings(const Sandbox::RenderSettings& source)
 	 hillshade(source.hillshade),surfaceMaterial(source.surfaceMaterial),
 	 useShadows(source.useShadows),
 	 elevationColorMap(source.elevationColorMap!=0?new ElevationColorMap(*source.elevationColorMap):0),
-	 useContourLines(source.useContourLines),contourLineSpacing(source.contourLineSpacing),
-	 renderWaterSurface(source.renderWaterSurface),waterOpacity(source.waterOpacity),
-	 surfaceRenderer(0),waterRenderer(0)
+	 useContourLines(source.useContourLines),contourLineSpacing(source.contourLineSpacing),contourLineWidth(source.contourLineWidth),
+	 renderWaterSurface(source.renderWaterSurface),waterOpacity(source.waterOpacity),advectWaterTexture(source.advectWaterTexture),
+	 surfaceRenderer(0),waterRenderer(0),contourExtractor(0)
 	{
 	}
 
@@ -185,6 +211,7 @@ Sandbox::RenderSettings::~RenderSettings(void)
 	{
 	delete surfaceRenderer;
 	delete waterRenderer;
+	delete contourExtractor;
 	delete elevationColorMap;
 	}
 
@@ -247,6 +274,9 @@ Methods of class Sandbox:
 
 void Sandbox::rawDepthFrameDispatcher(const Kinect::FrameBuffer& frameBuffer)
 	{
+	/* Trace the dispatch of the received frame: */
+	PipelineTrace::Scope dispatchScope(cameraTraceRing,"Dispatch raw frame",PipelineTrace::getFrameId(frameBuffer.timeStamp));
+	
 	/* Pass the received frame to the frame filter and the hand extractor: */
 	if(frameFilter!=0&&!pauseUpdates)
 		frameFilter->receiveRawFrame(frameBuffer);
@@ -283,39 +313,6 @@ void Sandbox::toggleDEM(DEM* dem)
 			rsIt->surfaceRenderer->setDem(activeDem);
 	}
 
-void Sandbox::addWater(GLContextData& contextData) const
-	{
-	/* Check if the most recent rain object list is not empty: */
-	if(handExtractor!=0&&!handExtractor->getLockedExtractedHands().empty())
-		{
-		/* Render all rain objects into the water table: */
-		glPushAttrib(GL_ENABLE_BIT);
-		glDisable(GL_CULL_FACE);
-		
-		/* Create a local coordinate frame to render rain disks: */
-		Vector z=waterTable->getBaseTransform().inverseTransform(Vector(0,0,1));
-		Vector x=Geometry::normal(z);
-		Vector y=Geometry::cross(z,x);
-		x.normalize();
-		y.normalize();
-		
-		glVertexAttrib1fARB(1,rainStrength/waterSpeed);
-		for(HandExtractor::HandList::const_iterator hIt=handExtractor->getLockedExtractedHands().begin();hIt!=handExtractor->getLockedExtractedHands().end();++hIt)
-			{
-			/* Render a rain disk approximating the hand: */
-			glBegin(GL_POLYGON);
-			for(int i=0;i<32;++i)
-				{
-				Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(32);
-				glVertex(hIt->center+x*(Math::cos(angle)*hIt->radius*0.75)+y*(Math::sin(angle)*hIt->radius*0.75));
-				}
-			glEnd();
-			}
-		
-		glPopAttrib();
-		}
-	}
-
 void Sandbox::pauseUpdatesCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData)
 	{
 	pauseUpdates=cbData->set;
@@ -326,6 +323,11 @@ void Sandbox::showWaterControlDialogCallback(Misc::CallbackData* cbData)
 	Vrui::popupPrimaryWidget(waterControlDialog);
 	}
 
+void Sandbox::showGpuProfileDialogCallback(Misc::CallbackData* cbData)
+	{
+	Vrui::popupPrimaryWidget(gpuProfileDialog);
+	}
+
 void Sandbox::waterSpeedSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData)
 	{
 	waterSpeed=cbData->value;
@@ -334,6 +336,8 @@ void Sandbox::waterSpeedSliderCallback(GLMotif::TextFieldSlider::ValueChangedCal
 void Sandbox::waterMaxStepsSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData)
 	{
 	waterMaxSteps=int(Math::floor(cbData->value+0.5));
+	if(waterGovernor!=0)
+		waterGovernor->setMaxSteps(waterMaxSteps-1U);
 	}
 
 void Sandbox::waterAttenuationSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData)
@@ -362,6 +366,13 @@ GLMotif::PopupMenu* Sandbox::createMainMenu(void)
 		showWaterControlDialogButton->getSelectCallbacks().add(this,&Sandbox::showWaterControlDialogCallback);
 		}
 	
+	if(passProfiler!=0)
+		{
+		/* Create a button to show the GPU profile dialog: */
+		GLMotif::Button* showGpuProfileDialogButton=new GLMotif::Button("ShowGpuProfileDialogButton",mainMenu,"Show GPU Profile");
+		showGpuProfileDialogButton->getSelectCallbacks().add(this,&Sandbox::showGpuProfileDialogCallback);
+		}
+	
 	/* Finish building the main menu: */
 	mainMenu->manageChild();
 	
@@ -420,6 +431,73 @@ GLMotif::PopupWindow* Sandbox::createWaterControlDialog(void)
 	
 	frameRateMargin->manageChild();
 	
+	if(waterSimulationThread!=0)
+		{
+		new GLMotif::Label("SimulationSpeedLabel",waterControlDialog,"Sim Speed");
+		
+		GLMotif::Margin* simulationSpeedMargin=new GLMotif::Margin("SimulationSpeedMargin",waterControlDialog,false);
+		simulationSpeedMargin->setAlignment(GLMotif::Alignment::LEFT);
+		
+		simulationSpeedTextField=new GLMotif::TextField("SimulationSpeedTextField",simulationSpeedMargin,8);
+		simulationSpeedTextField->setFieldWidth(7);
+		simulationSpeedTextField->setPrecision(3);
+		simulationSpeedTextField->setFloatFormat(GLMotif::TextField::FIXED);
+		simulationSpeedTextField->setValue(0.0);
+		
+		simulationSpeedMargin->manageChild();
+		}
+	
+	if(waterGovernor!=0)
+		{
+		new GLMotif::Label("WaterStepBudgetLabel",waterControlDialog,"Step Budget");
+		
+		GLMotif::Margin* waterStepBudgetMargin=new GLMotif::Margin("WaterStepBudgetMargin",waterControlDialog,false);
+		waterStepBudgetMargin->setAlignment(GLMotif::Alignment::LEFT);
+		
+		waterStepBudgetTextField=new GLMotif::TextField("WaterStepBudgetTextField",waterStepBudgetMargin,8);
+		waterStepBudgetTextField->setFieldWidth(7);
+		waterStepBudgetTextField->setPrecision(0);
+		waterStepBudgetTextField->setFloatFormat(GLMotif::TextField::FIXED);
+		waterStepBudgetTextField->setValue(waterGovernor->getNumSteps());
+		
+		waterStepBudgetMargin->manageChild();
+		
+		new GLMotif::Label("WaterStepCostLabel",waterControlDialog,"Step Cost (ms)");
+		
+		GLMotif::Margin* waterStepCostMargin=new GLMotif::Margin("WaterStepCostMargin",waterControlDialog,false);
+		waterStepCostMargin->setAlignment(GLMotif::Alignment::LEFT);
+		
+		waterStepCostTextField=new GLMotif::TextField("WaterStepCostTextField",waterStepCostMargin,8);
+		waterStepCostTextField->setFieldWidth(7);
+		waterStepCostTextField->setPrecision(3);
+		waterStepCostTextField->setFloatFormat(GLMotif::TextField::FIXED);
+		waterStepCostTextField->setValue(0.0);
+		
+		waterStepCostMargin->manageChild();
+		}
+	
+	/* Create read-only text fields to display water flow statistics: */
+	static const char* statisticsNames[7]={"Volume","WetArea","MaxDepth","MaxSpeed","SourceVolume","SinkVolume","BoundaryOutflow"};
+	static const char* statisticsLabels[7]={"Volume (cm^3)","Wet Area (cm^2)","Max Depth (cm)","Max Speed (cm/s)","Added/Step (cm^3)","Removed/Step (cm^3)","Outflow/Step (cm^3)"};
+	static const int statisticsPrecisions[7]={1,1,3,3,4,4,4};
+	for(int i=0;i<7;++i)
+		{
+		std::string name="WaterStatistics";
+		name.append(statisticsNames[i]);
+		new GLMotif::Label((name+"Label").c_str(),waterControlDialog,statisticsLabels[i]);
+		
+		GLMotif::Margin* statisticsMargin=new GLMotif::Margin((name+"Margin").c_str(),waterControlDialog,false);
+		statisticsMargin->setAlignment(GLMotif::Alignment::LEFT);
+		
+		waterStatisticsTextFields[i]=new GLMotif::TextField((name+"TextField").c_str(),statisticsMargin,10);
+		waterStatisticsTextFields[i]->setFieldWidth(9);
+		waterStatisticsTextFields[i]->setPrecision(statisticsPrecisions[i]);
+		waterStatisticsTextFields[i]->setFloatFormat(GLMotif::TextField::FIXED);
+		waterStatisticsTextFields[i]->setValue(0.0);
+		
+		statisticsMargin->manageChild();
+		}
+	
 	new GLMotif::Label("WaterAttenuationLabel",waterControlDialog,"Attenuation");
 	
 	waterAttenuationSlider=new GLMotif::TextFieldSlider("WaterAttenuationSlider",waterControlDialog,8,ss.fontHeight*10.0f);
@@ -437,6 +515,55 @@ GLMotif::PopupWindow* Sandbox::createWaterControlDialog(void)
 	return waterControlDialogPopup;
 	}
 
+GLMotif::PopupWindow* Sandbox::createGpuProfileDialog(void)
+	{
+	/* Create a popup window shell: */
+	GLMotif::PopupWindow* gpuProfileDialogPopup=new GLMotif::PopupWindow("GpuProfileDialogPopup",Vrui::getWidgetManager(),"GPU Profile");
+	gpuProfileDialogPopup->setCloseButton(true);
+	gpuProfileDialogPopup->setResizableFlags(true,false);
+	gpuProfileDialogPopup->popDownOnClose();
+	
+	GLMotif::RowColumn* gpuProfileDialog=new GLMotif::RowColumn("GpuProfileDialog",gpuProfileDialogPopup,false);
+	gpuProfileDialog->setOrientation(GLMotif::RowColumn::VERTICAL);
+	gpuProfileDialog->setPacking(GLMotif::RowColumn::PACK_TIGHT);
+	gpuProfileDialog->setNumMinorWidgets(4);
+	
+	/* Create the column headers: */
+	new GLMotif::Label("PassLabel",gpuProfileDialog,"Pass");
+	new GLMotif::Label("MeanLabel",gpuProfileDialog,"Mean (ms)");
+	new GLMotif::Label("P95Label",gpuProfileDialog,"P95 (ms)");
+	new GLMotif::Label("MaxLabel",gpuProfileDialog,"Max (ms)");
+	
+	/* Create read-only text fields to display the mean, 95th percentile, and maximum GPU time per frame of each pass: */
+	static const char* columnNames[3]={"Mean","P95","Max"};
+	gpuProfileTextFields.reserve(PassProfiler::NUM_PASSES*3);
+	for(int pass=0;pass<PassProfiler::NUM_PASSES;++pass)
+		{
+		std::string name="GpuProfile";
+		name.append(Misc::ValueCoder<int>::encode(pass));
+		new GLMotif::Label((name+"Label").c_str(),gpuProfileDialog,PassProfiler::getPassName(PassProfiler::Pass(pass)));
+		
+		for(int i=0;i<3;++i)
+			{
+			GLMotif::Margin* profileMargin=new GLMotif::Margin((name+columnNames[i]+"Margin").c_str(),gpuProfileDialog,false);
+			profileMargin->setAlignment(GLMotif::Alignment::LEFT);
+			
+			GLMotif::TextField* profileTextField=new GLMotif::TextField((name+columnNames[i]+"TextField").c_str(),profileMargin,8);
+			profileTextField->setFieldWidth(7);
+			profileTextField->setPrecision(3);
+			profileTextField->setFloatFormat(GLMotif::TextField::FIXED);
+			profileTextField->setValue(0.0);
+			gpuProfileTextFields.push_back(profileTextField);
+			
+			profileMargin->manageChild();
+			}
+		}
+	
+	gpuProfileDialog->manageChild();
+	
+	return gpuProfileDialogPopup;
+	}
+
 namespace {
 
 /****************
@@ -479,13 +606,75 @@ void printUsage(void)
 	std::cout<<"  -he <hysteresis envelope>"<<std::endl;
 	std::cout<<"     Sets the size of the hysteresis envelope used for jitter removal"<<std::endl;
 	std::cout<<"     Default: 0.1"<<std::endl;
+	std::cout<<"  -smd <surface mesh decimation>"<<std::endl;
+	std::cout<<"     Sets the distance between adjacent sand surface mesh vertices in"<<std::endl;
+	std::cout<<"     depth image pixels to 1, 2, or 4, to match the surface mesh's"<<std::endl;
+	std::cout<<"     resolution to the projectors' instead of the camera's"<<std::endl;
+	std::cout<<"     Default: 1"<<std::endl;
+	std::cout<<"  -cet <number of threads>"<<std::endl;
+	std::cout<<"     Sets the number of threads extracting topographic contour lines as"<<std::endl;
+	std::cout<<"     line geometry in windows using the -ecl option"<<std::endl;
+	std::cout<<"     Default: 2"<<std::endl;
 	std::cout<<"  -wts <water grid width> <water grid height>"<<std::endl;
 	std::cout<<"     Sets the width and height of the water flow simulation grid"<<std::endl;
 	std::cout<<"     Default: 640 480"<<std::endl;
+	std::cout<<"  -wrp <x> <y> <width> <height> <refinement>"<<std::endl;
+	std::cout<<"     Simulates the given rectangle of water grid cells on a grid refined"<<std::endl;
+	std::cout<<"     by the given factor; the rectangle must keep two cells of distance"<<std::endl;
+	std::cout<<"     from the water grid's boundary"<<std::endl;
+	std::cout<<"     Default: no refined patch"<<std::endl;
 	std::cout<<"  -ws <water speed> <water max steps>"<<std::endl;
 	std::cout<<"     Sets the relative speed of the water simulation and the maximum"<<std::endl;
 	std::cout<<"     number of simulation steps per frame"<<std::endl;
 	std::cout<<"     Default: 1.0 30"<<std::endl;
+	std::cout<<"  -wsr <water simulation rate>"<<std::endl;
+	std::cout<<"     Runs the water simulation in a background thread at the given fixed"<<std::endl;
+	std::cout<<"     update rate in Hz, independent of the display frame rate; 0 runs the"<<std::endl;
+	std::cout<<"     water simulation once per display frame"<<std::endl;
+	std::cout<<"     Default: 0.0"<<std::endl;
+	std::cout<<"  -wgt <target frame time>"<<std::endl;
+	std::cout<<"     Adapts the number of water simulation steps per frame to measured"<<std::endl;
+	std::cout<<"     GPU costs to keep the total frame time below the given target in"<<std::endl;
+	std::cout<<"     milliseconds; the maximum number of steps set by -ws remains an"<<std::endl;
+	std::cout<<"     upper limit; 0 disables the governor"<<std::endl;
+	std::cout<<"     Default: 0.0"<<std::endl;
+	std::cout<<"  -whp"<<std::endl;
+	std::cout<<"     Stores the water simulation's temporal derivative and intermediate"<<std::endl;
+	std::cout<<"     quantity grids in half precision to reduce GPU memory bandwidth"<<std::endl;
+	std::cout<<"  -wfp"<<std::endl;
+	std::cout<<"     Stores all water simulation grids in full precision (default)"<<std::endl;
+	std::cout<<"  -wmp"<<std::endl;
+	std::cout<<"     Runs the water simulation's temporal derivative calculations in"<<std::endl;
+	std::cout<<"     separate passes instead of inside the integration step passes"<<std::endl;
+	std::cout<<"  -wlt <max levels>"<<std::endl;
+	std::cout<<"     Lets tiles of the water grid halve the simulation step size up to"<<std::endl;
+	std::cout<<"     the given number of times to satisfy their own stability limits,"<<std::endl;
+	std::cout<<"     instead of running the entire grid at the smallest step size"<<std::endl;
+	std::cout<<"     Default: 0"<<std::endl;
+	std::cout<<"  -wsi <water statistics interval>"<<std::endl;
+	std::cout<<"     Gathers water volume, wet area, maximum depth and speed, and the"<<std::endl;
+	std::cout<<"     water volumes added, removed, and drained at the boundary every"<<std::endl;
+	std::cout<<"     given number of water simulation steps; 0 disables statistics"<<std::endl;
+	std::cout<<"     Default: 0"<<std::endl;
+	std::cout<<"  -lws <water state file name>"<<std::endl;
+	std::cout<<"     Starts the water simulation from the state saved in the water state"<<std::endl;
+	std::cout<<"     file of the given name"<<std::endl;
+	std::cout<<"     Default: dry"<<std::endl;
+	std::cout<<"  -rwr <water recording file name>"<<std::endl;
+	std::cout<<"     Records the inputs driving the water simulation in every frame to"<<std::endl;
+	std::cout<<"     the water recording file of the given name, for deterministic"<<std::endl;
+	std::cout<<"     replay with the ReplayWater utility; not supported with a"<<std::endl;
+	std::cout<<"     background water simulation thread"<<std::endl;
+	std::cout<<"     Default: none"<<std::endl;
+	std::cout<<"  -gpr"<<std::endl;
+	std::cout<<"     Measures the GPU time of the individual water simulation and"<<std::endl;
+	std::cout<<"     rendering passes with timer queries, and shows the results in the"<<std::endl;
+	std::cout<<"     GPU profile dialog and through the gpuProfile control pipe command"<<std::endl;
+	std::cout<<"  -ptr <events per thread>"<<std::endl;
+	std::cout<<"     Records the most recent processing events of the camera, frame"<<std::endl;
+	std::cout<<"     filter, hand extractor, main, and display threads, to be saved as a"<<std::endl;
+	std::cout<<"     Chrome trace through the saveTrace control pipe command"<<std::endl;
+	std::cout<<"     Default: 0 (disabled)"<<std::endl;
 	std::cout<<"  -rer <min rain elevation> <max rain elevation>"<<std::endl;
 	std::cout<<"     Sets the elevation range of the rain cloud level relative to the"<<std::endl;
 	std::cout<<"     ground plane in cm"<<std::endl;
@@ -528,6 +717,10 @@ void printUsage(void)
 	std::cout<<"     Enables topographic contour lines and sets the elevation distance between"<<std::endl;
 	std::cout<<"     adjacent contour lines to the given value in cm"<<std::endl;
 	std::cout<<"     Default contour line spacing: 0.75"<<std::endl;
+	std::cout<<"  -ecl <line width>"<<std::endl;
+	std::cout<<"     Extracts topographic contour lines as line geometry on the CPU, and"<<std::endl;
+	std::cout<<"     draws them as lines of the given width in pixels, independent of the"<<std::endl;
+	std::cout<<"     window's resolution; enables topographic contour lines"<<std::endl;
 	std::cout<<"  -rws"<<std::endl;
 	std::cout<<"     Renders water surface as geometric surface"<<std::endl;
 	std::cout<<"  -rwt"<<std::endl;
@@ -535,6 +728,9 @@ void printUsage(void)
 	std::cout<<"  -wo <water opacity>"<<std::endl;
 	std::cout<<"     Sets the water depth at which water appears opaque in cm"<<std::endl;
 	std::cout<<"     Default: 2.0"<<std::endl;
+	std::cout<<"  -awt"<<std::endl;
+	std::cout<<"     Shades water rendered as texture with a noise pattern advected by the"<<std::endl;
+	std::cout<<"     water flow instead of the default water color"<<std::endl;
 	std::cout<<"  -cp <control pipe name>"<<std::endl;
 	std::cout<<"     Sets the name of a named POSIX pipe from which to read control commands"<<std::endl;
 	}
@@ -545,15 +741,20 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	:Vrui::Application(argc,argv),
 	 camera(0),pixelDepthCorrection(0),
 	 frameFilter(0),pauseUpdates(false),
-	 depthImageRenderer(0),
-	 waterTable(0),
-	 handExtractor(0),addWaterFunction(0),addWaterFunctionRegistered(false),
+	 depthImageRenderer(0),simulationDepthImageRenderer(0),
+	 waterTable(0),waterNoise(0),waterSimulationThread(0),waterSimulationFallback(false),waterGovernor(0),waterStateSaver(0),waterRecorder(0),passProfiler(0),
+	 pipelineTrace(0),cameraTraceRing(0),mainTraceRing(0),
+	 handExtractor(0),
 	 sun(0),
 	 activeDem(0),
 	 mainMenu(0),pauseUpdatesToggle(0),waterControlDialog(0),
-	 waterSpeedSlider(0),waterMaxStepsSlider(0),frameRateTextField(0),waterAttenuationSlider(0),
+	 waterSpeedSlider(0),waterMaxStepsSlider(0),frameRateTextField(0),simulationSpeedTextField(0),waterStepBudgetTextField(0),waterStepCostTextField(0),waterAttenuationSlider(0),
+	 gpuProfileDialog(0),
 	 controlPipeFd(-1)
 	{
+	for(int i=0;i<7;++i)
+		waterStatisticsTextFields[i]=0;
+	
 	/* Read the sandbox's default configuration parameters: */
 	std::string sandboxConfigFileName=CONFIG_CONFIGDIR;
 	sandboxConfigFileName.push_back('/');
@@ -576,17 +777,35 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	unsigned int minNumSamples=cfg.retrieveValue<unsigned int>("./minNumSamples",10);
 	unsigned int maxVariance=cfg.retrieveValue<unsigned int>("./maxVariance",2);
 	float hysteresis=cfg.retrieveValue<float>("./hysteresis",0.1f);
+	unsigned int surfaceMeshDecimation=cfg.retrieveValue<unsigned int>("./surfaceMeshDecimation",1U);
+	unsigned int contourExtractorThreads=cfg.retrieveValue<unsigned int>("./contourExtractorThreads",2U);
 	Misc::FixedArray<unsigned int,2> wtSize;
 	wtSize[0]=640;
 	wtSize[1]=480;
 	wtSize=cfg.retrieveValue<Misc::FixedArray<unsigned int,2> >("./waterTableSize",wtSize);
+	unsigned int waterNoiseSize=cfg.retrieveValue<unsigned int>("./waterNoiseSize",64U);
+	unsigned int waterNoiseThreads=cfg.retrieveValue<unsigned int>("./waterNoiseThreads",4U);
+	unsigned int waterRenderTileSize=cfg.retrieveValue<unsigned int>("./waterRenderTileSize",16U);
 	waterSpeed=cfg.retrieveValue<double>("./waterSpeed",1.0);
 	waterMaxSteps=cfg.retrieveValue<unsigned int>("./waterMaxSteps",30U);
+	double waterSimulationRate=cfg.retrieveValue<double>("./waterSimulationRate",0.0);
+	double waterGovernorTargetFrameTime=cfg.retrieveValue<double>("./waterGovernorTargetFrameTime",0.0);
+	bool waterHalfPrecision=cfg.retrieveValue<bool>("./waterHalfPrecision",false);
+	bool waterFusedSteps=cfg.retrieveValue<bool>("./waterFusedSteps",true);
+	unsigned int waterLocalTimeSteppingLevels=cfg.retrieveValue<unsigned int>("./waterLocalTimeSteppingLevels",0U);
+	GLsizei waterPatchOrigin[2]={0,0};
+	GLsizei waterPatchSize[2]={0,0};
+	GLsizei waterPatchRefinement=1;
+	unsigned int waterStatisticsInterval=cfg.retrieveValue<unsigned int>("./waterStatisticsInterval",0U);
 	Math::Interval<double> rainElevationRange=cfg.retrieveValue<Math::Interval<double> >("./rainElevationRange",Math::Interval<double>(-1000.0,1000.0));
 	rainStrength=cfg.retrieveValue<GLfloat>("./rainStrength",0.25f);
 	double evaporationRate=cfg.retrieveValue<double>("./evaporationRate",0.0);
 	float demDistScale=cfg.retrieveValue<float>("./demDistScale",1.0f);
 	std::string controlPipeName=cfg.retrieveString("./controlPipeName","");
+	std::string waterStateFileName=cfg.retrieveString("./waterStateFileName","");
+	std::string waterRecordingFileName=cfg.retrieveString("./waterRecordingFileName","");
+	bool profileGpuPasses=cfg.retrieveValue<bool>("./profileGpuPasses",false);
+	unsigned int pipelineTraceSize=cfg.retrieveValue<unsigned int>("./pipelineTraceSize",0U);
 	
 	/* Process command line parameters: */
 	bool printHelp=false;
@@ -663,6 +882,16 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				++i;
 				hysteresis=float(atof(argv[i]));
 				}
+			else if(strcasecmp(argv[i]+1,"smd")==0)
+				{
+				++i;
+				surfaceMeshDecimation=(unsigned int)(atoi(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"cet")==0)
+				{
+				++i;
+				contourExtractorThreads=(unsigned int)(atoi(argv[i]));
+				}
 			else if(strcasecmp(argv[i]+1,"wts")==0)
 				{
 				for(int j=0;j<2;++j)
@@ -671,6 +900,21 @@ Sandbox::Sandbox(int& argc,char**& argv)
 					wtSize[j]=(unsigned int)(atoi(argv[i]));
 					}
 				}
+			else if(strcasecmp(argv[i]+1,"wrp")==0)
+				{
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					waterPatchOrigin[j]=GLsizei(atoi(argv[i]));
+					}
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					waterPatchSize[j]=GLsizei(atoi(argv[i]));
+					}
+				++i;
+				waterPatchRefinement=GLsizei(atoi(argv[i]));
+				}
 			else if(strcasecmp(argv[i]+1,"ws")==0)
 				{
 				++i;
@@ -678,6 +922,49 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				++i;
 				waterMaxSteps=atoi(argv[i]);
 				}
+			else if(strcasecmp(argv[i]+1,"wsr")==0)
+				{
+				++i;
+				waterSimulationRate=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"wgt")==0)
+				{
+				++i;
+				waterGovernorTargetFrameTime=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"whp")==0)
+				waterHalfPrecision=true;
+			else if(strcasecmp(argv[i]+1,"wfp")==0)
+				waterHalfPrecision=false;
+			else if(strcasecmp(argv[i]+1,"wmp")==0)
+				waterFusedSteps=false;
+			else if(strcasecmp(argv[i]+1,"wlt")==0)
+				{
+				++i;
+				waterLocalTimeSteppingLevels=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"wsi")==0)
+				{
+				++i;
+				waterStatisticsInterval=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"lws")==0)
+				{
+				++i;
+				waterStateFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"rwr")==0)
+				{
+				++i;
+				waterRecordingFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"gpr")==0)
+				profileGpuPasses=true;
+			else if(strcasecmp(argv[i]+1,"ptr")==0)
+				{
+				++i;
+				pipelineTraceSize=(unsigned int)(atoi(argv[i]));
+				}
 			else if(strcasecmp(argv[i]+1,"rer")==0)
 				{
 				++i;
@@ -762,6 +1049,12 @@ Sandbox::Sandbox(int& argc,char**& argv)
 					renderSettings.back().contourLineSpacing=GLfloat(atof(argv[i]));
 					}
 				}
+			else if(strcasecmp(argv[i]+1,"ecl")==0)
+				{
+				++i;
+				renderSettings.back().useContourLines=true;
+				renderSettings.back().contourLineWidth=GLfloat(atof(argv[i]));
+				}
 			else if(strcasecmp(argv[i]+1,"rws")==0)
 				renderSettings.back().renderWaterSurface=true;
 			else if(strcasecmp(argv[i]+1,"rwt")==0)
@@ -771,6 +1064,8 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				++i;
 				renderSettings.back().waterOpacity=GLfloat(atof(argv[i]));
 				}
+			else if(strcasecmp(argv[i]+1,"awt")==0)
+				renderSettings.back().advectWaterTexture=true;
 			else if(strcasecmp(argv[i]+1,"cp")==0)
 				{
 				++i;
@@ -911,6 +1206,14 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	evaporationRate*=sf;
 	demDistScale*=sf;
 	
+	if(pipelineTraceSize>0)
+		{
+		/* Create a trace to record the processing events of all pipeline threads: */
+		pipelineTrace=new PipelineTrace(pipelineTraceSize);
+		cameraTraceRing=pipelineTrace->createRing("Camera");
+		mainTraceRing=pipelineTrace->createRing("Main");
+		}
+	
 	/* Create the frame filter object: */
 	frameFilter=new FrameFilter(frameSize,numAveragingSlots,pixelDepthCorrection,cameraIps.depthProjection,basePlane);
 	frameFilter->setValidElevationInterval(cameraIps.depthProjection,basePlane,elevationRange.getMin(),elevationRange.getMax());
@@ -918,11 +1221,15 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	frameFilter->setHysteresis(hysteresis);
 	frameFilter->setSpatialFilter(true);
 	frameFilter->setOutputFrameFunction(Misc::createFunctionCall(this,&Sandbox::receiveFilteredFrame));
+	if(pipelineTrace!=0)
+		frameFilter->setTraceRing(pipelineTrace->createRing("Frame filter"));
 	
 	if(waterSpeed>0.0)
 		{
 		/* Create the hand extractor object: */
 		handExtractor=new HandExtractor(frameSize,pixelDepthCorrection,cameraIps.depthProjection);
+		if(pipelineTrace!=0)
+			handExtractor->setTraceRing(pipelineTrace->createRing("Hand extractor"));
 		}
 	
 	/* Start streaming depth frames: */
@@ -930,6 +1237,7 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	
 	/* Create the depth image renderer: */
 	depthImageRenderer=new DepthImageRenderer(frameSize);
+	depthImageRenderer->setMeshDecimation(surfaceMeshDecimation);
 	depthImageRenderer->setIntrinsics(cameraIps);
 	depthImageRenderer->setBasePlane(basePlane);
 	
@@ -956,17 +1264,91 @@ Sandbox::Sandbox(int& argc,char**& argv)
 		bbox.addPoint(basePlaneCorners[i]+basePlane.getNormal()*elevationRange.getMax());
 		}
 	
+	if(profileGpuPasses)
+		{
+		/* Create a profiler to measure the GPU time of the simulation and rendering passes: */
+		passProfiler=new PassProfiler;
+		}
+	
 	if(waterSpeed>0.0)
 		{
+		if(waterSimulationRate>0.0)
+			{
+			/* Create a separate depth image renderer to update the water table's bathymetry from the simulation thread: */
+			simulationDepthImageRenderer=new DepthImageRenderer(frameSize);
+			simulationDepthImageRenderer->setMeshDecimation(surfaceMeshDecimation);
+			simulationDepthImageRenderer->setIntrinsics(cameraIps);
+			simulationDepthImageRenderer->setBasePlane(basePlane);
+			}
+		
 		/* Initialize the water flow simulator: */
-		waterTable=new WaterTable2(wtSize[0],wtSize[1],depthImageRenderer,basePlaneCorners);
+		DepthImageRenderer* waterDepthImageRenderer=simulationDepthImageRenderer!=0?simulationDepthImageRenderer:depthImageRenderer;
+		waterTable=new WaterTable2(wtSize[0],wtSize[1],waterDepthImageRenderer,basePlaneCorners);
 		waterTable->setElevationRange(elevationRange.getMin(),rainElevationRange.getMax());
 		waterTable->setWaterDeposit(evaporationRate);
+		waterTable->setHalfPrecision(waterHalfPrecision);
+		waterTable->setFusedSteps(waterFusedSteps);
+		waterTable->setLocalTimeSteppingLevels(waterLocalTimeSteppingLevels);
+		waterTable->setStatisticsInterval(waterStatisticsInterval);
+		waterTable->setProfiler(passProfiler);
+		if(waterPatchRefinement>1)
+			{
+			/* Simulate the requested rectangle on a refined grid: */
+			try
+				{
+				waterTable->setRefinedPatch(waterPatchOrigin,waterPatchSize,waterPatchRefinement);
+				}
+			catch(const std::runtime_error& err)
+				{
+				std::cerr<<"Ignoring refined water grid patch due to exception "<<err.what()<<std::endl;
+				}
+			}
 		
-		/* Register a render function with the water table: */
-		addWaterFunction=Misc::createFunctionCall(this,&Sandbox::addWater);
-		waterTable->addRenderFunction(addWaterFunction);
-		addWaterFunctionRegistered=true;
+		if(!waterStateFileName.empty())
+			{
+			/* Restore the initial water state on the first bathymetry update: */
+			try
+				{
+				if(!waterTable->requestRestore(new WaterStateFile(waterStateFileName.c_str())))
+					std::cerr<<"Water state file "<<waterStateFileName<<" does not match the water table size; starting dry"<<std::endl;
+				}
+			catch(const std::runtime_error& err)
+				{
+				std::cerr<<"Unable to load water state file "<<waterStateFileName<<" due to exception "<<err.what()<<"; starting dry"<<std::endl;
+				}
+			}
+		
+		if(waterSimulationRate>0.0)
+			{
+			/* Create the background simulation thread; it will be started once the first OpenGL context is initialized: */
+			waterSimulationThread=new WaterSimulationThread(simulationDepthImageRenderer,waterTable,waterSimulationRate);
+			waterSimulationThread->setWaterSpeed(waterSpeed);
+			waterSimulationThread->setWaterMaxSteps(waterMaxSteps);
+			waterSimulationThread->setProfiler(passProfiler);
+			}
+		else if(waterGovernorTargetFrameTime>0.0)
+			{
+			/* Create a governor to adapt the number of simulation steps per frame to the frame time budget: */
+			waterGovernor=new WaterGovernor(waterGovernorTargetFrameTime*0.001,waterMaxSteps-1U);
+			}
+		
+		if(!waterRecordingFileName.empty())
+			{
+			if(waterSimulationThread!=0)
+				std::cerr<<"Water simulation inputs cannot be recorded from a background water simulation thread; ignoring water recording file "<<waterRecordingFileName<<std::endl;
+			else
+				{
+				/* Record the inputs of every simulated frame for deterministic replay: */
+				try
+					{
+					waterRecorder=new WaterRecorder(waterTable,depthImageRenderer,waterRecordingFileName.c_str());
+					}
+				catch(const std::runtime_error& err)
+					{
+					std::cerr<<"Unable to record water simulation to "<<waterRecordingFileName<<" due to exception "<<err.what()<<std::endl;
+					}
+				}
+			}
 		}
 	
 	/* Initialize all surface renderers: */
@@ -987,17 +1369,37 @@ Sandbox::Sandbox(int& argc,char**& argv)
 		rsIt->surfaceRenderer->setContourLineDistance(rsIt->contourLineSpacing);
 		rsIt->surfaceRenderer->setElevationColorMap(rsIt->elevationColorMap);
 		rsIt->surfaceRenderer->setIlluminate(rsIt->hillshade);
+		rsIt->surfaceRenderer->setProfiler(passProfiler);
+		if(rsIt->useContourLines&&rsIt->contourLineWidth>0.0f)
+			{
+			/* Create a contour extractor and draw contour lines as line geometry instead of in the surface shader: */
+			rsIt->contourExtractor=new ContourExtractor(frameSize,cameraIps,basePlane,Scalar(rsIt->contourLineSpacing),contourExtractorThreads);
+			rsIt->contourExtractor->setLineWidth(rsIt->contourLineWidth);
+			if(pipelineTrace!=0)
+				rsIt->contourExtractor->setTraceRing(pipelineTrace->createRing("Contour extractor"));
+			rsIt->surfaceRenderer->setDrawContourLines(false);
+			}
 		if(waterTable!=0)
 			{
 			if(rsIt->renderWaterSurface)
 				{
 				/* Create a water renderer: */
 				rsIt->waterRenderer=new WaterRenderer(waterTable);
+				rsIt->waterRenderer->setProfiler(passProfiler);
+				rsIt->waterRenderer->setTileSize(waterRenderTileSize);
 				}
 			else
 				{
 				rsIt->surfaceRenderer->setWaterTable(waterTable);
-				rsIt->surfaceRenderer->setAdvectWaterTexture(true);
+				if(rsIt->advectWaterTexture)
+					{
+					/* Generate the noise volume shared by all windows shading advected water: */
+					if(waterNoise==0)
+						waterNoise=new WaterNoise(waterNoiseSize,waterNoiseThreads);
+					
+					rsIt->surfaceRenderer->setWaterNoise(waterNoise);
+					rsIt->surfaceRenderer->setAdvectWaterTexture(true);
+					}
 				rsIt->surfaceRenderer->setWaterOpacity(rsIt->waterOpacity);
 				}
 			}
@@ -1018,6 +1420,8 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	Vrui::setMainMenu(mainMenu);
 	if(waterTable!=0)
 		waterControlDialog=createWaterControlDialog();
+	if(passProfiler!=0)
+		gpuProfileDialog=createGpuProfileDialog();
 	
 	/* Initialize the custom tool classes: */
 	GlobalWaterTool::initClass(*Vrui::getToolManager());
@@ -1050,14 +1454,22 @@ Sandbox::~Sandbox(void)
 	delete frameFilter;
 	
 	/* Delete helper objects: */
+	delete waterSimulationThread;
+	delete waterGovernor;
+	delete waterStateSaver;
+	delete waterRecorder;
 	delete waterTable;
+	delete waterNoise;
+	delete passProfiler;
+	delete simulationDepthImageRenderer;
 	delete depthImageRenderer;
 	delete handExtractor;
-	delete addWaterFunction;
+	delete pipelineTrace;
 	delete[] pixelDepthCorrection;
 	
 	delete mainMenu;
 	delete waterControlDialog;
+	delete gpuProfileDialog;
 	
 	close(controlPipeFd);
 	}
@@ -1123,34 +1535,48 @@ bool isToken(const std::string& token,const char* pattern)
 
 void Sandbox::frame(void)
 	{
+	/* Trace the main thread's frame processing: */
+	PipelineTrace::Scope frameScope(mainTraceRing,"Frame");
+	
 	/* Check if the filtered frame has been updated: */
 	if(filteredFrames.lockNewValue())
 		{
 		/* Update the depth image renderer's depth image: */
+		PipelineTrace::Scope updateScope(mainTraceRing,"Update depth image",PipelineTrace::getFrameId(filteredFrames.getLockedValue().timeStamp));
 		depthImageRenderer->setDepthImage(filteredFrames.getLockedValue());
+		
+		/* Forward the depth image to the water simulation thread, or to its depth image renderer after falling back to simulating in the display method: */
+		if(waterSimulationThread!=0)
+			waterSimulationThread->setDepthImage(filteredFrames.getLockedValue());
+		else if(simulationDepthImageRenderer!=0)
+			simulationDepthImageRenderer->setDepthImage(filteredFrames.getLockedValue());
+		
+		/* Forward the depth image to all contour extractors: */
+		for(std::vector<RenderSettings>::iterator rsIt=renderSettings.begin();rsIt!=renderSettings.end();++rsIt)
+			if(rsIt->contourExtractor!=0)
+				rsIt->contourExtractor->setDepthImage(filteredFrames.getLockedValue());
 		}
 	
+	/* Lock the most recently extracted contour lines: */
+	for(std::vector<RenderSettings>::iterator rsIt=renderSettings.begin();rsIt!=renderSettings.end();++rsIt)
+		if(rsIt->contourExtractor!=0)
+			rsIt->contourExtractor->lockNewContourLines();
+	
 	if(handExtractor!=0)
 		{
 		/* Lock the most recent extracted hand list: */
 		handExtractor->lockNewExtractedHands();
 		
-		#if 0
-		
-		/* Register/unregister the rain rendering function based on whether hands have been detected: */
-		bool registerWaterFunction=!handExtractor->getLockedExtractedHands().empty();
-		if(addWaterFunctionRegistered!=registerWaterFunction)
-			{
-			if(registerWaterFunction)
-				waterTable->addRenderFunction(addWaterFunction);
-			else
-				waterTable->removeRenderFunction(addWaterFunction);
-			addWaterFunctionRegistered=registerWaterFunction;
-			}
-		
-		#endif
+		/* Submit the extracted hands as rain disks to the water table: */
+		if(waterTable!=0&&waterSpeed>0.0)
+			for(HandExtractor::HandList::const_iterator hIt=handExtractor->getLockedExtractedHands().begin();hIt!=handExtractor->getLockedExtractedHands().end();++hIt)
+				waterTable->addWaterSource(hIt->center,hIt->radius*Scalar(0.75),rainStrength/waterSpeed);
 		}
 	
+	/* Post all water sources submitted during this frame by hands and water tools: */
+	if(waterTable!=0)
+		waterTable->postWaterSources();
+	
 	/* Update all surface renderers: */
 	for(std::vector<RenderSettings>::iterator rsIt=renderSettings.begin();rsIt!=renderSettings.end();++rsIt)
 		rsIt->surfaceRenderer->setAnimationTime(Vrui::getApplicationTime());
@@ -1174,6 +1600,9 @@ void Sandbox::frame(void)
 				if(tokens.empty())
 					continue;
 				
+				/* Trace the command's execution: */
+				PipelineTrace::Scope commandScope(mainTraceRing,"Control pipe command");
+				
 				/* Parse the command: */
 				if(isToken(tokens[0],"waterSpeed"))
 					{
@@ -1193,6 +1622,8 @@ void Sandbox::frame(void)
 						waterMaxSteps=atoi(tokens[1].c_str());
 						if(waterMaxStepsSlider!=0)
 							waterMaxStepsSlider->setValue(waterMaxSteps);
+						if(waterGovernor!=0)
+							waterGovernor->setMaxSteps(waterMaxSteps-1U);
 						}
 					else
 						std::cerr<<"Wrong number of arguments for waterMaxSteps control pipe command"<<std::endl;
@@ -1308,16 +1739,210 @@ void Sandbox::frame(void)
 					else
 						std::cerr<<"Wrong number of arguments for dippingBedThickness control pipe command"<<std::endl;
 					}
+				else if(isToken(tokens[0],"waterStatisticsInterval"))
+					{
+					if(tokens.size()==2)
+						{
+						if(waterTable!=0)
+							waterTable->setStatisticsInterval(atoi(tokens[1].c_str()));
+						}
+					else
+						std::cerr<<"Wrong number of arguments for waterStatisticsInterval control pipe command"<<std::endl;
+					}
+				else if(isToken(tokens[0],"waterStatistics"))
+					{
+					if(tokens.size()<=2)
+						{
+						if(waterTable!=0)
+							{
+							/* Format the most recent water flow statistics as a single line: */
+							WaterTable2::Statistics statistics=waterTable->getStatistics();
+							std::ostringstream statisticsLine;
+							statisticsLine<<Vrui::getApplicationTime()<<' '<<statistics.version<<' '<<statistics.stepSize;
+							statisticsLine<<' '<<statistics.volume<<' '<<statistics.wetArea<<' '<<statistics.maxDepth<<' '<<statistics.maxSpeed;
+							statisticsLine<<' '<<statistics.sourceVolume<<' '<<statistics.sinkVolume<<' '<<statistics.boundaryOutflow;
+							
+							/* Print the statistics to stdout or append them to the given file: */
+							if(tokens.size()==2)
+								{
+								std::ofstream statisticsFile(tokens[1].c_str(),std::ios::app);
+								if(statisticsFile)
+									statisticsFile<<statisticsLine.str()<<std::endl;
+								else
+									std::cerr<<"Unable to append water statistics to file "<<tokens[1]<<std::endl;
+								}
+							else
+								std::cout<<"Water statistics: "<<statisticsLine.str()<<std::endl;
+							}
+						}
+					else
+						std::cerr<<"Wrong number of arguments for waterStatistics control pipe command"<<std::endl;
+					}
+				else if(isToken(tokens[0],"saveWaterState"))
+					{
+					if(tokens.size()==2)
+						{
+						if(waterStateSaver!=0)
+							std::cerr<<"Water state is already being saved to "<<waterStateSaver->getFileName()<<"; ignoring saveWaterState control pipe command"<<std::endl;
+						else if(waterTable!=0)
+							waterStateSaver=new WaterStateSaver(waterTable,tokens[1].c_str());
+						}
+					else
+						std::cerr<<"Wrong number of arguments for saveWaterState control pipe command"<<std::endl;
+					}
+				else if(isToken(tokens[0],"loadWaterState"))
+					{
+					if(tokens.size()==2)
+						{
+						if(waterTable!=0)
+							{
+							try
+								{
+								if(!waterTable->requestRestore(new WaterStateFile(tokens[1].c_str())))
+									std::cerr<<"Water state file "<<tokens[1]<<" does not match the water table size"<<std::endl;
+								}
+							catch(const std::runtime_error& err)
+								{
+								std::cerr<<"Unable to load water state file "<<tokens[1]<<" due to exception "<<err.what()<<std::endl;
+								}
+							}
+						}
+					else
+						std::cerr<<"Wrong number of arguments for loadWaterState control pipe command"<<std::endl;
+					}
+				else if(isToken(tokens[0],"gpuProfile"))
+					{
+					if(tokens.size()<=2)
+						{
+						if(passProfiler!=0)
+							{
+							/* Print the GPU profile to stdout or append it to the given file: */
+							if(tokens.size()==2)
+								{
+								std::ofstream profileFile(tokens[1].c_str(),std::ios::app);
+								if(profileFile)
+									{
+									profileFile<<"Application time "<<Vrui::getApplicationTime()<<std::endl;
+									passProfiler->printReport(profileFile);
+									}
+								else
+									std::cerr<<"Unable to append GPU profile to file "<<tokens[1]<<std::endl;
+								}
+							else
+								passProfiler->printReport(std::cout);
+							}
+						else
+							std::cerr<<"GPU pass profiling is disabled; ignoring gpuProfile control pipe command"<<std::endl;
+						}
+					else
+						std::cerr<<"Wrong number of arguments for gpuProfile control pipe command"<<std::endl;
+					}
+				else if(isToken(tokens[0],"saveTrace"))
+					{
+					if(tokens.size()==2)
+						{
+						if(pipelineTrace!=0)
+							{
+							try
+								{
+								/* Write the recorded pipeline events to a Chrome trace file: */
+								pipelineTrace->writeChromeTrace(tokens[1].c_str());
+								}
+							catch(const std::runtime_error& err)
+								{
+								std::cerr<<"Unable to save pipeline trace due to exception "<<err.what()<<std::endl;
+								}
+							}
+						else
+							std::cerr<<"Pipeline tracing is disabled; ignoring saveTrace control pipe command"<<std::endl;
+						}
+					else
+						std::cerr<<"Wrong number of arguments for saveTrace control pipe command"<<std::endl;
+					}
 				else
 					std::cerr<<"Unrecognized control pipe command "<<tokens[0]<<std::endl;
 				}
 			}
 		}
 	
+	if(waterStateSaver!=0)
+		{
+		/* Check if the water state has been read back completely and saved: */
+		try
+			{
+			if(waterStateSaver->update())
+				{
+				std::cout<<"Saved water state to "<<waterStateSaver->getFileName()<<std::endl;
+				delete waterStateSaver;
+				waterStateSaver=0;
+				}
+			}
+		catch(const std::runtime_error& err)
+			{
+			std::cerr<<"Unable to save water state to "<<waterStateSaver->getFileName()<<" due to exception "<<err.what()<<std::endl;
+			delete waterStateSaver;
+			waterStateSaver=0;
+			}
+		}
+	
+	if(waterSimulationThread!=0&&waterSimulationFallback)
+		{
+		/* Stop the background simulation thread and let each rendering context simulate its own water table: */
+		delete waterSimulationThread;
+		waterSimulationThread=0;
+		waterTable->setPublishSnapshots(false);
+		}
+	
+	if(waterSimulationThread!=0)
+		{
+		/* Forward the current simulation parameters to the simulation thread: */
+		waterSimulationThread->setWaterSpeed(waterSpeed);
+		waterSimulationThread->setWaterMaxSteps(waterMaxSteps);
+		
+		/* Lock the most recent simulation state snapshot for rendering: */
+		waterTable->lockNewSnapshot();
+		}
+	
 	if(frameRateTextField!=0&&Vrui::getWidgetManager()->isVisible(waterControlDialog))
 		{
 		/* Update the frame rate display: */
 		frameRateTextField->setValue(1.0/Vrui::getCurrentFrameTime());
+		
+		/* Update the simulation speed display: */
+		if(simulationSpeedTextField!=0&&waterSimulationThread!=0)
+			simulationSpeedTextField->setValue(waterSimulationThread->getSimulationSpeed());
+		
+		/* Update the water governor display: */
+		if(waterStepBudgetTextField!=0)
+			{
+			waterStepBudgetTextField->setValue(waterGovernor->getNumSteps());
+			waterStepCostTextField->setValue(waterGovernor->getStepCost()*1000.0);
+			}
+		
+		/* Update the water statistics display: */
+		if(waterStatisticsTextFields[0]!=0&&waterTable->getStatisticsInterval()!=0)
+			{
+			WaterTable2::Statistics statistics=waterTable->getStatistics();
+			waterStatisticsTextFields[0]->setValue(statistics.volume);
+			waterStatisticsTextFields[1]->setValue(statistics.wetArea);
+			waterStatisticsTextFields[2]->setValue(statistics.maxDepth);
+			waterStatisticsTextFields[3]->setValue(statistics.maxSpeed);
+			waterStatisticsTextFields[4]->setValue(statistics.sourceVolume);
+			waterStatisticsTextFields[5]->setValue(statistics.sinkVolume);
+			waterStatisticsTextFields[6]->setValue(statistics.boundaryOutflow);
+			}
+		}
+	
+	if(gpuProfileDialog!=0&&Vrui::getWidgetManager()->isVisible(gpuProfileDialog))
+		{
+		/* Update the GPU profile display: */
+		for(int pass=0;pass<PassProfiler::NUM_PASSES;++pass)
+			{
+			PassProfiler::Statistics stats=passProfiler->getStatistics(PassProfiler::Pass(pass));
+			gpuProfileTextFields[pass*3+0]->setValue(stats.mean);
+			gpuProfileTextFields[pass*3+1]->setValue(stats.p95);
+			gpuProfileTextFields[pass*3+2]->setValue(stats.max);
+			}
 		}
 	
 	if(pauseUpdates)
@@ -1329,6 +1954,43 @@ void Sandbox::display(GLContextData& contextData) const
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
 	
+	/* Trace the rendering of the depth image currently held by the depth image renderer: */
+	PipelineTrace::Scope displayScope(dataItem->displayTraceRing,"Display",PipelineTrace::getFrameId(depthImageRenderer->getDepthImageTimeStamp()));
+	
+	/* Check if the water simulation state needs to be updated, unless it is updated by a background thread: */
+	bool updateWaterTable=waterTable!=0&&waterSimulationThread==0&&dataItem->waterTableTime!=Vrui::getApplicationTime();
+	
+	/* Check if this frame's GPU busy time and water simulation time need to be measured for the governor: */
+	bool measureFrame=false;
+	if(updateWaterTable&&waterGovernor!=0&&dataItem->haveTimerQuery)
+		{
+		if(dataItem->waterTimerQueryPending)
+			{
+			/* Check if the measurement of a previous frame is complete, i.e., if that frame's final timestamp is available: */
+			GLint available=0;
+			glGetQueryObjectivARB(dataItem->waterTimerQueryObjects[3],GL_QUERY_RESULT_AVAILABLE_ARB,&available);
+			if(available)
+				{
+				/* Feed that frame's GPU busy time and simulation time to the governor: */
+				GLuint64 timestamps[4];
+				for(int i=0;i<4;++i)
+					glGetQueryObjectui64v(dataItem->waterTimerQueryObjects[i],GL_QUERY_RESULT_ARB,&timestamps[i]);
+				double frameBusyTime=double(timestamps[3]-timestamps[0])*1.0e-9;
+				double simulationTime=double(timestamps[2]-timestamps[1])*1.0e-9;
+				waterGovernor->update(frameBusyTime,simulationTime,dataItem->waterTimerQueryNumSteps,dataItem->waterTimerQueryRanOutOfTime);
+				dataItem->waterTimerQueryPending=false;
+				}
+			}
+		
+		/* Start measuring this frame if there is no outstanding measurement: */
+		measureFrame=!dataItem->waterTimerQueryPending;
+		if(measureFrame)
+			glQueryCounter(dataItem->waterTimerQueryObjects[0],GL_TIMESTAMP);
+		}
+	
+	/* Start streaming a new depth image into this context's depth texture, to overlap the transfer with the following work: */
+	depthImageRenderer->uploadDepthImage(contextData);
+	
 	/* Get the rendering settings for this window: */
 	const Vrui::DisplayState& ds=Vrui::getDisplayState(contextData);
 	const Vrui::VRWindow* window=ds.window;
@@ -1337,16 +1999,41 @@ void Sandbox::display(GLContextData& contextData) const
 		;
 	const RenderSettings& rs=windowIndex<int(renderSettings.size())?renderSettings[windowIndex]:renderSettings.back();
 	
-	/* Check if the water simulation state needs to be updated: */
-	if(waterTable!=0&&dataItem->waterTableTime!=Vrui::getApplicationTime())
+	/* Update the water simulation state: */
+	if(updateWaterTable)
 		{
+		/* Trace the water simulation update: */
+		PipelineTrace::Scope waterScope(dataItem->displayTraceRing,"Water simulation");
+		
 		/* Update the water table's bathymetry grid: */
 		waterTable->updateBathymetry(contextData);
 		
-		/* Run the water flow simulation's main pass: */
+		/* Determine the number of simulation steps for this frame: */
+		unsigned int maxNumSteps=waterMaxSteps-1U;
+		bool forceFinalStep=false;
+		if(waterGovernor!=0)
+			{
+			/* Use the governor's step budget, reserving one step to catch up if the governor says so: */
+			maxNumSteps=waterGovernor->getNumSteps();
+			forceFinalStep=waterGovernor->getForceFinalStep();
+			if(forceFinalStep&&maxNumSteps>1U)
+				--maxNumSteps;
+			}
+		
+		/* Calculate the simulation time by which to advance the water table in this frame: */
 		GLfloat totalTimeStep=GLfloat(Vrui::getFrameTime()*waterSpeed);
+		
+		/* Record this frame's simulation inputs: */
+		if(waterRecorder!=0)
+			waterRecorder->recordFrame(Vrui::getFrameTime(),totalTimeStep,maxNumSteps,forceFinalStep,contextData);
+		
+		/* Mark the start of this frame's simulation steps: */
+		if(measureFrame)
+			glQueryCounter(dataItem->waterTimerQueryObjects[1],GL_TIMESTAMP);
+		
+		/* Run the water flow simulation's main pass: */
 		unsigned int numSteps=0;
-		while(numSteps<waterMaxSteps-1U&&totalTimeStep>1.0e-8f)
+		while(numSteps<maxNumSteps&&totalTimeStep>1.0e-8f)
 			{
 			/* Run with a self-determined time step to maintain stability: */
 			waterTable->setMaxStepSize(totalTimeStep);
@@ -1354,6 +2041,7 @@ void Sandbox::display(GLContextData& contextData) const
 			totalTimeStep-=timeStep;
 			++numSteps;
 			}
+		bool ranOutOfTime=totalTimeStep>1.0e-8f;
 		#if 0
 		if(totalTimeStep>1.0e-8f)
 			{
@@ -1365,10 +2053,26 @@ void Sandbox::display(GLContextData& contextData) const
 			++numSteps;
 			}
 		#else
-		if(totalTimeStep>1.0e-8f)
+		if(ranOutOfTime&&forceFinalStep)
+			{
+			/* Force the final step to avoid simulation slow-down: */
+			waterTable->setMaxStepSize(totalTimeStep);
+			GLfloat timeStep=waterTable->runSimulationStep(true,contextData);
+			totalTimeStep-=timeStep;
+			++numSteps;
+			}
+		else if(ranOutOfTime&&waterGovernor==0)
 			std::cout<<"Ran out of time by "<<totalTimeStep<<std::endl;
 		#endif
 		
+		if(measureFrame)
+			{
+			/* Mark the end of this frame's simulation steps: */
+			glQueryCounter(dataItem->waterTimerQueryObjects[2],GL_TIMESTAMP);
+			dataItem->waterTimerQueryNumSteps=numSteps;
+			dataItem->waterTimerQueryRanOutOfTime=ranOutOfTime;
+			}
+		
 		/* Mark the water simulation state as up-to-date for this frame: */
 		dataItem->waterTableTime=Vrui::getApplicationTime();
 		}
@@ -1561,6 +2265,12 @@ void Sandbox::display(GLContextData& contextData) const
 		rs.surfaceRenderer->renderSinglePass(ds.viewport,projection,ds.modelviewNavigational,contextData);
 		}
 	
+	if(rs.contourExtractor!=0)
+		{
+		/* Draw the extracted contour lines: */
+		rs.contourExtractor->render(projection,ds.modelviewNavigational,contextData);
+		}
+	
 	if(rs.waterRenderer!=0)
 		{
 		/* Draw the water surface: */
@@ -1569,6 +2279,21 @@ void Sandbox::display(GLContextData& contextData) const
 		glMaterialShininess(GLMaterialEnums::FRONT,64.0f);
 		rs.waterRenderer->render(projection,ds.modelviewNavigational,contextData);
 		}
+	
+	/* Let the water simulation thread know when this context is done with the current simulation state snapshot; unshared contexts cannot signal the simulation thread: */
+	if(waterSimulationThread!=0&&!waterSimulationFallback)
+		waterTable->releaseSnapshot(contextData);
+	
+	if(measureFrame)
+		{
+		/* Mark the end of this frame's rendering work; the measurement will be retrieved in a later frame: */
+		glQueryCounter(dataItem->waterTimerQueryObjects[3],GL_TIMESTAMP);
+		dataItem->waterTimerQueryPending=true;
+		}
+	
+	/* Finish the frame's pass timings: */
+	if(passProfiler!=0)
+		passProfiler->finishFrame(contextData);
 	}
 
 void Sandbox::resetNavigation(void)
@@ -1608,6 +2333,23 @@ void Sandbox::initContext(GLContextData& contextData) const
 	DataItem* dataItem=new DataItem;
 	contextData.addDataItem(this,dataItem);
 	
+	/* Create a ring buffer to trace this context's display events: */
+	if(pipelineTrace!=0)
+		dataItem->displayTraceRing=pipelineTrace->createRing("Display");
+	
+	/* Start the water simulation thread in a context sharing texture objects with the first rendering context: */
+	if(waterSimulationThread!=0)
+		{
+		if(!waterSimulationThread->isRunning())
+			waterSimulationThread->start(glXGetCurrentDisplay(),glXGetCurrentContext());
+		else if(!waterSimulationFallback)
+			{
+			/* This context does not share the simulation's snapshot textures; fall back to simulating in every context's display method: */
+			std::cerr<<"Background water simulation does not support multiple unshared OpenGL contexts; simulating water in the display method instead"<<std::endl;
+			waterSimulationFallback=true;
+			}
+		}
+	
 	{
 	/* Save the currently bound frame buffer: */
 	GLint currentFrameBuffer;
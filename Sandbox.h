@@ -22,6 +22,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef SANDBOX_INCLUDED
 #define SANDBOX_INCLUDED
 
+#include <vector>
+#include <Threads/Mutex.h>
 #include <Threads/TripleBuffer.h>
 #include <Geometry/Box.h>
 #include <Geometry/Rotation.h>
@@ -42,12 +44,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Kinect/FrameSource.h>
 
 #include "Types.h"
+#include "PipelineTrace.h"
 
 /* Forward declarations: */
-namespace Misc {
-template <class ParameterParam>
-class FunctionCall;
-}
 class GLContextData;
 namespace GLMotif {
 class PopupMenu;
@@ -66,9 +65,15 @@ class ElevationColorMap;
 class DEM;
 class SurfaceRenderer;
 class WaterTable2;
+class WaterNoise;
 class HandExtractor;
-typedef Misc::FunctionCall<GLContextData&> AddWaterFunction;
+class WaterSimulationThread;
+class WaterGovernor;
+class WaterStateSaver;
+class WaterRecorder;
+class PassProfiler;
 class WaterRenderer;
+class ContourExtractor;
 
 class Sandbox:public Vrui::Application,public GLObject
 	{
@@ -83,9 +88,15 @@ class Sandbox:public Vrui::Application,public GLObject
 		/* Elements: */
 		public:
 		double waterTableTime; // Simulation time stamp of the water table in this OpenGL context
+		bool haveTimerQuery; // Flag whether the OpenGL context supports timer queries
+		GLuint waterTimerQueryObjects[4]; // Timestamp query objects marking the start of a frame, the start and end of its water simulation steps, and the end of the frame
+		bool waterTimerQueryPending; // Flag whether a frame time measurement has been issued but not yet retrieved
+		unsigned int waterTimerQueryNumSteps; // Number of simulation steps covered by the pending time measurement
+		bool waterTimerQueryRanOutOfTime; // Flag whether the simulation steps covered by the pending time measurement ran out of time
 		GLsizei shadowBufferSize[2]; // Size of the shadow rendering frame buffer
 		GLuint shadowFramebufferObject; // Frame buffer object to render shadow maps
 		GLuint shadowDepthTextureObject; // Depth texture for the shadow rendering frame buffer
+		PipelineTrace::Ring* displayTraceRing; // Ring buffer recording the display events of this OpenGL context, or null
 		
 		/* Constructors and destructors: */
 		DataItem(void);
@@ -105,10 +116,13 @@ class Sandbox:public Vrui::Application,public GLObject
 		ElevationColorMap* elevationColorMap; // Pointer to an elevation color map
 		bool useContourLines; // Flag whether to draw elevation contour lines
 		GLfloat contourLineSpacing; // Spacing between adjacent contour lines in cm
+		GLfloat contourLineWidth; // Width of contour lines extracted as line geometry in pixels, or 0 to draw contour lines in the surface shader
 		bool renderWaterSurface; // Flag whether to render the water surface as a geometric surface
 		GLfloat waterOpacity; // Opacity factor for water when rendered as texture
+		bool advectWaterTexture; // Flag whether to shade water rendered as texture with a noise pattern advected by the water flow
 		SurfaceRenderer* surfaceRenderer; // Surface rendering object for this window
 		WaterRenderer* waterRenderer; // A renderer to render the water surface as geometry
+		ContourExtractor* contourExtractor; // An extractor to draw contour lines as line geometry, or null
 		
 		/* Constructors and destructors: */
 		RenderSettings(void); // Creates default rendering settings
@@ -134,16 +148,25 @@ class Sandbox:public Vrui::Application,public GLObject
 	bool pauseUpdates; // Pauses updates of the topography
 	Threads::TripleBuffer<Kinect::FrameBuffer> filteredFrames; // Triple buffer for incoming filtered depth frames
 	DepthImageRenderer* depthImageRenderer; // Object managing the current filtered depth image
+	DepthImageRenderer* simulationDepthImageRenderer; // Separate depth image renderer to update the water table's bathymetry from a background simulation thread
 	ONTransform boxTransform; // Transformation from camera space to baseplane space (x along long sandbox axis, z up)
 	Scalar boxSize; // Radius of sphere around sandbox area
 	Box bbox; // Bounding box around all potential surfaces
 	WaterTable2* waterTable; // Water flow simulation object
+	WaterNoise* waterNoise; // Noise volume to shade advected water in windows that enable advected water shading, or null
 	double waterSpeed; // Relative speed of water flow simulation
 	unsigned int waterMaxSteps; // Maximum number of water simulation steps per frame
+	WaterSimulationThread* waterSimulationThread; // Background thread running the water flow simulation at a fixed rate, or null if the simulation runs in the display method
+	mutable volatile bool waterSimulationFallback; // Flag set when a rendering context does not share texture objects with the simulation thread's context, to stop the thread and simulate in the display method instead
+	WaterGovernor* waterGovernor; // Governor adapting the number of water simulation steps per frame to a frame time budget, or null
+	WaterStateSaver* waterStateSaver; // Helper object saving the water simulation state to a file, or null if no save is in progress
+	WaterRecorder* waterRecorder; // Helper object recording the water simulation's inputs for deterministic replay, or null
+	PassProfiler* passProfiler; // Profiler measuring the GPU time of the rendering and simulation passes, or null
+	PipelineTrace* pipelineTrace; // Trace recording timed events from all threads of the frame processing pipeline, or null
+	PipelineTrace::Ring* cameraTraceRing; // Ring buffer recording the events of the camera's streaming thread, or null
+	PipelineTrace::Ring* mainTraceRing; // Ring buffer recording the events of the main thread, or null
 	GLfloat rainStrength; // Amount of water deposited by rain tools and objects on each water simulation step
 	HandExtractor* handExtractor; // Object to detect splayed hands above the sand surface to make rain
-	const AddWaterFunction* addWaterFunction; // Render function registered with the water table
-	bool addWaterFunctionRegistered; // Flag if the water adding function is currently registered with the water table
 	std::vector<RenderSettings> renderSettings; // List of per-window rendering settings
 	Vrui::Lightsource* sun; // An external fixed light source
 	DEM* activeDem; // The currently active DEM
@@ -153,21 +176,28 @@ class Sandbox:public Vrui::Application,public GLObject
 	GLMotif::TextFieldSlider* waterSpeedSlider;
 	GLMotif::TextFieldSlider* waterMaxStepsSlider;
 	GLMotif::TextField* frameRateTextField;
+	GLMotif::TextField* simulationSpeedTextField;
+	GLMotif::TextField* waterStepBudgetTextField;
+	GLMotif::TextField* waterStepCostTextField;
+	GLMotif::TextField* waterStatisticsTextFields[7]; // Text fields displaying water volume, wet area, maximum depth, maximum speed, source and sink volumes, and boundary outflow
 	GLMotif::TextFieldSlider* waterAttenuationSlider;
+	GLMotif::PopupWindow* gpuProfileDialog;
+	std::vector<GLMotif::TextField*> gpuProfileTextFields; // Text fields displaying the mean, 95th percentile, and maximum GPU time per frame of each profiled pass
 	int controlPipeFd; // File descriptor of an optional named pipe to send control commands to a running AR Sandbox
 	
 	/* Private methods: */
 	void rawDepthFrameDispatcher(const Kinect::FrameBuffer& frameBuffer); // Callback receiving raw depth frames from the Kinect camera; forwards them to the frame filter and rain maker objects
 	void receiveFilteredFrame(const Kinect::FrameBuffer& frameBuffer); // Callback receiving filtered depth frames from the filter object
 	void toggleDEM(DEM* dem); // Sets or toggles the currently active DEM
-	void addWater(GLContextData& contextData) const; // Function to render geometry that adds water to the water table
 	void pauseUpdatesCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData);
 	void showWaterControlDialogCallback(Misc::CallbackData* cbData);
+	void showGpuProfileDialogCallback(Misc::CallbackData* cbData);
 	void waterSpeedSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
 	void waterMaxStepsSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
 	void waterAttenuationSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
 	GLMotif::PopupMenu* createMainMenu(void);
 	GLMotif::PopupWindow* createWaterControlDialog(void);
+	GLMotif::PopupWindow* createGpuProfileDialog(void);
 	
 	/* Constructors and destructors: */
 	public:
@@ -1,6 +1,7 @@
 /***********************************************************************
-ShaderHelper - Helper functions to create GLSL shaders from text files.
-Copyright (c) 2014 Oliver Kreylos
+ShaderHelper - Helper functions to create GLSL shaders from text files,
+and to cache linked shader programs as binaries on disk.
+Copyright (c) 2014-2018 Oliver Kreylos
 
 This file is part of the Augmented Reality Sandbox (SARndbox).
 
@@ -21,14 +22,277 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "ShaderHelper.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <string>
+#include <iterator>
+#include <fstream>
+#include <Misc/ThrowStdErr.h>
 #include <GL/gl.h>
+#include <GL/GLExtensionManager.h>
 #include <GL/Extensions/GLARBFragmentShader.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
 #include <GL/Extensions/GLARBVertexShader.h>
 
 #include "Config.h"
 
+/* Tokens and entry points of the GL_ARB_get_program_binary extension: */
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+namespace {
+
+typedef void (APIENTRY *GetProgramivProc)(GLuint program,GLenum pname,GLint* params);
+typedef void (APIENTRY *GetProgramBinaryProc)(GLuint program,GLsizei bufSize,GLsizei* length,GLenum* binaryFormat,void* binary);
+typedef void (APIENTRY *ProgramBinaryProc)(GLuint program,GLenum binaryFormat,const void* binary,GLsizei length);
+typedef void (APIENTRY *ProgramParameteriProc)(GLuint program,GLenum pname,GLint value);
+
+/****************
+Helper functions:
+****************/
+
+Misc::UInt64 hashBytes(Misc::UInt64 hash,const void* bytes,size_t numBytes) // Adds the given bytes to a 64-bit FNV-1a hash value
+	{
+	const unsigned char* bPtr=static_cast<const unsigned char*>(bytes);
+	for(size_t i=0;i<numBytes;++i,++bPtr)
+		{
+		hash^=Misc::UInt64(*bPtr);
+		hash*=1099511628211ULL;
+		}
+	return hash;
+	}
+
+std::string getCacheDirectory(void) // Returns the name of the current user's program binary cache directory, creating it if necessary; returns an empty string if there is no usable cache directory
+	{
+	/* Follow the XDG base directory specification to find the user's cache base directory: */
+	std::string result;
+	const char* xdgCacheHome=getenv("XDG_CACHE_HOME");
+	if(xdgCacheHome!=0&&xdgCacheHome[0]=='/')
+		result=xdgCacheHome;
+	else
+		{
+		const char* home=getenv("HOME");
+		if(home==0||home[0]!='/')
+			return std::string();
+		result=home;
+		result.append("/.cache");
+		}
+	mkdir(result.c_str(),0700);
+	
+	/* Create the SARndbox's own cache directory, accessible only by the current user: */
+	result.append("/SARndbox");
+	mkdir(result.c_str(),0700);
+	
+	/* Only use the cache directory if it is a real directory owned by the current user and not writable by anyone else: */
+	struct stat dirStat;
+	if(lstat(result.c_str(),&dirStat)!=0||!S_ISDIR(dirStat.st_mode)||dirStat.st_uid!=getuid()||(dirStat.st_mode&(S_IWGRP|S_IWOTH))!=0)
+		return std::string();
+	
+	return result;
+	}
+
+bool loadProgramBinary(const std::string& cacheFileName,GLhandleARB& program) // Creates a shader program from the given program binary cache file; returns false if the file is missing or rejected by the OpenGL driver
+	{
+	/* Read the cache file's binary format and binary: */
+	std::ifstream file(cacheFileName.c_str(),std::ios::in|std::ios::binary);
+	if(!file)
+		return false;
+	Misc::UInt32 binaryFormat;
+	if(!file.read(reinterpret_cast<char*>(&binaryFormat),sizeof(Misc::UInt32)))
+		return false;
+	std::string binary((std::istreambuf_iterator<char>(file)),std::istreambuf_iterator<char>());
+	if(binary.empty())
+		return false;
+	
+	/* Create a shader program from the binary: */
+	ProgramBinaryProc programBinary=GLExtensionManager::getFunction<ProgramBinaryProc>("glProgramBinary");
+	program=glCreateProgramObjectARB();
+	programBinary(GLuint(program),GLenum(binaryFormat),binary.data(),GLsizei(binary.size()));
+	
+	/* Check if the driver accepted the binary: */
+	GLint linkStatus;
+	glGetObjectParameterivARB(program,GL_OBJECT_LINK_STATUS_ARB,&linkStatus);
+	if(!linkStatus)
+		{
+		glDeleteObjectARB(program);
+		return false;
+		}
+	
+	return true;
+	}
+
+void storeProgramBinary(GLhandleARB program,const std::string& cacheDirectory,const std::string& cacheFileName) // Writes the binary of the given linked shader program to the given program binary cache file inside the given cache directory; ignores all errors
+	{
+	/* Retrieve the shader program's binary: */
+	GetProgramivProc getProgramiv=GLExtensionManager::getFunction<GetProgramivProc>("glGetProgramiv");
+	GetProgramBinaryProc getProgramBinary=GLExtensionManager::getFunction<GetProgramBinaryProc>("glGetProgramBinary");
+	GLint binaryLength=0;
+	getProgramiv(GLuint(program),GL_PROGRAM_BINARY_LENGTH,&binaryLength);
+	if(binaryLength<=0)
+		return;
+	std::vector<char> binary(binaryLength);
+	GLsizei length=0;
+	GLenum binaryFormat=0;
+	getProgramBinary(GLuint(program),GLsizei(binaryLength),&length,&binaryFormat,&binary.front());
+	if(length<=0)
+		return;
+	
+	/* Write the binary to a uniquely-named temporary file in the cache directory: */
+	std::string tempFileName=cacheDirectory;
+	tempFileName.append("/tmpXXXXXX");
+	std::vector<char> tempFileNameBuffer(tempFileName.begin(),tempFileName.end());
+	tempFileNameBuffer.push_back('\0');
+	int fd=mkstemp(&tempFileNameBuffer.front());
+	if(fd<0)
+		return;
+	Misc::UInt32 format=Misc::UInt32(binaryFormat);
+	bool ok=write(fd,&format,sizeof(Misc::UInt32))==ssize_t(sizeof(Misc::UInt32))&&write(fd,&binary.front(),length)==ssize_t(length);
+	if(close(fd)!=0)
+		ok=false;
+	
+	/* Move the temporary file into place, so that concurrent processes never read a partial file: */
+	if(!ok||rename(&tempFileNameBuffer.front(),cacheFileName.c_str())!=0)
+		unlink(&tempFileNameBuffer.front());
+	}
+
+}
+
+/************************************
+Methods of class ShaderProgramSource:
+************************************/
+
+void ShaderProgramSource::addShader(GLenum type,const std::string& source)
+	{
+	shaders.push_back(Shader());
+	shaders.back().type=type;
+	shaders.back().source=source;
+	}
+
+std::string ShaderProgramSource::readShaderFile(const char* shaderFileName)
+	{
+	/* Construct the full shader source file name: */
+	std::string fullShaderFileName=CONFIG_SHADERDIR;
+	fullShaderFileName.push_back('/');
+	fullShaderFileName.append(shaderFileName);
+	
+	/* Read the entire shader source file: */
+	std::ifstream file(fullShaderFileName.c_str());
+	if(!file)
+		Misc::throwStdErr("ShaderProgramSource: Unable to read shader source file %s",fullShaderFileName.c_str());
+	return std::string((std::istreambuf_iterator<char>(file)),std::istreambuf_iterator<char>());
+	}
+
+Misc::UInt64 ShaderProgramSource::getHash(void) const
+	{
+	/* Hash the types and source codes of all shaders: */
+	Misc::UInt64 result=14695981039346656037ULL;
+	for(std::vector<Shader>::const_iterator sIt=shaders.begin();sIt!=shaders.end();++sIt)
+		{
+		Misc::UInt32 type=Misc::UInt32(sIt->type);
+		result=hashBytes(result,&type,sizeof(Misc::UInt32));
+		result=hashBytes(result,sIt->source.c_str(),sIt->source.size()+1);
+		}
+	return result;
+	}
+
+GLhandleARB ShaderProgramSource::link(void) const
+	{
+	/* Check if the OpenGL context supports retrieving and loading shader program binaries, and the current user has a cache directory: */
+	bool useCache=GLExtensionManager::isExtensionSupported("GL_ARB_get_program_binary");
+	std::string cacheDirectory;
+	if(useCache)
+		{
+		cacheDirectory=getCacheDirectory();
+		useCache=!cacheDirectory.empty();
+		}
+	std::string cacheFileName;
+	if(useCache)
+		{
+		/* Identify the shader program by its source code and the OpenGL driver's identity: */
+		Misc::UInt64 hash=getHash();
+		static const GLenum driverStrings[3]={GL_VENDOR,GL_RENDERER,GL_VERSION};
+		for(int i=0;i<3;++i)
+			{
+			const char* driverString=reinterpret_cast<const char*>(glGetString(driverStrings[i]));
+			if(driverString!=0)
+				hash=hashBytes(hash,driverString,strlen(driverString)+1);
+			}
+		char hashString[17];
+		snprintf(hashString,sizeof(hashString),"%016llx",(unsigned long long)(hash));
+		cacheFileName=cacheDirectory;
+		cacheFileName.push_back('/');
+		cacheFileName.append(hashString);
+		cacheFileName.append(".bin");
+		
+		/* Load the shader program from the cache if it was linked before: */
+		GLhandleARB result;
+		if(loadProgramBinary(cacheFileName,result))
+			return result;
+		}
+	
+	/* Compile all shaders: */
+	std::vector<GLhandleARB> shaderObjects;
+	try
+		{
+		for(std::vector<Shader>::const_iterator sIt=shaders.begin();sIt!=shaders.end();++sIt)
+			{
+			if(sIt->type==GL_VERTEX_SHADER_ARB)
+				shaderObjects.push_back(glCompileVertexShaderFromString(sIt->source.c_str()));
+			else
+				shaderObjects.push_back(glCompileFragmentShaderFromString(sIt->source.c_str()));
+			}
+		}
+	catch(...)
+		{
+		/* Clean up and re-throw the exception: */
+		for(std::vector<GLhandleARB>::iterator soIt=shaderObjects.begin();soIt!=shaderObjects.end();++soIt)
+			glDeleteObjectARB(*soIt);
+		throw;
+		}
+	
+	/* Link the shader program, asking the driver to keep the program's binary retrievable: */
+	GLhandleARB result=glCreateProgramObjectARB();
+	for(std::vector<GLhandleARB>::iterator soIt=shaderObjects.begin();soIt!=shaderObjects.end();++soIt)
+		glAttachObjectARB(result,*soIt);
+	if(useCache)
+		{
+		ProgramParameteriProc programParameteri=GLExtensionManager::getFunction<ProgramParameteriProc>("glProgramParameteri");
+		programParameteri(GLuint(result),GL_PROGRAM_BINARY_RETRIEVABLE_HINT,GL_TRUE);
+		}
+	glLinkProgramARB(result);
+	
+	/* Release the compiled shaders (won't get deleted until shader program is released): */
+	for(std::vector<GLhandleARB>::iterator soIt=shaderObjects.begin();soIt!=shaderObjects.end();++soIt)
+		glDeleteObjectARB(*soIt);
+	
+	/* Check if the shader program linked successfully: */
+	GLint linkStatus;
+	glGetObjectParameterivARB(result,GL_OBJECT_LINK_STATUS_ARB,&linkStatus);
+	if(!linkStatus)
+		{
+		/* Get some more detailed information: */
+		GLcharARB linkLogBuffer[2048];
+		GLsizei linkLogSize;
+		glGetInfoLogARB(result,sizeof(linkLogBuffer),&linkLogSize,linkLogBuffer);
+		glDeleteObjectARB(result);
+		Misc::throwStdErr("ShaderProgramSource::link: Error \"%s\" while linking shader program",linkLogBuffer);
+		}
+	
+	/* Store the shader program's binary in the cache: */
+	if(useCache)
+		storeProgramBinary(result,cacheDirectory,cacheFileName);
+	
+	return result;
+	}
+
 GLhandleARB compileVertexShader(const char* vertexShaderFileName)
 	{
 	/* Construct the full shader source file name: */
@@ -55,16 +319,11 @@ GLhandleARB compileFragmentShader(const char* fragmentShaderFileName)
 
 GLhandleARB linkVertexAndFragmentShader(const char* shaderFileName)
 	{
-	/* Compile the vertex and fragment shaders: */
-	GLhandleARB vertexShader=compileVertexShader(shaderFileName);
-	GLhandleARB fragmentShader=compileFragmentShader(shaderFileName);
-	
-	/* Link the shader program: */
-	GLhandleARB shaderProgram=glLinkShader(vertexShader,fragmentShader);
-	
-	/* Release the compiled shaders (won't get deleted until shader program is released): */
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	/* Collect the vertex and fragment shaders' source code: */
+	ShaderProgramSource source;
+	source.addVertexShaderFile(shaderFileName);
+	source.addFragmentShaderFile(shaderFileName);
 	
-	return shaderProgram;
+	/* Link the shader program through the program binary cache: */
+	return source.link();
 	}
@@ -1,6 +1,7 @@
 /***********************************************************************
-ShaderHelper - Helper functions to create GLSL shaders from text files.
-Copyright (c) 2014 Oliver Kreylos
+ShaderHelper - Helper functions to create GLSL shaders from text files,
+and to cache linked shader programs as binaries on disk.
+Copyright (c) 2014-2018 Oliver Kreylos
 
 This file is part of the Augmented Reality Sandbox (SARndbox).
 
@@ -22,11 +23,55 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef SHADERHELPER_INCLUDED
 #define SHADERHELPER_INCLUDED
 
+#include <string>
+#include <vector>
+#include <Misc/SizedTypes.h>
 #include <GL/gl.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
 
+class ShaderProgramSource // Class to collect the source code of a shader program's shaders, to link the program through the on-disk program binary cache
+	{
+	/* Embedded classes: */
+	private:
+	struct Shader // Structure for the source code of a single shader
+		{
+		/* Elements: */
+		public:
+		GLenum type; // Type of the shader, GL_VERTEX_SHADER_ARB or GL_FRAGMENT_SHADER_ARB
+		std::string source; // Source code of the shader
+		};
+	
+	/* Elements: */
+	std::vector<Shader> shaders; // List of the shader program's shaders in attachment order
+	
+	/* Private methods: */
+	void addShader(GLenum type,const std::string& source); // Adds a shader of the given type and source code
+	static std::string readShaderFile(const char* shaderFileName); // Returns the contents of the given source file in the SARndbox's shader directory
+	
+	/* Methods: */
+	public:
+	void addVertexShader(const std::string& source) // Adds a vertex shader of the given source code
+		{
+		addShader(GL_VERTEX_SHADER_ARB,source);
+		}
+	void addVertexShaderFile(const char* vertexShaderFileName) // Adds a vertex shader from the given source file in the SARndbox's shader directory
+		{
+		addShader(GL_VERTEX_SHADER_ARB,readShaderFile((std::string(vertexShaderFileName)+".vs").c_str()));
+		}
+	void addFragmentShader(const std::string& source) // Adds a fragment shader of the given source code
+		{
+		addShader(GL_FRAGMENT_SHADER_ARB,source);
+		}
+	void addFragmentShaderFile(const char* fragmentShaderFileName) // Adds a fragment shader from the given source file in the SARndbox's shader directory
+		{
+		addShader(GL_FRAGMENT_SHADER_ARB,readShaderFile((std::string(fragmentShaderFileName)+".fs").c_str()));
+		}
+	Misc::UInt64 getHash(void) const; // Returns a hash value identifying the shader program's source code
+	GLhandleARB link(void) const; // Returns a handle to the linked shader program, loaded from the program binary cache if possible; throws exception on compilation or linking errors
+	};
+
 GLhandleARB compileVertexShader(const char* vertexShaderFileName); // Returns a handle to a vertex shader compiled from the given source file in the SARndbox's shader directory
 GLhandleARB compileFragmentShader(const char* fragmentShaderFileName); // Returns a handle to a fragment shader compiled from the given source file in the SARndbox's shader directory
-GLhandleARB linkVertexAndFragmentShader(const char* shaderFileName); // Returns a handle to a shader program linked from a vertex shader and a fragment shader compiled from the given source files in the SARndbox's shader directory
+GLhandleARB linkVertexAndFragmentShader(const char* shaderFileName); // Returns a handle to a shader program linked from a vertex shader and a fragment shader compiled from the given source files in the SARndbox's shader directory, through the program binary cache
 
 #endif
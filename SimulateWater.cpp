@@ -0,0 +1,481 @@
+/***********************************************************************
+SimulateWater - Utility to run the water flow simulation on a digital
+elevation model without a 3D camera or display, to benchmark simulation
+throughput and to pre-compute flooding scenarios.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <Misc/Timer.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
+#include <IO/OStream.h>
+#include <Math/Math.h>
+#include <GL/gl.h>
+#include <GL/Extensions/GLARBTextureRectangle.h>
+#include <GL/GLContextData.h>
+
+#include "OffscreenGLContext.h"
+#include "DEM.h"
+#include "WaterTable2.h"
+#include "WaterStateFile.h"
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+GLfloat sampleDem(const DEM& dem,double x,double y)
+	{
+	/* Convert the given position to DEM pixel space: */
+	const int* demSize=dem.getDemSize();
+	const Scalar* demBox=dem.getDemBox();
+	double dx=(x-double(demBox[0]))*double(demSize[0]-1)/double(demBox[2]-demBox[0]);
+	double dy=(y-double(demBox[1]))*double(demSize[1]-1)/double(demBox[3]-demBox[1]);
+	
+	/* Find the DEM pixel containing the position, clamping to the DEM's boundary: */
+	int x0=Math::max(Math::min(int(Math::floor(dx)),demSize[0]-2),0);
+	int y0=Math::max(Math::min(int(Math::floor(dy)),demSize[1]-2),0);
+	double wx=Math::max(Math::min(dx-double(x0),1.0),0.0);
+	double wy=Math::max(Math::min(dy-double(y0),1.0),0.0);
+	
+	/* Bilinearly interpolate the four surrounding elevation measurements: */
+	const float* d=dem.getDem()+(y0*demSize[0]+x0);
+	int xStep=demSize[0]>1?1:0;
+	int yStep=demSize[1]>1?demSize[0]:0;
+	double e0=double(d[0])*(1.0-wx)+double(d[xStep])*wx;
+	double e1=double(d[yStep])*(1.0-wx)+double(d[yStep+xStep])*wx;
+	return GLfloat(e0*(1.0-wy)+e1*wy);
+	}
+
+void writeWaterDepth(const char* fileName,const GLsizei size[2],const double box[4],const GLfloat* quantity,const GLfloat* bathymetry)
+	{
+	/* Write the water depth grid in the same format as read by DEM::load: */
+	IO::FilePtr file=IO::openFile(fileName,IO::File::WriteOnly);
+	file->setEndianness(Misc::LittleEndian);
+	file->write<int>(size[0]);
+	file->write<int>(size[1]);
+	for(int i=0;i<4;++i)
+		file->write<float>(float(box[i]));
+	
+	/* Calculate water depth at each cell center, using the same cell-centered bathymetry as the simulation shaders: */
+	GLsizei bSize[2]={size[0]-1,size[1]-1};
+	const GLfloat* qPtr=quantity;
+	for(int y=0;y<size[1];++y)
+		{
+		int y0=Math::max(y-1,0);
+		int y1=Math::min(y,bSize[1]-1);
+		for(int x=0;x<size[0];++x,qPtr+=3)
+			{
+			int x0=Math::max(x-1,0);
+			int x1=Math::min(x,bSize[0]-1);
+			float b=(bathymetry[y0*bSize[0]+x0]+bathymetry[y0*bSize[0]+x1]+bathymetry[y1*bSize[0]+x0]+bathymetry[y1*bSize[0]+x1])*0.25f;
+			file->write<float>(Math::max(qPtr[0]-b,0.0f));
+			}
+		}
+	}
+
+void printUsage(void)
+	{
+	std::cout<<"Usage: SimulateWater [option 1] ... [option n] [<DEM file name>]"<<std::endl;
+	std::cout<<"  Options:"<<std::endl;
+	std::cout<<"  -h"<<std::endl;
+	std::cout<<"     Prints this help message"<<std::endl;
+	std::cout<<"  -wts <water grid width> <water grid height>"<<std::endl;
+	std::cout<<"     Sets the width and height of the water flow simulation grid"<<std::endl;
+	std::cout<<"     Default: size of DEM grid"<<std::endl;
+	std::cout<<"  -wl <water level>"<<std::endl;
+	std::cout<<"     Fills the DEM with water up to the given elevation at the start"<<std::endl;
+	std::cout<<"     of the simulation"<<std::endl;
+	std::cout<<"     Default: dry"<<std::endl;
+	std::cout<<"  -lws <water state file name>"<<std::endl;
+	std::cout<<"     Starts the simulation from the bathymetry and water state saved in"<<std::endl;
+	std::cout<<"     the water state file of the given name instead of a DEM"<<std::endl;
+	std::cout<<"     Default: none"<<std::endl;
+	std::cout<<"  -sws <water state file name>"<<std::endl;
+	std::cout<<"     Saves the bathymetry and water state at the end of the simulation"<<std::endl;
+	std::cout<<"     to the water state file of the given name"<<std::endl;
+	std::cout<<"     Default: none"<<std::endl;
+	std::cout<<"  -rs <rain strength>"<<std::endl;
+	std::cout<<"     Adds rain of the given strength in elevation units per second to"<<std::endl;
+	std::cout<<"     the entire DEM during the simulation"<<std::endl;
+	std::cout<<"     Default: 0.0"<<std::endl;
+	std::cout<<"  -t <simulated time>"<<std::endl;
+	std::cout<<"     Sets the simulated time in seconds"<<std::endl;
+	std::cout<<"     Default: 60.0"<<std::endl;
+	std::cout<<"  -ss <snapshot interval> <snapshot file name prefix>"<<std::endl;
+	std::cout<<"     Writes a water depth grid in DEM format every given interval of"<<std::endl;
+	std::cout<<"     simulated time to files <prefix>-<index>.dem"<<std::endl;
+	std::cout<<"     Default: no snapshots"<<std::endl;
+	std::cout<<"  -tf <timing file name>"<<std::endl;
+	std::cout<<"     Writes the step size and wall-clock time of each simulation step"<<std::endl;
+	std::cout<<"     to the given file in CSV format; waits for each step to finish on"<<std::endl;
+	std::cout<<"     the GPU, which reduces overall throughput"<<std::endl;
+	std::cout<<"     Default: no timing file"<<std::endl;
+	std::cout<<"  -ms <max step size>"<<std::endl;
+	std::cout<<"     Sets the maximum step size of a single simulation step in seconds"<<std::endl;
+	std::cout<<"     Default: 1.0"<<std::endl;
+	std::cout<<"  -whp"<<std::endl;
+	std::cout<<"     Stores the water simulation's temporal derivative and intermediate"<<std::endl;
+	std::cout<<"     quantity grids in half precision"<<std::endl;
+	std::cout<<"  -wmp"<<std::endl;
+	std::cout<<"     Runs the water simulation's temporal derivative calculations in"<<std::endl;
+	std::cout<<"     separate passes"<<std::endl;
+	std::cout<<"  -wlt <max levels>"<<std::endl;
+	std::cout<<"     Lets tiles of the water grid halve the simulation step size up to"<<std::endl;
+	std::cout<<"     the given number of times to satisfy their own stability limits,"<<std::endl;
+	std::cout<<"     instead of running the entire grid at the smallest step size"<<std::endl;
+	std::cout<<"     Default: 0"<<std::endl;
+	std::cout<<"  -display <X display name>"<<std::endl;
+	std::cout<<"     Selects the X server on which to create the OpenGL context"<<std::endl;
+	std::cout<<"     Default: DISPLAY environment variable"<<std::endl;
+	}
+
+}
+
+int main(int argc,char* argv[])
+	{
+	/* Process command line parameters: */
+	const char* demFileName=0;
+	GLsizei size[2]={0,0};
+	bool haveWaterLevel=false;
+	GLfloat waterLevel=0.0f;
+	const char* loadStateFileName=0;
+	const char* saveStateFileName=0;
+	GLfloat rainStrength=0.0f;
+	double duration=60.0;
+	double snapshotInterval=0.0;
+	const char* snapshotPrefix=0;
+	const char* timingFileName=0;
+	GLfloat maxStepSize=1.0f;
+	bool halfPrecision=false;
+	bool fusedSteps=true;
+	unsigned int localTimeSteppingLevels=0;
+	const char* displayName=0;
+	for(int i=1;i<argc;++i)
+		{
+		if(argv[i][0]=='-')
+			{
+			if(strcasecmp(argv[i]+1,"h")==0)
+				{
+				printUsage();
+				return 0;
+				}
+			else if(strcasecmp(argv[i]+1,"wts")==0&&i+2<argc)
+				{
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					size[j]=GLsizei(atoi(argv[i]));
+					}
+				}
+			else if(strcasecmp(argv[i]+1,"wl")==0&&i+1<argc)
+				{
+				++i;
+				haveWaterLevel=true;
+				waterLevel=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"lws")==0&&i+1<argc)
+				{
+				++i;
+				loadStateFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"sws")==0&&i+1<argc)
+				{
+				++i;
+				saveStateFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"rs")==0&&i+1<argc)
+				{
+				++i;
+				rainStrength=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"t")==0&&i+1<argc)
+				{
+				++i;
+				duration=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"ss")==0&&i+2<argc)
+				{
+				++i;
+				snapshotInterval=atof(argv[i]);
+				++i;
+				snapshotPrefix=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"tf")==0&&i+1<argc)
+				{
+				++i;
+				timingFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"ms")==0&&i+1<argc)
+				{
+				++i;
+				maxStepSize=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"whp")==0)
+				halfPrecision=true;
+			else if(strcasecmp(argv[i]+1,"wmp")==0)
+				fusedSteps=false;
+			else if(strcasecmp(argv[i]+1,"wlt")==0&&i+1<argc)
+				{
+				++i;
+				localTimeSteppingLevels=(unsigned int)(atoi(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"display")==0&&i+1<argc)
+				{
+				++i;
+				displayName=argv[i];
+				}
+			else
+				std::cerr<<"Ignoring unrecognized command line option "<<argv[i]<<std::endl;
+			}
+		else if(demFileName==0)
+			demFileName=argv[i];
+		else
+			std::cerr<<"Ignoring extra command line argument "<<argv[i]<<std::endl;
+		}
+	if(demFileName==0&&loadStateFileName==0)
+		{
+		printUsage();
+		return 1;
+		}
+	if(demFileName!=0&&loadStateFileName!=0)
+		{
+		std::cerr<<"Ignoring DEM file "<<demFileName<<" in favor of water state file "<<loadStateFileName<<std::endl;
+		demFileName=0;
+		}
+	
+	try
+		{
+		GLfloat cellSize[2];
+		double box[4]; // Extent of the simulation domain in the DEM's or water state file's coordinates
+		float elevationMin,elevationMax;
+		GLfloat* bathymetry=0;
+		WaterStateFile* stateFile=0;
+		if(loadStateFileName!=0)
+			{
+			/* Map the water state file: */
+			stateFile=new WaterStateFile(loadStateFileName);
+			for(int i=0;i<2;++i)
+				{
+				size[i]=stateFile->getSize()[i];
+				cellSize[i]=stateFile->getCellSize()[i];
+				box[i]=0.0;
+				box[2+i]=double(size[i])*double(cellSize[i]);
+				}
+			
+			/* Calculate the elevation range of the bathymetry and the water surface: */
+			const GLfloat* b=stateFile->getBathymetry();
+			elevationMin=elevationMax=b[0];
+			for(int i=1;i<(size[1]-1)*(size[0]-1);++i)
+				{
+				elevationMin=Math::min(elevationMin,b[i]);
+				elevationMax=Math::max(elevationMax,b[i]);
+				}
+			const GLfloat* q=stateFile->getQuantity();
+			for(int i=0;i<size[1]*size[0];++i)
+				elevationMax=Math::max(elevationMax,q[i*3]);
+			}
+		else
+			{
+			/* Load the DEM: */
+			DEM dem;
+			dem.load(demFileName);
+			const int* demSize=dem.getDemSize();
+			const Scalar* demBox=dem.getDemBox();
+			if(size[0]<=1||size[1]<=1)
+				{
+				size[0]=GLsizei(demSize[0]);
+				size[1]=GLsizei(demSize[1]);
+				}
+			for(int i=0;i<4;++i)
+				box[i]=double(demBox[i]);
+			
+			/* Calculate the water table's cell size and the DEM's elevation range: */
+			cellSize[0]=GLfloat((demBox[2]-demBox[0])/Scalar(size[0]));
+			cellSize[1]=GLfloat((demBox[3]-demBox[1])/Scalar(size[1]));
+			elevationMin=dem.getDem()[0];
+			elevationMax=elevationMin;
+			for(int i=1;i<demSize[1]*demSize[0];++i)
+				{
+				elevationMin=Math::min(elevationMin,dem.getDem()[i]);
+				elevationMax=Math::max(elevationMax,dem.getDem()[i]);
+				}
+			
+			/* Resample the DEM into the water table's vertex-centered bathymetry grid: */
+			GLsizei bSize[2]={size[0]-1,size[1]-1};
+			bathymetry=new GLfloat[bSize[1]*bSize[0]];
+			GLfloat* bPtr=bathymetry;
+			for(int y=0;y<bSize[1];++y)
+				for(int x=0;x<bSize[0];++x,++bPtr)
+					*bPtr=sampleDem(dem,double(demBox[0])+double(x+1)*double(cellSize[0]),double(demBox[1])+double(y+1)*double(cellSize[1]));
+			}
+		
+		/* Create an OpenGL context to run the simulation: */
+		OffscreenGLContext context(displayName);
+		context.makeCurrent();
+		GLContextData& contextData=context.getContextData();
+		
+		/* Create and initialize a water table for offline simulation: */
+		WaterTable2 waterTable(size[0],size[1],cellSize);
+		waterTable.setElevationRange(Scalar(elevationMin),Scalar(Math::max(elevationMax,haveWaterLevel?waterLevel:elevationMax)));
+		waterTable.setWaterDeposit(rainStrength);
+		waterTable.setHalfPrecision(halfPrecision);
+		waterTable.setFusedSteps(fusedSteps);
+		waterTable.setLocalTimeSteppingLevels(localTimeSteppingLevels);
+		waterTable.initContext(contextData);
+		if(stateFile!=0)
+			{
+			/* Restore the saved bathymetry and water state directly from the mapped file: */
+			Misc::Timer restoreTimer;
+			waterTable.restoreState(*stateFile,contextData);
+			glFinish();
+			restoreTimer.elapse();
+			std::cout<<"Restored water state from "<<loadStateFileName<<" in "<<restoreTimer.getTime()*1000.0<<" ms"<<std::endl;
+			}
+		else
+			{
+			waterTable.updateBathymetry(bathymetry,contextData);
+			
+			/* Set the initial water level; the water table raises it to the bathymetry where it is below: */
+			GLfloat* waterGrid=new GLfloat[size[1]*size[0]];
+			for(int i=0;i<size[1]*size[0];++i)
+				waterGrid[i]=haveWaterLevel?waterLevel:elevationMin;
+			waterTable.setWaterLevel(waterGrid,contextData);
+			delete[] waterGrid;
+			}
+		const GLfloat* bathymetryGrid=stateFile!=0?stateFile->getBathymetry():bathymetry;
+		
+		/* Calculate the bounding box of the water table's cell centers for snapshot files: */
+		double snapshotBox[4];
+		for(int i=0;i<2;++i)
+			{
+			snapshotBox[i]=box[i]+double(cellSize[i])*0.5;
+			snapshotBox[2+i]=box[2+i]-double(cellSize[i])*0.5;
+			}
+		GLfloat* quantity=new GLfloat[size[1]*size[0]*3];
+		
+		/* Open the optional timing file: */
+		IO::OStream* timingFile=0;
+		if(timingFileName!=0)
+			{
+			timingFile=new IO::OStream(IO::openFile(timingFileName,IO::File::WriteOnly));
+			*timingFile<<"Step,Simulation time,Step size,Wall time (ms)"<<std::endl;
+			}
+		
+		/* Run the simulation: */
+		std::cout<<"Simulating "<<duration<<" s on a "<<size[0]<<" x "<<size[1]<<" grid with "<<cellSize[0]<<" x "<<cellSize[1]<<" cells"<<std::endl;
+		double simulationTime=0.0;
+		unsigned int numSteps=0;
+		unsigned int snapshotIndex=0;
+		double nextSnapshotTime=snapshotPrefix!=0?0.0:duration;
+		double simulationWallTime=0.0;
+		Misc::Timer timer;
+		while(true)
+			{
+			/* Write a snapshot if it is due: */
+			if(snapshotPrefix!=0&&simulationTime>=nextSnapshotTime-1.0e-6)
+				{
+				/* Read back the current conserved quantity grid: */
+				glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+				waterTable.bindQuantityTexture(contextData);
+				glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB,GL_FLOAT,quantity);
+				glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+				
+				char snapshotFileName[1024];
+				snprintf(snapshotFileName,sizeof(snapshotFileName),"%s-%04u.dem",snapshotPrefix,snapshotIndex);
+				writeWaterDepth(snapshotFileName,size,snapshotBox,quantity,bathymetryGrid);
+				++snapshotIndex;
+				nextSnapshotTime+=snapshotInterval>0.0?snapshotInterval:duration;
+				
+				/* Don't count snapshot read-back against simulation throughput: */
+				timer.elapse();
+				}
+			if(simulationTime>=duration-1.0e-6)
+				break;
+			
+			/* Run simulation steps until the next snapshot or the end of the simulation: */
+			double stopTime=Math::min(nextSnapshotTime,duration);
+			while(stopTime-simulationTime>1.0e-6)
+				{
+				waterTable.setMaxStepSize(GLfloat(Math::min(stopTime-simulationTime,double(maxStepSize))));
+				GLfloat stepSize=waterTable.runSimulationStep(false,contextData);
+				simulationTime+=double(stepSize);
+				++numSteps;
+				
+				if(timingFile!=0)
+					{
+					/* Wait for the step to finish and log its time: */
+					glFinish();
+					timer.elapse();
+					simulationWallTime+=timer.getTime();
+					*timingFile<<numSteps<<','<<simulationTime<<','<<stepSize<<','<<timer.getTime()*1000.0<<std::endl;
+					}
+				}
+			glFinish();
+			timer.elapse();
+			simulationWallTime+=timer.getTime();
+			}
+		
+		/* Print throughput statistics: */
+		std::cout<<"Simulated "<<simulationTime<<" s in "<<numSteps<<" steps and "<<simulationWallTime<<" s wall-clock time"<<std::endl;
+		if(numSteps>0&&simulationWallTime>0.0)
+			{
+			std::cout<<std::setprecision(4)<<simulationWallTime*1000.0/double(numSteps)<<" ms per step, ";
+			std::cout<<double(numSteps)/simulationWallTime<<" steps per second, ";
+			std::cout<<double(numSteps)*double(size[0])*double(size[1])/(simulationWallTime*1.0e6)<<" million cell updates per second, ";
+			std::cout<<simulationTime/simulationWallTime<<" x real time"<<std::endl;
+			}
+		
+		if(saveStateFileName!=0)
+			{
+			/* Read back the final bathymetry and conserved quantity grids and save them: */
+			GLfloat* finalBathymetry=new GLfloat[(size[1]-1)*(size[0]-1)];
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			waterTable.bindBathymetryTexture(contextData);
+			glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,finalBathymetry);
+			waterTable.bindQuantityTexture(contextData);
+			glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB,GL_FLOAT,quantity);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			WaterStateFile::write(saveStateFileName,waterTable,finalBathymetry,quantity);
+			delete[] finalBathymetry;
+			}
+		
+		/* Clean up: */
+		delete timingFile;
+		delete[] quantity;
+		delete[] bathymetry;
+		delete stateFile;
+		context.release();
+		}
+	catch(const std::runtime_error& err)
+		{
+		std::cerr<<"Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	
+	return 0;
+	}
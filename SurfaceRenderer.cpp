@@ -23,10 +23,12 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "SurfaceRenderer.h"
 
 #include <string>
-#include <vector>
+#include <map>
 #include <Misc/PrintInteger.h>
 #include <Misc/ThrowStdErr.h>
 #include <Misc/MessageLogger.h>
+#include <Math/Math.h>
+#include <Math/Constants.h>
 #include <GL/gl.h>
 #include <GL/GLVertexArrayParts.h>
 #include <GL/Extensions/GLARBFragmentShader.h>
@@ -46,6 +48,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ElevationColorMap.h"
 #include "DEM.h"
 #include "WaterTable2.h"
+#include "WaterNoise.h"
+#include "PassProfiler.h"
 #include "ShaderHelper.h"
 #include "Config.h"
 
@@ -75,7 +79,8 @@ SurfaceRenderer::DataItem::~DataItem(void)
 	glDeleteFramebuffersEXT(1,&contourLineFramebufferObject);
 	glDeleteRenderbuffersEXT(1,&contourLineDepthBufferObject);
 	glDeleteTextures(1,&contourLineColorTextureObject);
-	glDeleteObjectARB(heightMapShader);
+	for(std::map<Misc::UInt64,HeightMapShader>::iterator hmsIt=heightMapShaders.begin();hmsIt!=heightMapShaders.end();++hmsIt)
+		glDeleteObjectARB(hmsIt->second.shader);
 	glDeleteObjectARB(globalAmbientHeightMapShader);
 	glDeleteObjectARB(shadowedIlluminatedHeightMapShader);
 	}
@@ -90,11 +95,10 @@ void SurfaceRenderer::shaderSourceFileChanged(const IO::FileMonitor::Event& even
 	++surfaceSettingsVersion;
 	}
 
-GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker& lt,GLint* uniformLocations) const
+void SurfaceRenderer::updateSinglePassSurfaceShader(const GLLightTracker& lt,SurfaceRenderer::DataItem* dataItem) const
 	{
-	GLhandleARB result=0;
+	ShaderProgramSource source;
 	
-	std::vector<GLhandleARB> shaders;
 	try
 		{
 		/*********************************************************************
@@ -203,17 +207,17 @@ GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker&
 			/* Add declarations for illumination: */
 			vertexUniforms+="\
 				uniform mat4 modelview; // Transformation from camera space to eye space\n\
-				uniform mat4 tangentModelviewDepthProjection; // Transformation from depth image space to eye space for tangent planes\n";
+				uniform mat4 tangentModelviewDepthProjection; // Transformation from depth image space to eye space for tangent planes\n\
+				uniform sampler2DRect tangentSampler; // Sampler for the depth image-space tangent plane texture\n";
 			
 			vertexVaryings+="\
 				varying vec4 diffColor,specColor; // Diffuse and specular colors, interpolated separately for correct highlights\n";
 			
 			/* Add illumination code to vertex shader's main function: */
 			vertexMain+="\
-				/* Calculate the vertex' tangent plane equation in depth image space: */\n\
+				/* Get the vertex' tangent plane equation in depth image space from the precomputed tangent plane texture: */\n\
 				vec4 tangentDic;\n\
-				tangentDic.x=texture2DRect(depthSampler,vec2(vertexDic.x-1.0,vertexDic.y)).r-texture2DRect(depthSampler,vec2(vertexDic.x+1.0,vertexDic.y)).r;\n\
-				tangentDic.y=texture2DRect(depthSampler,vec2(vertexDic.x,vertexDic.y-1.0)).r-texture2DRect(depthSampler,vec2(vertexDic.x,vertexDic.y+1.0)).r;\n\
+				tangentDic.xy=texture2DRect(tangentSampler,vertexDic.xy).rg;\n\
 				tangentDic.z=2.0;\n\
 				tangentDic.w=-dot(vertexDic.xyz,tangentDic.xyz)/vertexDic.w;\n\
 				\n\
@@ -275,8 +279,8 @@ GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker&
 				gl_Position=projectionModelviewDepthProjection*vertexDic;\n\
 				}\n";
 		
-		/* Compile the vertex shader: */
-		shaders.push_back(glCompileVertexShaderFromStrings(7,vertexFunctions.c_str(),"\t\t\n",vertexUniforms.c_str(),"\t\t\n",vertexVaryings.c_str(),"\t\t\n",vertexMain.c_str()));
+		/* Add the vertex shader: */
+		source.addVertexShader(vertexFunctions+"\t\t\n"+vertexUniforms+"\t\t\n"+vertexVaryings+"\t\t\n"+vertexMain);
 		
 		/*********************************************************************
 		Assemble and compile the surface rendering fragment shaders:
@@ -361,8 +365,8 @@ GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker&
 			fragmentDeclarations+="\
 				void addContourLines(in vec2,inout vec4);\n";
 			
-			/* Compile the contour line shader: */
-			shaders.push_back(compileFragmentShader("SurfaceAddContourLines"));
+			/* Add the contour line shader: */
+			source.addFragmentShaderFile("SurfaceAddContourLines");
 			
 			/* Call contour line function from fragment shader's main function: */
 			fragmentMain+="\
@@ -377,8 +381,8 @@ GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker&
 			fragmentDeclarations+="\
 				void illuminate(inout vec4);\n";
 			
-			/* Compile the illumination shader: */
-			shaders.push_back(compileFragmentShader("SurfaceIlluminate"));
+			/* Add the illumination shader: */
+			source.addFragmentShaderFile("SurfaceIlluminate");
 			
 			/* Call illumination function from fragment shader's main function: */
 			fragmentMain+="\
@@ -394,11 +398,11 @@ GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker&
 				void addWaterColor(in vec2,inout vec4);\n\
 				void addWaterColorAdvected(inout vec4);\n";
 			
-			/* Compile the water handling shader: */
-			shaders.push_back(compileFragmentShader("SurfaceAddWaterColor"));
+			/* Add the water handling shader: */
+			source.addFragmentShaderFile("SurfaceAddWaterColor");
 			
 			/* Call water coloring function from fragment shader's main function: */
-			if(advectWaterTexture)
+			if(advectWaterTexture&&waterNoise!=0)
 				{
 				fragmentMain+="\
 					/* Modulate the base color with water color: */\n\
@@ -420,21 +424,30 @@ GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker&
 			gl_FragColor=baseColor;\n\
 			}\n";
 		
-		/* Compile the fragment shader: */
-		shaders.push_back(glCompileFragmentShaderFromStrings(7,fragmentDeclarations.c_str(),"\t\t\n",fragmentUniforms.c_str(),"\t\t\n",fragmentVaryings.c_str(),"\t\t\n",fragmentMain.c_str()));
+		/* Add the fragment shader: */
+		source.addFragmentShader(fragmentDeclarations+"\t\t\n"+fragmentUniforms+"\t\t\n"+fragmentVaryings+"\t\t\n"+fragmentMain);
 		
-		/* Link the shader program: */
-		result=glLinkShader(shaders);
+		/* Select the shader program if it was already created from the same source code: */
+		Misc::UInt64 sourceHash=source.getHash();
+		std::map<Misc::UInt64,HeightMapShader>::iterator hmsIt=dataItem->heightMapShaders.find(sourceHash);
+		if(hmsIt!=dataItem->heightMapShaders.end())
+			{
+			dataItem->heightMapShader=hmsIt->second.shader;
+			for(int i=0;i<20;++i)
+				dataItem->heightMapShaderUniforms[i]=hmsIt->second.uniforms[i];
+			return;
+			}
 		
-		/* Release all compiled shaders: */
-		for(std::vector<GLhandleARB>::iterator shIt=shaders.begin();shIt!=shaders.end();++shIt)
-			glDeleteObjectARB(*shIt);
+		/* Link the shader program: */
+		HeightMapShader newShader;
+		GLhandleARB result=source.link();
+		newShader.shader=result;
 		
 		/*******************************************************************
 		Query the shader program's uniform locations:
 		*******************************************************************/
 		
-		GLint* ulPtr=uniformLocations;
+		GLint* ulPtr=newShader.uniforms;
 		
 		/* Query common uniform variables: */
 		*(ulPtr++)=glGetUniformLocationARB(result,"depthSampler");
@@ -470,6 +483,7 @@ GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker&
 			/* Query illumination uniform variables: */
 			*(ulPtr++)=glGetUniformLocationARB(result,"modelview");
 			*(ulPtr++)=glGetUniformLocationARB(result,"tangentModelviewDepthProjection");
+			*(ulPtr++)=glGetUniformLocationARB(result,"tangentSampler");
 			}
 		if(waterTable!=0&&dem==0)
 			{
@@ -480,22 +494,36 @@ GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker&
 			*(ulPtr++)=glGetUniformLocationARB(result,"waterCellSize");
 			*(ulPtr++)=glGetUniformLocationARB(result,"waterOpacity");
 			*(ulPtr++)=glGetUniformLocationARB(result,"waterAnimationTime");
+			*(ulPtr++)=glGetUniformLocationARB(result,"waterNoiseSampler");
 			}
 		*(ulPtr++)=glGetUniformLocationARB(result,"projectionModelviewDepthProjection");
+		
+		/* Store and select the new shader program: */
+		dataItem->heightMapShaders.insert(std::make_pair(sourceHash,newShader));
+		dataItem->heightMapShader=newShader.shader;
+		for(int i=0;i<20;++i)
+			dataItem->heightMapShaderUniforms[i]=newShader.uniforms[i];
 		}
-	catch(...)
+	catch(const std::runtime_error& err)
 		{
-		/* Clean up and re-throw the exception: */
-		for(std::vector<GLhandleARB>::iterator shIt=shaders.begin();shIt!=shaders.end();++shIt)
-			glDeleteObjectARB(*shIt);
-		throw;
+		/* Re-throw the exception; the previously selected shader program remains in use: */
+		Misc::throwStdErr("SurfaceRenderer::updateSinglePassSurfaceShader: Unable to build surface shader due to exception %s",err.what());
 		}
-	
-	return result;
 	}
 
 void SurfaceRenderer::renderPixelCornerElevations(const int viewport[4],const PTransform& projectionModelview,GLContextData& contextData,SurfaceRenderer::DataItem* dataItem) const
 	{
+	/* Check if the pixel-corner elevations are still valid for the current depth image and view: */
+	unsigned int depthImageVersion=depthImageRenderer->getDepthImageVersion();
+	bool viewValid=dataItem->contourLineFramebufferObject!=0&&dataItem->contourLineFramebufferSize[0]==(unsigned int)(viewport[2]+1)&&dataItem->contourLineFramebufferSize[1]==(unsigned int)(viewport[3]+1);
+	for(int i=0;i<4&&viewValid;++i)
+		for(int j=0;j<4&&viewValid;++j)
+			viewValid=dataItem->contourLineProjectionModelview.getMatrix()(i,j)==projectionModelview.getMatrix()(i,j);
+	if(viewValid&&dataItem->contourLineVersion==depthImageVersion)
+		return;
+	
+	PassProfiler::Timer pixelCornersTimer(profiler,PassProfiler::SURFACE_PIXEL_CORNERS,contextData);
+	
 	/* Save the currently-bound frame buffer and clear color: */
 	GLint currentFrameBuffer;
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
@@ -549,11 +577,6 @@ void SurfaceRenderer::renderPixelCornerElevations(const int viewport[4],const PT
 			}
 		}
 	
-	/* Extend the viewport to render the corners of all pixels: */
-	glViewport(0,0,viewport[2]+1,viewport[3]+1);
-	glClearColor(0.0f,0.0f,0.0f,1.0f);
-	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-	
 	/* Shift the projection matrix by half a pixel to render the corners of the final pixels: */
 	PTransform shiftedProjectionModelview=projectionModelview;
 	PTransform::Matrix& spmm=shiftedProjectionModelview.getMatrix();
@@ -565,11 +588,73 @@ void SurfaceRenderer::renderPixelCornerElevations(const int viewport[4],const PT
 		spmm(1,j)*=ys;
 		}
 	
-	/* Render the surface elevation into the half-pixel offset frame buffer: */
-	depthImageRenderer->renderElevation(shiftedProjectionModelview,contextData);
+	/* Calculate the dirty region of the frame buffer; the entire frame buffer is dirty if the view changed: */
+	GLint region[4]; // Dirty region as x, y, width, height in frame buffer pixels
+	region[0]=0;
+	region[1]=0;
+	region[2]=viewport[2]+1;
+	region[3]=viewport[3]+1;
+	DepthImageRenderer::Box dirtyBox;
+	if(viewValid&&depthImageRenderer->getDirtyBox(dataItem->contourLineVersion,dirtyBox))
+		{
+		/* Project the dirty box into the frame buffer, with one pixel of slack: */
+		Scalar windowMin[2],windowMax[2];
+		for(int i=0;i<2;++i)
+			{
+			windowMin[i]=Math::Constants<Scalar>::max;
+			windowMax[i]=-Math::Constants<Scalar>::max;
+			}
+		bool inFront=true;
+		for(int i=0;i<8&&inFront;++i)
+			{
+			PTransform::HVector cp=shiftedProjectionModelview.transform(PTransform::HVector(dirtyBox.getVertex(i)));
+			inFront=cp[3]>Scalar(0);
+			for(int j=0;j<2;++j)
+				{
+				Scalar w=(cp[j]/cp[3]+Scalar(1))*Scalar(region[2+j])*Scalar(0.5);
+				if(windowMin[j]>w)
+					windowMin[j]=w;
+				if(windowMax[j]<w)
+					windowMax[j]=w;
+				}
+			}
+		if(inFront)
+			{
+			for(int i=0;i<2;++i)
+				{
+				Scalar rMin=Math::floor(windowMin[i])-Scalar(1);
+				Scalar rMax=Math::ceil(windowMax[i])+Scalar(1);
+				if(rMin<Scalar(0))
+					rMin=Scalar(0);
+				if(rMax>Scalar(region[2+i]))
+					rMax=Scalar(region[2+i]);
+				region[i]=rMax>rMin?GLint(rMin):0;
+				region[2+i]=rMax>rMin?GLint(rMax-rMin):0;
+				}
+			}
+		}
+	
+	if(region[2]!=0&&region[3]!=0)
+		{
+		/* Extend the viewport to render the corners of all pixels, and restrict rendering to the dirty region: */
+		glPushAttrib(GL_SCISSOR_BIT);
+		glViewport(0,0,viewport[2]+1,viewport[3]+1);
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(region[0],region[1],region[2],region[3]);
+		glClearColor(0.0f,0.0f,0.0f,1.0f);
+		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+		
+		/* Render the surface elevation into the half-pixel offset frame buffer: */
+		depthImageRenderer->renderElevation(shiftedProjectionModelview,contextData);
+		
+		/* Restore the original viewport and scissor state: */
+		glViewport(viewport[0],viewport[1],viewport[2],viewport[3]);
+		glPopAttrib();
+		}
 	
-	/* Restore the original viewport: */
-	glViewport(viewport[0],viewport[1],viewport[2],viewport[3]);
+	/* Mark the pixel-corner elevations as up-to-date: */
+	dataItem->contourLineVersion=depthImageVersion;
+	dataItem->contourLineProjectionModelview=projectionModelview;
 	
 	/* Restore the original clear color and frame buffer binding: */
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
@@ -584,9 +669,10 @@ SurfaceRenderer::SurfaceRenderer(const DepthImageRenderer* sDepthImageRenderer)
 	 dippingBedPlane(Plane::Vector(0,0,1),0.0f),dippingBedThickness(1),
 	 dem(0),demDistScale(1.0f),
 	 illuminate(false),
-	 waterTable(0),advectWaterTexture(false),waterOpacity(2.0f),
+	 waterTable(0),advectWaterTexture(false),waterNoise(0),waterOpacity(2.0f),
 	 surfaceSettingsVersion(1),
-	 animationTime(0.0)
+	 animationTime(0.0),
+	 profiler(0)
 	{
 	/* Copy the depth image size: */
 	for(int i=0;i<2;++i)
@@ -619,7 +705,7 @@ void SurfaceRenderer::initContext(GLContextData& contextData) const
 	contextData.addDataItem(this,dataItem);
 	
 	/* Create the height map render shader: */
-	dataItem->heightMapShader=createSinglePassSurfaceShader(*contextData.getLightTracker(),dataItem->heightMapShaderUniforms);
+	updateSinglePassSurfaceShader(*contextData.getLightTracker(),dataItem);
 	dataItem->surfaceSettingsVersion=surfaceSettingsVersion;
 	dataItem->lightTrackerVersion=contextData.getLightTracker()->getVersion();
 	
@@ -742,7 +828,13 @@ void SurfaceRenderer::setWaterTable(WaterTable2* newWaterTable)
 
 void SurfaceRenderer::setAdvectWaterTexture(bool newAdvectWaterTexture)
 	{
-	advectWaterTexture=false; // newAdvectWaterTexture;
+	advectWaterTexture=newAdvectWaterTexture;
+	++surfaceSettingsVersion;
+	}
+
+void SurfaceRenderer::setWaterNoise(const WaterNoise* newWaterNoise)
+	{
+	waterNoise=newWaterNoise;
 	++surfaceSettingsVersion;
 	}
 
@@ -761,10 +853,16 @@ void SurfaceRenderer::setAnimationTime(double newAnimationTime)
 	fileMonitor.processEvents();
 	}
 
+void SurfaceRenderer::setProfiler(const PassProfiler* newProfiler)
+	{
+	profiler=newProfiler;
+	}
+
 void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& projection,const OGTransform& modelview,GLContextData& contextData) const
 	{
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	PassProfiler::Timer renderTimer(profiler,PassProfiler::SURFACE_RENDER,contextData);
 	
 	/* Calculate the required matrices: */
 	PTransform projectionModelview=projection;
@@ -790,12 +888,10 @@ void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& p
 	/* Check if the single-pass surface shader is outdated: */
 	if(dataItem->surfaceSettingsVersion!=surfaceSettingsVersion||(illuminate&&dataItem->lightTrackerVersion!=contextData.getLightTracker()->getVersion()))
 		{
-		/* Rebuild the shader: */
+		/* Select or rebuild the shader: */
 		try
 			{
-			GLhandleARB newShader=createSinglePassSurfaceShader(*contextData.getLightTracker(),dataItem->heightMapShaderUniforms);
-			glDeleteObjectARB(dataItem->heightMapShader);
-			dataItem->heightMapShader=newShader;
+			updateSinglePassSurfaceShader(*contextData.getLightTracker(),dataItem);
 			}
 		catch(const std::runtime_error& err)
 			{
@@ -889,6 +985,11 @@ void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& p
 		for(int i=0;i<16;++i,++tmdpPtr,++mPtr)
 				*mPtr=GLfloat(*tmdpPtr);
 		glUniformMatrix4fvARB(*(ulPtr++),1,GL_FALSE,matrix);
+		
+		/* Bind the tangent plane texture, which is calculated once per depth image: */
+		glActiveTextureARB(GL_TEXTURE5_ARB);
+		depthImageRenderer->bindTangentTexture(contextData);
+		glUniform1iARB(*(ulPtr++),5);
 		}
 	
 	if(waterTable!=0&&dem==0)
@@ -922,6 +1023,15 @@ void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& p
 		
 		/* Upload the water animation time: */
 		glUniform1fARB(*(ulPtr++),GLfloat(animationTime));
+		
+		if(waterNoise!=0)
+			{
+			/* Bind the water noise volume texture: */
+			glActiveTextureARB(GL_TEXTURE6_ARB);
+			waterNoise->bindTexture(contextData);
+			glUniform1iARB(*ulPtr,6);
+			}
+		++ulPtr;
 		}
 	
 	/* Upload the combined projection, modelview, and depth unprojection matrix: */
@@ -933,8 +1043,18 @@ void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& p
 	depthImageRenderer->renderSurfaceTemplate(contextData);
 	
 	/* Unbind all textures and buffers: */
+	if(illuminate)
+		{
+		glActiveTextureARB(GL_TEXTURE5_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		}
 	if(waterTable!=0&&dem==0)
 		{
+		if(waterNoise!=0)
+			{
+			glActiveTextureARB(GL_TEXTURE6_ARB);
+			glBindTexture(GL_TEXTURE_3D,0);
+			}
 		glActiveTextureARB(GL_TEXTURE4_ARB);
 		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
@@ -23,6 +23,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef SURFACERENDERER_INCLUDED
 #define SURFACERENDERER_INCLUDED
 
+#include <map>
+#include <Misc/SizedTypes.h>
 #include <IO/FileMonitor.h>
 #include <Geometry/ProjectiveTransformation.h>
 #include <Geometry/Plane.h>
@@ -39,6 +41,8 @@ class ElevationColorMap;
 class GLLightTracker;
 class DEM;
 class WaterTable2;
+class WaterNoise;
+class PassProfiler;
 
 class SurfaceRenderer:public GLObject
 	{
@@ -47,6 +51,14 @@ class SurfaceRenderer:public GLObject
 	typedef Geometry::Plane<GLfloat,3> Plane; // Type for plane equations
 	
 	private:
+	struct HeightMapShader // Structure for a single-pass surface shader created for one combination of surface settings
+		{
+		/* Elements: */
+		public:
+		GLhandleARB shader; // Shader program to render the surface
+		GLint uniforms[20]; // Locations of the shader program's uniform variables
+		};
+	
 	struct DataItem:public GLObject::DataItem
 		{
 		/* Elements: */
@@ -56,8 +68,10 @@ class SurfaceRenderer:public GLObject
 		GLuint contourLineDepthBufferObject; // Depth render buffer for topographic contour line frame buffer
 		GLuint contourLineColorTextureObject; // Color texture object for topographic contour line frame buffer
 		unsigned int contourLineVersion; // Version number of depth image used for contour line generation
+		PTransform contourLineProjectionModelview; // Projection and modelview matrix used for contour line generation
+		std::map<Misc::UInt64,HeightMapShader> heightMapShaders; // Map of all single-pass surface shaders created so far, keyed by the hash of their source code
 		GLhandleARB heightMapShader; // Shader program to render the surface using a height color map
-		GLint heightMapShaderUniforms[16]; // Locations of the height map shader's uniform variables
+		GLint heightMapShaderUniforms[20]; // Locations of the height map shader's uniform variables
 		unsigned int surfaceSettingsVersion; // Version number of surface settings for which the height map shader was built
 		unsigned int lightTrackerVersion; // Version number of light tracker state for which the height map shader was built
 		GLhandleARB globalAmbientHeightMapShader; // Shader program to render the global ambient component of the surface using a height color map
@@ -93,15 +107,17 @@ class SurfaceRenderer:public GLObject
 	bool illuminate; // Flag whether the surface shall be illuminated
 	
 	WaterTable2* waterTable; // Pointer to the water table object; if NULL, water is ignored
-	bool advectWaterTexture; // Flag whether water texture coordinates are advected to visualize water flow
+	bool advectWaterTexture; // Flag whether the water noise pattern is advected to visualize water flow
+	const WaterNoise* waterNoise; // Pointer to the noise volume used to shade advected water; if NULL, water is not advected
 	GLfloat waterOpacity; // Scaling factor for water opacity
 	
 	unsigned int surfaceSettingsVersion; // Version number of surface settings to invalidate surface rendering shader on changes
 	double animationTime; // Time value for water animation
+	const PassProfiler* profiler; // Profiler measuring the GPU time of the rendering passes, or null
 	
 	/* Private methods: */
 	void shaderSourceFileChanged(const IO::FileMonitor::Event& event); // Callback called when one of the external shader source files is changed
-	GLhandleARB createSinglePassSurfaceShader(const GLLightTracker& lt,GLint* uniformLocations) const; // Creates a single-pass surface rendering shader based on current renderer settings
+	void updateSinglePassSurfaceShader(const GLLightTracker& lt,DataItem* dataItem) const; // Selects the single-pass surface rendering shader for the current renderer settings, creating it if it does not exist yet
 	void renderPixelCornerElevations(const int viewport[4],const PTransform& projectionModelview,GLContextData& contextData,DataItem* dataItem) const; // Creates texture containing pixel-corner elevations based on the current depth image
 	
 	/* Constructors and destructors: */
@@ -124,8 +140,10 @@ class SurfaceRenderer:public GLObject
 	void setIlluminate(bool newIlluminate); // Sets the illumination flag
 	void setWaterTable(WaterTable2* newWaterTable); // Sets the pointer to the water table; NULL disables water handling
 	void setAdvectWaterTexture(bool newAdvectWaterTexture); // Sets the water texture coordinate advection flag
+	void setWaterNoise(const WaterNoise* newWaterNoise); // Sets the noise volume used to shade advected water
 	void setWaterOpacity(GLfloat newWaterOpacity); // Sets the water opacity factor
 	void setAnimationTime(double newAnimationTime); // Sets the time for water animation in seconds
+	void setProfiler(const PassProfiler* newProfiler); // Sets a profiler to measure the GPU time of the rendering passes; null disables profiling
 	void renderSinglePass(const int viewport[4],const PTransform& projection,const OGTransform& modelview,GLContextData& contextData) const; // Renders the surface in a single pass using the current surface settings
 	#if 0
 	void renderGlobalAmbientHeightMap(GLuint heightColorMapTexture,GLContextData& contextData) const; // Renders the global ambient component of the surface as an illuminated height map in the current OpenGL context using the given pixel-corner elevation texture and 1D height color map
@@ -0,0 +1,409 @@
+/***********************************************************************
+ValidateWaterPatch - Utility to check that a refined water grid patch
+over curved bathymetry keeps a lake at rest and conserves the total
+water volume of the coupled water flow simulation.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <Math/Math.h>
+#include <Math/Constants.h>
+#include <GL/gl.h>
+#include <GL/Extensions/GLARBTextureRectangle.h>
+#include <GL/GLContextData.h>
+
+#include "OffscreenGLContext.h"
+#include "WaterTable2.h"
+
+namespace {
+
+/**************
+Helper classes:
+**************/
+
+enum Scene // Enumerated type for validation scenes
+	{
+	LAKE=0,MOUND,NUM_SCENES
+	};
+
+const char* sceneNames[NUM_SCENES]={"lake","mound"};
+
+const GLfloat wallHeight=60.0f; // Height of the wall keeping the water away from the grid boundary
+const GLfloat lakeLevel=40.0f; // Water level of the resting lake, above all bathymetry inside the wall
+
+struct Grid // Structure holding a water table's cell-centered bathymetry and conserved quantities
+	{
+	/* Elements: */
+	public:
+	GLsizei size[2]; // Grid size in cells
+	GLfloat* bathymetry; // Vertex-centered bathymetry grid of size minus 1
+	GLfloat* quantity; // Cell-centered conserved quantity grid read back from the water table
+	
+	/* Constructors and destructors: */
+	Grid(const GLsizei sSize[2])
+		{
+		for(int i=0;i<2;++i)
+			size[i]=sSize[i];
+		bathymetry=new GLfloat[(size[1]-1)*(size[0]-1)];
+		quantity=new GLfloat[size[1]*size[0]*3];
+		}
+	~Grid(void)
+		{
+		delete[] bathymetry;
+		delete[] quantity;
+		}
+	
+	/* Methods: */
+	double cellBathymetry(int x,int y) const // Returns the bathymetry of the given cell the same way as the simulation shaders
+		{
+		GLsizei bSize[2]={size[0]-1,size[1]-1};
+		int x0=Math::max(x-1,0);
+		int x1=Math::min(x,bSize[0]-1);
+		int y0=Math::max(y-1,0);
+		int y1=Math::min(y,bSize[1]-1);
+		return (double(bathymetry[y0*bSize[0]+x0])+double(bathymetry[y0*bSize[0]+x1])+double(bathymetry[y1*bSize[0]+x0])+double(bathymetry[y1*bSize[0]+x1]))*0.25;
+		}
+	void read(const WaterTable2& waterTable,GLContextData& contextData) // Reads back the water table's current conserved quantities
+		{
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		waterTable.bindQuantityTexture(contextData);
+		glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB,GL_FLOAT,quantity);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		}
+	};
+
+struct RunResult // Structure holding the result of simulating one scene
+	{
+	/* Elements: */
+	public:
+	double maxSurfaceError; // Maximum deviation of the water surface from the resting lake level over the fine cells and the coarse cells outside the patch
+	double maxSpeed; // Maximum flow speed over the fine cells and the coarse cells outside the patch
+	double initialVolume; // Water volume after setting up the scene
+	double maxDrift; // Maximum absolute relative volume drift over all measurements
+	unsigned int numSteps; // Number of simulation steps taken
+	};
+
+/****************
+Helper functions:
+****************/
+
+GLfloat calcBathymetry(double x,double y,const double domainSize[2],double coarseCellSize)
+	{
+	/* Combine a bowl across the domain with bumps too narrow for the coarse grid to resolve: */
+	double dx=(x-domainSize[0]*0.5)/(domainSize[0]*0.5);
+	double dy=(y-domainSize[1]*0.5)/(domainSize[1]*0.5);
+	double bumpFreq=2.0*Math::Constants<double>::pi/(1.5*coarseCellSize);
+	return GLfloat(12.0*(dx*dx+dy*dy)+4.0*Math::sin(x*bumpFreq)*Math::cos(y*bumpFreq));
+	}
+
+void createBathymetry(Grid& coarse,Grid& fine,GLfloat cellSize,const GLsizei patchOrigin[2],GLsizei refinement)
+	{
+	/* Sample the bathymetry function at the coarse grid's vertices, surrounded by a wall: */
+	const int wallWidth=4;
+	double domainSize[2];
+	for(int i=0;i<2;++i)
+		domainSize[i]=double(coarse.size[i])*double(cellSize);
+	GLsizei bSize[2]={coarse.size[0]-1,coarse.size[1]-1};
+	GLfloat* bPtr=coarse.bathymetry;
+	for(int y=0;y<bSize[1];++y)
+		for(int x=0;x<bSize[0];++x,++bPtr)
+			{
+			if(x<wallWidth||x>=bSize[0]-wallWidth||y<wallWidth||y>=bSize[1]-wallWidth)
+				*bPtr=wallHeight;
+			else
+				*bPtr=calcBathymetry(double(x+1)*double(cellSize),double(y+1)*double(cellSize),domainSize,double(cellSize));
+			}
+	
+	/* Sample the same function at the fine grid's vertices, including the ghost cells' vertices: */
+	double fineCellSize=double(cellSize)/double(refinement);
+	double fineMin[2];
+	for(int i=0;i<2;++i)
+		fineMin[i]=double(patchOrigin[i])*double(cellSize)-2.0*fineCellSize;
+	GLsizei fbSize[2]={fine.size[0]-1,fine.size[1]-1};
+	bPtr=fine.bathymetry;
+	for(int y=0;y<fbSize[1];++y)
+		for(int x=0;x<fbSize[0];++x,++bPtr)
+			*bPtr=calcBathymetry(fineMin[0]+double(x+1)*fineCellSize,fineMin[1]+double(y+1)*fineCellSize,domainSize,double(cellSize));
+	}
+
+double calcVolume(const Grid& coarse,GLfloat cellSize)
+	{
+	/* Sum up the coarse water column heights; the coarse cells covered by the patch hold the fine cells' average water column heights: */
+	double volume=0.0;
+	const GLfloat* qPtr=coarse.quantity;
+	for(int y=0;y<coarse.size[1];++y)
+		for(int x=0;x<coarse.size[0];++x,qPtr+=3)
+			volume+=double(qPtr[0])-coarse.cellBathymetry(x,y);
+	return volume*double(cellSize)*double(cellSize);
+	}
+
+void checkRest(const Grid& grid,int x0,int y0,int x1,int y1,const GLsizei skip[4],RunResult& result)
+	{
+	/* Compare the water surface against the lake level, or against the bathymetry where the lake does not reach, and measure flow speeds: */
+	for(int y=y0;y<y1;++y)
+		for(int x=x0;x<x1;++x)
+			{
+			if(x>=skip[0]&&x<skip[2]&&y>=skip[1]&&y<skip[3])
+				continue;
+			const GLfloat* q=grid.quantity+(y*grid.size[0]+x)*3;
+			double b=grid.cellBathymetry(x,y);
+			double expected=Math::max(double(lakeLevel),b);
+			result.maxSurfaceError=Math::max(result.maxSurfaceError,Math::abs(double(q[0])-expected));
+			double h=double(q[0])-b;
+			if(h>1.0e-3)
+				{
+				result.maxSpeed=Math::max(result.maxSpeed,Math::abs(double(q[1]))/h);
+				result.maxSpeed=Math::max(result.maxSpeed,Math::abs(double(q[2]))/h);
+				}
+			}
+	}
+
+RunResult runScene(Scene scene,const GLsizei size[2],GLfloat cellSize,const GLsizei patchOrigin[2],const GLsizei patchSize[2],GLsizei refinement,double duration,double measureInterval,const char* displayName)
+	{
+	/* Create a fresh OpenGL context for this run; its destructor releases the water tables' per-context state: */
+	OffscreenGLContext context(displayName);
+	context.makeCurrent();
+	GLContextData& contextData=context.getContextData();
+	
+	/* Create and initialize a water table with a refined patch for offline simulation: */
+	GLfloat cellSizes[2]={cellSize,cellSize};
+	WaterTable2* waterTable=new WaterTable2(size[0],size[1],cellSizes);
+	waterTable->setElevationRange(Scalar(-20),Scalar(100));
+	waterTable->setDryBoundary(false);
+	waterTable->setRefinedPatch(patchOrigin,patchSize,refinement);
+	waterTable->initContext(contextData);
+	const WaterTable2* patch=waterTable->getRefinedPatch();
+	
+	/* Upload the bathymetry to the coarse grid and the refined patch: */
+	Grid coarse(size);
+	Grid fine(patch->getSize());
+	createBathymetry(coarse,fine,cellSize,patchOrigin,refinement);
+	waterTable->updateBathymetry(coarse.bathymetry,contextData);
+	patch->updateBathymetry(fine.bathymetry,contextData);
+	
+	/* Fill the basin to the lake level, with a mound of water across the patch's left edge for the volume check: */
+	GLfloat* waterLevel=new GLfloat[size[1]*size[0]];
+	GLfloat* wPtr=waterLevel;
+	for(int y=0;y<size[1];++y)
+		for(int x=0;x<size[0];++x,++wPtr)
+			{
+			*wPtr=lakeLevel;
+			if(scene==MOUND)
+				{
+				GLfloat dx=GLfloat(x-patchOrigin[0]);
+				GLfloat dy=GLfloat(y)-(GLfloat(patchOrigin[1])+GLfloat(patchSize[1])*0.5f);
+				GLfloat sigma=GLfloat(patchSize[1])*0.25f;
+				*wPtr+=8.0f*Math::exp(-(dx*dx+dy*dy)/(2.0f*sigma*sigma));
+				}
+			}
+	waterTable->setWaterLevel(waterLevel,contextData);
+	delete[] waterLevel;
+	
+	/* Measure the initial water volume: */
+	RunResult result;
+	coarse.read(*waterTable,contextData);
+	result.initialVolume=calcVolume(coarse,cellSize);
+	result.maxDrift=0.0;
+	result.maxSurfaceError=0.0;
+	result.maxSpeed=0.0;
+	result.numSteps=0;
+	
+	/* Run the simulation, measuring the water volume at regular intervals of simulated time: */
+	double simulationTime=0.0;
+	while(simulationTime<duration)
+		{
+		double measureTime=Math::min(simulationTime+measureInterval,duration);
+		while(measureTime-simulationTime>1.0e-6)
+			{
+			waterTable->setMaxStepSize(GLfloat(measureTime-simulationTime));
+			simulationTime+=double(waterTable->runSimulationStep(false,contextData));
+			++result.numSteps;
+			}
+		
+		coarse.read(*waterTable,contextData);
+		double drift=Math::abs(calcVolume(coarse,cellSize)-result.initialVolume)/result.initialVolume;
+		if(result.maxDrift<drift)
+			result.maxDrift=drift;
+		}
+	
+	if(scene==LAKE)
+		{
+		/* Check the coarse cells outside the patch; the covered cells hold the fine cells' average water column heights over the coarse bathymetry: */
+		GLsizei patchCells[4]={patchOrigin[0],patchOrigin[1],patchOrigin[0]+patchSize[0],patchOrigin[1]+patchSize[1]};
+		checkRest(coarse,0,0,size[0],size[1],patchCells,result);
+		
+		/* Check the fine cells inside the patch, skipping the ghost cells: */
+		fine.read(*patch,contextData);
+		GLsizei noCells[4]={0,0,0,0};
+		checkRest(fine,2,2,fine.size[0]-2,fine.size[1]-2,noCells,result);
+		}
+	
+	/* Clean up: */
+	delete waterTable;
+	
+	return result;
+	}
+
+void printUsage(void)
+	{
+	std::cout<<"Usage: ValidateWaterPatch [option 1] ... [option n]"<<std::endl;
+	std::cout<<"  Options:"<<std::endl;
+	std::cout<<"  -h"<<std::endl;
+	std::cout<<"     Prints this help message"<<std::endl;
+	std::cout<<"  -wts <water grid width> <water grid height>"<<std::endl;
+	std::cout<<"     Sets the width and height of the coarse water flow simulation grid"<<std::endl;
+	std::cout<<"     Default: 64 64"<<std::endl;
+	std::cout<<"  -cs <cell size>"<<std::endl;
+	std::cout<<"     Sets the width and height of coarse water flow simulation cells"<<std::endl;
+	std::cout<<"     Default: 1.0"<<std::endl;
+	std::cout<<"  -patch <origin x> <origin y> <width> <height> <refinement>"<<std::endl;
+	std::cout<<"     Sets the rectangle of coarse cells covered by the refined patch, and"<<std::endl;
+	std::cout<<"     the patch's refinement factor"<<std::endl;
+	std::cout<<"     Default: 24 24 16 16 2"<<std::endl;
+	std::cout<<"  -t <simulated time> <measurement interval>"<<std::endl;
+	std::cout<<"     Sets the simulated time per scene and the interval between water"<<std::endl;
+	std::cout<<"     volume measurements in seconds"<<std::endl;
+	std::cout<<"     Default: 20.0 1.0"<<std::endl;
+	std::cout<<"  -tol <surface error> <speed> <relative drift>"<<std::endl;
+	std::cout<<"     Sets the maximum acceptable water surface deviation and flow speed"<<std::endl;
+	std::cout<<"     of the resting lake, and the maximum acceptable relative volume drift"<<std::endl;
+	std::cout<<"     Default: 0.001 0.001 0.0001"<<std::endl;
+	std::cout<<"  -display <X display name>"<<std::endl;
+	std::cout<<"     Selects the X server on which to create the OpenGL context"<<std::endl;
+	std::cout<<"     Default: DISPLAY environment variable"<<std::endl;
+	}
+
+}
+
+int main(int argc,char* argv[])
+	{
+	/* Process command line parameters: */
+	GLsizei size[2]={64,64};
+	GLfloat cellSize=1.0f;
+	GLsizei patchOrigin[2]={24,24};
+	GLsizei patchSize[2]={16,16};
+	GLsizei refinement=2;
+	double duration=20.0;
+	double measureInterval=1.0;
+	double surfaceTolerance=1.0e-3;
+	double speedTolerance=1.0e-3;
+	double driftTolerance=1.0e-4;
+	const char* displayName=0;
+	for(int i=1;i<argc;++i)
+		{
+		if(argv[i][0]=='-')
+			{
+			if(strcasecmp(argv[i]+1,"h")==0)
+				{
+				printUsage();
+				return 0;
+				}
+			else if(strcasecmp(argv[i]+1,"wts")==0&&i+2<argc)
+				{
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					size[j]=GLsizei(atoi(argv[i]));
+					}
+				}
+			else if(strcasecmp(argv[i]+1,"cs")==0&&i+1<argc)
+				{
+				++i;
+				cellSize=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"patch")==0&&i+5<argc)
+				{
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					patchOrigin[j]=GLsizei(atoi(argv[i]));
+					}
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					patchSize[j]=GLsizei(atoi(argv[i]));
+					}
+				++i;
+				refinement=GLsizei(atoi(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"t")==0&&i+2<argc)
+				{
+				++i;
+				duration=atof(argv[i]);
+				++i;
+				measureInterval=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"tol")==0&&i+3<argc)
+				{
+				++i;
+				surfaceTolerance=atof(argv[i]);
+				++i;
+				speedTolerance=atof(argv[i]);
+				++i;
+				driftTolerance=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"display")==0&&i+1<argc)
+				{
+				++i;
+				displayName=argv[i];
+				}
+			else
+				std::cerr<<"Ignoring unrecognized command line option "<<argv[i]<<std::endl;
+			}
+		}
+	
+	bool passed=true;
+	try
+		{
+		std::cout<<std::setw(8)<<"Scene"<<std::setw(16)<<"Initial volume"<<std::setw(14)<<"Max drift"<<std::setw(16)<<"Surface error"<<std::setw(14)<<"Max speed"<<std::setw(10)<<"Steps"<<std::endl;
+		for(int scene=0;scene<NUM_SCENES;++scene)
+			{
+			RunResult r=runScene(Scene(scene),size,cellSize,patchOrigin,patchSize,refinement,duration,measureInterval,displayName);
+			std::cout<<std::setw(8)<<sceneNames[scene]<<std::setw(16)<<std::setprecision(8)<<r.initialVolume<<std::setw(14)<<std::setprecision(4)<<r.maxDrift;
+			if(scene==LAKE)
+				std::cout<<std::setw(16)<<std::setprecision(4)<<r.maxSurfaceError<<std::setw(14)<<std::setprecision(4)<<r.maxSpeed;
+			else
+				std::cout<<std::setw(16)<<"-"<<std::setw(14)<<"-";
+			std::cout<<std::setw(10)<<r.numSteps<<std::endl;
+			
+			/* Check the results against the tolerances: */
+			if(r.maxDrift>driftTolerance)
+				{
+				std::cout<<"Scene "<<sceneNames[scene]<<": volume drift "<<r.maxDrift<<" exceeds tolerance "<<driftTolerance<<std::endl;
+				passed=false;
+				}
+			if(scene==LAKE&&(r.maxSurfaceError>surfaceTolerance||r.maxSpeed>speedTolerance))
+				{
+				std::cout<<"Scene "<<sceneNames[scene]<<": lake does not stay at rest; surface error "<<r.maxSurfaceError<<", speed "<<r.maxSpeed<<std::endl;
+				passed=false;
+				}
+			}
+		}
+	catch(const std::runtime_error& err)
+		{
+		std::cerr<<"Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	
+	return passed?0:1;
+	}
@@ -0,0 +1,355 @@
+/***********************************************************************
+ValidateWaterPrecision - Utility to measure the mass conservation drift
+of the water flow simulation's half-precision storage mode against the
+full-precision simulation on a set of reference scenes.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <Misc/Timer.h>
+#include <Math/Math.h>
+#include <GL/gl.h>
+#include <GL/Extensions/GLARBTextureRectangle.h>
+#include <GL/GLContextData.h>
+
+#include "OffscreenGLContext.h"
+#include "WaterTable2.h"
+
+namespace {
+
+/**************
+Helper classes:
+**************/
+
+enum Scene // Enumerated type for reference scenes
+	{
+	DAMBREAK=0,BOWL,SLOPE,NUM_SCENES
+	};
+
+const char* sceneNames[NUM_SCENES]={"dambreak","bowl","slope"};
+
+struct RunResult // Structure holding the result of simulating one scene at one precision
+	{
+	/* Elements: */
+	public:
+	double initialVolume; // Water volume after setting up the scene
+	double finalVolume; // Water volume at the end of the simulation
+	double maxDrift; // Maximum absolute relative volume drift over all measurements
+	unsigned int numSteps; // Number of simulation steps taken
+	double wallTime; // Wall-clock time of all simulation steps in seconds
+	};
+
+/****************
+Helper functions:
+****************/
+
+void createScene(Scene scene,const GLsizei size[2],GLfloat* bathymetry,GLfloat* waterLevel)
+	{
+	/* Surround all scenes by a wall high enough to keep the water away from the grid boundary: */
+	const int wallWidth=4;
+	const GLfloat wallHeight=40.0f;
+	
+	/* Create the vertex-centered bathymetry grid: */
+	GLsizei bSize[2]={size[0]-1,size[1]-1};
+	GLfloat* bPtr=bathymetry;
+	for(int y=0;y<bSize[1];++y)
+		for(int x=0;x<bSize[0];++x,++bPtr)
+			{
+			if(x<wallWidth||x>=bSize[0]-wallWidth||y<wallWidth||y>=bSize[1]-wallWidth)
+				*bPtr=wallHeight;
+			else if(scene==BOWL)
+				{
+				GLfloat dx=(GLfloat(x)-GLfloat(bSize[0]-1)*0.5f)/(GLfloat(bSize[0]-1)*0.5f);
+				GLfloat dy=(GLfloat(y)-GLfloat(bSize[1]-1)*0.5f)/(GLfloat(bSize[1]-1)*0.5f);
+				*bPtr=30.0f*(dx*dx+dy*dy);
+				}
+			else if(scene==SLOPE)
+				*bPtr=20.0f*(1.0f-GLfloat(x)/GLfloat(bSize[0]-1));
+			else
+				*bPtr=0.0f;
+			}
+	
+	/* Create the cell-centered water level grid; the water table raises it to the bathymetry where it is below: */
+	GLfloat* wPtr=waterLevel;
+	for(int y=0;y<size[1];++y)
+		for(int x=0;x<size[0];++x,++wPtr)
+			{
+			switch(scene)
+				{
+				case DAMBREAK:
+					/* Column of water in the left third of the basin: */
+					*wPtr=x<size[0]/3?10.0f:0.0f;
+					break;
+				
+				case BOWL:
+					{
+					/* Mound of water off the bowl's center on top of a resting pool: */
+					GLfloat dx=GLfloat(x)-GLfloat(size[0])*0.35f;
+					GLfloat dy=GLfloat(y)-GLfloat(size[1])*0.4f;
+					GLfloat sigma=GLfloat(size[0])*0.08f;
+					*wPtr=10.0f+8.0f*Math::exp(-(dx*dx+dy*dy)/(2.0f*sigma*sigma));
+					break;
+					}
+				
+				case SLOPE:
+					/* Water released at the top of the slope: */
+					*wPtr=x<size[0]/4?25.0f:0.0f;
+					break;
+				
+				default:
+					;
+				}
+			}
+	}
+
+double calcVolume(WaterTable2& waterTable,const GLfloat* bathymetry,GLfloat* quantity,GLContextData& contextData)
+	{
+	/* Read back the current conserved quantity grid: */
+	const GLsizei* size=waterTable.getSize();
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	waterTable.bindQuantityTexture(contextData);
+	glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB,GL_FLOAT,quantity);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	
+	/* Sum up water column heights, using the same cell-centered bathymetry as the simulation shaders: */
+	GLsizei bSize[2]={size[0]-1,size[1]-1};
+	double volume=0.0;
+	const GLfloat* qPtr=quantity;
+	for(int y=0;y<size[1];++y)
+		{
+		int y0=Math::max(y-1,0);
+		int y1=Math::min(y,bSize[1]-1);
+		for(int x=0;x<size[0];++x,qPtr+=3)
+			{
+			int x0=Math::max(x-1,0);
+			int x1=Math::min(x,bSize[0]-1);
+			double b=(double(bathymetry[y0*bSize[0]+x0])+double(bathymetry[y0*bSize[0]+x1])+double(bathymetry[y1*bSize[0]+x0])+double(bathymetry[y1*bSize[0]+x1]))*0.25;
+			volume+=double(qPtr[0])-b;
+			}
+		}
+	
+	const GLfloat* cellSize=waterTable.getCellSize();
+	return volume*double(cellSize[0])*double(cellSize[1]);
+	}
+
+RunResult runScene(Scene scene,bool halfPrecision,const GLsizei size[2],GLfloat cellSize,double duration,double measureInterval,const char* displayName)
+	{
+	/* Create a fresh OpenGL context for this run; its destructor releases the water table's per-context state: */
+	OffscreenGLContext context(displayName);
+	context.makeCurrent();
+	GLContextData& contextData=context.getContextData();
+	
+	/* Create and initialize a water table for offline simulation: */
+	GLfloat cellSizes[2]={cellSize,cellSize};
+	WaterTable2* waterTable=new WaterTable2(size[0],size[1],cellSizes);
+	waterTable->setElevationRange(Scalar(-20),Scalar(100));
+	waterTable->setDryBoundary(false);
+	waterTable->setHalfPrecision(halfPrecision);
+	waterTable->initContext(contextData);
+	
+	/* Upload the reference scene: */
+	GLfloat* bathymetry=new GLfloat[(size[1]-1)*(size[0]-1)];
+	GLfloat* waterLevel=new GLfloat[size[1]*size[0]];
+	createScene(scene,size,bathymetry,waterLevel);
+	waterTable->updateBathymetry(bathymetry,contextData);
+	waterTable->setWaterLevel(waterLevel,contextData);
+	
+	/* Measure the initial water volume: */
+	GLfloat* quantity=new GLfloat[size[1]*size[0]*3];
+	RunResult result;
+	result.initialVolume=calcVolume(*waterTable,bathymetry,quantity,contextData);
+	result.finalVolume=result.initialVolume;
+	result.maxDrift=0.0;
+	result.numSteps=0;
+	result.wallTime=0.0;
+	
+	/* Run the simulation, measuring the water volume at regular intervals of simulated time: */
+	double simulationTime=0.0;
+	while(simulationTime<duration)
+		{
+		double measureTime=Math::min(simulationTime+measureInterval,duration);
+		Misc::Timer timer;
+		while(measureTime-simulationTime>1.0e-6)
+			{
+			waterTable->setMaxStepSize(GLfloat(measureTime-simulationTime));
+			simulationTime+=double(waterTable->runSimulationStep(false,contextData));
+			++result.numSteps;
+			}
+		glFinish();
+		timer.elapse();
+		result.wallTime+=timer.getTime();
+		
+		result.finalVolume=calcVolume(*waterTable,bathymetry,quantity,contextData);
+		double drift=Math::abs(result.finalVolume-result.initialVolume)/result.initialVolume;
+		if(result.maxDrift<drift)
+			result.maxDrift=drift;
+		}
+	
+	/* Clean up: */
+	delete[] quantity;
+	delete[] waterLevel;
+	delete[] bathymetry;
+	delete waterTable;
+	
+	return result;
+	}
+
+void printUsage(void)
+	{
+	std::cout<<"Usage: ValidateWaterPrecision [option 1] ... [option n]"<<std::endl;
+	std::cout<<"  Options:"<<std::endl;
+	std::cout<<"  -h"<<std::endl;
+	std::cout<<"     Prints this help message"<<std::endl;
+	std::cout<<"  -wts <water grid width> <water grid height>"<<std::endl;
+	std::cout<<"     Sets the width and height of the water flow simulation grid"<<std::endl;
+	std::cout<<"     Default: 256 256"<<std::endl;
+	std::cout<<"  -cs <cell size>"<<std::endl;
+	std::cout<<"     Sets the width and height of water flow simulation cells"<<std::endl;
+	std::cout<<"     Default: 1.0"<<std::endl;
+	std::cout<<"  -t <simulated time> <measurement interval>"<<std::endl;
+	std::cout<<"     Sets the simulated time per scene and the interval between water"<<std::endl;
+	std::cout<<"     volume measurements in seconds"<<std::endl;
+	std::cout<<"     Default: 60.0 1.0"<<std::endl;
+	std::cout<<"  -s <scene name>"<<std::endl;
+	std::cout<<"     Adds a reference scene to the list of simulated scenes; one of"<<std::endl;
+	std::cout<<"     dambreak, bowl, slope"<<std::endl;
+	std::cout<<"     Default: all scenes"<<std::endl;
+	std::cout<<"  -tol <relative drift>"<<std::endl;
+	std::cout<<"     Sets the maximum acceptable additional relative volume drift of the"<<std::endl;
+	std::cout<<"     half-precision simulation over the full-precision simulation"<<std::endl;
+	std::cout<<"     Default: 0.001"<<std::endl;
+	std::cout<<"  -display <X display name>"<<std::endl;
+	std::cout<<"     Selects the X server on which to create the OpenGL context"<<std::endl;
+	std::cout<<"     Default: DISPLAY environment variable"<<std::endl;
+	}
+
+}
+
+int main(int argc,char* argv[])
+	{
+	/* Process command line parameters: */
+	GLsizei size[2]={256,256};
+	GLfloat cellSize=1.0f;
+	double duration=60.0;
+	double measureInterval=1.0;
+	bool scenes[NUM_SCENES]={false,false,false};
+	bool haveScene=false;
+	double tolerance=1.0e-3;
+	const char* displayName=0;
+	for(int i=1;i<argc;++i)
+		{
+		if(argv[i][0]=='-')
+			{
+			if(strcasecmp(argv[i]+1,"h")==0)
+				{
+				printUsage();
+				return 0;
+				}
+			else if(strcasecmp(argv[i]+1,"wts")==0&&i+2<argc)
+				{
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					size[j]=GLsizei(atoi(argv[i]));
+					}
+				}
+			else if(strcasecmp(argv[i]+1,"cs")==0&&i+1<argc)
+				{
+				++i;
+				cellSize=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"t")==0&&i+2<argc)
+				{
+				++i;
+				duration=atof(argv[i]);
+				++i;
+				measureInterval=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"s")==0&&i+1<argc)
+				{
+				++i;
+				int scene;
+				for(scene=0;scene<NUM_SCENES&&strcasecmp(argv[i],sceneNames[scene])!=0;++scene)
+					;
+				if(scene<NUM_SCENES)
+					{
+					scenes[scene]=true;
+					haveScene=true;
+					}
+				else
+					std::cerr<<"Ignoring unknown scene "<<argv[i]<<std::endl;
+				}
+			else if(strcasecmp(argv[i]+1,"tol")==0&&i+1<argc)
+				{
+				++i;
+				tolerance=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"display")==0&&i+1<argc)
+				{
+				++i;
+				displayName=argv[i];
+				}
+			else
+				std::cerr<<"Ignoring unrecognized command line option "<<argv[i]<<std::endl;
+			}
+		}
+	if(!haveScene)
+		for(int scene=0;scene<NUM_SCENES;++scene)
+			scenes[scene]=true;
+	
+	bool passed=true;
+	try
+		{
+		std::cout<<std::setw(10)<<"Scene"<<std::setw(12)<<"Precision"<<std::setw(16)<<"Initial volume"<<std::setw(16)<<"Final volume"<<std::setw(14)<<"Max drift"<<std::setw(10)<<"Steps"<<std::setw(14)<<"ms per step"<<std::endl;
+		for(int scene=0;scene<NUM_SCENES;++scene)
+			if(scenes[scene])
+				{
+				/* Run the scene at full and half precision: */
+				RunResult results[2];
+				for(int precision=0;precision<2;++precision)
+					{
+					results[precision]=runScene(Scene(scene),precision==1,size,cellSize,duration,measureInterval,displayName);
+					const RunResult& r=results[precision];
+					std::cout<<std::setw(10)<<sceneNames[scene]<<std::setw(12)<<(precision==1?"half":"full");
+					std::cout<<std::setw(16)<<std::setprecision(8)<<r.initialVolume<<std::setw(16)<<std::setprecision(8)<<r.finalVolume;
+					std::cout<<std::setw(14)<<std::setprecision(4)<<r.maxDrift<<std::setw(10)<<r.numSteps;
+					std::cout<<std::setw(14)<<std::setprecision(4)<<(r.numSteps>0?r.wallTime*1000.0/double(r.numSteps):0.0)<<std::endl;
+					}
+				
+				/* Compare the half-precision drift against the full-precision drift: */
+				double excessDrift=results[1].maxDrift-results[0].maxDrift;
+				if(excessDrift>tolerance)
+					{
+					std::cout<<"Scene "<<sceneNames[scene]<<": half-precision drift exceeds full-precision drift by "<<excessDrift<<", tolerance is "<<tolerance<<std::endl;
+					passed=false;
+					}
+				}
+		}
+	catch(const std::runtime_error& err)
+		{
+		std::cerr<<"Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	
+	return passed?0:1;
+	}
@@ -0,0 +1,150 @@
+/***********************************************************************
+WaterGovernor - Class to adapt the number of water simulation steps per
+frame to measured GPU costs, to keep the total frame time within a
+target budget.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterGovernor.h"
+
+#include <iostream>
+#include <Math/Math.h>
+
+/******************************
+Methods of class WaterGovernor:
+******************************/
+
+void WaterGovernor::logDecision(const char* reason) const
+	{
+	std::cout<<"WaterGovernor: "<<reason<<"; "<<numSteps<<" steps per frame at "<<stepCost*1000.0<<" ms per step, "<<otherCost*1000.0<<" ms other GPU work per frame";
+	if(forceFinalStep)
+		std::cout<<", forcing final step";
+	std::cout<<std::endl;
+	if(overBudget)
+		std::cout<<"WaterGovernor: A single simulation step exceeds the frame time budget of "<<targetFrameTime*1000.0<<" ms; consider reducing the water table grid size (-wts)"<<std::endl;
+	}
+
+WaterGovernor::WaterGovernor(double sTargetFrameTime,unsigned int sMaxSteps)
+	:targetFrameTime(sTargetFrameTime),maxSteps(sMaxSteps),
+	 stepCost(0.0),otherCost(0.0),
+	 numSteps(sMaxSteps),forceFinalStep(false),numCalmFrames(0),overBudget(false)
+	{
+	}
+
+void WaterGovernor::setTargetFrameTime(double newTargetFrameTime)
+	{
+	Threads::Mutex::Lock lock(mutex);
+	targetFrameTime=newTargetFrameTime;
+	}
+
+void WaterGovernor::setMaxSteps(unsigned int newMaxSteps)
+	{
+	Threads::Mutex::Lock lock(mutex);
+	maxSteps=newMaxSteps;
+	if(numSteps>maxSteps)
+		numSteps=maxSteps;
+	}
+
+unsigned int WaterGovernor::getNumSteps(void) const
+	{
+	Threads::Mutex::Lock lock(mutex);
+	return numSteps;
+	}
+
+bool WaterGovernor::getForceFinalStep(void) const
+	{
+	Threads::Mutex::Lock lock(mutex);
+	return forceFinalStep;
+	}
+
+double WaterGovernor::getStepCost(void) const
+	{
+	Threads::Mutex::Lock lock(mutex);
+	return stepCost;
+	}
+
+void WaterGovernor::update(double frameBusyTime,double simulationTime,unsigned int simulationNumSteps,bool ranOutOfTime)
+	{
+	Threads::Mutex::Lock lock(mutex);
+	
+	/* Ignore frames that did not run any simulation steps: */
+	if(simulationNumSteps==0||simulationTime<=0.0)
+		return;
+	
+	/* Update the running cost averages: */
+	double newStepCost=simulationTime/double(simulationNumSteps);
+	double newOtherCost=frameBusyTime-simulationTime;
+	if(newOtherCost<0.0)
+		newOtherCost=0.0;
+	if(stepCost==0.0)
+		{
+		stepCost=newStepCost;
+		otherCost=newOtherCost;
+		}
+	else
+		{
+		stepCost=stepCost*0.9+newStepCost*0.1;
+		otherCost=otherCost*0.9+newOtherCost*0.1;
+		}
+	
+	/* Calculate the number of simulation steps that fit into the remaining frame time budget: */
+	double budget=targetFrameTime-otherCost;
+	bool newOverBudget=budget<stepCost;
+	unsigned int newNumSteps=newOverBudget?1U:(unsigned int)(Math::floor(budget/stepCost));
+	if(newNumSteps>maxSteps)
+		newNumSteps=maxSteps;
+	if(newNumSteps<1U)
+		newNumSteps=1U;
+	
+	/* Reduce the step budget immediately, but only increase it by significant amounts to avoid oscillation: */
+	const char* reason=0;
+	if(newNumSteps<numSteps)
+		reason="Reduced step budget";
+	else if(newNumSteps>numSteps&&newNumSteps-numSteps>=(numSteps+9U)/10U)
+		reason="Increased step budget";
+	if(reason!=0)
+		numSteps=newNumSteps;
+	
+	/* Force the final step of each frame if the step budget is too small to keep up with the requested simulation speed: */
+	if(ranOutOfTime&&numSteps<maxSteps)
+		{
+		numCalmFrames=0;
+		if(!forceFinalStep)
+			{
+			forceFinalStep=true;
+			reason="Simulation fell behind";
+			}
+		}
+	else if(forceFinalStep&&++numCalmFrames>=30U)
+		{
+		forceFinalStep=false;
+		reason="Simulation caught up";
+		}
+	
+	if(newOverBudget!=overBudget)
+		{
+		overBudget=newOverBudget;
+		if(reason==0)
+			reason=overBudget?"Exceeded frame time budget":"Returned to frame time budget";
+		}
+	
+	/* Log the governor's decision: */
+	if(reason!=0)
+		logDecision(reason);
+	}
@@ -0,0 +1,63 @@
+/***********************************************************************
+WaterGovernor - Class to adapt the number of water simulation steps per
+frame to measured GPU costs, to keep the total frame time within a
+target budget.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERGOVERNOR_INCLUDED
+#define WATERGOVERNOR_INCLUDED
+
+#include <Threads/Mutex.h>
+
+class WaterGovernor
+	{
+	/* Elements: */
+	private:
+	mutable Threads::Mutex mutex; // Mutex serializing access to the governor's state from multiple rendering threads
+	double targetFrameTime; // Target total frame time in seconds
+	unsigned int maxSteps; // Upper limit for the number of simulation steps per frame
+	double stepCost; // Running average of GPU time per simulation step in seconds
+	double otherCost; // Running average of GPU busy time per frame not spent in the water simulation in seconds
+	unsigned int numSteps; // Current budget of simulation steps per frame
+	bool forceFinalStep; // Flag whether the last step of each frame is forced to cover the remaining simulation time
+	unsigned int numCalmFrames; // Number of consecutive frames in which the simulation steps covered the requested simulation time
+	bool overBudget; // Flag whether even a single simulation step per frame exceeds the frame time budget
+	
+	/* Private methods: */
+	void logDecision(const char* reason) const; // Prints the current governor state and the reason for the most recent change
+	
+	/* Constructors and destructors: */
+	public:
+	WaterGovernor(double sTargetFrameTime,unsigned int sMaxSteps); // Creates a governor for the given target frame time in seconds and maximum number of steps
+	
+	/* Methods: */
+	double getTargetFrameTime(void) const // Returns the target frame time in seconds
+		{
+		return targetFrameTime;
+		}
+	void setTargetFrameTime(double newTargetFrameTime); // Sets a new target frame time in seconds
+	void setMaxSteps(unsigned int newMaxSteps); // Sets a new upper limit for the number of simulation steps per frame
+	unsigned int getNumSteps(void) const; // Returns the current budget of simulation steps per frame
+	bool getForceFinalStep(void) const; // Returns true if the last simulation step of a frame should be forced to cover the remaining simulation time
+	double getStepCost(void) const; // Returns the current estimate of GPU time per simulation step in seconds
+	void update(double frameBusyTime,double simulationTime,unsigned int simulationNumSteps,bool ranOutOfTime); // Updates the governor with the GPU busy time of a previous frame excluding buffer swap waits, the GPU time and number of simulation steps in the same frame, and whether the steps could not cover the requested simulation time
+	};
+
+#endif
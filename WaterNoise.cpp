@@ -0,0 +1,189 @@
+/***********************************************************************
+WaterNoise - Class to generate a tileable 3D turbulence noise volume in
+a set of threads at startup, and to provide it as a 3D texture for
+animated water shading.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterNoise.h"
+
+#include <Misc/ThrowStdErr.h>
+#include <Threads/Thread.h>
+#include <Math/Math.h>
+#include <GL/GLContextData.h>
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+inline float fade(float t) // Returns the quintic fade curve of improved Perlin noise
+	{
+	return t*t*t*(t*(t*6.0f-15.0f)+10.0f);
+	}
+
+inline float grad(unsigned int hash,float x,float y,float z) // Returns the dot product of an offset vector and one of twelve lattice gradient vectors selected by the given hash value
+	{
+	unsigned int h=hash&15U;
+	float u=h<8U?x:y;
+	float v=h<4U?y:h==12U||h==14U?x:z;
+	return ((h&1U)==0U?u:-u)+((h&2U)==0U?v:-v);
+	}
+
+inline float lerp(float t,float a,float b)
+	{
+	return a+(b-a)*t;
+	}
+
+}
+
+/***************************
+Methods of class WaterNoise:
+***************************/
+
+float WaterNoise::calcNoise(float x,float y,float z,unsigned int period) const
+	{
+	/* Find the lattice cell containing the position and the position's offset inside the cell: */
+	float fx=Math::floor(x);
+	float fy=Math::floor(y);
+	float fz=Math::floor(z);
+	x-=fx;
+	y-=fy;
+	z-=fz;
+	
+	/* Wrap the cell's corner indices to make the noise repeat after the given period: */
+	unsigned int x0=(unsigned int)(fx)%period;
+	unsigned int y0=(unsigned int)(fy)%period;
+	unsigned int z0=(unsigned int)(fz)%period;
+	unsigned int x1=(x0+1U)%period;
+	unsigned int y1=(y0+1U)%period;
+	unsigned int z1=(z0+1U)%period;
+	
+	/* Hash the cell's eight corners: */
+	unsigned int h0=perm[x0];
+	unsigned int h1=perm[x1];
+	unsigned int h00=perm[(h0+y0)&255U];
+	unsigned int h01=perm[(h0+y1)&255U];
+	unsigned int h10=perm[(h1+y0)&255U];
+	unsigned int h11=perm[(h1+y1)&255U];
+	
+	/* Interpolate the corners' gradient contributions: */
+	float u=fade(x);
+	float v=fade(y);
+	float w=fade(z);
+	float n00=lerp(u,grad(perm[(h00+z0)&255U],x,y,z),grad(perm[(h10+z0)&255U],x-1.0f,y,z));
+	float n10=lerp(u,grad(perm[(h01+z0)&255U],x,y-1.0f,z),grad(perm[(h11+z0)&255U],x-1.0f,y-1.0f,z));
+	float n01=lerp(u,grad(perm[(h00+z1)&255U],x,y,z-1.0f),grad(perm[(h10+z1)&255U],x-1.0f,y,z-1.0f));
+	float n11=lerp(u,grad(perm[(h01+z1)&255U],x,y-1.0f,z-1.0f),grad(perm[(h11+z1)&255U],x-1.0f,y-1.0f,z-1.0f));
+	return lerp(w,lerp(v,n00,n10),lerp(v,n01,n11));
+	}
+
+void* WaterNoise::generatorThreadMethod(unsigned int threadIndex)
+	{
+	/* Generate every numThreads-th slice of the volume, starting with the thread's index: */
+	for(unsigned int z=threadIndex;z<size;z+=numThreads)
+		{
+		GLubyte* vPtr=volume+size_t(z)*size_t(size)*size_t(size);
+		for(unsigned int y=0;y<size;++y)
+			for(unsigned int x=0;x<size;++x,++vPtr)
+				{
+				/* Sum the absolute noise values of all octaves with amplitudes inversely proportional to their frequencies: */
+				float turb=0.0f;
+				unsigned int period=basePeriod;
+				float amplitude=1.0f;
+				for(unsigned int octave=0;octave<numOctaves;++octave,period*=2U,amplitude*=0.5f)
+					{
+					float scale=float(period)/float(size);
+					turb+=Math::abs(calcNoise((float(x)+0.5f)*scale,(float(y)+0.5f)*scale,(float(z)+0.5f)*scale,period))*amplitude;
+					}
+				
+				/* Store the clamped turbulence value: */
+				*vPtr=GLubyte(Math::floor(Math::min(turb,1.0f)*255.0f+0.5f));
+				}
+		}
+	
+	return 0;
+	}
+
+WaterNoise::WaterNoise(unsigned int sSize,unsigned int sNumThreads)
+	:size(sSize),numThreads(sNumThreads>0?sNumThreads:1U),
+	 volume(0)
+	{
+	/* Check that the volume resolves the highest octave's lattice cells: */
+	if(size<(basePeriod<<numOctaves))
+		Misc::throwStdErr("WaterNoise::WaterNoise: Noise volume size %u is smaller than the minimum of %u",size,basePeriod<<numOctaves);
+	
+	/* Create a reproducible permutation table with a linear congruential generator: */
+	for(unsigned int i=0;i<256;++i)
+		perm[i]=(unsigned char)(i);
+	unsigned int seed=12345U;
+	for(unsigned int i=255;i>0;--i)
+		{
+		seed=seed*1103515245U+12345U;
+		unsigned int j=(seed>>16)%(i+1U);
+		unsigned char t=perm[i];
+		perm[i]=perm[j];
+		perm[j]=t;
+		}
+	
+	/* Generate the noise volume, with the calling thread taking the first share of slices: */
+	volume=new GLubyte[size_t(size)*size_t(size)*size_t(size)];
+	Threads::Thread* generatorThreads=new Threads::Thread[numThreads-1];
+	for(unsigned int i=1;i<numThreads;++i)
+		generatorThreads[i-1].start(this,&WaterNoise::generatorThreadMethod,i);
+	generatorThreadMethod(0);
+	for(unsigned int i=1;i<numThreads;++i)
+		generatorThreads[i-1].join();
+	delete[] generatorThreads;
+	}
+
+WaterNoise::~WaterNoise(void)
+	{
+	delete[] volume;
+	}
+
+void WaterNoise::initContext(GLContextData& contextData) const
+	{
+	/* Create the data item and associate it with this object: */
+	DataItem* dataItem=new DataItem;
+	contextData.addDataItem(this,dataItem);
+	
+	/* Upload the noise volume into a repeating 3D texture: */
+	glBindTexture(GL_TEXTURE_3D,dataItem->textureObjectId);
+	glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_S,GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_T,GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_REPEAT);
+	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexImage3D(GL_TEXTURE_3D,0,GL_LUMINANCE8,size,size,size,0,GL_LUMINANCE,GL_UNSIGNED_BYTE,volume);
+	glPopClientAttrib();
+	glBindTexture(GL_TEXTURE_3D,0);
+	}
+
+void WaterNoise::bindTexture(GLContextData& contextData) const
+	{
+	/* Retrieve the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Bind the texture object: */
+	glBindTexture(GL_TEXTURE_3D,dataItem->textureObjectId);
+	}
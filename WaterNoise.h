@@ -0,0 +1,65 @@
+/***********************************************************************
+WaterNoise - Class to generate a tileable 3D turbulence noise volume in
+a set of threads at startup, and to provide it as a 3D texture for
+animated water shading.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERNOISE_INCLUDED
+#define WATERNOISE_INCLUDED
+
+#include <GL/gl.h>
+#include <GL/GLTextureObject.h>
+
+class WaterNoise:public GLTextureObject
+	{
+	/* Elements: */
+	private:
+	static const unsigned int basePeriod=4; // Number of noise lattice cells along each axis of the volume in the lowest octave
+	static const unsigned int numOctaves=4; // Number of noise octaves summed into the turbulence volume, each doubling the lattice frequency
+	unsigned int size; // Number of voxels along each axis of the noise volume
+	unsigned int numThreads; // Number of threads generating the noise volume
+	unsigned char perm[256]; // Permutation table to hash noise lattice points
+	GLubyte* volume; // Turbulence values of all voxels in x, y, z order
+	
+	/* Private methods: */
+	float calcNoise(float x,float y,float z,unsigned int period) const; // Returns gradient noise at the given position in lattice units, repeating after the given number of lattice cells along each axis
+	void* generatorThreadMethod(unsigned int threadIndex); // Method to generate all volume slices assigned to the given thread
+	
+	/* Constructors and destructors: */
+	public:
+	WaterNoise(unsigned int sSize,unsigned int sNumThreads); // Generates a noise volume of the given size along each axis using the given number of threads
+	private:
+	WaterNoise(const WaterNoise& source); // Prohibit copy constructor
+	WaterNoise& operator=(const WaterNoise& source); // Prohibit assignment operator
+	public:
+	virtual ~WaterNoise(void);
+	
+	/* Methods from GLObject: */
+	virtual void initContext(GLContextData& contextData) const;
+	
+	/* New methods: */
+	unsigned int getSize(void) const // Returns the number of voxels along each axis of the noise volume
+		{
+		return size;
+		}
+	void bindTexture(GLContextData& contextData) const; // Binds the noise volume texture object to the currently active texture unit
+	};
+
+#endif
@@ -0,0 +1,121 @@
+/***********************************************************************
+WaterRecorder - Class to record the inputs that drive a running water
+flow simulation frame by frame, for deterministic replay.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterRecorder.h"
+
+#include <IO/OpenFile.h>
+#include <GL/Extensions/GLARBTextureRectangle.h>
+
+#include "DepthImageRenderer.h"
+#include "WaterTable2.h"
+
+/******************************
+Methods of class WaterRecorder:
+******************************/
+
+void WaterRecorder::readBathymetry(GLContextData& contextData)
+	{
+	/* Read back the current bathymetry texture; this stalls the pipeline, but only when the depth image changed: */
+	frame.bathymetry.resize(size_t(waterTable->getBathymetrySize(1))*size_t(waterTable->getBathymetrySize(0)));
+	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+	glPixelStorei(GL_PACK_ALIGNMENT,1);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	waterTable->bindBathymetryTexture(contextData);
+	glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,&frame.bathymetry.front());
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	glPopClientAttrib();
+	}
+
+WaterRecorder::WaterRecorder(const WaterTable2* sWaterTable,const DepthImageRenderer* sDepthImageRenderer,const char* sFileName)
+	:waterTable(sWaterTable),depthImageRenderer(sDepthImageRenderer),fileName(sFileName),
+	 file(IO::openFile(sFileName,IO::File::WriteOnly)),
+	 recordingContext(0),
+	 headerWritten(false),numFrames(0)
+	{
+	frame.depthImageVersion=0;
+	}
+
+void WaterRecorder::recordFrame(double frameTime,GLfloat timeBudget,unsigned int maxNumSteps,bool forceFinalStep,GLContextData& contextData)
+	{
+	Threads::Mutex::Lock recordLock(recordMutex);
+	
+	/* Record the water simulation of a single OpenGL context; other contexts run their own copies of the same simulation: */
+	if(recordingContext==0)
+		recordingContext=&contextData;
+	else if(recordingContext!=&contextData)
+		return;
+	
+	/* Check whether the water table's bathymetry changed since the previous frame: */
+	unsigned int depthImageVersion=depthImageRenderer->getDepthImageVersion();
+	frame.bathymetryChanged=headerWritten&&frame.depthImageVersion!=depthImageVersion;
+	if(!headerWritten||frame.bathymetryChanged)
+		readBathymetry(contextData);
+	frame.depthImageVersion=depthImageVersion;
+	
+	if(!headerWritten)
+		{
+		/* Read back the initial conserved quantity grid: */
+		quantity.resize(size_t(waterTable->getSize()[1])*size_t(waterTable->getSize()[0])*3);
+		glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+		glPixelStorei(GL_PACK_ALIGNMENT,1);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		waterTable->bindQuantityTexture(contextData);
+		glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB,GL_FLOAT,&quantity.front());
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		glPopClientAttrib();
+		
+		/* Write the recording header with the water table's initial state: */
+		WaterRecording::writeHeader(*file,*waterTable,&frame.bathymetry.front(),&quantity.front());
+		std::vector<GLfloat>().swap(quantity);
+		headerWritten=true;
+		}
+	
+	/* Record the frame's timing and simulation parameters: */
+	frame.frameTime=frameTime;
+	frame.timeBudget=timeBudget;
+	frame.maxNumSteps=maxNumSteps;
+	frame.forceFinalStep=forceFinalStep;
+	frame.attenuation=waterTable->getAttenuation();
+	frame.waterDeposit=waterTable->getWaterDeposit();
+	frame.dryBoundary=waterTable->getDryBoundary();
+	
+	/* Record the water sources relative to the water table's domain, so they can be replayed on an offline water table: */
+	std::vector<WaterTable2::WaterSource> waterSources=waterTable->getWaterSources();
+	frame.waterSources.clear();
+	frame.waterSources.reserve(waterSources.size());
+	const WaterTable2::Box& domain=waterTable->getDomain();
+	for(std::vector<WaterTable2::WaterSource>::const_iterator wsIt=waterSources.begin();wsIt!=waterSources.end();++wsIt)
+		{
+		WaterRecording::WaterSource ws;
+		Point center=waterTable->getBaseTransform().transform(wsIt->center);
+		for(int i=0;i<2;++i)
+			ws.center[i]=GLfloat(center[i]-domain.min[i]);
+		ws.center[2]=GLfloat(center[2]);
+		ws.radius=GLfloat(wsIt->radius);
+		ws.rate=wsIt->rate;
+		frame.waterSources.push_back(ws);
+		}
+	
+	/* Write the frame: */
+	WaterRecording::writeFrame(*file,*waterTable,frame);
+	++numFrames;
+	}
@@ -0,0 +1,73 @@
+/***********************************************************************
+WaterRecorder - Class to record the inputs that drive a running water
+flow simulation frame by frame, for deterministic replay.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERRECORDER_INCLUDED
+#define WATERRECORDER_INCLUDED
+
+#include <string>
+#include <vector>
+#include <IO/File.h>
+#include <Threads/Mutex.h>
+#include <GL/gl.h>
+
+#include "WaterRecording.h"
+
+/* Forward declarations: */
+class GLContextData;
+class DepthImageRenderer;
+class WaterTable2;
+
+class WaterRecorder
+	{
+	/* Elements: */
+	private:
+	const WaterTable2* waterTable; // Water table whose inputs are recorded
+	const DepthImageRenderer* depthImageRenderer; // Depth image renderer from which the water table derives its bathymetry
+	std::string fileName; // Name of the recording file
+	IO::FilePtr file; // File to which the recording is written
+	Threads::Mutex recordMutex; // Mutex serializing frame recording calls from multiple rendering threads
+	const GLContextData* recordingContext; // OpenGL context whose water simulation is recorded, or null before the first frame
+	bool headerWritten; // Flag whether the recording header and initial state have been written
+	WaterRecording::Frame frame; // Buffer for the most recent frame's inputs
+	std::vector<GLfloat> quantity; // Buffer for the initial conserved quantity grid
+	unsigned int numFrames; // Number of frames recorded so far
+	
+	/* Private methods: */
+	void readBathymetry(GLContextData& contextData); // Reads back the water table's current bathymetry grid into the frame buffer
+	
+	/* Constructors and destructors: */
+	public:
+	WaterRecorder(const WaterTable2* sWaterTable,const DepthImageRenderer* sDepthImageRenderer,const char* sFileName); // Starts recording the inputs of the given water table to a recording file of the given name; throws exception if the file cannot be created
+	
+	/* Methods: */
+	const std::string& getFileName(void) const // Returns the name of the recording file
+		{
+		return fileName;
+		}
+	unsigned int getNumFrames(void) const // Returns the number of frames recorded so far
+		{
+		return numFrames;
+		}
+	void recordFrame(double frameTime,GLfloat timeBudget,unsigned int maxNumSteps,bool forceFinalStep,GLContextData& contextData); // Records the inputs of a frame with the given wall-clock duration, simulation time budget, and step limits; must be called after the water table's bathymetry was updated and before the frame's simulation steps; only records frames simulated in the context of the first call
+	};
+
+#endif
@@ -0,0 +1,164 @@
+/***********************************************************************
+WaterRecording - Class to write and read recordings of the inputs that
+drive a water flow simulation frame by frame, for deterministic replay.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterRecording.h"
+
+#include <string.h>
+#include <Misc/SizedTypes.h>
+#include <Misc/ThrowStdErr.h>
+#include <IO/OpenFile.h>
+
+#include "WaterTable2.h"
+
+namespace {
+
+/***********************************************************************
+Layout of a water recording. All values are stored in little-endian byte
+order. The header holds the water table's layout and settings and its
+full initial state; each following frame holds the simulation inputs of
+one frame, including the bathymetry grid if it changed in that frame.
+***********************************************************************/
+
+const char fileMagic[16]={'S','A','R','n','d','b','o','x','R','e','p','l','a','y','0','1'};
+
+}
+
+/*******************************
+Methods of class WaterRecording:
+*******************************/
+
+WaterRecording::WaterRecording(const char* fileName)
+	:file(IO::openFile(fileName)),
+	 halfPrecision(false),fusedSteps(true),localTimeSteppingLevels(0)
+	{
+	file->setEndianness(Misc::LittleEndian);
+	
+	/* Check the file header: */
+	char magic[sizeof(fileMagic)];
+	file->readRaw(magic,sizeof(fileMagic));
+	if(memcmp(magic,fileMagic,sizeof(fileMagic))!=0)
+		Misc::throwStdErr("WaterRecording::WaterRecording: %s is not a water recording",fileName);
+	
+	/* Read the water table's layout and settings: */
+	for(int i=0;i<2;++i)
+		size[i]=GLsizei(file->read<Misc::UInt32>());
+	for(int i=0;i<2;++i)
+		cellSize[i]=GLfloat(file->read<Misc::Float32>());
+	for(int i=0;i<2;++i)
+		elevationRange[i]=Scalar(file->read<Misc::Float64>());
+	halfPrecision=file->read<Misc::UInt8>()!=0;
+	fusedSteps=file->read<Misc::UInt8>()!=0;
+	localTimeSteppingLevels=file->read<Misc::UInt32>();
+	if(size[0]<2||size[1]<2)
+		Misc::throwStdErr("WaterRecording::WaterRecording: Water recording %s has invalid grid size %d x %d",fileName,size[0],size[1]);
+	
+	/* Read the initial state: */
+	bathymetry.resize(size_t(size[1]-1)*size_t(size[0]-1));
+	file->read(&bathymetry.front(),bathymetry.size());
+	quantity.resize(size_t(size[1])*size_t(size[0])*3);
+	file->read(&quantity.front(),quantity.size());
+	}
+
+void WaterRecording::writeHeader(IO::File& file,const WaterTable2& waterTable,const GLfloat* bathymetry,const GLfloat* quantity)
+	{
+	file.setEndianness(Misc::LittleEndian);
+	
+	/* Write the water table's layout and settings: */
+	file.writeRaw(fileMagic,sizeof(fileMagic));
+	const GLsizei* size=waterTable.getSize();
+	for(int i=0;i<2;++i)
+		file.write<Misc::UInt32>(Misc::UInt32(size[i]));
+	for(int i=0;i<2;++i)
+		file.write<Misc::Float32>(Misc::Float32(waterTable.getCellSize()[i]));
+	file.write<Misc::Float64>(Misc::Float64(waterTable.getDomain().min[2]));
+	file.write<Misc::Float64>(Misc::Float64(waterTable.getDomain().max[2]));
+	file.write<Misc::UInt8>(waterTable.getHalfPrecision()?1U:0U);
+	file.write<Misc::UInt8>(waterTable.getFusedSteps()?1U:0U);
+	file.write<Misc::UInt32>(Misc::UInt32(waterTable.getLocalTimeSteppingLevels()));
+	
+	/* Write the initial state: */
+	file.write<GLfloat>(bathymetry,size_t(size[1]-1)*size_t(size[0]-1));
+	file.write<GLfloat>(quantity,size_t(size[1])*size_t(size[0])*3);
+	}
+
+void WaterRecording::writeFrame(IO::File& file,const WaterTable2& waterTable,const WaterRecording::Frame& frame)
+	{
+	/* Write the frame's timing and simulation parameters: */
+	file.write<Misc::Float64>(Misc::Float64(frame.frameTime));
+	file.write<Misc::Float32>(Misc::Float32(frame.timeBudget));
+	file.write<Misc::UInt32>(Misc::UInt32(frame.maxNumSteps));
+	file.write<Misc::UInt8>(frame.forceFinalStep?1U:0U);
+	file.write<Misc::Float32>(Misc::Float32(frame.attenuation));
+	file.write<Misc::Float32>(Misc::Float32(frame.waterDeposit));
+	file.write<Misc::UInt8>(frame.dryBoundary?1U:0U);
+	
+	/* Write the bathymetry grid if it changed: */
+	file.write<Misc::UInt32>(Misc::UInt32(frame.depthImageVersion));
+	file.write<Misc::UInt8>(frame.bathymetryChanged?1U:0U);
+	if(frame.bathymetryChanged)
+		file.write<GLfloat>(&frame.bathymetry.front(),size_t(waterTable.getSize()[1]-1)*size_t(waterTable.getSize()[0]-1));
+	
+	/* Write the water source list: */
+	file.write<Misc::UInt32>(Misc::UInt32(frame.waterSources.size()));
+	for(std::vector<WaterSource>::const_iterator wsIt=frame.waterSources.begin();wsIt!=frame.waterSources.end();++wsIt)
+		{
+		file.write<Misc::Float32>(wsIt->center,3);
+		file.write<Misc::Float32>(Misc::Float32(wsIt->radius));
+		file.write<Misc::Float32>(Misc::Float32(wsIt->rate));
+		}
+	}
+
+bool WaterRecording::readFrame(WaterRecording::Frame& frame)
+	{
+	/* Check for the end of the recording: */
+	if(file->eof())
+		return false;
+	
+	/* Read the frame's timing and simulation parameters: */
+	frame.frameTime=double(file->read<Misc::Float64>());
+	frame.timeBudget=GLfloat(file->read<Misc::Float32>());
+	frame.maxNumSteps=(unsigned int)(file->read<Misc::UInt32>());
+	frame.forceFinalStep=file->read<Misc::UInt8>()!=0;
+	frame.attenuation=GLfloat(file->read<Misc::Float32>());
+	frame.waterDeposit=GLfloat(file->read<Misc::Float32>());
+	frame.dryBoundary=file->read<Misc::UInt8>()!=0;
+	
+	/* Read the bathymetry grid if it changed: */
+	frame.depthImageVersion=(unsigned int)(file->read<Misc::UInt32>());
+	frame.bathymetryChanged=file->read<Misc::UInt8>()!=0;
+	if(frame.bathymetryChanged)
+		{
+		frame.bathymetry.resize(size_t(size[1]-1)*size_t(size[0]-1));
+		file->read(&frame.bathymetry.front(),frame.bathymetry.size());
+		}
+	
+	/* Read the water source list: */
+	frame.waterSources.resize(file->read<Misc::UInt32>());
+	for(std::vector<WaterSource>::iterator wsIt=frame.waterSources.begin();wsIt!=frame.waterSources.end();++wsIt)
+		{
+		file->read(wsIt->center,3);
+		wsIt->radius=GLfloat(file->read<Misc::Float32>());
+		wsIt->rate=GLfloat(file->read<Misc::Float32>());
+		}
+	
+	return true;
+	}
@@ -0,0 +1,119 @@
+/***********************************************************************
+WaterRecording - Class to write and read recordings of the inputs that
+drive a water flow simulation frame by frame, for deterministic replay.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERRECORDING_INCLUDED
+#define WATERRECORDING_INCLUDED
+
+#include <vector>
+#include <IO/File.h>
+#include <GL/gl.h>
+
+#include "Types.h"
+
+/* Forward declarations: */
+class WaterTable2;
+
+class WaterRecording
+	{
+	/* Embedded classes: */
+	public:
+	struct WaterSource // Structure describing a disk-shaped water source or sink in the water table's grid space
+		{
+		/* Elements: */
+		public:
+		GLfloat center[3]; // Disk center relative to the lower-left corner of the water table's domain, and elevation
+		GLfloat radius; // Disk radius
+		GLfloat rate; // Amount of water added per simulation time unit; negative for sinks
+		};
+	
+	struct Frame // Structure holding the simulation inputs of one recorded frame
+		{
+		/* Elements: */
+		public:
+		double frameTime; // Wall-clock duration of the recorded frame in seconds
+		GLfloat timeBudget; // Simulation time by which the frame advanced the water table
+		unsigned int maxNumSteps; // Maximum number of regular simulation steps in the frame
+		bool forceFinalStep; // Flag whether a final forced step covered simulation time left over by the regular steps
+		GLfloat attenuation; // Attenuation factor for partial discharges
+		GLfloat waterDeposit; // Amount of water deposited on every simulation step
+		bool dryBoundary; // Flag whether dry boundaries were enforced
+		unsigned int depthImageVersion; // Version number of the filtered depth image from which the bathymetry was derived
+		bool bathymetryChanged; // Flag whether the frame updated the bathymetry grid
+		std::vector<GLfloat> bathymetry; // Vertex-centered bathymetry grid if it was updated in the frame
+		std::vector<WaterSource> waterSources; // List of water sources and sinks active during the frame
+		};
+	
+	/* Elements: */
+	private:
+	IO::FilePtr file; // File from which the recording is read
+	GLsizei size[2]; // Width and height of the recorded water table in cells
+	GLfloat cellSize[2]; // Width and height of the recorded water table's cells
+	Scalar elevationRange[2]; // Elevation range of the recorded water table's domain
+	bool halfPrecision; // Flag whether the recorded water table used half-float storage
+	bool fusedSteps; // Flag whether the recorded water table fused temporal derivative calculations into integration steps
+	unsigned int localTimeSteppingLevels; // Number of local time stepping levels of the recorded water table
+	std::vector<GLfloat> bathymetry; // Vertex-centered bathymetry grid at the start of the recording
+	std::vector<GLfloat> quantity; // Cell-centered conserved quantity grid at the start of the recording
+	
+	/* Constructors and destructors: */
+	public:
+	WaterRecording(const char* fileName); // Opens the recording of the given name and reads its header and initial state; throws exception if the file is not a water recording
+	
+	/* Methods: */
+	static void writeHeader(IO::File& file,const WaterTable2& waterTable,const GLfloat* bathymetry,const GLfloat* quantity); // Writes a recording header for the given water table and its given initial bathymetry and conserved quantity grids to the given file
+	static void writeFrame(IO::File& file,const WaterTable2& waterTable,const Frame& frame); // Writes the given frame of a recording of the given water table to the given file
+	const GLsizei* getSize(void) const // Returns the size of the recorded water table
+		{
+		return size;
+		}
+	const GLfloat* getCellSize(void) const // Returns the cell size of the recorded water table
+		{
+		return cellSize;
+		}
+	const Scalar* getElevationRange(void) const // Returns the elevation range of the recorded water table
+		{
+		return elevationRange;
+		}
+	bool getHalfPrecision(void) const // Returns true if the recorded water table used half-float storage
+		{
+		return halfPrecision;
+		}
+	bool getFusedSteps(void) const // Returns true if the recorded water table fused temporal derivative calculations into integration steps
+		{
+		return fusedSteps;
+		}
+	unsigned int getLocalTimeSteppingLevels(void) const // Returns the number of local time stepping levels of the recorded water table
+		{
+		return localTimeSteppingLevels;
+		}
+	const GLfloat* getBathymetry(void) const // Returns the initial vertex-centered bathymetry grid, of size getSize() minus 1
+		{
+		return &bathymetry.front();
+		}
+	const GLfloat* getQuantity(void) const // Returns the initial cell-centered conserved quantity grid, of size getSize(), three components (w, hu, hv) per cell
+		{
+		return &quantity.front();
+		}
+	bool readFrame(Frame& frame); // Reads the next recorded frame; returns false at the end of the recording
+	};
+
+#endif
@@ -25,20 +25,26 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 // DEBUGGING
 #include <iostream>
 
+#include <stdio.h>
+#include <algorithm>
 #include <GL/gl.h>
 #include <GL/GLVertexArrayParts.h>
 #include <GL/GLContextData.h>
 #include <GL/Extensions/GLARBFragmentShader.h>
 #include <GL/Extensions/GLARBMultitexture.h>
+#include <GL/Extensions/GLARBPixelBufferObject.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
+#include <GL/Extensions/GLARBSync.h>
 #include <GL/Extensions/GLARBTextureFloat.h>
 #include <GL/Extensions/GLARBTextureRectangle.h>
 #include <GL/Extensions/GLARBTextureRg.h>
 #include <GL/Extensions/GLARBVertexBufferObject.h>
 #include <GL/Extensions/GLARBVertexShader.h>
+#include <GL/Extensions/GLEXTFramebufferObject.h>
 #include <GL/GLTransformationWrappers.h>
 
 #include "WaterTable2.h"
+#include "PassProfiler.h"
 #include "ShaderHelper.h"
 
 /****************************************
@@ -47,17 +53,26 @@ Methods of class WaterRenderer::DataItem:
 
 WaterRenderer::DataItem::DataItem(void)
 	:vertexBuffer(0),indexBuffer(0),
-	 waterShader(0)
+	 waterShader(0),
+	 tileTexture(0),tileFramebuffer(0),tileShader(0),tileReadbackBuffer(0),haveSync(false),tileReadbackFence(0),
+	 haveTileRuns(false)
 	{
 	/* Initialize all required extensions: */
 	GLARBFragmentShader::initExtension();
 	GLARBMultitexture::initExtension();
+	GLARBPixelBufferObject::initExtension();
 	GLARBShaderObjects::initExtension();
 	GLARBTextureFloat::initExtension();
 	GLARBTextureRectangle::initExtension();
 	GLARBTextureRg::initExtension();
 	GLARBVertexBufferObject::initExtension();
 	GLARBVertexShader::initExtension();
+	GLEXTFramebufferObject::initExtension();
+	
+	/* Initialize the optional extension to read back the wet flags asynchronously: */
+	haveSync=GLARBSync::isSupported();
+	if(haveSync)
+		GLARBSync::initExtension();
 	
 	/* Allocate the buffers: */
 	glGenBuffersARB(1,&vertexBuffer);
@@ -70,14 +85,138 @@ WaterRenderer::DataItem::~DataItem(void)
 	glDeleteBuffersARB(1,&vertexBuffer);
 	glDeleteBuffersARB(1,&indexBuffer);
 	glDeleteObjectARB(waterShader);
+	
+	/* Release all dry tile culling resources: */
+	if(tileReadbackFence!=0)
+		glDeleteSync(tileReadbackFence);
+	glDeleteBuffersARB(1,&tileReadbackBuffer);
+	glDeleteObjectARB(tileShader);
+	glDeleteFramebuffersEXT(1,&tileFramebuffer);
+	glDeleteTextures(1,&tileTexture);
 	}
 
 /******************************
 Methods of class WaterRenderer:
 ******************************/
 
+void WaterRenderer::processWetFlags(WaterRenderer::DataItem* dataItem) const
+	{
+	/* Map the read-back pixel buffer, which waits for the read-back to complete if it has not yet: */
+	glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->tileReadbackBuffer);
+	const GLubyte* flags=static_cast<const GLubyte*>(glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB,GL_READ_ONLY_ARB));
+	if(flags!=0)
+		{
+		/* Dilate the wet flags by one tile to cover water that moved into neighboring tiles since the flags were calculated: */
+		for(unsigned int y=0;y<numTiles[1];++y)
+			for(unsigned int x=0;x<numTiles[0];++x)
+				{
+				GLubyte wet=0;
+				for(unsigned int ny=y>0?y-1:0;ny<=y+1&&ny<numTiles[1];++ny)
+					for(unsigned int nx=x>0?x-1:0;nx<=x+1&&nx<numTiles[0];++nx)
+						wet|=flags[ny*numTiles[0]+nx];
+				dataItem->wetTiles[y*numTiles[0]+x]=wet;
+				}
+		glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+		
+		/* Merge horizontally adjacent wet tiles into runs: */
+		dataItem->tileRuns.clear();
+		const GLubyte* wtPtr=&dataItem->wetTiles[0];
+		for(unsigned int y=0;y<numTiles[1];++y,wtPtr+=numTiles[0])
+			{
+			unsigned int x=0;
+			while(x<numTiles[0])
+				{
+				/* Skip dry tiles: */
+				for(;x<numTiles[0]&&wtPtr[x]==0;++x)
+					;
+				if(x<numTiles[0])
+					{
+					/* Collect the run of wet tiles starting at the current tile: */
+					TileRun run;
+					run.row=y;
+					run.first=x;
+					for(;x<numTiles[0]&&wtPtr[x]!=0;++x)
+						;
+					run.last=x;
+					dataItem->tileRuns.push_back(run);
+					}
+				}
+			}
+		dataItem->haveTileRuns=true;
+		}
+	glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+	}
+
+void WaterRenderer::updateWetTiles(WaterRenderer::DataItem* dataItem) const
+	{
+	/* Check if a read-back of the wet flags has completed: */
+	if(dataItem->tileReadbackFence!=0)
+		{
+		GLenum waitResult=glClientWaitSync(dataItem->tileReadbackFence,0,0);
+		if(waitResult==GL_ALREADY_SIGNALED||waitResult==GL_CONDITION_SATISFIED)
+			{
+			glDeleteSync(dataItem->tileReadbackFence);
+			dataItem->tileReadbackFence=0;
+			
+			processWetFlags(dataItem);
+			}
+		}
+	
+	/* Start a new read-back if none is in progress: */
+	if(dataItem->tileReadbackFence==0)
+		{
+		/* Save relevant OpenGL state: */
+		glPushAttrib(GL_ENABLE_BIT|GL_VIEWPORT_BIT);
+		GLint currentFrameBuffer;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+		
+		/* Bind the wet tile frame buffer: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->tileFramebuffer);
+		glViewport(0,0,numTiles[0],numTiles[1]);
+		glDisable(GL_BLEND);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_SCISSOR_TEST);
+		
+		/* Bind the wet tile shader and the already-bound quantity and bathymetry textures: */
+		glUseProgramObjectARB(dataItem->tileShader);
+		glUniform1iARB(dataItem->tileShaderUniforms[0],0);
+		glUniform1iARB(dataItem->tileShaderUniforms[1],1);
+		glUniform1fARB(dataItem->tileShaderUniforms[2],GLfloat(tileSize));
+		
+		/* Calculate the wet flags of all tiles: */
+		glBegin(GL_QUADS);
+		glVertex2i(0,0);
+		glVertex2i(numTiles[0],0);
+		glVertex2i(numTiles[0],numTiles[1]);
+		glVertex2i(0,numTiles[1]);
+		glEnd();
+		
+		/* Start reading back the wet flags into the pixel buffer: */
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->tileReadbackBuffer);
+		glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+		glPixelStorei(GL_PACK_ALIGNMENT,1);
+		glReadPixels(0,0,numTiles[0],numTiles[1],GL_RED,GL_UNSIGNED_BYTE,0);
+		glPopClientAttrib();
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		
+		/* Insert a fence to detect when the read-back is complete, or wait for it right away if the context does not support fences: */
+		if(dataItem->haveSync)
+			dataItem->tileReadbackFence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+		else
+			processWetFlags(dataItem);
+		
+		/* Restore OpenGL state: */
+		glUseProgramObjectARB(0);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+		glPopAttrib();
+		}
+	}
+
 WaterRenderer::WaterRenderer(const WaterTable2* sWaterTable)
-	:waterTable(sWaterTable)
+	:waterTable(sWaterTable),
+	 profiler(0),
+	 tileSize(0)
 	{
 	/* Copy the water table's grid sizes and grid cell size: */
 	for(int i=0;i<2;++i)
@@ -107,6 +246,9 @@ WaterRenderer::WaterRenderer(const WaterTable2* sWaterTable)
 	tgtm(1,1)=Scalar(waterGridSize[1])/(wd.max[1]-wd.min[1]);
 	tgtm(1,3)=-wd.min[1]*tgtm(1,1);
 	tangentGridTransform*=waterTable->getBaseTransform();
+	
+	/* Enable dry tile culling with the default tile size: */
+	setTileSize(16);
 	}
 
 void WaterRenderer::initContext(GLContextData& contextData) const
@@ -150,29 +292,88 @@ void WaterRenderer::initContext(GLContextData& contextData) const
 	*(ulPtr++)=glGetUniformLocationARB(dataItem->waterShader,"modelviewGridMatrix");
 	*(ulPtr++)=glGetUniformLocationARB(dataItem->waterShader,"tangentModelviewGridMatrix");
 	*(ulPtr++)=glGetUniformLocationARB(dataItem->waterShader,"projectionModelviewGridMatrix");
+	
+	if(tileSize!=0)
+		{
+		/* Initialize the wet tile texture: */
+		glGenTextures(1,&dataItem->tileTexture);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->tileTexture);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_R8,numTiles[0],numTiles[1],0,GL_RED,GL_UNSIGNED_BYTE,0);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		
+		/* Attach the wet tile texture to the wet tile frame buffer: */
+		glGenFramebuffersEXT(1,&dataItem->tileFramebuffer);
+		GLint currentFrameBuffer;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->tileFramebuffer);
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,GL_COLOR_ATTACHMENT0_EXT,GL_TEXTURE_RECTANGLE_ARB,dataItem->tileTexture,0);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+		
+		/* Allocate the wet flag read-back buffer: */
+		glGenBuffersARB(1,&dataItem->tileReadbackBuffer);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->tileReadbackBuffer);
+		glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,numTiles[1]*numTiles[0]*sizeof(GLubyte),0,GL_STREAM_READ_ARB);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		dataItem->wetTiles.resize(numTiles[1]*numTiles[0],0);
+		
+		/* Create the wet tile shader with a simple vertex shader rendering quads in tile space: */
+		static const char* vertexShaderSourceTemplate="void main(){gl_Position=vec4(gl_Vertex.x*%f-1.0,gl_Vertex.y*%f-1.0,0.0,1.0);}";
+		char vertexShaderSource[256];
+		snprintf(vertexShaderSource,sizeof(vertexShaderSource),vertexShaderSourceTemplate,2.0/double(numTiles[0]),2.0/double(numTiles[1]));
+		ShaderProgramSource source;
+		source.addVertexShader(vertexShaderSource);
+		source.addFragmentShaderFile("WaterWetTileShader");
+		dataItem->tileShader=source.link();
+		dataItem->tileShaderUniforms[0]=glGetUniformLocationARB(dataItem->tileShader,"quantitySampler");
+		dataItem->tileShaderUniforms[1]=glGetUniformLocationARB(dataItem->tileShader,"bathymetrySampler");
+		dataItem->tileShaderUniforms[2]=glGetUniformLocationARB(dataItem->tileShader,"tileSize");
+		}
+	}
+
+void WaterRenderer::setProfiler(const PassProfiler* newProfiler)
+	{
+	profiler=newProfiler;
+	}
+
+void WaterRenderer::setTileSize(unsigned int newTileSize)
+	{
+	tileSize=newTileSize;
+	
+	/* Calculate the number of tiles covering the grid's quads: */
+	for(int i=0;i<2;++i)
+		numTiles[i]=tileSize!=0?(waterGridSize[i]+tileSize-2)/tileSize:0;
 	}
 
 void WaterRenderer::render(const PTransform& projection,const OGTransform& modelview,GLContextData& contextData) const
 	{
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	PassProfiler::Timer renderTimer(profiler,PassProfiler::WATER_RENDER,contextData);
 	
 	/* Calculate the required matrices: */
 	PTransform projectionModelview=projection;
 	projectionModelview*=modelview;
 	
-	/* Bind the water rendering shader: */
-	glUseProgramObjectARB(dataItem->waterShader);
-	const GLint* ulPtr=dataItem->waterShaderUniforms;
-	
-	/* Bind the water quantity texture: */
+	/* Bind the water quantity and bathymetry textures: */
 	glActiveTextureARB(GL_TEXTURE0_ARB);
 	waterTable->bindQuantityTexture(contextData);
-	glUniform1iARB(*(ulPtr++),0);
-	
-	/* Bind the bathymetry texture: */
 	glActiveTextureARB(GL_TEXTURE1_ARB);
 	waterTable->bindBathymetryTexture(contextData);
+	
+	/* Update the list of wet tiles if dry tile culling is enabled: */
+	if(tileSize!=0)
+		updateWetTiles(dataItem);
+	
+	/* Bind the water rendering shader: */
+	glUseProgramObjectARB(dataItem->waterShader);
+	const GLint* ulPtr=dataItem->waterShaderUniforms;
+	glUniform1iARB(*(ulPtr++),0);
 	glUniform1iARB(*(ulPtr++),1);
 	
 	/* Calculate and upload the vertex transformation from grid space to eye space: */
@@ -205,9 +406,30 @@ void WaterRenderer::render(const PTransform& projection,const OGTransform& model
 	/* Draw the surface: */
 	GLVertexArrayParts::enable(Vertex::getPartsMask());
 	glVertexPointer(static_cast<const Vertex*>(0));
-	GLuint* indexPtr=0;
-	for(unsigned int y=1;y<waterGridSize[1];++y,indexPtr+=waterGridSize[0]*2)
-		glDrawElements(GL_QUAD_STRIP,waterGridSize[0]*2,GL_UNSIGNED_INT,indexPtr);
+	if(tileSize!=0&&dataItem->haveTileRuns)
+		{
+		/* Draw only the parts of quad strips covered by runs of wet tiles: */
+		for(std::vector<TileRun>::const_iterator trIt=dataItem->tileRuns.begin();trIt!=dataItem->tileRuns.end();++trIt)
+			{
+			/* Calculate the range of template vertex columns and quad strips covered by the run: */
+			unsigned int x0=trIt->first*tileSize;
+			unsigned int x1=std::min(trIt->last*tileSize,waterGridSize[0]-1);
+			unsigned int y0=trIt->row*tileSize+1;
+			unsigned int y1=std::min((trIt->row+1)*tileSize,waterGridSize[1]-1);
+			
+			/* Draw the run's part of each quad strip: */
+			const GLuint* indexPtr=static_cast<const GLuint*>(0)+((y0-1)*waterGridSize[0]+x0)*2;
+			for(unsigned int y=y0;y<=y1;++y,indexPtr+=waterGridSize[0]*2)
+				glDrawElements(GL_QUAD_STRIP,(x1-x0+1)*2,GL_UNSIGNED_INT,indexPtr);
+			}
+		}
+	else
+		{
+		/* Draw all quad strips: */
+		GLuint* indexPtr=0;
+		for(unsigned int y=1;y<waterGridSize[1];++y,indexPtr+=waterGridSize[0]*2)
+			glDrawElements(GL_QUAD_STRIP,waterGridSize[0]*2,GL_UNSIGNED_INT,indexPtr);
+		}
 	GLVertexArrayParts::disable(Vertex::getPartsMask());
 	
 	/* Unbind all textures and buffers: */
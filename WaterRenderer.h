@@ -23,8 +23,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef WATERRENDERER_INCLUDED
 #define WATERRENDERER_INCLUDED
 
+#include <vector>
 #include <GL/gl.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
+#include <GL/Extensions/GLARBSync.h>
 #include <GL/GLObject.h>
 #include <GL/GLGeometryVertex.h>
 
@@ -32,6 +34,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 /* Forward declarations: */
 class WaterTable2;
+class PassProfiler;
 
 class WaterRenderer:public GLObject
 	{
@@ -39,6 +42,14 @@ class WaterRenderer:public GLObject
 	private:
 	typedef GLGeometry::Vertex<void,0,void,0,void,GLfloat,2> Vertex; // Type for template vertices
 	
+	struct TileRun // Structure for a run of horizontally adjacent tiles containing water
+		{
+		/* Elements: */
+		public:
+		unsigned int row; // Index of the tile row containing the run
+		unsigned int first,last; // Range of tile columns covered by the run, as [first, last)
+		};
+	
 	struct DataItem:public GLObject::DataItem // Structure storing per-context OpenGL state
 		{
 		/* Elements: */
@@ -52,6 +63,18 @@ class WaterRenderer:public GLObject
 		GLhandleARB waterShader; // Shader program to render the water surface
 		GLint waterShaderUniforms[5]; // Locations of the water shader's uniform variables
 		
+		/* Dry tile culling state: */
+		GLuint tileTexture; // ID of texture holding the wet flags of all tiles
+		GLuint tileFramebuffer; // ID of frame buffer to calculate the wet flags of all tiles
+		GLhandleARB tileShader; // Shader program to calculate the wet flags of all tiles
+		GLint tileShaderUniforms[3]; // Locations of the wet tile shader's uniform variables
+		GLuint tileReadbackBuffer; // ID of pixel buffer object receiving asynchronous read-backs of the wet flags
+		bool haveSync; // Flag whether the OpenGL context supports sync objects; the wet flags are read back synchronously otherwise
+		GLsync tileReadbackFence; // Fence signaling completion of the asynchronous read-back, or null if no read-back is in progress
+		std::vector<GLubyte> wetTiles; // Wet flags of all tiles, dilated by one tile to cover water movement during read-back latency
+		bool haveTileRuns; // Flag whether the list of wet tile runs reflects at least one completed read-back
+		std::vector<TileRun> tileRuns; // List of runs of wet tiles to render
+		
 		/* Constructors and destructors: */
 		DataItem(void);
 		virtual ~DataItem(void);
@@ -64,6 +87,13 @@ class WaterRenderer:public GLObject
 	GLfloat cellSize[2]; // Cell size of the bathymetry and water level grids in world coordinate units
 	PTransform gridTransform; // Vertex transformation from grid space to world space
 	PTransform tangentGridTransform; // Transposed tangent plane transformation from grid space to world space
+	const PassProfiler* profiler; // Profiler measuring the GPU time of water rendering, or null
+	unsigned int tileSize; // Number of water surface quads along each side of a square culling tile; 0 disables culling
+	unsigned int numTiles[2]; // Number of culling tiles along each water grid axis
+	
+	/* Private methods: */
+	void processWetFlags(DataItem* dataItem) const; // Updates the wet tiles and wet tile runs from the read-back pixel buffer, waiting for the read-back to complete
+	void updateWetTiles(DataItem* dataItem) const; // Processes a completed read-back of tile wet flags and starts a new one if none is in progress; expects quantity and bathymetry textures bound to texture units 0 and 1
 	
 	/* Constructors and destructors: */
 	public:
@@ -73,6 +103,8 @@ class WaterRenderer:public GLObject
 	virtual void initContext(GLContextData& contextData) const;
 	
 	/* New methods: */
+	void setProfiler(const PassProfiler* newProfiler); // Sets a profiler to measure the GPU time of water rendering; null disables profiling
+	void setTileSize(unsigned int newTileSize); // Sets the size of square tiles of water surface quads that are skipped while dry; 0 disables culling; must be called before the renderer is initialized in any OpenGL context
 	void render(const PTransform& projection,const OGTransform& modelview,GLContextData& contextData) const; // Renders the water surface
 	};
 
@@ -0,0 +1,174 @@
+/***********************************************************************
+WaterSimulationThread - Class to run a water flow simulation at a fixed
+rate in a background thread with its own OpenGL context, decoupled from
+the display frame rate.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterSimulationThread.h"
+
+#include <unistd.h>
+#include <Misc/Timer.h>
+#include <GL/GLContextData.h>
+#include <Vrui/Vrui.h>
+
+#include "OffscreenGLContext.h"
+#include "DepthImageRenderer.h"
+#include "WaterTable2.h"
+#include "PassProfiler.h"
+
+/**************************************
+Methods of class WaterSimulationThread:
+**************************************/
+
+void* WaterSimulationThread::simulationThreadMethod(void)
+	{
+	/* Make the simulation context current in this thread and initialize the simulation's OpenGL state: */
+	context->makeCurrent();
+	GLContextData& contextData=context->getContextData();
+	depthImageRenderer->initContext(contextData);
+	waterTable->initContext(contextData);
+	waterTable->initSnapshots(contextData);
+	if(profiler!=0)
+		profiler->initContext(contextData);
+	
+	/* Run the simulation loop: */
+	Misc::Timer timer;
+	double wallTime=0.0; // Wall-clock time since the thread started
+	double nextTickTime=0.0; // Wall-clock time at which to start the next update
+	double measureStartTime=0.0; // Start of the current metrics measurement interval
+	double measureSimulatedTime=0.0; // Simulated time during the current measurement interval
+	unsigned int measureNumSteps=0; // Number of simulation steps during the current measurement interval
+	while(runSimulationThread)
+		{
+		/* Check if there is a new depth image: */
+		if(depthFrames.lockNewValue())
+			depthImageRenderer->setDepthImage(depthFrames.getLockedValue());
+		
+		/* Update the water table's bathymetry grid: */
+		waterTable->updateBathymetry(contextData);
+		
+		/* Advance the simulation by one tick's worth of simulated time: */
+		GLfloat totalTimeStep=GLfloat(tickInterval*waterSpeed);
+		unsigned int numSteps=0;
+		while(numSteps<waterMaxSteps&&totalTimeStep>1.0e-8f)
+			{
+			/* Run with a self-determined time step to maintain stability: */
+			waterTable->setMaxStepSize(totalTimeStep);
+			GLfloat timeStep=waterTable->runSimulationStep(false,contextData);
+			totalTimeStep-=timeStep;
+			measureSimulatedTime+=double(timeStep);
+			++numSteps;
+			}
+		if(totalTimeStep>1.0e-8f)
+			++numMissedTicks;
+		measureNumSteps+=numSteps;
+		
+		/* Hand the new simulation state to the renderers: */
+		waterTable->publishSnapshot(contextData);
+		Vrui::requestUpdate();
+		
+		/* Finish the tick's pass timings: */
+		if(profiler!=0)
+			profiler->finishFrame(contextData);
+		
+		/* Update the simulation metrics about once per second: */
+		timer.elapse();
+		wallTime+=timer.getTime();
+		if(wallTime-measureStartTime>=1.0)
+			{
+			simulationSpeed=measureSimulatedTime/(wallTime-measureStartTime);
+			stepRate=double(measureNumSteps)/(wallTime-measureStartTime);
+			measureStartTime=wallTime;
+			measureSimulatedTime=0.0;
+			measureNumSteps=0;
+			}
+		
+		/* Sleep until the next tick; drop ticks instead of trying to catch up if the simulation fell behind: */
+		nextTickTime+=tickInterval;
+		if(nextTickTime>wallTime)
+			usleep(useconds_t((nextTickTime-wallTime)*1.0e6));
+		else
+			nextTickTime=wallTime;
+		timer.elapse();
+		wallTime+=timer.getTime();
+		}
+	
+	/* Destroy the simulation context and all OpenGL state created in it: */
+	delete context;
+	
+	return 0;
+	}
+
+WaterSimulationThread::WaterSimulationThread(DepthImageRenderer* sDepthImageRenderer,WaterTable2* sWaterTable,double sSimulationRate)
+	:depthImageRenderer(sDepthImageRenderer),waterTable(sWaterTable),
+	 tickInterval(1.0/sSimulationRate),
+	 waterSpeed(1.0),waterMaxSteps(30U),
+	 profiler(0),context(0),
+	 runSimulationThread(false),
+	 simulationSpeed(0.0),stepRate(0.0),numMissedTicks(0U)
+	{
+	/* Tell the water table that renderers have to use published snapshots: */
+	waterTable->setPublishSnapshots(true);
+	}
+
+WaterSimulationThread::~WaterSimulationThread(void)
+	{
+	if(context!=0)
+		{
+		/* Shut down the simulation thread; the thread destroys its own context: */
+		runSimulationThread=false;
+		simulationThread.join();
+		}
+	}
+
+void WaterSimulationThread::start(Display* shareDisplay,GLXContext shareContext)
+	{
+	/* Bail out if the thread is already running: */
+	if(context!=0)
+		return;
+	
+	/* Create the simulation context in this thread to ensure that it shares texture objects with the given context: */
+	context=new OffscreenGLContext(DisplayString(shareDisplay),shareContext);
+	
+	/* Start the simulation thread: */
+	runSimulationThread=true;
+	simulationThread.start(this,&WaterSimulationThread::simulationThreadMethod);
+	}
+
+void WaterSimulationThread::setProfiler(const PassProfiler* newProfiler)
+	{
+	profiler=newProfiler;
+	}
+
+void WaterSimulationThread::setWaterSpeed(double newWaterSpeed)
+	{
+	waterSpeed=newWaterSpeed;
+	}
+
+void WaterSimulationThread::setWaterMaxSteps(unsigned int newWaterMaxSteps)
+	{
+	waterMaxSteps=newWaterMaxSteps;
+	}
+
+void WaterSimulationThread::setDepthImage(const Kinect::FrameBuffer& newDepthImage)
+	{
+	/* Post the new depth image to the simulation thread: */
+	depthFrames.postNewValue(newDepthImage);
+	}
@@ -0,0 +1,89 @@
+/***********************************************************************
+WaterSimulationThread - Class to run a water flow simulation at a fixed
+rate in a background thread with its own OpenGL context, decoupled from
+the display frame rate.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERSIMULATIONTHREAD_INCLUDED
+#define WATERSIMULATIONTHREAD_INCLUDED
+
+#include <Threads/Thread.h>
+#include <Threads/TripleBuffer.h>
+#include <GL/gl.h>
+#include <GL/glx.h>
+#include <Kinect/FrameBuffer.h>
+
+/* Forward declarations: */
+class OffscreenGLContext;
+class DepthImageRenderer;
+class WaterTable2;
+class PassProfiler;
+
+class WaterSimulationThread
+	{
+	/* Elements: */
+	private:
+	DepthImageRenderer* depthImageRenderer; // Private depth image renderer used to update the water table's bathymetry; must not be used by any other thread
+	WaterTable2* waterTable; // The water table simulated by the background thread
+	double tickInterval; // Wall-clock time between simulation updates in seconds
+	volatile double waterSpeed; // Relative speed of the water flow simulation
+	volatile unsigned int waterMaxSteps; // Maximum number of simulation steps per update
+	Threads::TripleBuffer<Kinect::FrameBuffer> depthFrames; // Triple buffer of depth frames handed from the main thread to the simulation thread
+	const PassProfiler* profiler; // Profiler measuring the GPU time of the simulation passes, or null
+	OffscreenGLContext* context; // OpenGL context sharing texture objects with the rendering contexts
+	volatile bool runSimulationThread; // Flag to keep the simulation thread running
+	Threads::Thread simulationThread; // The background simulation thread
+	volatile double simulationSpeed; // Simulated seconds per wall-clock second, averaged over the last measurement interval
+	volatile double stepRate; // Simulation steps per wall-clock second, averaged over the last measurement interval
+	volatile unsigned int numMissedTicks; // Number of updates that could not keep up with the requested simulation speed since the thread was started
+	
+	/* Private methods: */
+	void* simulationThreadMethod(void); // Method running the background simulation thread
+	
+	/* Constructors and destructors: */
+	public:
+	WaterSimulationThread(DepthImageRenderer* sDepthImageRenderer,WaterTable2* sWaterTable,double sSimulationRate); // Creates a simulation thread for the given water table, updated at the given rate in Hz; does not start the thread
+	~WaterSimulationThread(void); // Stops the simulation thread and destroys its OpenGL context
+	
+	/* Methods: */
+	void start(Display* shareDisplay,GLXContext shareContext); // Starts the simulation thread in a new context sharing texture objects with the given context; must be called from the thread in which the given context is current
+	bool isRunning(void) const // Returns true if the simulation thread has been started
+		{
+		return context!=0;
+		}
+	void setProfiler(const PassProfiler* newProfiler); // Sets a profiler to measure the GPU time of the simulation passes; must be called before the thread is started
+	void setWaterSpeed(double newWaterSpeed); // Sets the relative speed of the water flow simulation
+	void setWaterMaxSteps(unsigned int newWaterMaxSteps); // Sets the maximum number of simulation steps per update
+	void setDepthImage(const Kinect::FrameBuffer& newDepthImage); // Hands a new depth image to the simulation thread to update the water table's bathymetry
+	double getSimulationSpeed(void) const // Returns the number of simulated seconds per wall-clock second
+		{
+		return simulationSpeed;
+		}
+	double getStepRate(void) const // Returns the number of simulation steps per wall-clock second
+		{
+		return stepRate;
+		}
+	unsigned int getNumMissedTicks(void) const // Returns the number of updates that fell behind the requested simulation speed
+		{
+		return numMissedTicks;
+		}
+	};
+
+#endif
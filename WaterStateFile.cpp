@@ -0,0 +1,192 @@
+/***********************************************************************
+WaterStateFile - Class to save the full state of a water flow simulation
+to a compact binary file, and to map such files into memory for fast
+restoring.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterStateFile.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <Misc/SizedTypes.h>
+#include <Misc/ThrowStdErr.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
+
+namespace {
+
+/***********************************************************************
+Layout of a water state file. All values are stored in the byte order of
+the writing host, which is identified by the byte order tag; the header
+is padded to keep the grids aligned for direct use from a memory-mapped
+file.
+***********************************************************************/
+
+const char fileMagic[16]={'S','A','R','n','d','b','o','x','W','a','t','e','r','0','1','\n'};
+const Misc::UInt32 byteOrderTag=0x01020304U;
+const size_t sizeOffset=20; // Two UInt32 for width and height of the water table
+const size_t cellSizeOffset=28; // Two Float32 for the cell size
+const size_t domainOffset=40; // Six Float64 for the domain's min and max corners
+const size_t translationOffset=88; // Three Float64 for the base transformation's translation
+const size_t rotationOffset=112; // Four Float64 for the base transformation's rotation quaternion
+const size_t headerSize=256; // Total size of the header
+
+/****************
+Helper functions:
+****************/
+
+template <class ValueParam>
+inline
+ValueParam readValue(const char* header,size_t offset)
+	{
+	ValueParam result;
+	memcpy(&result,header+offset,sizeof(ValueParam));
+	return result;
+	}
+
+}
+
+/*******************************
+Methods of class WaterStateFile:
+*******************************/
+
+WaterStateFile::WaterStateFile(const char* fileName)
+	:mapping(0),mappingSize(0),
+	 bathymetry(0),quantity(0)
+	{
+	/* Open the file and map it into memory; the mapping stays valid after the file is closed: */
+	int fd=open(fileName,O_RDONLY);
+	if(fd<0)
+		Misc::throwStdErr("WaterStateFile::WaterStateFile: Unable to open water state file %s",fileName);
+	struct stat fileStat;
+	if(fstat(fd,&fileStat)<0||size_t(fileStat.st_size)<headerSize)
+		{
+		close(fd);
+		Misc::throwStdErr("WaterStateFile::WaterStateFile: %s is not a water state file",fileName);
+		}
+	mappingSize=size_t(fileStat.st_size);
+	mapping=mmap(0,mappingSize,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(mapping==MAP_FAILED)
+		{
+		mapping=0;
+		Misc::throwStdErr("WaterStateFile::WaterStateFile: Unable to map water state file %s",fileName);
+		}
+	
+	/* The grids are read sequentially once by the restore; let the kernel start reading them now: */
+	madvise(mapping,mappingSize,MADV_WILLNEED);
+	
+	/* Check the file header: */
+	const char* header=static_cast<const char*>(mapping);
+	if(memcmp(header,fileMagic,sizeof(fileMagic))!=0||readValue<Misc::UInt32>(header,sizeof(fileMagic))!=byteOrderTag)
+		{
+		munmap(mapping,mappingSize);
+		Misc::throwStdErr("WaterStateFile::WaterStateFile: %s is not a water state file of this host's byte order",fileName);
+		}
+	
+	/* Read the water table's layout: */
+	for(int i=0;i<2;++i)
+		{
+		size[i]=GLsizei(readValue<Misc::UInt32>(header,sizeOffset+i*sizeof(Misc::UInt32)));
+		cellSize[i]=GLfloat(readValue<Misc::Float32>(header,cellSizeOffset+i*sizeof(Misc::Float32)));
+		}
+	for(int i=0;i<3;++i)
+		{
+		domain.min[i]=Scalar(readValue<Misc::Float64>(header,domainOffset+i*sizeof(Misc::Float64)));
+		domain.max[i]=Scalar(readValue<Misc::Float64>(header,domainOffset+(3+i)*sizeof(Misc::Float64)));
+		}
+	Vector translation;
+	for(int i=0;i<3;++i)
+		translation[i]=Scalar(readValue<Misc::Float64>(header,translationOffset+i*sizeof(Misc::Float64)));
+	Scalar rotation[4];
+	for(int i=0;i<4;++i)
+		rotation[i]=Scalar(readValue<Misc::Float64>(header,rotationOffset+i*sizeof(Misc::Float64)));
+	baseTransform=WaterTable2::ONTransform(translation,WaterTable2::ONTransform::Rotation(rotation));
+	
+	/* Check that the file contains both grids: */
+	size_t bathymetrySize=size_t(size[1]-1)*size_t(size[0]-1);
+	size_t quantitySize=size_t(size[1])*size_t(size[0])*3;
+	if(size[0]<2||size[1]<2||mappingSize<headerSize+(bathymetrySize+quantitySize)*sizeof(GLfloat))
+		{
+		munmap(mapping,mappingSize);
+		Misc::throwStdErr("WaterStateFile::WaterStateFile: Water state file %s is truncated",fileName);
+		}
+	
+	/* Point to the grids inside the mapped file: */
+	bathymetry=reinterpret_cast<const GLfloat*>(header+headerSize);
+	quantity=bathymetry+bathymetrySize;
+	}
+
+WaterStateFile::~WaterStateFile(void)
+	{
+	munmap(mapping,mappingSize);
+	}
+
+void WaterStateFile::write(const char* fileName,const WaterTable2& waterTable,const GLfloat* bathymetry,const GLfloat* quantity)
+	{
+	/* Assemble the file header: */
+	char header[headerSize];
+	memset(header,0,headerSize);
+	memcpy(header,fileMagic,sizeof(fileMagic));
+	memcpy(header+sizeof(fileMagic),&byteOrderTag,sizeof(Misc::UInt32));
+	const GLsizei* size=waterTable.getSize();
+	for(int i=0;i<2;++i)
+		{
+		Misc::UInt32 s=Misc::UInt32(size[i]);
+		memcpy(header+sizeOffset+i*sizeof(Misc::UInt32),&s,sizeof(Misc::UInt32));
+		Misc::Float32 cs=Misc::Float32(waterTable.getCellSize()[i]);
+		memcpy(header+cellSizeOffset+i*sizeof(Misc::Float32),&cs,sizeof(Misc::Float32));
+		}
+	const WaterTable2::Box& domain=waterTable.getDomain();
+	for(int i=0;i<3;++i)
+		{
+		Misc::Float64 min=Misc::Float64(domain.min[i]);
+		memcpy(header+domainOffset+i*sizeof(Misc::Float64),&min,sizeof(Misc::Float64));
+		Misc::Float64 max=Misc::Float64(domain.max[i]);
+		memcpy(header+domainOffset+(3+i)*sizeof(Misc::Float64),&max,sizeof(Misc::Float64));
+		}
+	const WaterTable2::ONTransform& baseTransform=waterTable.getBaseTransform();
+	for(int i=0;i<3;++i)
+		{
+		Misc::Float64 t=Misc::Float64(baseTransform.getTranslation()[i]);
+		memcpy(header+translationOffset+i*sizeof(Misc::Float64),&t,sizeof(Misc::Float64));
+		}
+	for(int i=0;i<4;++i)
+		{
+		Misc::Float64 q=Misc::Float64(baseTransform.getRotation().getQuaternion()[i]);
+		memcpy(header+rotationOffset+i*sizeof(Misc::Float64),&q,sizeof(Misc::Float64));
+		}
+	
+	/* Write the header and both grids: */
+	IO::FilePtr file=IO::openFile(fileName,IO::File::WriteOnly);
+	file->writeRaw(header,headerSize);
+	file->write<GLfloat>(bathymetry,size_t(size[1]-1)*size_t(size[0]-1));
+	file->write<GLfloat>(quantity,size_t(size[1])*size_t(size[0])*3);
+	}
+
+bool WaterStateFile::matches(const WaterTable2& waterTable) const
+	{
+	/* The grids can be restored into any water table of the same size: */
+	return size[0]==waterTable.getSize()[0]&&size[1]==waterTable.getSize()[1];
+	}
@@ -0,0 +1,83 @@
+/***********************************************************************
+WaterStateFile - Class to save the full state of a water flow simulation
+to a compact binary file, and to map such files into memory for fast
+restoring.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERSTATEFILE_INCLUDED
+#define WATERSTATEFILE_INCLUDED
+
+#include <stddef.h>
+#include <GL/gl.h>
+
+#include "WaterTable2.h"
+
+class WaterStateFile
+	{
+	/* Elements: */
+	private:
+	void* mapping; // Pointer to the memory-mapped file contents
+	size_t mappingSize; // Size of the memory-mapped file in bytes
+	GLsizei size[2]; // Width and height of the saved water table in cells
+	GLfloat cellSize[2]; // Width and height of the saved water table's cells
+	WaterTable2::Box domain; // Domain of the saved water table in rotated camera space
+	WaterTable2::ONTransform baseTransform; // Transformation from camera space to upright elevation map space of the saved water table
+	const GLfloat* bathymetry; // Pointer to the vertex-centered bathymetry grid inside the mapped file
+	const GLfloat* quantity; // Pointer to the cell-centered conserved quantity grid inside the mapped file
+	
+	/* Constructors and destructors: */
+	public:
+	WaterStateFile(const char* fileName); // Maps the water state file of the given name into memory
+	private:
+	WaterStateFile(const WaterStateFile& source); // Prohibit copy constructor
+	WaterStateFile& operator=(const WaterStateFile& source); // Prohibit assignment operator
+	public:
+	~WaterStateFile(void); // Unmaps the water state file
+	
+	/* Methods: */
+	static void write(const char* fileName,const WaterTable2& waterTable,const GLfloat* bathymetry,const GLfloat* quantity); // Writes the given bathymetry and conserved quantity grids, as read back from the given water table, to a water state file of the given name
+	const GLsizei* getSize(void) const // Returns the size of the saved water table
+		{
+		return size;
+		}
+	const GLfloat* getCellSize(void) const // Returns the cell size of the saved water table
+		{
+		return cellSize;
+		}
+	const WaterTable2::Box& getDomain(void) const // Returns the domain of the saved water table
+		{
+		return domain;
+		}
+	const WaterTable2::ONTransform& getBaseTransform(void) const // Returns the base transformation of the saved water table
+		{
+		return baseTransform;
+		}
+	bool matches(const WaterTable2& waterTable) const; // Returns true if the saved state can be restored into the given water table
+	const GLfloat* getBathymetry(void) const // Returns the vertex-centered bathymetry grid, of size getSize() minus 1, one component per vertex
+		{
+		return bathymetry;
+		}
+	const GLfloat* getQuantity(void) const // Returns the cell-centered conserved quantity grid, of size getSize(), three components (w, hu, hv) per cell
+		{
+		return quantity;
+		}
+	};
+
+#endif
@@ -0,0 +1,99 @@
+/***********************************************************************
+WaterStateSaver - Class to read back the full state of a running water
+flow simulation asynchronously and save it to a water state file.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterStateSaver.h"
+
+#include <string.h>
+#include <Misc/FunctionCalls.h>
+
+#include "WaterTable2.h"
+#include "WaterStateFile.h"
+
+/********************************
+Methods of class WaterStateSaver:
+********************************/
+
+void WaterStateSaver::bathymetryReadbackCallback(const GLfloat* bathymetry)
+	{
+	/* Copy the bathymetry grid; the water table's buffer is only valid during this call: */
+	memcpy(grids[0],bathymetry,size_t(waterTable->getBathymetrySize(1))*size_t(waterTable->getBathymetrySize(0))*sizeof(GLfloat));
+	ready[0]=true;
+	}
+
+void WaterStateSaver::quantityReadbackCallback(const GLfloat* quantity)
+	{
+	/* Copy the conserved quantity grid: */
+	memcpy(grids[1],quantity,size_t(waterTable->getSize()[1])*size_t(waterTable->getSize()[0])*3*sizeof(GLfloat));
+	ready[1]=true;
+	}
+
+WaterStateSaver::WaterStateSaver(WaterTable2* sWaterTable,const char* sFileName)
+	:waterTable(sWaterTable),fileName(sFileName)
+	{
+	/* Allocate the grid buffers: */
+	grids[0]=new GLfloat[size_t(waterTable->getBathymetrySize(1))*size_t(waterTable->getBathymetrySize(0))];
+	grids[1]=new GLfloat[size_t(waterTable->getSize()[1])*size_t(waterTable->getSize()[0])*3];
+	
+	/* Create the read-back functions: */
+	readbackFunctions[0]=Misc::createFunctionCall(this,&WaterStateSaver::bathymetryReadbackCallback);
+	readbackFunctions[1]=Misc::createFunctionCall(this,&WaterStateSaver::quantityReadbackCallback);
+	for(int i=0;i<2;++i)
+		{
+		requested[i]=false;
+		ready[i]=false;
+		}
+	
+	/* Request both grids: */
+	update();
+	}
+
+WaterStateSaver::~WaterStateSaver(void)
+	{
+	/* Cancel outstanding read-backs: */
+	for(int i=0;i<2;++i)
+		waterTable->cancelReadbacks(readbackFunctions[i]);
+	
+	/* Clean up: */
+	for(int i=0;i<2;++i)
+		{
+		delete readbackFunctions[i];
+		delete[] grids[i];
+		}
+	}
+
+bool WaterStateSaver::update(void)
+	{
+	/* Request grids that could not be requested before because another client's read-back of the same grid was pending: */
+	if(!requested[0])
+		requested[0]=waterTable->requestBathymetry(readbackFunctions[0]);
+	if(!requested[1])
+		requested[1]=waterTable->requestQuantity(readbackFunctions[1]);
+	
+	/* Write the water state file once both grids have arrived: */
+	if(ready[0]&&ready[1])
+		{
+		WaterStateFile::write(fileName.c_str(),*waterTable,grids[0],grids[1]);
+		return true;
+		}
+	else
+		return false;
+	}
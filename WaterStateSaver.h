@@ -0,0 +1,65 @@
+/***********************************************************************
+WaterStateSaver - Class to read back the full state of a running water
+flow simulation asynchronously and save it to a water state file.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERSTATESAVER_INCLUDED
+#define WATERSTATESAVER_INCLUDED
+
+#include <string>
+#include <GL/gl.h>
+
+/* Forward declarations: */
+namespace Misc {
+template <class ParameterParam>
+class FunctionCall;
+}
+class WaterTable2;
+typedef Misc::FunctionCall<const GLfloat*> GridReadbackFunction;
+
+class WaterStateSaver
+	{
+	/* Elements: */
+	private:
+	WaterTable2* waterTable; // Water table whose state is saved
+	std::string fileName; // Name of the water state file to write
+	GLfloat* grids[2]; // Buffers receiving the bathymetry and conserved quantity grids
+	GridReadbackFunction* readbackFunctions[2]; // Functions receiving the requested grids from the water table
+	bool requested[2]; // Flags whether the read-back of each grid has been requested from the water table
+	volatile bool ready[2]; // Flags whether each requested grid has arrived in its buffer
+	
+	/* Private methods: */
+	void bathymetryReadbackCallback(const GLfloat* bathymetry); // Callback receiving the requested bathymetry grid from the water table
+	void quantityReadbackCallback(const GLfloat* quantity); // Callback receiving the requested conserved quantity grid from the water table
+	
+	/* Constructors and destructors: */
+	public:
+	WaterStateSaver(WaterTable2* sWaterTable,const char* sFileName); // Starts saving the state of the given water table to a water state file of the given name
+	~WaterStateSaver(void); // Cancels any outstanding read-backs
+	
+	/* Methods: */
+	const std::string& getFileName(void) const // Returns the name of the water state file
+		{
+		return fileName;
+		}
+	bool update(void); // Requests outstanding grid read-backs, and writes the water state file once both grids have arrived; returns true when the file has been written; throws exception if the file could not be written
+	};
+
+#endif
@@ -26,23 +26,32 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdarg.h>
 #include <stdio.h>
 #include <string>
+#include <Misc/ThrowStdErr.h>
 #include <Math/Math.h>
+#include <Math/Constants.h>
 #include <Geometry/AffineCombiner.h>
 #include <Geometry/Vector.h>
 #include <GL/gl.h>
 #include <GL/Extensions/GLARBDrawBuffers.h>
+#include <GL/Extensions/GLARBDrawInstanced.h>
 #include <GL/Extensions/GLARBFragmentShader.h>
+#include <GL/Extensions/GLARBInstancedArrays.h>
 #include <GL/Extensions/GLARBMultitexture.h>
+#include <GL/Extensions/GLARBPixelBufferObject.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
+#include <GL/Extensions/GLARBSync.h>
 #include <GL/Extensions/GLARBTextureFloat.h>
 #include <GL/Extensions/GLARBTextureRectangle.h>
 #include <GL/Extensions/GLARBTextureRg.h>
+#include <GL/Extensions/GLARBVertexBufferObject.h>
+#include <GL/Extensions/GLARBVertexProgram.h>
 #include <GL/Extensions/GLARBVertexShader.h>
 #include <GL/Extensions/GLEXTFramebufferObject.h>
 #include <GL/GLContextData.h>
 #include <GL/GLTransformationWrappers.h>
 
 #include "DepthImageRenderer.h"
+#include "WaterStateFile.h"
 #include "ShaderHelper.h"
 
 // DEBUGGING
@@ -50,6 +59,14 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 namespace {
 
+/**************************************************************
+Size of the square tiles sharing a step size under local time
+stepping:
+**************************************************************/
+
+const int tileSizeLog=4;
+const GLsizei tileSize=1<<tileSizeLog;
+
 /****************
 Helper functions:
 ****************/
@@ -73,6 +90,21 @@ GLfloat* makeBuffer(int width,int height,int numComponents,...)
 	return buffer;
 	}
 
+inline void drawRectangle(GLint x0,GLint y0,GLint x1,GLint y1)
+	{
+	/* Draw an axis-aligned rectangle as part of an active GL_QUADS primitive: */
+	glVertex2i(x0,y0);
+	glVertex2i(x1,y0);
+	glVertex2i(x1,y1);
+	glVertex2i(x0,y1);
+	}
+
+inline bool isTileActive(GLfloat tileLevel,unsigned int substep,unsigned int numLevels)
+	{
+	/* A tile of level l starts a step on every 2^(numLevels-l)-th sub-step: */
+	return (substep&((1U<<(numLevels-(unsigned int)(tileLevel)))-1U))==0U;
+	}
+
 }
 
 /**************************************
@@ -80,29 +112,68 @@ Methods of class WaterTable2::DataItem:
 **************************************/
 
 WaterTable2::DataItem::DataItem(void)
-	:currentBathymetry(0),bathymetryVersion(0),currentQuantity(0),
-	 derivativeTextureObject(0),waterTextureObject(0),
+	:currentBathymetry(0),bathymetryVersion(0),previousBathymetryVersion(0),currentQuantity(0),
+	 derivativeTextureObject(0),waterTextureObject(0),numStepsSinceStatistics(0),
 	 bathymetryFramebufferObject(0),derivativeFramebufferObject(0),maxStepSizeFramebufferObject(0),integrationFramebufferObject(0),waterFramebufferObject(0),
-	 bathymetryShader(0),waterAdaptShader(0),derivativeShader(0),maxStepSizeShader(0),boundaryShader(0),eulerStepShader(0),rungeKuttaStepShader(0),waterAddShader(0),waterShader(0)
+	 bathymetryShader(0),waterAdaptShader(0),derivativeShader(0),maxStepSizeShader(0),boundaryShader(0),eulerStepShader(0),rungeKuttaStepShader(0),fusedEulerStepShader(0),fusedRungeKuttaStepShader(0),waterAddShader(0),
+	 diskVertexBufferObject(0),waterSourceBufferObject(0),waterSourcesVersion(0),numWaterSources(0),waterSourceShader(0),haveInstancing(false),waterShader(0),
+	 statisticsShader(0),sourceStatisticsShader(0),statisticsReduceShader(0),
+	 patchProlongationShader(0),patchRestrictionShader(0),patchFluxShader(0),patchRefluxShader(0),
+	 fluxAccumulatorTextureObject(0),tileLevelTextureObject(0),localStepFramebufferObject(0),
+	 localFluxShader(0),localUpdateShader(0),
+	 haveSync(false)
 	{
 	for(int i=0;i<2;++i)
 		{
 		bathymetryTextureObjects[i]=0;
 		maxStepSizeTextureObjects[i]=0;
+		statisticsFramebufferObjects[i]=0;
+		readbackBufferObjects[i]=0;
+		readbackFences[i]=0;
+		readbackFunctions[i]=0;
 		}
 	for(int i=0;i<3;++i)
 		quantityTextureObjects[i]=0;
+	for(int i=0;i<4;++i)
+		statisticsTextureObjects[i]=0;
+	for(int i=0;i<3;++i)
+		snapshotFences[i]=0;
+	for(int i=0;i<6;++i)
+		snapshotTextureObjects[i]=0;
 	
 	/* Initialize all required OpenGL extensions: */
 	GLARBDrawBuffers::initExtension();
 	GLARBFragmentShader::initExtension();
 	GLARBMultitexture::initExtension();
+	GLARBPixelBufferObject::initExtension();
 	GLARBShaderObjects::initExtension();
 	GLARBTextureFloat::initExtension();
 	GLARBTextureRectangle::initExtension();
 	GLARBTextureRg::initExtension();
+	GLARBVertexBufferObject::initExtension();
+	GLARBVertexProgram::initExtension();
 	GLARBVertexShader::initExtension();
 	GLEXTFramebufferObject::initExtension();
+	
+	/* Initialize the optional extension to read back grids asynchronously and to publish snapshots: */
+	haveSync=GLARBSync::isSupported();
+	if(haveSync)
+		GLARBSync::initExtension();
+	
+	/* Initialize the optional extensions to draw all water sources in a single instanced draw: */
+	haveInstancing=GLARBDrawInstanced::isSupported()&&GLARBInstancedArrays::isSupported();
+	if(haveInstancing)
+		{
+		GLARBDrawInstanced::initExtension();
+		GLARBInstancedArrays::initExtension();
+		}
+	
+	/* Create the read-back pixel buffers: */
+	glGenBuffersARB(2,readbackBufferObjects);
+	
+	/* Create the water source vertex buffers: */
+	glGenBuffersARB(1,&diskVertexBufferObject);
+	glGenBuffersARB(1,&waterSourceBufferObject);
 	}
 
 WaterTable2::DataItem::~DataItem(void)
@@ -113,11 +184,26 @@ WaterTable2::DataItem::~DataItem(void)
 	glDeleteTextures(1,&derivativeTextureObject);
 	glDeleteTextures(2,maxStepSizeTextureObjects);
 	glDeleteTextures(1,&waterTextureObject);
+	glDeleteTextures(4,statisticsTextureObjects);
+	glDeleteTextures(6,snapshotTextureObjects);
+	glDeleteTextures(1,&fluxAccumulatorTextureObject);
+	glDeleteTextures(1,&tileLevelTextureObject);
+	for(int i=0;i<2;++i)
+		if(readbackFences[i]!=0)
+			glDeleteSync(readbackFences[i]);
+	for(int i=0;i<3;++i)
+		if(snapshotFences[i]!=0)
+			glDeleteSync(snapshotFences[i]);
+	glDeleteBuffersARB(2,readbackBufferObjects);
+	glDeleteBuffersARB(1,&diskVertexBufferObject);
+	glDeleteBuffersARB(1,&waterSourceBufferObject);
 	glDeleteFramebuffersEXT(1,&bathymetryFramebufferObject);
 	glDeleteFramebuffersEXT(1,&derivativeFramebufferObject);
 	glDeleteFramebuffersEXT(1,&maxStepSizeFramebufferObject);
 	glDeleteFramebuffersEXT(1,&integrationFramebufferObject);
 	glDeleteFramebuffersEXT(1,&waterFramebufferObject);
+	glDeleteFramebuffersEXT(2,statisticsFramebufferObjects);
+	glDeleteFramebuffersEXT(1,&localStepFramebufferObject);
 	glDeleteObjectARB(bathymetryShader);
 	glDeleteObjectARB(waterAdaptShader);
 	glDeleteObjectARB(derivativeShader);
@@ -125,8 +211,20 @@ WaterTable2::DataItem::~DataItem(void)
 	glDeleteObjectARB(boundaryShader);
 	glDeleteObjectARB(eulerStepShader);
 	glDeleteObjectARB(rungeKuttaStepShader);
+	glDeleteObjectARB(fusedEulerStepShader);
+	glDeleteObjectARB(fusedRungeKuttaStepShader);
 	glDeleteObjectARB(waterAddShader);
+	glDeleteObjectARB(waterSourceShader);
 	glDeleteObjectARB(waterShader);
+	glDeleteObjectARB(statisticsShader);
+	glDeleteObjectARB(sourceStatisticsShader);
+	glDeleteObjectARB(statisticsReduceShader);
+	glDeleteObjectARB(patchProlongationShader);
+	glDeleteObjectARB(patchRestrictionShader);
+	glDeleteObjectARB(patchFluxShader);
+	glDeleteObjectARB(patchRefluxShader);
+	glDeleteObjectARB(localFluxShader);
+	glDeleteObjectARB(localUpdateShader);
 	}
 
 /****************************
@@ -181,6 +279,16 @@ void WaterTable2::calcTransformations(void)
 		for(int i=0;i<4;++i,++wapPtr)
 			*wapPtr=GLfloat(waterAddPmv.getMatrix()(i,j));
 	
+	/* Calculate the camera-space axes of the base plane to render water source disks: */
+	for(int i=0;i<2;++i)
+		{
+		Vector axis=Vector::zero;
+		axis[i]=Scalar(1);
+		axis=baseTransform.inverseTransform(axis);
+		for(int j=0;j<3;++j)
+			waterSourceAxes[i][j]=GLfloat(axis[j]);
+		}
+	
 	/* Calculate a transformation from camera space into water texture space: */
 	waterTextureTransform=PTransform::identity;
 	PTransform::Matrix& wttm=waterTextureTransform.getMatrix();
@@ -197,6 +305,23 @@ void WaterTable2::calcTransformations(void)
 			*wttmPtr=GLfloat(wttm(i,j));
 	}
 
+void WaterTable2::setupDerivative(const GLint* uniformLocations,WaterTable2::DataItem* dataItem,GLuint quantityTextureObject) const
+	{
+	/* Upload the simulation parameters: */
+	glUniformARB<2>(uniformLocations[0],1,cellSize);
+	glUniformARB(uniformLocations[1],theta);
+	glUniformARB(uniformLocations[2],g);
+	glUniformARB(uniformLocations[3],epsilon);
+	
+	/* Bind the current bathymetry texture and the quantity texture: */
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+	glUniform1iARB(uniformLocations[4],0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,quantityTextureObject);
+	glUniform1iARB(uniformLocations[5],1);
+	}
+
 GLfloat WaterTable2::calcDerivative(WaterTable2::DataItem* dataItem,GLuint quantityTextureObject,bool calcMaxStepSize) const
 	{
 	/*********************************************************************
@@ -210,16 +335,7 @@ GLfloat WaterTable2::calcDerivative(WaterTable2::DataItem* dataItem,GLuint quant
 	
 	/* Set up the temporal derivative computation shader: */
 	glUseProgramObjectARB(dataItem->derivativeShader);
-	glUniformARB<2>(dataItem->derivativeShaderUniformLocations[0],1,cellSize);
-	glUniformARB(dataItem->derivativeShaderUniformLocations[1],theta);
-	glUniformARB(dataItem->derivativeShaderUniformLocations[2],g);
-	glUniformARB(dataItem->derivativeShaderUniformLocations[3],epsilon);
-	glActiveTextureARB(GL_TEXTURE0_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
-	glUniform1iARB(dataItem->derivativeShaderUniformLocations[4],0);
-	glActiveTextureARB(GL_TEXTURE1_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,quantityTextureObject);
-	glUniform1iARB(dataItem->derivativeShaderUniformLocations[5],1);
+	setupDerivative(dataItem->derivativeShaderUniformLocations,dataItem,quantityTextureObject);
 	
 	/* Run the temporal derivative computation: */
 	glBegin(GL_QUADS);
@@ -242,43 +358,8 @@ GLfloat WaterTable2::calcDerivative(WaterTable2::DataItem* dataItem,GLuint quant
 	
 	if(calcMaxStepSize)
 		{
-		/* Set up the maximum step size reduction shader: */
-		glUseProgramObjectARB(dataItem->maxStepSizeShader);
-		
-		/* Bind the maximum step size computation frame buffer: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->maxStepSizeFramebufferObject);
-		
-		/* Reduce the maximum step size texture in a sequence of half-reduction steps: */
-		int reducedWidth=size[0];
-		int reducedHeight=size[1];
-		int currentMaxStepSizeTexture=0;
-		while(reducedWidth>1||reducedHeight>1)
-			{
-			/* Set up the simulation frame buffer for maximum step size reduction: */
-			glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-currentMaxStepSizeTexture));
-			
-			/* Reduce the viewport by a factor of two: */
-			glViewport(0,0,(reducedWidth+1)/2,(reducedHeight+1)/2);
-			glUniformARB(dataItem->maxStepSizeShaderUniformLocations[0],GLfloat(reducedWidth-1),GLfloat(reducedHeight-1));
-			
-			/* Bind the current max step size texture: */
-			glActiveTextureARB(GL_TEXTURE0_ARB);
-			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->maxStepSizeTextureObjects[currentMaxStepSizeTexture]);
-			glUniform1iARB(dataItem->maxStepSizeShaderUniformLocations[1],0);
-			
-			/* Run the reduction step: */
-			glBegin(GL_QUADS);
-			glVertex2i(0,0);
-			glVertex2i(size[0],0);
-			glVertex2i(size[0],size[1]);
-			glVertex2i(0,size[1]);
-			glEnd();
-			
-			/* Go to the next step: */
-			reducedWidth=(reducedWidth+1)/2;
-			reducedHeight=(reducedHeight+1)/2;
-			currentMaxStepSizeTexture=1-currentMaxStepSizeTexture;
-			}
+		/* Reduce the maximum step size texture to a single pixel: */
+		int currentMaxStepSizeTexture=reduceMaxStepSize(dataItem,-1);
 		
 		/* Read the final value written into the last reduced 1x1 frame buffer: */
 		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT+currentMaxStepSizeTexture);
@@ -291,11 +372,186 @@ GLfloat WaterTable2::calcDerivative(WaterTable2::DataItem* dataItem,GLuint quant
 	return stepSize;
 	}
 
+int WaterTable2::reduceMaxStepSize(WaterTable2::DataItem* dataItem,int numReductions) const
+	{
+	/* Set up the maximum step size reduction shader: */
+	glUseProgramObjectARB(dataItem->maxStepSizeShader);
+	
+	/* Bind the maximum step size computation frame buffer: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->maxStepSizeFramebufferObject);
+	
+	/* Reduce the maximum step size texture in a sequence of half-reduction steps: */
+	int reducedWidth=size[0];
+	int reducedHeight=size[1];
+	int currentMaxStepSizeTexture=0;
+	for(int step=0;(numReductions<0||step<numReductions)&&(reducedWidth>1||reducedHeight>1);++step)
+		{
+		/* Set up the simulation frame buffer for maximum step size reduction: */
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-currentMaxStepSizeTexture));
+		
+		/* Reduce the viewport by a factor of two: */
+		glViewport(0,0,(reducedWidth+1)/2,(reducedHeight+1)/2);
+		glUniformARB(dataItem->maxStepSizeShaderUniformLocations[0],GLfloat(reducedWidth-1),GLfloat(reducedHeight-1));
+		
+		/* Bind the current max step size texture: */
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->maxStepSizeTextureObjects[currentMaxStepSizeTexture]);
+		glUniform1iARB(dataItem->maxStepSizeShaderUniformLocations[1],0);
+		
+		/* Run the reduction step: */
+		glBegin(GL_QUADS);
+		glVertex2i(0,0);
+		glVertex2i(size[0],0);
+		glVertex2i(size[0],size[1]);
+		glVertex2i(0,size[1]);
+		glEnd();
+		
+		/* Go to the next step: */
+		reducedWidth=(reducedWidth+1)/2;
+		reducedHeight=(reducedHeight+1)/2;
+		currentMaxStepSizeTexture=1-currentMaxStepSizeTexture;
+		}
+	
+	return currentMaxStepSizeTexture;
+	}
+
+void WaterTable2::reduceStatistics(WaterTable2::DataItem* dataItem,GLfloat sums[4],GLfloat maxima[4]) const
+	{
+	/* Set up the statistics reduction shader: */
+	glUseProgramObjectARB(dataItem->statisticsReduceShader);
+	
+	/* Reduce the first pair of statistics textures in a sequence of half-reduction steps: */
+	int reducedWidth=size[0];
+	int reducedHeight=size[1];
+	int currentStatisticsTextures=0;
+	while(reducedWidth>1||reducedHeight>1)
+		{
+		/* Set up the statistics frame buffer rendering into the other pair of statistics textures: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->statisticsFramebufferObjects[1-currentStatisticsTextures]);
+		
+		/* Reduce the viewport by a factor of two: */
+		glViewport(0,0,(reducedWidth+1)/2,(reducedHeight+1)/2);
+		glUniformARB(dataItem->statisticsReduceShaderUniformLocations[0],GLfloat(reducedWidth-1),GLfloat(reducedHeight-1));
+		
+		/* Bind the current pair of statistics textures: */
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->statisticsTextureObjects[currentStatisticsTextures]);
+		glUniform1iARB(dataItem->statisticsReduceShaderUniformLocations[1],0);
+		glActiveTextureARB(GL_TEXTURE1_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->statisticsTextureObjects[2+currentStatisticsTextures]);
+		glUniform1iARB(dataItem->statisticsReduceShaderUniformLocations[2],1);
+		
+		/* Run the reduction step: */
+		glBegin(GL_QUADS);
+		glVertex2i(0,0);
+		glVertex2i(size[0],0);
+		glVertex2i(size[0],size[1]);
+		glVertex2i(0,size[1]);
+		glEnd();
+		
+		/* Go to the next step: */
+		reducedWidth=(reducedWidth+1)/2;
+		reducedHeight=(reducedHeight+1)/2;
+		currentStatisticsTextures=1-currentStatisticsTextures;
+		}
+	
+	/* Read the final sums and maxima written into the last reduced 1x1 frame buffer: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->statisticsFramebufferObjects[currentStatisticsTextures]);
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	glReadPixels(0,0,1,1,GL_RGBA,GL_FLOAT,sums);
+	glReadBuffer(GL_COLOR_ATTACHMENT1_EXT);
+	glReadPixels(0,0,1,1,GL_RGBA,GL_FLOAT,maxima);
+	glReadBuffer(GL_NONE);
+	
+	/* Unbind unneeded textures: */
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	}
+
+void WaterTable2::deliverReadback(WaterTable2::DataItem* dataItem,int grid) const
+	{
+	/* Deliver the grid unless the request was canceled or replaced in the meantime: */
+	if(readbacksStarted[grid]&&readbackRequests[grid]==dataItem->readbackFunctions[grid])
+		{
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->readbackBufferObjects[grid]);
+		const GLfloat* gridData=static_cast<const GLfloat*>(glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB,GL_READ_ONLY_ARB));
+		if(gridData!=0)
+			{
+			(*readbackRequests[grid])(gridData);
+			glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+			}
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		
+		/* Finish the request: */
+		readbackRequests[grid]=0;
+		readbacksStarted[grid]=false;
+		}
+	dataItem->readbackFunctions[grid]=0;
+	}
+
+void WaterTable2::processReadbacks(WaterTable2::DataItem* dataItem) const
+	{
+	for(int grid=0;grid<2;++grid)
+		{
+		/* Check if a read-back in this context has completed: */
+		if(dataItem->readbackFences[grid]!=0)
+			{
+			GLenum waitResult=glClientWaitSync(dataItem->readbackFences[grid],0,0);
+			if(waitResult==GL_ALREADY_SIGNALED||waitResult==GL_CONDITION_SATISFIED)
+				{
+				glDeleteSync(dataItem->readbackFences[grid]);
+				dataItem->readbackFences[grid]=0;
+				
+				Threads::Mutex::Lock readbackLock(readbackMutex);
+				deliverReadback(dataItem,grid);
+				}
+			}
+		
+		/* Check if there is a pending request that has not been started yet: */
+		if(dataItem->readbackFences[grid]==0)
+			{
+			Threads::Mutex::Lock readbackLock(readbackMutex);
+			if(readbackRequests[grid]!=0&&!readbacksStarted[grid])
+				{
+				/* Start reading back the current grid into the pixel buffer: */
+				glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->readbackBufferObjects[grid]);
+				glActiveTextureARB(GL_TEXTURE0_ARB);
+				if(grid==BATHYMETRY)
+					{
+					glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,(size[1]-1)*(size[0]-1)*sizeof(GLfloat),0,GL_STREAM_READ_ARB);
+					glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+					glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,0);
+					}
+				else
+					{
+					glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,size[1]*size[0]*3*sizeof(GLfloat),0,GL_STREAM_READ_ARB);
+					glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+					glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB,GL_FLOAT,0);
+					}
+				glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+				glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+				
+				dataItem->readbackFunctions[grid]=readbackRequests[grid];
+				readbacksStarted[grid]=true;
+				
+				/* Insert a fence to detect when the read-back is complete, or wait for it right away if the context does not support fences: */
+				if(dataItem->haveSync)
+					dataItem->readbackFences[grid]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+				else
+					deliverReadback(dataItem,grid);
+				}
+			}
+		}
+	}
+
 WaterTable2::WaterTable2(GLsizei width,GLsizei height,const GLfloat sCellSize[2])
 	:depthImageRenderer(0),
 	 baseTransform(ONTransform::identity),
-	 dryBoundary(true),
-	 readBathymetryRequest(0U),readBathymetryBuffer(0),readBathymetryReply(0U)
+	 dryBoundary(true),halfPrecision(false),fusedSteps(true),
+	 waterSourcesVersion(0),
+	 statisticsInterval(0),pendingRestore(0),
+	 patchRefinement(1),patch(0),localTimeSteppingLevels(0),profiler(0),
+	 publishSnapshots(false)
 	{
 	/* Initialize the water table size and cell size: */
 	size[0]=width;
@@ -322,12 +578,29 @@ WaterTable2::WaterTable2(GLsizei width,GLsizei height,const GLfloat sCellSize[2]
 	
 	/* Initialize the water deposit amount: */
 	waterDeposit=0.0f;
+	
+	/* Initialize the grid read-back requests: */
+	for(int i=0;i<2;++i)
+		{
+		readbackRequests[i]=0;
+		readbacksStarted[i]=false;
+		}
+	
+	/* Start without a refined patch: */
+	for(int i=0;i<2;++i)
+		{
+		patchOrigin[i]=0;
+		patchSize[i]=0;
+		}
 	}
 
 WaterTable2::WaterTable2(GLsizei width,GLsizei height,const DepthImageRenderer* sDepthImageRenderer,const Point basePlaneCorners[4])
 	:depthImageRenderer(sDepthImageRenderer),
-	 dryBoundary(true),
-	 readBathymetryRequest(0U),readBathymetryBuffer(0),readBathymetryReply(0U)
+	 dryBoundary(true),halfPrecision(false),fusedSteps(true),
+	 waterSourcesVersion(0),
+	 statisticsInterval(0),pendingRestore(0),
+	 patchRefinement(1),patch(0),localTimeSteppingLevels(0),profiler(0),
+	 publishSnapshots(false)
 	{
 	/* Initialize the water table size: */
 	size[0]=width;
@@ -379,10 +652,75 @@ WaterTable2::WaterTable2(GLsizei width,GLsizei height,const DepthImageRenderer*
 	
 	/* Initialize the water deposit amount: */
 	waterDeposit=0.0f;
+	
+	/* Initialize the grid read-back requests: */
+	for(int i=0;i<2;++i)
+		{
+		readbackRequests[i]=0;
+		readbacksStarted[i]=false;
+		}
+	
+	/* Start without a refined patch: */
+	for(int i=0;i<2;++i)
+		{
+		patchOrigin[i]=0;
+		patchSize[i]=0;
+		}
+	}
+
+WaterTable2::WaterTable2(const WaterTable2& parent,const GLsizei sPatchOrigin[2],const GLsizei sPatchSize[2],GLsizei sPatchRefinement)
+	:GLObject(false),
+	 depthImageRenderer(parent.depthImageRenderer),
+	 baseTransform(parent.baseTransform),
+	 dryBoundary(false),halfPrecision(parent.halfPrecision),fusedSteps(parent.fusedSteps),
+	 waterSourcesVersion(0),
+	 statisticsInterval(0),pendingRestore(0),
+	 patchRefinement(1),patch(0),localTimeSteppingLevels(0),profiler(0),
+	 publishSnapshots(false)
+	{
+	/* Cover the patch's coarse cells with fine cells, plus two layers of ghost cells receiving the coarse quantities around the patch: */
+	for(int i=0;i<2;++i)
+		{
+		size[i]=sPatchSize[i]*sPatchRefinement+4;
+		cellSize[i]=parent.cellSize[i]/GLfloat(sPatchRefinement);
+		domain.min[i]=parent.domain.min[i]+Scalar(sPatchOrigin[i])*Scalar(parent.cellSize[i])-Scalar(2)*Scalar(cellSize[i]);
+		domain.max[i]=domain.min[i]+Scalar(size[i])*Scalar(cellSize[i]);
+		}
+	domain.min[2]=parent.domain.min[2];
+	domain.max[2]=parent.domain.max[2];
+	
+	/* Calculate the water table transformations: */
+	calcTransformations();
+	
+	/* Copy the parent's simulation parameters: */
+	theta=parent.theta;
+	g=parent.g;
+	epsilon=parent.epsilon;
+	attenuation=parent.attenuation;
+	maxStepSize=parent.maxStepSize;
+	
+	/* The patch adds the parent's water sources and water deposit: */
+	waterDeposit=0.0f;
+	
+	/* Initialize the grid read-back requests: */
+	for(int i=0;i<2;++i)
+		{
+		readbackRequests[i]=0;
+		readbacksStarted[i]=false;
+		}
+	
+	/* Start without a refined patch: */
+	for(int i=0;i<2;++i)
+		{
+		patchOrigin[i]=0;
+		patchSize[i]=0;
+		}
 	}
 
 WaterTable2::~WaterTable2(void)
 	{
+	delete pendingRestore;
+	delete patch;
 	}
 
 void WaterTable2::initContext(GLContextData& contextData) const
@@ -420,7 +758,9 @@ void WaterTable2::initContext(GLContextData& contextData) const
 		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
 		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
-		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB32F,size[0],size[1],0,GL_RGB,GL_FLOAT,q);
+		
+		/* Store the intermediate quantities of the Runge-Kutta step in half precision if requested; the primary state always uses full precision: */
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,halfPrecision&&i==2?GL_RGB16F_ARB:GL_RGB32F,size[0],size[1],0,GL_RGB,GL_FLOAT,q);
 		}
 	delete[] q;
 	}
@@ -434,7 +774,7 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
 	GLfloat* qt=makeBuffer(size[0],size[1],3,0.0,0.0,0.0);
-	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB32F,size[0],size[1],0,GL_RGB,GL_FLOAT,qt);
+	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,halfPrecision?GL_RGB16F_ARB:GL_RGB32F,size[0],size[1],0,GL_RGB,GL_FLOAT,qt);
 	delete[] qt;
 	}
 	
@@ -467,6 +807,52 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	delete[] w;
 	}
 	
+	{
+	/* Create the cell-centered statistics gathering textures: */
+	glGenTextures(4,dataItem->statisticsTextureObjects);
+	for(int i=0;i<4;++i)
+		{
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->statisticsTextureObjects[i]);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGBA32F,size[0],size[1],0,GL_RGBA,GL_FLOAT,0);
+		}
+	}
+	
+	bool localTimeStepping=localTimeSteppingLevels>0&&patch==0;
+	if(localTimeStepping||patch!=0)
+		{
+		/* Create the cell-centered flux accumulation texture: */
+		glGenTextures(1,&dataItem->fluxAccumulatorTextureObject);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->fluxAccumulatorTextureObject);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
+		GLfloat* a=makeBuffer(size[0],size[1],3,0.0,0.0,0.0);
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB32F,size[0],size[1],0,GL_RGB,GL_FLOAT,a);
+		delete[] a;
+		}
+	
+	if(localTimeStepping)
+		{
+		/* Create the per-tile step size level texture: */
+		GLsizei numTiles[2];
+		for(int i=0;i<2;++i)
+			numTiles[i]=(size[i]+tileSize-1)>>tileSizeLog;
+		dataItem->tileStepSizes.resize(size_t(numTiles[1])*size_t(numTiles[0]));
+		dataItem->tileLevels.resize(size_t(numTiles[1])*size_t(numTiles[0]),0.0f);
+		glGenTextures(1,&dataItem->tileLevelTextureObject);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->tileLevelTextureObject);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_R32F,numTiles[0],numTiles[1],0,GL_LUMINANCE,GL_FLOAT,&dataItem->tileLevels[0]);
+		}
+	
 	/* Protect the newly-created textures: */
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 	
@@ -534,6 +920,34 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	glReadBuffer(GL_NONE);
 	}
 	
+	{
+	/* Create the statistics gathering frame buffers: */
+	glGenFramebuffersEXT(2,dataItem->statisticsFramebufferObjects);
+	for(int i=0;i<2;++i)
+		{
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->statisticsFramebufferObjects[i]);
+		
+		/* Attach one pair of summed and maximized statistics textures to the frame buffer: */
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,GL_COLOR_ATTACHMENT0_EXT,GL_TEXTURE_RECTANGLE_ARB,dataItem->statisticsTextureObjects[i],0);
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,GL_COLOR_ATTACHMENT1_EXT,GL_TEXTURE_RECTANGLE_ARB,dataItem->statisticsTextureObjects[2+i],0);
+		GLenum drawBuffers[2]={GL_COLOR_ATTACHMENT0_EXT,GL_COLOR_ATTACHMENT1_EXT};
+		glDrawBuffersARB(2,drawBuffers);
+		glReadBuffer(GL_NONE);
+		}
+	}
+	
+	if(localTimeStepping||patch!=0)
+		{
+		/* Create the flux accumulation frame buffer: */
+		glGenFramebuffersEXT(1,&dataItem->localStepFramebufferObject);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->localStepFramebufferObject);
+		
+		/* Attach the flux accumulation texture to the flux accumulation frame buffer: */
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,GL_COLOR_ATTACHMENT0_EXT,GL_TEXTURE_RECTANGLE_ARB,dataItem->fluxAccumulatorTextureObject,0);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+		glReadBuffer(GL_NONE);
+		}
+	
 	/* Restore the previously bound frame buffer: */
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
 	
@@ -544,11 +958,10 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	
 	/* Create the bathymetry update shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2BathymetryUpdateShader");
-	dataItem->bathymetryShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2BathymetryUpdateShader");
+	dataItem->bathymetryShader=source.link();
 	dataItem->bathymetryShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->bathymetryShader,"oldBathymetrySampler");
 	dataItem->bathymetryShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->bathymetryShader,"newBathymetrySampler");
 	dataItem->bathymetryShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->bathymetryShader,"quantitySampler");
@@ -556,22 +969,21 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	
 	/* Create the water adaptation shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2WaterAdaptShader");
-	dataItem->waterAdaptShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2WaterAdaptShader");
+	dataItem->waterAdaptShader=source.link();
 	dataItem->waterAdaptShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->waterAdaptShader,"bathymetrySampler");
 	dataItem->waterAdaptShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->waterAdaptShader,"newQuantitySampler");
 	}
 	
 	/* Create the temporal derivative computation shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2SlopeAndFluxAndDerivativeShader");
-	dataItem->derivativeShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2SlopeAndFluxAndDerivativeShader");
+	source.addFragmentShaderFile("Water2SlopeAndFluxAndDerivative");
+	dataItem->derivativeShader=source.link();
 	dataItem->derivativeShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->derivativeShader,"cellSize");
 	dataItem->derivativeShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->derivativeShader,"theta");
 	dataItem->derivativeShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->derivativeShader,"g");
@@ -582,32 +994,29 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	
 	/* Create the maximum step size gathering shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2MaxStepSizeShader");
-	dataItem->maxStepSizeShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2MaxStepSizeShader");
+	dataItem->maxStepSizeShader=source.link();
 	dataItem->maxStepSizeShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->maxStepSizeShader,"fullTextureSize");
 	dataItem->maxStepSizeShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->maxStepSizeShader,"maxStepSizeSampler");
 	}
 	
 	/* Create the boundary condition shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2BoundaryShader");
-	dataItem->boundaryShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2BoundaryShader");
+	dataItem->boundaryShader=source.link();
 	dataItem->boundaryShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->boundaryShader,"bathymetrySampler");
 	}
 	
 	/* Create the Euler integration step shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2EulerStepShader");
-	dataItem->eulerStepShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2EulerStepShader");
+	dataItem->eulerStepShader=source.link();
 	dataItem->eulerStepShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->eulerStepShader,"stepSize");
 	dataItem->eulerStepShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->eulerStepShader,"attenuation");
 	dataItem->eulerStepShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->eulerStepShader,"quantitySampler");
@@ -616,11 +1025,10 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	
 	/* Create the Runge-Kutta integration step shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2RungeKuttaStepShader");
-	dataItem->rungeKuttaStepShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2RungeKuttaStepShader");
+	dataItem->rungeKuttaStepShader=source.link();
 	dataItem->rungeKuttaStepShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"stepSize");
 	dataItem->rungeKuttaStepShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"attenuation");
 	dataItem->rungeKuttaStepShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"quantitySampler");
@@ -628,29 +1036,234 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	dataItem->rungeKuttaStepShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"derivativeSampler");
 	}
 	
+	/* Create the fused Euler integration step shader: */
+	{
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2FusedEulerStepShader");
+	source.addFragmentShaderFile("Water2SlopeAndFluxAndDerivative");
+	dataItem->fusedEulerStepShader=source.link();
+	dataItem->fusedEulerStepShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->fusedEulerStepShader,"cellSize");
+	dataItem->fusedEulerStepShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->fusedEulerStepShader,"theta");
+	dataItem->fusedEulerStepShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->fusedEulerStepShader,"g");
+	dataItem->fusedEulerStepShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->fusedEulerStepShader,"epsilon");
+	dataItem->fusedEulerStepShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->fusedEulerStepShader,"bathymetrySampler");
+	dataItem->fusedEulerStepShaderUniformLocations[5]=glGetUniformLocationARB(dataItem->fusedEulerStepShader,"quantitySampler");
+	dataItem->fusedEulerStepShaderUniformLocations[6]=glGetUniformLocationARB(dataItem->fusedEulerStepShader,"stepSize");
+	dataItem->fusedEulerStepShaderUniformLocations[7]=glGetUniformLocationARB(dataItem->fusedEulerStepShader,"attenuation");
+	}
+	
+	/* Create the fused Runge-Kutta integration step shader: */
+	{
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2FusedRungeKuttaStepShader");
+	source.addFragmentShaderFile("Water2SlopeAndFluxAndDerivative");
+	dataItem->fusedRungeKuttaStepShader=source.link();
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"cellSize");
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"theta");
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"g");
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"epsilon");
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"bathymetrySampler");
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[5]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"quantitySampler");
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[6]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"stepSize");
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[7]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"attenuation");
+	dataItem->fusedRungeKuttaStepShaderUniformLocations[8]=glGetUniformLocationARB(dataItem->fusedRungeKuttaStepShader,"oldQuantitySampler");
+	}
+	
+	if(patch!=0)
+		{
+		/* Create the refined patch interface flux accumulation shader: */
+		{
+		ShaderProgramSource source;
+		source.addVertexShader(vertexShaderSource);
+		source.addFragmentShaderFile("Water2PatchFluxShader");
+		source.addFragmentShaderFile("Water2PatchFaceFlux");
+		source.addFragmentShaderFile("Water2SlopeAndFluxAndDerivative");
+		dataItem->patchFluxShader=source.link();
+		dataItem->patchFluxShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->patchFluxShader,"theta");
+		dataItem->patchFluxShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->patchFluxShader,"g");
+		dataItem->patchFluxShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->patchFluxShader,"epsilon");
+		dataItem->patchFluxShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->patchFluxShader,"fineCellSize");
+		dataItem->patchFluxShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->patchFluxShader,"patchOrigin");
+		dataItem->patchFluxShaderUniformLocations[5]=glGetUniformLocationARB(dataItem->patchFluxShader,"refinement");
+		dataItem->patchFluxShaderUniformLocations[6]=glGetUniformLocationARB(dataItem->patchFluxShader,"faceNormal");
+		dataItem->patchFluxShaderUniformLocations[7]=glGetUniformLocationARB(dataItem->patchFluxShader,"stepSize");
+		dataItem->patchFluxShaderUniformLocations[8]=glGetUniformLocationARB(dataItem->patchFluxShader,"fineBathymetrySampler");
+		dataItem->patchFluxShaderUniformLocations[9]=glGetUniformLocationARB(dataItem->patchFluxShader,"fineQuantitySampler");
+		dataItem->patchFluxShaderUniformLocations[10]=glGetUniformLocationARB(dataItem->patchFluxShader,"fineQuantityStarSampler");
+		}
+		
+		/* Create the refined patch interface flux correction shader: */
+		{
+		ShaderProgramSource source;
+		source.addVertexShader(vertexShaderSource);
+		source.addFragmentShaderFile("Water2PatchRefluxShader");
+		source.addFragmentShaderFile("Water2PatchFaceFlux");
+		source.addFragmentShaderFile("Water2SlopeAndFluxAndDerivative");
+		dataItem->patchRefluxShader=source.link();
+		dataItem->patchRefluxShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->patchRefluxShader,"cellSize");
+		dataItem->patchRefluxShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->patchRefluxShader,"theta");
+		dataItem->patchRefluxShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->patchRefluxShader,"g");
+		dataItem->patchRefluxShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->patchRefluxShader,"epsilon");
+		dataItem->patchRefluxShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->patchRefluxShader,"faceNormal");
+		dataItem->patchRefluxShaderUniformLocations[5]=glGetUniformLocationARB(dataItem->patchRefluxShader,"stepSize");
+		dataItem->patchRefluxShaderUniformLocations[6]=glGetUniformLocationARB(dataItem->patchRefluxShader,"coarseBathymetrySampler");
+		dataItem->patchRefluxShaderUniformLocations[7]=glGetUniformLocationARB(dataItem->patchRefluxShader,"coarseQuantitySampler");
+		dataItem->patchRefluxShaderUniformLocations[8]=glGetUniformLocationARB(dataItem->patchRefluxShader,"coarseQuantityStarSampler");
+		dataItem->patchRefluxShaderUniformLocations[9]=glGetUniformLocationARB(dataItem->patchRefluxShader,"fineFluxSampler");
+		}
+		}
+	
+	if(localTimeStepping)
+		{
+		/* Create the local time stepping flux accumulation shader: */
+		ShaderProgramSource source;
+		source.addVertexShader(vertexShaderSource);
+		source.addFragmentShaderFile("Water2LocalFluxShader");
+		source.addFragmentShaderFile("Water2SlopeAndFluxAndDerivative");
+		dataItem->localFluxShader=source.link();
+		dataItem->localFluxShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->localFluxShader,"cellSize");
+		dataItem->localFluxShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->localFluxShader,"theta");
+		dataItem->localFluxShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->localFluxShader,"g");
+		dataItem->localFluxShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->localFluxShader,"epsilon");
+		dataItem->localFluxShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->localFluxShader,"bathymetrySampler");
+		dataItem->localFluxShaderUniformLocations[5]=glGetUniformLocationARB(dataItem->localFluxShader,"quantitySampler");
+		dataItem->localFluxShaderUniformLocations[6]=glGetUniformLocationARB(dataItem->localFluxShader,"tileLevelSampler");
+		dataItem->localFluxShaderUniformLocations[7]=glGetUniformLocationARB(dataItem->localFluxShader,"tileSize");
+		dataItem->localFluxShaderUniformLocations[8]=glGetUniformLocationARB(dataItem->localFluxShader,"numLevels");
+		dataItem->localFluxShaderUniformLocations[9]=glGetUniformLocationARB(dataItem->localFluxShader,"substep");
+		dataItem->localFluxShaderUniformLocations[10]=glGetUniformLocationARB(dataItem->localFluxShader,"stepSize");
+		}
+	
 	/* Create the water adder rendering shader: */
 	{
-	GLhandleARB vertexShader=compileVertexShader("Water2WaterAddShader");
-	GLhandleARB fragmentShader=compileFragmentShader("Water2WaterAddShader");
-	dataItem->waterAddShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShaderFile("Water2WaterAddShader");
+	source.addFragmentShaderFile("Water2WaterAddShader");
+	dataItem->waterAddShader=source.link();
 	dataItem->waterAddShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->waterAddShader,"pmv");
 	dataItem->waterAddShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->waterAddShader,"stepSize");
 	dataItem->waterAddShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->waterAddShader,"waterSampler");
 	}
 	
+	/* Upload the unit circle template for water source disks: */
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->diskVertexBufferObject);
+	glBufferDataARB(GL_ARRAY_BUFFER_ARB,32*2*sizeof(GLfloat),0,GL_STATIC_DRAW_ARB);
+	GLfloat* dvPtr=static_cast<GLfloat*>(glMapBufferARB(GL_ARRAY_BUFFER_ARB,GL_WRITE_ONLY_ARB));
+	for(int i=0;i<32;++i,dvPtr+=2)
+		{
+		Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(32);
+		dvPtr[0]=GLfloat(Math::cos(angle));
+		dvPtr[1]=GLfloat(Math::sin(angle));
+		}
+	glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB,0);
+	
+	/* Create the instanced water source rendering shader: */
+	{
+	ShaderProgramSource source;
+	source.addVertexShaderFile("Water2WaterSourceShader");
+	source.addFragmentShaderFile("Water2WaterAddShader");
+	dataItem->waterSourceShader=source.link();
+	dataItem->waterSourceShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->waterSourceShader,"pmv");
+	dataItem->waterSourceShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->waterSourceShader,"stepSize");
+	dataItem->waterSourceShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->waterSourceShader,"xAxis");
+	dataItem->waterSourceShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->waterSourceShader,"yAxis");
+	dataItem->waterSourceShaderAttributeLocations[0]=glGetAttribLocationARB(dataItem->waterSourceShader,"source");
+	dataItem->waterSourceShaderAttributeLocations[1]=glGetAttribLocationARB(dataItem->waterSourceShader,"waterAmount");
+	}
+	
 	/* Create the water shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2WaterUpdateShader");
-	dataItem->waterShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2WaterUpdateShader");
+	dataItem->waterShader=source.link();
 	dataItem->waterShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->waterShader,"bathymetrySampler");
 	dataItem->waterShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->waterShader,"quantitySampler");
 	dataItem->waterShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->waterShader,"waterSampler");
 	}
+	
+	/* Create the statistics gathering shader: */
+	{
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2StatisticsShader");
+	dataItem->statisticsShader=source.link();
+	dataItem->statisticsShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->statisticsShader,"gridSize");
+	dataItem->statisticsShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->statisticsShader,"wetDepth");
+	dataItem->statisticsShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->statisticsShader,"bathymetrySampler");
+	dataItem->statisticsShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->statisticsShader,"quantitySampler");
+	}
+	
+	/* Create the water source statistics gathering shader: */
+	{
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2SourceStatisticsShader");
+	dataItem->sourceStatisticsShader=source.link();
+	dataItem->sourceStatisticsShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->sourceStatisticsShader,"oldQuantitySampler");
+	dataItem->sourceStatisticsShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->sourceStatisticsShader,"quantitySampler");
+	}
+	
+	/* Create the statistics reduction shader: */
+	{
+	ShaderProgramSource source;
+	source.addVertexShader(vertexShaderSource);
+	source.addFragmentShaderFile("Water2StatisticsReduceShader");
+	dataItem->statisticsReduceShader=source.link();
+	dataItem->statisticsReduceShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->statisticsReduceShader,"fullTextureSize");
+	dataItem->statisticsReduceShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->statisticsReduceShader,"sumSampler");
+	dataItem->statisticsReduceShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->statisticsReduceShader,"maxSampler");
+	}
+	
+	if(localTimeStepping)
+		{
+		/* Create the local time stepping update shader: */
+		ShaderProgramSource source;
+		source.addVertexShader(vertexShaderSource);
+		source.addFragmentShaderFile("Water2LocalUpdateShader");
+		dataItem->localUpdateShader=source.link();
+		dataItem->localUpdateShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->localUpdateShader,"attenuation");
+		dataItem->localUpdateShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->localUpdateShader,"updateSampler");
+		}
+	
+	if(patch!=0)
+		{
+		/* Create the refined patch prolongation shader, which renders into the patch's grid: */
+		{
+		char patchVertexShaderSource[256];
+		snprintf(patchVertexShaderSource,sizeof(patchVertexShaderSource),vertexShaderSourceTemplate,2.0/double(patch->size[0]),2.0/double(patch->size[1]));
+		ShaderProgramSource source;
+		source.addVertexShader(patchVertexShaderSource);
+		source.addFragmentShaderFile("Water2PatchProlongationShader");
+		dataItem->patchProlongationShader=source.link();
+		dataItem->patchProlongationShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->patchProlongationShader,"patchOrigin");
+		dataItem->patchProlongationShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->patchProlongationShader,"refinement");
+		dataItem->patchProlongationShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->patchProlongationShader,"coarseBathymetrySampler");
+		dataItem->patchProlongationShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->patchProlongationShader,"coarseQuantitySampler");
+		dataItem->patchProlongationShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->patchProlongationShader,"newCoarseQuantitySampler");
+		dataItem->patchProlongationShaderUniformLocations[5]=glGetUniformLocationARB(dataItem->patchProlongationShader,"alpha");
+		dataItem->patchProlongationShaderUniformLocations[6]=glGetUniformLocationARB(dataItem->patchProlongationShader,"fineBathymetrySampler");
+		}
+		
+		/* Create the refined patch restriction shader: */
+		{
+		ShaderProgramSource source;
+		source.addVertexShader(vertexShaderSource);
+		source.addFragmentShaderFile("Water2PatchRestrictionShader");
+		dataItem->patchRestrictionShader=source.link();
+		dataItem->patchRestrictionShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->patchRestrictionShader,"patchOrigin");
+		dataItem->patchRestrictionShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->patchRestrictionShader,"refinement");
+		dataItem->patchRestrictionShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->patchRestrictionShader,"coarseBathymetrySampler");
+		dataItem->patchRestrictionShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->patchRestrictionShader,"fineBathymetrySampler");
+		dataItem->patchRestrictionShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->patchRestrictionShader,"fineQuantitySampler");
+		}
+		
+		/* Initialize the refined patch, which is not registered with the OpenGL context manager itself: */
+		patch->initContext(contextData);
+		}
 	}
 
 void WaterTable2::setElevationRange(Scalar newMin,Scalar newMax)
@@ -661,27 +1274,37 @@ void WaterTable2::setElevationRange(Scalar newMin,Scalar newMax)
 	
 	/* Recalculate the water table transformations: */
 	calcTransformations();
+	
+	/* Forward the new elevation range to the refined patch: */
+	if(patch!=0)
+		patch->setElevationRange(newMin,newMax);
 	}
 
 void WaterTable2::setAttenuation(GLfloat newAttenuation)
 	{
 	attenuation=newAttenuation;
+	if(patch!=0)
+		patch->setAttenuation(newAttenuation);
 	}
 
 void WaterTable2::setMaxStepSize(GLfloat newMaxStepSize)
 	{
 	maxStepSize=newMaxStepSize;
+	if(patch!=0)
+		patch->setMaxStepSize(newMaxStepSize);
 	}
 
 void WaterTable2::addRenderFunction(const AddWaterFunction* newRenderFunction)
 	{
 	/* Store the new render function: */
+	Threads::Mutex::Lock renderFunctionsLock(renderFunctionsMutex);
 	renderFunctions.push_back(newRenderFunction);
 	}
 
 void WaterTable2::removeRenderFunction(const AddWaterFunction* removeRenderFunction)
 	{
 	/* Find the given render function in the list and remove it: */
+	Threads::Mutex::Lock renderFunctionsLock(renderFunctionsMutex);
 	for(std::vector<const AddWaterFunction*>::iterator rfIt=renderFunctions.begin();rfIt!=renderFunctions.end();++rfIt)
 		if(*rfIt==removeRenderFunction)
 			{
@@ -691,6 +1314,35 @@ void WaterTable2::removeRenderFunction(const AddWaterFunction* removeRenderFunct
 			}
 	}
 
+void WaterTable2::addWaterSource(const Point& center,Scalar radius,GLfloat rate)
+	{
+	/* Append the new water source to the list of submitted water sources: */
+	Threads::Mutex::Lock waterSourcesLock(waterSourcesMutex);
+	WaterSource ws;
+	ws.center=center;
+	ws.radius=radius;
+	ws.rate=rate;
+	submittedWaterSources.push_back(ws);
+	}
+
+void WaterTable2::postWaterSources(void)
+	{
+	/* Replace the current water source list with the submitted one, and start a new submission list: */
+	Threads::Mutex::Lock waterSourcesLock(waterSourcesMutex);
+	if(!waterSources.empty()||!submittedWaterSources.empty())
+		{
+		waterSources.swap(submittedWaterSources);
+		submittedWaterSources.clear();
+		++waterSourcesVersion;
+		}
+	}
+
+std::vector<WaterTable2::WaterSource> WaterTable2::getWaterSources(void) const
+	{
+	Threads::Mutex::Lock waterSourcesLock(waterSourcesMutex);
+	return waterSources;
+	}
+
 void WaterTable2::setWaterDeposit(GLfloat newWaterDeposit)
 	{
 	waterDeposit=newWaterDeposit;
@@ -701,85 +1353,225 @@ void WaterTable2::setDryBoundary(bool newDryBoundary)
 	dryBoundary=newDryBoundary;
 	}
 
-void WaterTable2::updateBathymetry(GLContextData& contextData) const
+void WaterTable2::setHalfPrecision(bool newHalfPrecision)
 	{
-	/* Get the data item: */
-	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	halfPrecision=newHalfPrecision;
+	if(patch!=0)
+		patch->setHalfPrecision(newHalfPrecision);
+	}
+
+void WaterTable2::setFusedSteps(bool newFusedSteps)
+	{
+	fusedSteps=newFusedSteps;
+	if(patch!=0)
+		patch->setFusedSteps(newFusedSteps);
+	}
+
+void WaterTable2::setRefinedPatch(const GLsizei newPatchOrigin[2],const GLsizei newPatchSize[2],GLsizei newPatchRefinement)
+	{
+	/* Check the patch layout; the patch must leave room for the coarse cells that correct its interface fluxes: */
+	if(newPatchRefinement<2)
+		Misc::throwStdErr("WaterTable2::setRefinedPatch: Refinement factor %d is less than 2",int(newPatchRefinement));
+	for(int i=0;i<2;++i)
+		if(newPatchSize[i]<1||newPatchOrigin[i]<2||newPatchOrigin[i]+newPatchSize[i]>size[i]-2)
+			Misc::throwStdErr("WaterTable2::setRefinedPatch: Patch does not fit inside the water table's interior");
 	
-	/* Check if the current bathymetry texture is outdated: */
-	if(dataItem->bathymetryVersion!=depthImageRenderer->getDepthImageVersion())
+	/* Replace the current refined patch: */
+	delete patch;
+	patch=0;
+	for(int i=0;i<2;++i)
 		{
-		/* Save relevant OpenGL state: */
-		glPushAttrib(GL_VIEWPORT_BIT);
-		GLint currentFrameBuffer;
-		glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
-		GLfloat currentClearColor[4];
-		glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
-		
-		/* Bind the bathymetry rendering frame buffer and clear it: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->bathymetryFramebufferObject);
-		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentBathymetry));
-		glViewport(0,0,size[0]-1,size[1]-1);
-		glClearColor(GLfloat(domain.min[2]),0.0f,0.0f,1.0f);
-		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-		
-		/* Render the surface into the bathymetry grid: */
-		depthImageRenderer->renderElevation(bathymetryPmv,contextData);
-		
-		/* Set up the integration frame buffer to update the conserved quantities based on bathymetry changes: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
-		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
-		glViewport(0,0,size[0],size[1]);
-		
-		/* Set up the bathymetry update shader: */
-		glUseProgramObjectARB(dataItem->bathymetryShader);
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
-		glUniform1iARB(dataItem->bathymetryShaderUniformLocations[0],0);
-		glActiveTextureARB(GL_TEXTURE1_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[1-dataItem->currentBathymetry]);
-		glUniform1iARB(dataItem->bathymetryShaderUniformLocations[1],1);
+		patchOrigin[i]=newPatchOrigin[i];
+		patchSize[i]=newPatchSize[i];
+		}
+	patchRefinement=newPatchRefinement;
+	patch=new WaterTable2(*this,patchOrigin,patchSize,patchRefinement);
+	}
+
+void WaterTable2::setLocalTimeSteppingLevels(unsigned int newLocalTimeSteppingLevels)
+	{
+	localTimeSteppingLevels=newLocalTimeSteppingLevels;
+	}
+
+void WaterTable2::setProfiler(const PassProfiler* newProfiler)
+	{
+	profiler=newProfiler;
+	}
+
+void WaterTable2::setStatisticsInterval(unsigned int newStatisticsInterval)
+	{
+	statisticsInterval=newStatisticsInterval;
+	}
+
+WaterTable2::Statistics WaterTable2::getStatistics(void) const
+	{
+	Threads::Mutex::Lock statisticsLock(statisticsMutex);
+	return statistics;
+	}
+
+void WaterTable2::updateBathymetry(GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Check if the current bathymetry texture is outdated: */
+	unsigned int depthImageVersion=depthImageRenderer->getDepthImageVersion();
+	if(dataItem->bathymetryVersion!=depthImageVersion)
+		{
+		PassProfiler::Timer bathymetryTimer(profiler,PassProfiler::WATER_BATHYMETRY,contextData);
 		
-		/* Check if the current bathymetry grid was requested: */
-		if(readBathymetryReply!=readBathymetryRequest)
+		/* Calculate the dirty region of the bathymetry grid; the target texture lags behind by all changes since its own version: */
+		GLint region[4]; // Dirty region as x, y, width, height in bathymetry grid pixels
+		region[0]=0;
+		region[1]=0;
+		region[2]=size[0]-1;
+		region[3]=size[1]-1;
+		unsigned int rowRange[2]; // Range of depth image rows that need to be rendered
+		rowRange[0]=0;
+		rowRange[1]=depthImageRenderer->getDepthImageSize(1)-1;
+		Box dirtyBox;
+		if(depthImageRenderer->getDirtyBox(dataItem->previousBathymetryVersion,dirtyBox))
 			{
-			/* Read back the bathymetry grid into the supplied buffer: */
-			glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,readBathymetryBuffer);
+			/* Calculate the dirty region in bathymetry grid space, with one pixel of slack: */
+			Scalar gridMin[2],gridMax[2];
+			for(int i=0;i<2;++i)
+				{
+				gridMin[i]=Math::Constants<Scalar>::max;
+				gridMax[i]=-Math::Constants<Scalar>::max;
+				}
+			for(int i=0;i<8;++i)
+				{
+				Point gp=baseTransform.transform(dirtyBox.getVertex(i));
+				for(int j=0;j<2;++j)
+					{
+					Scalar g=(gp[j]-domain.min[j])/Scalar(cellSize[j])-Scalar(0.5);
+					if(gridMin[j]>g)
+						gridMin[j]=g;
+					if(gridMax[j]<g)
+						gridMax[j]=g;
+					}
+				}
+			for(int i=0;i<2;++i)
+				{
+				GLint rMin=GLint(Math::floor(gridMin[i]))-1;
+				GLint rMax=GLint(Math::ceil(gridMax[i]))+2;
+				if(rMin<0)
+					rMin=0;
+				if(rMax>size[i]-1)
+					rMax=size[i]-1;
+				region[i]=rMin;
+				region[2+i]=rMax>rMin?rMax-rMin:0;
+				}
 			
-			/* Finish the request: */
-			readBathymetryReply=readBathymetryRequest;
+			/* Calculate the range of depth image rows that can contribute to the dirty region: */
+			Point prism[8];
+			for(int i=0;i<8;++i)
+				{
+				Point gp;
+				gp[0]=domain.min[0]+(Scalar(region[0]+(i&0x1?region[2]:0))+Scalar(0.5))*Scalar(cellSize[0]);
+				gp[1]=domain.min[1]+(Scalar(region[1]+(i&0x2?region[3]:0))+Scalar(0.5))*Scalar(cellSize[1]);
+				gp[2]=i&0x4?domain.max[2]:domain.min[2];
+				prism[i]=baseTransform.inverseTransform(gp);
+				}
+			depthImageRenderer->calcRowRange(8,prism,rowRange);
 			}
 		
-		glActiveTextureARB(GL_TEXTURE2_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
-		glUniform1iARB(dataItem->bathymetryShaderUniformLocations[2],2);
-		
-		/* Run the bathymetry update: */
-		glBegin(GL_QUADS);
-		glVertex2i(0,0);
-		glVertex2i(size[0],0);
-		glVertex2i(size[0],size[1]);
-		glVertex2i(0,size[1]);
-		glEnd();
-		
-		/* Unbind all shaders and textures: */
-		glUseProgramObjectARB(0);
-		glActiveTextureARB(GL_TEXTURE2_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
-		glActiveTextureARB(GL_TEXTURE1_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
-		
-		/* Restore OpenGL state: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
-		glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
-		glPopAttrib();
-		
-		/* Update the bathymetry and quantity grids: */
-		dataItem->currentBathymetry=1-dataItem->currentBathymetry;
-		dataItem->bathymetryVersion=depthImageRenderer->getDepthImageVersion();
-		dataItem->currentQuantity=1-dataItem->currentQuantity;
+		if(region[2]==0||region[3]==0)
+			{
+			/* The surface changes do not touch the bathymetry grid; the other bathymetry texture still lags behind by the same changes: */
+			dataItem->bathymetryVersion=depthImageVersion;
+			}
+		else
+			{
+			/* Save relevant OpenGL state: */
+			glPushAttrib(GL_VIEWPORT_BIT|GL_SCISSOR_BIT);
+			GLint currentFrameBuffer;
+			glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+			GLfloat currentClearColor[4];
+			glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
+			
+			/* Bind the bathymetry rendering frame buffer and clear its dirty region: */
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->bathymetryFramebufferObject);
+			glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentBathymetry));
+			glViewport(0,0,size[0]-1,size[1]-1);
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(region[0],region[1],region[2],region[3]);
+			glClearColor(GLfloat(domain.min[2]),0.0f,0.0f,1.0f);
+			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+			
+			/* Render the part of the surface that can touch the dirty region into the bathymetry grid: */
+			depthImageRenderer->renderElevation(bathymetryPmv,rowRange,contextData);
+			glDisable(GL_SCISSOR_TEST);
+			
+			/* Set up the integration frame buffer to update the conserved quantities based on bathymetry changes: */
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+			glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
+			glViewport(0,0,size[0],size[1]);
+			
+			/* Set up the bathymetry update shader: */
+			glUseProgramObjectARB(dataItem->bathymetryShader);
+			glActiveTextureARB(GL_TEXTURE0_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+			glUniform1iARB(dataItem->bathymetryShaderUniformLocations[0],0);
+			glActiveTextureARB(GL_TEXTURE1_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[1-dataItem->currentBathymetry]);
+			glUniform1iARB(dataItem->bathymetryShaderUniformLocations[1],1);
+			
+			glActiveTextureARB(GL_TEXTURE2_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+			glUniform1iARB(dataItem->bathymetryShaderUniformLocations[2],2);
+			
+			/* Run the bathymetry update: */
+			glBegin(GL_QUADS);
+			glVertex2i(0,0);
+			glVertex2i(size[0],0);
+			glVertex2i(size[0],size[1]);
+			glVertex2i(0,size[1]);
+			glEnd();
+			
+			/* Unbind all shaders and textures: */
+			glUseProgramObjectARB(0);
+			glActiveTextureARB(GL_TEXTURE2_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			glActiveTextureARB(GL_TEXTURE1_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			glActiveTextureARB(GL_TEXTURE0_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			
+			/* Restore OpenGL state: */
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+			glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+			glPopAttrib();
+			
+			/* Update the bathymetry and quantity grids: */
+			dataItem->currentBathymetry=1-dataItem->currentBathymetry;
+			dataItem->previousBathymetryVersion=dataItem->bathymetryVersion;
+			dataItem->bathymetryVersion=depthImageVersion;
+			dataItem->currentQuantity=1-dataItem->currentQuantity;
+			}
+		}
+	
+	/* Update the refined patch's bathymetry from the same depth image: */
+	if(patch!=0)
+		{
+		PassProfiler::Timer patchTimer(profiler,PassProfiler::WATER_PATCH,contextData);
+		patch->updateBathymetry(contextData);
+		}
+	
+	/* Service grid read-back requests: */
+	processReadbacks(dataItem);
+	
+	/* Restore a pending water state file: */
+	WaterStateFile* stateFile;
+	{
+	Threads::Mutex::Lock restoreLock(restoreMutex);
+	stateFile=pendingRestore;
+	pendingRestore=0;
+	}
+	if(stateFile!=0)
+		{
+		restoreState(*stateFile,contextData);
+		delete stateFile;
 		}
 	}
 
@@ -836,6 +1628,9 @@ void WaterTable2::updateBathymetry(const GLfloat* bathymetryGrid,GLContextData&
 	/* Update the bathymetry and quantity grids: */
 	dataItem->currentBathymetry=1-dataItem->currentBathymetry;
 	dataItem->currentQuantity=1-dataItem->currentQuantity;
+	
+	/* Force a full bathymetry update from the next depth image, as neither bathymetry texture matches a depth image version now: */
+	dataItem->previousBathymetryVersion=0;
 	}
 
 void WaterTable2::setWaterLevel(const GLfloat* waterGrid,GLContextData& contextData) const
@@ -875,6 +1670,18 @@ void WaterTable2::setWaterLevel(const GLfloat* waterGrid,GLContextData& contextD
 	glVertex2i(0,size[1]);
 	glEnd();
 	
+	if(patch!=0)
+		{
+		/* Re-initialize the refined patch from the new coarse conserved quantities: */
+		DataItem* patchDataItem=contextData.retrieveDataItem<DataItem>(patch);
+		GLuint quantityTextureObject=dataItem->quantityTextureObjects[1-dataItem->currentQuantity];
+		prolongatePatch(dataItem,patchDataItem,quantityTextureObject,quantityTextureObject,0.0f,patchDataItem->currentQuantity,false);
+		glActiveTextureARB(GL_TEXTURE3_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		glActiveTextureARB(GL_TEXTURE2_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		}
+	
 	/* Unbind all shaders and textures: */
 	glActiveTextureARB(GL_TEXTURE1_ARB);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
@@ -890,186 +1697,916 @@ void WaterTable2::setWaterLevel(const GLfloat* waterGrid,GLContextData& contextD
 	dataItem->currentQuantity=1-dataItem->currentQuantity;
 	}
 
-GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& contextData) const
+void WaterTable2::restoreState(const GLfloat* bathymetryGrid,const GLfloat* quantityGrid,GLContextData& contextData) const
 	{
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
 	
-	/* Save relevant OpenGL state: */
-	glPushAttrib(GL_COLOR_BUFFER_BIT|GL_VIEWPORT_BIT);
-	GLint currentFrameBuffer;
-	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+	/* Upload the saved bathymetry grid, which adapts the current conserved quantities to the new bathymetry: */
+	updateBathymetry(bathymetryGrid,contextData);
 	
-	/*********************************************************************
-	Step 1: Calculate temporal derivative of most recent quantities.
-	*********************************************************************/
+	/* Replace the adapted conserved quantities with the saved ones: */
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,size[0],size[1],GL_RGB,GL_FLOAT,quantityGrid);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 	
-	GLfloat stepSize=calcDerivative(dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity],!forceStepSize);
+	if(patch!=0)
+		{
+		/* Re-initialize the refined patch from the restored coarse conserved quantities: */
+		glPushAttrib(GL_VIEWPORT_BIT);
+		GLint currentFrameBuffer;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+		DataItem* patchDataItem=contextData.retrieveDataItem<DataItem>(patch);
+		GLuint quantityTextureObject=dataItem->quantityTextureObjects[dataItem->currentQuantity];
+		prolongatePatch(dataItem,patchDataItem,quantityTextureObject,quantityTextureObject,0.0f,patchDataItem->currentQuantity,false);
+		
+		/* Unbind all shaders and textures: */
+		glUseProgramObjectARB(0);
+		for(int i=3;i>=0;--i)
+			{
+			glActiveTextureARB(GL_TEXTURE0_ARB+i);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			}
+		
+		/* Restore OpenGL state: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+		glPopAttrib();
+		}
+	}
+
+void WaterTable2::restoreState(const WaterStateFile& stateFile,GLContextData& contextData) const
+	{
+	/* Restore the grids directly from the mapped file: */
+	restoreState(stateFile.getBathymetry(),stateFile.getQuantity(),contextData);
+	}
+
+bool WaterTable2::requestRestore(WaterStateFile* stateFile)
+	{
+	/* Reject water state files of the wrong size: */
+	if(!stateFile->matches(*this))
+		{
+		delete stateFile;
+		return false;
+		}
 	
-	/*********************************************************************
-	Step 2: Perform the tentative Euler integration step.
-	*********************************************************************/
+	/* Replace any pending request: */
+	Threads::Mutex::Lock restoreLock(restoreMutex);
+	delete pendingRestore;
+	pendingRestore=stateFile;
 	
+	return true;
+	}
+
+void WaterTable2::eulerStep(WaterTable2::DataItem* dataItem,GLfloat stepSize,bool fused) const
+	{
 	/* Set up the Euler step integration frame buffer: */
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
 	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+2);
 	glViewport(0,0,size[0],size[1]);
 	
-	/* Set up the Euler integration step shader: */
-	glUseProgramObjectARB(dataItem->eulerStepShader);
-	glUniformARB(dataItem->eulerStepShaderUniformLocations[0],stepSize);
-	glUniformARB(dataItem->eulerStepShaderUniformLocations[1],Math::pow(attenuation,stepSize));
-	glActiveTextureARB(GL_TEXTURE0_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
-	glUniform1iARB(dataItem->eulerStepShaderUniformLocations[2],0);
-	glActiveTextureARB(GL_TEXTURE1_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->derivativeTextureObject);
-	glUniform1iARB(dataItem->eulerStepShaderUniformLocations[3],1);
+	if(fused)
+		{
+		/* Set up the fused Euler integration step shader: */
+		glUseProgramObjectARB(dataItem->fusedEulerStepShader);
+		setupDerivative(dataItem->fusedEulerStepShaderUniformLocations,dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+		glUniformARB(dataItem->fusedEulerStepShaderUniformLocations[6],stepSize);
+		glUniformARB(dataItem->fusedEulerStepShaderUniformLocations[7],Math::pow(attenuation,stepSize));
+		}
+	else
+		{
+		/* Set up the Euler integration step shader: */
+		glUseProgramObjectARB(dataItem->eulerStepShader);
+		glUniformARB(dataItem->eulerStepShaderUniformLocations[0],stepSize);
+		glUniformARB(dataItem->eulerStepShaderUniformLocations[1],Math::pow(attenuation,stepSize));
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+		glUniform1iARB(dataItem->eulerStepShaderUniformLocations[2],0);
+		glActiveTextureARB(GL_TEXTURE1_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->derivativeTextureObject);
+		glUniform1iARB(dataItem->eulerStepShaderUniformLocations[3],1);
+		}
 	
 	/* Run the Euler integration step: */
 	glBegin(GL_QUADS);
-	glVertex2i(0,0);
-	glVertex2i(size[0],0);
-	glVertex2i(size[0],size[1]);
-	glVertex2i(0,size[1]);
+	drawRectangle(0,0,size[0],size[1]);
 	glEnd();
-	
-	/*********************************************************************
-	Step 3: Calculate temporal derivative of intermediate quantities.
-	*********************************************************************/
-	
-	calcDerivative(dataItem,dataItem->quantityTextureObjects[2],false);
-	
-	/*********************************************************************
-	Step 4: Perform the final Runge-Kutta integration step.
-	*********************************************************************/
+	}
+
+void WaterTable2::rungeKuttaStep(WaterTable2::DataItem* dataItem,GLfloat stepSize) const
+	{
+	/* Calculate the temporal derivative of the intermediate quantities unless it is calculated in the same pass: */
+	if(!fusedSteps)
+		calcDerivative(dataItem,dataItem->quantityTextureObjects[2],false);
 	
 	/* Set up the Runge-Kutta step integration frame buffer: */
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
 	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
 	glViewport(0,0,size[0],size[1]);
 	
-	/* Set up the Runge-Kutta integration step shader: */
-	glUseProgramObjectARB(dataItem->rungeKuttaStepShader);
-	glUniformARB(dataItem->rungeKuttaStepShaderUniformLocations[0],stepSize);
-	glUniformARB(dataItem->rungeKuttaStepShaderUniformLocations[1],Math::pow(attenuation,stepSize));
-	glActiveTextureARB(GL_TEXTURE0_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
-	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[2],0);
-	glActiveTextureARB(GL_TEXTURE1_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[2]);
-	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[3],1);
-	glActiveTextureARB(GL_TEXTURE2_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->derivativeTextureObject);
-	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[4],2);
+	if(fusedSteps)
+		{
+		/* Set up the fused Runge-Kutta integration step shader: */
+		glUseProgramObjectARB(dataItem->fusedRungeKuttaStepShader);
+		setupDerivative(dataItem->fusedRungeKuttaStepShaderUniformLocations,dataItem,dataItem->quantityTextureObjects[2]);
+		glUniformARB(dataItem->fusedRungeKuttaStepShaderUniformLocations[6],stepSize);
+		glUniformARB(dataItem->fusedRungeKuttaStepShaderUniformLocations[7],Math::pow(attenuation,stepSize));
+		glActiveTextureARB(GL_TEXTURE2_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+		glUniform1iARB(dataItem->fusedRungeKuttaStepShaderUniformLocations[8],2);
+		}
+	else
+		{
+		/* Set up the Runge-Kutta integration step shader: */
+		glUseProgramObjectARB(dataItem->rungeKuttaStepShader);
+		glUniformARB(dataItem->rungeKuttaStepShaderUniformLocations[0],stepSize);
+		glUniformARB(dataItem->rungeKuttaStepShaderUniformLocations[1],Math::pow(attenuation,stepSize));
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+		glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[2],0);
+		glActiveTextureARB(GL_TEXTURE1_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[2]);
+		glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[3],1);
+		glActiveTextureARB(GL_TEXTURE2_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->derivativeTextureObject);
+		glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[4],2);
+		}
 	
 	/* Run the Runge-Kutta integration step: */
 	glBegin(GL_QUADS);
-	glVertex2i(0,0);
-	glVertex2i(size[0],0);
-	glVertex2i(size[0],size[1]);
-	glVertex2i(0,size[1]);
+	drawRectangle(0,0,size[0],size[1]);
 	glEnd();
+	}
+
+void WaterTable2::addWater(WaterTable2::DataItem* dataItem,GLfloat stepSize,const WaterTable2& sourceTable,GLContextData& contextData) const
+	{
+	/* Save OpenGL state: */
+	GLfloat currentClearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
 	
-	if(dryBoundary)
-		{
-		/* Set up the boundary condition shader to enforce dry boundaries: */
-		glUseProgramObjectARB(dataItem->boundaryShader);
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
-		glUniform1iARB(dataItem->boundaryShaderUniformLocations[0],0);
-		
-		/* Run the boundary condition shader on the outermost layer of pixels: */
-		//glColorMask(GL_TRUE,GL_FALSE,GL_FALSE,GL_FALSE);
-		glBegin(GL_LINE_LOOP);
-		glVertex2f(0.5f,0.5f);
-		glVertex2f(GLfloat(size[0])-0.5f,0.5f);
-		glVertex2f(GLfloat(size[0])-0.5f,GLfloat(size[1])-0.5f);
-		glVertex2f(0.5f,GLfloat(size[1])-0.5f);
-		glEnd();
-		//glColorMask(GL_TRUE,GL_TRUE,GL_TRUE,GL_TRUE);
-		}
+	/*******************************************************************
+	Step 5: Render all water sources and sinks additively into the water
+	texture.
+	*******************************************************************/
 	
-	/* Update the current quantities: */
-	dataItem->currentQuantity=1-dataItem->currentQuantity;
+	/* Set up and clear the water frame buffer: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->waterFramebufferObject);
+	glViewport(0,0,size[0],size[1]);
+	glClearColor(sourceTable.waterDeposit*stepSize,0.0f,0.0f,0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	
+	/* Enable additive rendering: */
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE,GL_ONE);
+	
+	/* Set up the water adding shader: */
+	glUseProgramObjectARB(dataItem->waterAddShader);
+	glUniformMatrix4fvARB(dataItem->waterAddShaderUniformLocations[0],1,GL_FALSE,waterAddPmvMatrix);
+	glUniform1fARB(dataItem->waterAddShaderUniformLocations[1],stepSize);
+	
+	/* Bind the water texture: */
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
+	glUniform1iARB(dataItem->waterAddShaderUniformLocations[2],0);
 	
-	if(waterDeposit!=0.0f||!renderFunctions.empty())
+	/* Call all render functions: */
+	for(std::vector<const AddWaterFunction*>::const_iterator rfIt=sourceTable.renderFunctions.begin();rfIt!=sourceTable.renderFunctions.end();++rfIt)
+		(**rfIt)(contextData);
+	
+	if(!sourceTable.waterSources.empty())
 		{
-		/* Save OpenGL state: */
-		GLfloat currentClearColor[4];
-		glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
-		
-		/*******************************************************************
-		Step 5: Render all water sources and sinks additively into the water
-		texture.
-		*******************************************************************/
-		
-		/* Set up and clear the water frame buffer: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->waterFramebufferObject);
-		glViewport(0,0,size[0],size[1]);
-		glClearColor(waterDeposit*stepSize,0.0f,0.0f,0.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
-		
-		/* Enable additive rendering: */
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_ONE,GL_ONE);
-		
-		/* Set up the water adding shader: */
-		glUseProgramObjectARB(dataItem->waterAddShader);
-		glUniformMatrix4fvARB(dataItem->waterAddShaderUniformLocations[0],1,GL_FALSE,waterAddPmvMatrix);
-		glUniform1fARB(dataItem->waterAddShaderUniformLocations[1],stepSize);
-		
-		/* Bind the water texture: */
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
-		glUniform1iARB(dataItem->waterAddShaderUniformLocations[2],0);
-		
-		/* Call all render functions: */
-		for(std::vector<const AddWaterFunction*>::const_iterator rfIt=renderFunctions.begin();rfIt!=renderFunctions.end();++rfIt)
-			(**rfIt)(contextData);
-		
-		/* Restore OpenGL state: */
-		glDisable(GL_BLEND);
-		glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+		/* Upload the water source list if it changed since the last simulation step in this context: */
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->waterSourceBufferObject);
+		if(dataItem->haveInstancing&&dataItem->waterSourcesVersion!=sourceTable.waterSourcesVersion)
+			{
+			dataItem->numWaterSources=GLsizei(sourceTable.waterSources.size());
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB,dataItem->numWaterSources*5*sizeof(GLfloat),0,GL_STREAM_DRAW_ARB);
+			GLfloat* wsPtr=static_cast<GLfloat*>(glMapBufferARB(GL_ARRAY_BUFFER_ARB,GL_WRITE_ONLY_ARB));
+			for(std::vector<WaterSource>::const_iterator wsIt=sourceTable.waterSources.begin();wsIt!=sourceTable.waterSources.end();++wsIt,wsPtr+=5)
+				{
+				for(int i=0;i<3;++i)
+					wsPtr[i]=GLfloat(wsIt->center[i]);
+				wsPtr[3]=GLfloat(wsIt->radius);
+				wsPtr[4]=wsIt->rate;
+				}
+			glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
+			dataItem->waterSourcesVersion=sourceTable.waterSourcesVersion;
+			}
 		
-		/*******************************************************************
-		Step 6: Update the conserved quantities based on the water texture.
-		*******************************************************************/
+		/* Set up the water source shader: */
+		glUseProgramObjectARB(dataItem->waterSourceShader);
+		glUniformMatrix4fvARB(dataItem->waterSourceShaderUniformLocations[0],1,GL_FALSE,waterAddPmvMatrix);
+		glUniform1fARB(dataItem->waterSourceShaderUniformLocations[1],stepSize);
+		glUniform3fvARB(dataItem->waterSourceShaderUniformLocations[2],1,waterSourceAxes[0]);
+		glUniform3fvARB(dataItem->waterSourceShaderUniformLocations[3],1,waterSourceAxes[1]);
 		
-		/* Set up the integration frame buffer to update the conserved quantities based on the water texture: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
-		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
-		glViewport(0,0,size[0],size[1]);
+		GLint sourceLocation=dataItem->waterSourceShaderAttributeLocations[0];
+		GLint waterAmountLocation=dataItem->waterSourceShaderAttributeLocations[1];
+		if(dataItem->haveInstancing)
+			{
+			/* Bind the per-instance water source attributes: */
+			glEnableVertexAttribArrayARB(sourceLocation);
+			glVertexAttribPointerARB(sourceLocation,4,GL_FLOAT,GL_FALSE,5*sizeof(GLfloat),static_cast<const GLfloat*>(0)+0);
+			glVertexAttribDivisorARB(sourceLocation,1);
+			glEnableVertexAttribArrayARB(waterAmountLocation);
+			glVertexAttribPointerARB(waterAmountLocation,1,GL_FLOAT,GL_FALSE,5*sizeof(GLfloat),static_cast<const GLfloat*>(0)+4);
+			glVertexAttribDivisorARB(waterAmountLocation,1);
+			}
 		
-		/* Set up the water update shader: */
-		glUseProgramObjectARB(dataItem->waterShader);
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
-		glUniform1iARB(dataItem->waterShaderUniformLocations[0],0);
-		glActiveTextureARB(GL_TEXTURE1_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
-		glUniform1iARB(dataItem->waterShaderUniformLocations[1],1);
-		glActiveTextureARB(GL_TEXTURE2_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
-		glUniform1iARB(dataItem->waterShaderUniformLocations[2],2);
+		/* Bind the disk template: */
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->diskVertexBufferObject);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(2,GL_FLOAT,0,0);
 		
-		/* Run the water update: */
-		glBegin(GL_QUADS);
-		glVertex2i(0,0);
-		glVertex2i(size[0],0);
-		glVertex2i(size[0],size[1]);
-		glVertex2i(0,size[1]);
-		glEnd();
+		glPushAttrib(GL_ENABLE_BIT);
+		glDisable(GL_CULL_FACE);
+		if(dataItem->haveInstancing)
+			{
+			/* Render all water source disks at once: */
+			glDrawArraysInstancedARB(GL_TRIANGLE_FAN,0,32,dataItem->numWaterSources);
+			}
+		else
+			{
+			/* Render the water source disks one at a time, passing each source's parameters as constant vertex attributes: */
+			for(std::vector<WaterSource>::const_iterator wsIt=sourceTable.waterSources.begin();wsIt!=sourceTable.waterSources.end();++wsIt)
+				{
+				glVertexAttrib4fARB(sourceLocation,GLfloat(wsIt->center[0]),GLfloat(wsIt->center[1]),GLfloat(wsIt->center[2]),GLfloat(wsIt->radius));
+				glVertexAttrib1fARB(waterAmountLocation,wsIt->rate);
+				glDrawArrays(GL_TRIANGLE_FAN,0,32);
+				}
+			}
+		glPopAttrib();
 		
-		/* Update the current quantities: */
-		dataItem->currentQuantity=1-dataItem->currentQuantity;
+		/* Reset the vertex array state: */
+		glDisableClientState(GL_VERTEX_ARRAY);
+		if(dataItem->haveInstancing)
+			{
+			glVertexAttribDivisorARB(sourceLocation,0);
+			glDisableVertexAttribArrayARB(sourceLocation);
+			glVertexAttribDivisorARB(waterAmountLocation,0);
+			glDisableVertexAttribArrayARB(waterAmountLocation);
+			}
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB,0);
 		}
 	
-	/* Unbind all shaders and textures: */
-	glUseProgramObjectARB(0);
-	glActiveTextureARB(GL_TEXTURE2_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
-	glActiveTextureARB(GL_TEXTURE1_ARB);
+	/* Restore OpenGL state: */
+	glDisable(GL_BLEND);
+	glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+	
+	/*******************************************************************
+	Step 6: Update the conserved quantities based on the water texture.
+	*******************************************************************/
+	
+	/* Set up the integration frame buffer to update the conserved quantities based on the water texture: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
+	glViewport(0,0,size[0],size[1]);
+	
+	/* Set up the water update shader: */
+	glUseProgramObjectARB(dataItem->waterShader);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+	glUniform1iARB(dataItem->waterShaderUniformLocations[0],0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	glUniform1iARB(dataItem->waterShaderUniformLocations[1],1);
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
+	glUniform1iARB(dataItem->waterShaderUniformLocations[2],2);
+	
+	/* Run the water update: */
+	glBegin(GL_QUADS);
+	drawRectangle(0,0,size[0],size[1]);
+	glEnd();
+	}
+
+void WaterTable2::prolongatePatch(WaterTable2::DataItem* dataItem,WaterTable2::DataItem* patchDataItem,GLuint quantityTextureObject,GLuint newQuantityTextureObject,GLfloat alpha,int patchQuantityIndex,bool ghostCellsOnly) const
+	{
+	/* Set up the refined patch's integration frame buffer: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,patchDataItem->integrationFramebufferObject);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+patchQuantityIndex);
+	const GLsizei* ps=patch->size;
+	glViewport(0,0,ps[0],ps[1]);
+	
+	/* Set up the prolongation shader: */
+	glUseProgramObjectARB(dataItem->patchProlongationShader);
+	glUniformARB(dataItem->patchProlongationShaderUniformLocations[0],GLfloat(patchOrigin[0]),GLfloat(patchOrigin[1]));
+	glUniformARB(dataItem->patchProlongationShaderUniformLocations[1],GLfloat(patchRefinement));
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+	glUniform1iARB(dataItem->patchProlongationShaderUniformLocations[2],0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,quantityTextureObject);
+	glUniform1iARB(dataItem->patchProlongationShaderUniformLocations[3],1);
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,newQuantityTextureObject);
+	glUniform1iARB(dataItem->patchProlongationShaderUniformLocations[4],2);
+	glUniformARB(dataItem->patchProlongationShaderUniformLocations[5],alpha);
+	glActiveTextureARB(GL_TEXTURE3_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,patchDataItem->bathymetryTextureObjects[patchDataItem->currentBathymetry]);
+	glUniform1iARB(dataItem->patchProlongationShaderUniformLocations[6],3);
+	
+	/* Run the prolongation on the two outermost layers of fine cells, or on the entire patch: */
+	glBegin(GL_QUADS);
+	if(ghostCellsOnly)
+		{
+		drawRectangle(0,0,ps[0],2);
+		drawRectangle(0,ps[1]-2,ps[0],ps[1]);
+		drawRectangle(0,2,2,ps[1]-2);
+		drawRectangle(ps[0]-2,2,ps[0],ps[1]-2);
+		}
+	else
+		drawRectangle(0,0,ps[0],ps[1]);
+	glEnd();
+	}
+
+void WaterTable2::drawPatchInterface(GLint faceNormalUniformLocation) const
+	{
+	/* Draw the coarse cells to the left, right, bottom, and top of the refined patch: */
+	GLint x0=patchOrigin[0];
+	GLint y0=patchOrigin[1];
+	GLint x1=patchOrigin[0]+patchSize[0];
+	GLint y1=patchOrigin[1]+patchSize[1];
+	glUniformARB(faceNormalUniformLocation,1.0f,0.0f);
+	glBegin(GL_QUADS);
+	drawRectangle(x0-1,y0,x0,y1);
+	glEnd();
+	glUniformARB(faceNormalUniformLocation,-1.0f,0.0f);
+	glBegin(GL_QUADS);
+	drawRectangle(x1,y0,x1+1,y1);
+	glEnd();
+	glUniformARB(faceNormalUniformLocation,0.0f,1.0f);
+	glBegin(GL_QUADS);
+	drawRectangle(x0,y0-1,x1,y0);
+	glEnd();
+	glUniformARB(faceNormalUniformLocation,0.0f,-1.0f);
+	glBegin(GL_QUADS);
+	drawRectangle(x0,y1,x1,y1+1);
+	glEnd();
+	}
+
+void WaterTable2::advancePatch(WaterTable2::DataItem* dataItem,WaterTable2::DataItem* patchDataItem,GLfloat stepSize,bool forceStepSize) const
+	{
+	/* Clear the accumulated fine fluxes across the patch interface: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->localStepFramebufferObject);
+	glViewport(0,0,size[0],size[1]);
+	GLfloat currentClearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
+	glClearColor(0.0f,0.0f,0.0f,0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+	
+	/* The coarse grid has finished its step; interpolate the patch's ghost cells between the old and new coarse quantities: */
+	GLuint oldQuantityTextureObject=dataItem->quantityTextureObjects[dataItem->currentQuantity];
+	GLuint newQuantityTextureObject=dataItem->quantityTextureObjects[1-dataItem->currentQuantity];
+	prolongatePatch(dataItem,patchDataItem,oldQuantityTextureObject,newQuantityTextureObject,0.0f,patchDataItem->currentQuantity,true);
+	
+	/* Take one sub-step per refinement level, or more if that violates the fine grid's stability limit: */
+	unsigned int numSubSteps=patchRefinement;
+	bool fuseFirstEulerStep=fusedSteps&&forceStepSize;
+	if(!fuseFirstEulerStep)
+		{
+		GLfloat patchStepSize=patch->calcDerivative(patchDataItem,patchDataItem->quantityTextureObjects[patchDataItem->currentQuantity],!forceStepSize);
+		if(!forceStepSize&&stepSize>patchStepSize*GLfloat(numSubSteps))
+			numSubSteps=(unsigned int)(Math::ceil(stepSize/patchStepSize));
+		}
+	GLfloat subStepSize=stepSize/GLfloat(numSubSteps);
+	
+	for(unsigned int subStep=0;subStep<numSubSteps;++subStep)
+		{
+		/* Perform the Euler step; the first sub-step's temporal derivative has already been calculated: */
+		if(subStep>0)
+			{
+			prolongatePatch(dataItem,patchDataItem,oldQuantityTextureObject,newQuantityTextureObject,GLfloat(subStep)/GLfloat(numSubSteps),patchDataItem->currentQuantity,true);
+			if(!fusedSteps)
+				patch->calcDerivative(patchDataItem,patchDataItem->quantityTextureObjects[patchDataItem->currentQuantity],false);
+			patch->eulerStep(patchDataItem,subStepSize,fusedSteps);
+			}
+		else
+			patch->eulerStep(patchDataItem,subStepSize,fuseFirstEulerStep);
+		
+		/* Fill the intermediate quantities' ghost cells with the coarse quantities at the end of the sub-step: */
+		prolongatePatch(dataItem,patchDataItem,oldQuantityTextureObject,newQuantityTextureObject,GLfloat(subStep+1)/GLfloat(numSubSteps),2,true);
+		
+		/* Perform the Runge-Kutta step: */
+		patch->rungeKuttaStep(patchDataItem,subStepSize);
+		
+		/* Add the sub-step's fine fluxes across the patch interface to the accumulators of the bordering coarse cells: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->localStepFramebufferObject);
+		glViewport(0,0,size[0],size[1]);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE,GL_ONE);
+		glUseProgramObjectARB(dataItem->patchFluxShader);
+		glUniformARB(dataItem->patchFluxShaderUniformLocations[0],theta);
+		glUniformARB(dataItem->patchFluxShaderUniformLocations[1],g);
+		glUniformARB(dataItem->patchFluxShaderUniformLocations[2],epsilon);
+		glUniformARB(dataItem->patchFluxShaderUniformLocations[3],patch->cellSize[0],patch->cellSize[1]);
+		glUniformARB(dataItem->patchFluxShaderUniformLocations[4],GLfloat(patchOrigin[0]),GLfloat(patchOrigin[1]));
+		glUniformARB(dataItem->patchFluxShaderUniformLocations[5],GLfloat(patchRefinement));
+		glUniformARB(dataItem->patchFluxShaderUniformLocations[7],subStepSize);
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,patchDataItem->bathymetryTextureObjects[patchDataItem->currentBathymetry]);
+		glUniform1iARB(dataItem->patchFluxShaderUniformLocations[8],0);
+		glActiveTextureARB(GL_TEXTURE1_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,patchDataItem->quantityTextureObjects[patchDataItem->currentQuantity]);
+		glUniform1iARB(dataItem->patchFluxShaderUniformLocations[9],1);
+		glActiveTextureARB(GL_TEXTURE2_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,patchDataItem->quantityTextureObjects[2]);
+		glUniform1iARB(dataItem->patchFluxShaderUniformLocations[10],2);
+		drawPatchInterface(dataItem->patchFluxShaderUniformLocations[6]);
+		glDisable(GL_BLEND);
+		
+		/* Update the patch's quantity grid: */
+		patchDataItem->currentQuantity=1-patchDataItem->currentQuantity;
+		}
+	}
+
+void WaterTable2::couplePatch(WaterTable2::DataItem* dataItem,WaterTable2::DataItem* patchDataItem,GLfloat stepSize) const
+	{
+	/* Set up the integration frame buffer to modify the new coarse quantities: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
+	glViewport(0,0,size[0],size[1]);
+	
+	/* Replace the coarse cells covered by the refined patch with the averages of the new fine quantities: */
+	glUseProgramObjectARB(dataItem->patchRestrictionShader);
+	glUniformARB(dataItem->patchRestrictionShaderUniformLocations[0],GLfloat(patchOrigin[0]),GLfloat(patchOrigin[1]));
+	glUniformARB(dataItem->patchRestrictionShaderUniformLocations[1],GLfloat(patchRefinement));
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+	glUniform1iARB(dataItem->patchRestrictionShaderUniformLocations[2],0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,patchDataItem->bathymetryTextureObjects[patchDataItem->currentBathymetry]);
+	glUniform1iARB(dataItem->patchRestrictionShaderUniformLocations[3],1);
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,patchDataItem->quantityTextureObjects[patchDataItem->currentQuantity]);
+	glUniform1iARB(dataItem->patchRestrictionShaderUniformLocations[4],2);
+	glBegin(GL_QUADS);
+	drawRectangle(patchOrigin[0],patchOrigin[1],patchOrigin[0]+patchSize[0],patchOrigin[1]+patchSize[1]);
+	glEnd();
+	
+	/*********************************************************************
+	Correct the coarse cells bordering the refined patch by replacing the
+	coarse fluxes across the patch interface with the fine fluxes across
+	the same faces, accumulated over all of the patch's sub-steps, which
+	makes the coupled update conservative. Both coarse Runge-Kutta
+	stages' quantities are still in their textures.
+	*********************************************************************/
+	
+	/* Enable additive rendering to apply the flux corrections: */
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE,GL_ONE);
+	
+	/* Set up the flux correction shader: */
+	glUseProgramObjectARB(dataItem->patchRefluxShader);
+	glUniformARB(dataItem->patchRefluxShaderUniformLocations[0],cellSize[0],cellSize[1]);
+	glUniformARB(dataItem->patchRefluxShaderUniformLocations[1],theta);
+	glUniformARB(dataItem->patchRefluxShaderUniformLocations[2],g);
+	glUniformARB(dataItem->patchRefluxShaderUniformLocations[3],epsilon);
+	glUniformARB(dataItem->patchRefluxShaderUniformLocations[5],stepSize);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+	glUniform1iARB(dataItem->patchRefluxShaderUniformLocations[6],0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	glUniform1iARB(dataItem->patchRefluxShaderUniformLocations[7],1);
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[2]);
+	glUniform1iARB(dataItem->patchRefluxShaderUniformLocations[8],2);
+	glActiveTextureARB(GL_TEXTURE3_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->fluxAccumulatorTextureObject);
+	glUniform1iARB(dataItem->patchRefluxShaderUniformLocations[9],3);
+	
+	/* Correct the coarse cells to the left, right, bottom, and top of the refined patch: */
+	drawPatchInterface(dataItem->patchRefluxShaderUniformLocations[4]);
+	
+	glDisable(GL_BLEND);
+	}
+
+GLfloat WaterTable2::calcTileLevels(WaterTable2::DataItem* dataItem,bool forceStepSize,unsigned int& numLevels) const
+	{
+	/* Calculate the maximum step size of each cell: */
+	calcDerivative(dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity],false);
+	
+	/* Reduce the per-cell maximum step sizes to per-tile maximum step sizes and read them back: */
+	GLsizei numTiles[2];
+	for(int i=0;i<2;++i)
+		numTiles[i]=(size[i]+tileSize-1)>>tileSizeLog;
+	int currentMaxStepSizeTexture=reduceMaxStepSize(dataItem,tileSizeLog);
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT+currentMaxStepSizeTexture);
+	glReadPixels(0,0,numTiles[0],numTiles[1],GL_LUMINANCE,GL_FLOAT,&dataItem->tileStepSizes[0]);
+	
+	/* Choose the macro step size such that the tiles with the smallest maximum step size use the finest level: */
+	GLfloat minTileStepSize=dataItem->tileStepSizes[0];
+	for(std::vector<GLfloat>::const_iterator tssIt=dataItem->tileStepSizes.begin();tssIt!=dataItem->tileStepSizes.end();++tssIt)
+		minTileStepSize=Math::min(minTileStepSize,*tssIt);
+	GLfloat stepSize=maxStepSize;
+	if(!forceStepSize)
+		stepSize=Math::min(stepSize,minTileStepSize*GLfloat(1U<<localTimeSteppingLevels));
+	
+	/* Assign each tile the coarsest level whose step size does not exceed the tile's maximum step size: */
+	std::vector<GLfloat>::iterator tlIt=dataItem->tileLevels.begin();
+	for(std::vector<GLfloat>::const_iterator tssIt=dataItem->tileStepSizes.begin();tssIt!=dataItem->tileStepSizes.end();++tssIt,++tlIt)
+		{
+		unsigned int level=0;
+		GLfloat levelStepSize=stepSize;
+		while(level<localTimeSteppingLevels&&levelStepSize>*tssIt)
+			{
+			levelStepSize*=0.5f;
+			++level;
+			}
+		*tlIt=GLfloat(level);
+		}
+	
+	/* Limit the level difference between neighboring tiles to one so that no tile is frozen for more than one of its neighbors' steps: */
+	for(unsigned int pass=1;pass<localTimeSteppingLevels;++pass)
+		for(GLsizei y=0;y<numTiles[1];++y)
+			for(GLsizei x=0;x<numTiles[0];++x)
+				{
+				GLfloat* tl=&dataItem->tileLevels[y*numTiles[0]+x];
+				if(x>0)
+					*tl=Math::max(*tl,tl[-1]-1.0f);
+				if(x<numTiles[0]-1)
+					*tl=Math::max(*tl,tl[1]-1.0f);
+				if(y>0)
+					*tl=Math::max(*tl,tl[-numTiles[0]]-1.0f);
+				if(y<numTiles[1]-1)
+					*tl=Math::max(*tl,tl[numTiles[0]]-1.0f);
+				}
+	
+	/* Find the finest level in use: */
+	numLevels=0;
+	for(std::vector<GLfloat>::const_iterator tlIt=dataItem->tileLevels.begin();tlIt!=dataItem->tileLevels.end();++tlIt)
+		numLevels=Math::max(numLevels,(unsigned int)(*tlIt));
+	
+	/* Upload the tile levels: */
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->tileLevelTextureObject);
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,numTiles[0],numTiles[1],GL_LUMINANCE,GL_FLOAT,&dataItem->tileLevels[0]);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	
+	return stepSize;
+	}
+
+void WaterTable2::localTimeStep(WaterTable2::DataItem* dataItem,GLfloat stepSize,unsigned int numLevels) const
+	{
+	GLsizei numTiles[2];
+	for(int i=0;i<2;++i)
+		numTiles[i]=(size[i]+tileSize-1)>>tileSizeLog;
+	const GLfloat* tileLevels=&dataItem->tileLevels[0];
+	glClearColor(0.0f,0.0f,0.0f,0.0f);
+	
+	/*********************************************************************
+	Advance all tiles through 2^numLevels sub-steps. A tile of level l
+	takes one forward Euler step of 2^-l times the macro step size every
+	2^(numLevels-l) sub-steps. Each face's flux is evaluated at the rate
+	of the finer of its two cells and accumulated into both cells, and
+	each cell applies its accumulated fluxes when its own step ends,
+	which keeps the update conservative across level boundaries.
+	*********************************************************************/
+	
+	unsigned int numSubsteps=1U<<numLevels;
+	for(unsigned int substep=0;substep<numSubsteps;++substep)
+		{
+		/* Set up the flux accumulation frame buffer: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->localStepFramebufferObject);
+		glViewport(0,0,size[0],size[1]);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE,GL_ONE);
+		
+		/* Set up the flux accumulation shader: */
+		glUseProgramObjectARB(dataItem->localFluxShader);
+		setupDerivative(dataItem->localFluxShaderUniformLocations,dataItem,dataItem->quantityTextureObjects[1-dataItem->currentQuantity]);
+		glActiveTextureARB(GL_TEXTURE2_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->tileLevelTextureObject);
+		glUniform1iARB(dataItem->localFluxShaderUniformLocations[6],2);
+		glUniformARB(dataItem->localFluxShaderUniformLocations[7],GLfloat(tileSize));
+		glUniformARB(dataItem->localFluxShaderUniformLocations[8],GLfloat(numLevels));
+		glUniformARB(dataItem->localFluxShaderUniformLocations[9],GLfloat(substep));
+		glUniformARB(dataItem->localFluxShaderUniformLocations[10],stepSize);
+		
+		/* Accumulate fluxes in all tiles that start a step, or that border a tile starting a step: */
+		glBegin(GL_QUADS);
+		for(GLsizei y=0;y<numTiles[1];++y)
+			for(GLsizei x=0;x<numTiles[0];++x)
+				{
+				const GLfloat* tl=tileLevels+(y*numTiles[0]+x);
+				if(isTileActive(tl[0],substep,numLevels)||
+				   (x>0&&isTileActive(tl[-1],substep,numLevels))||
+				   (x<numTiles[0]-1&&isTileActive(tl[1],substep,numLevels))||
+				   (y>0&&isTileActive(tl[-numTiles[0]],substep,numLevels))||
+				   (y<numTiles[1]-1&&isTileActive(tl[numTiles[0]],substep,numLevels)))
+					drawRectangle(x*tileSize,y*tileSize,Math::min((x+1)*tileSize,size[0]),Math::min((y+1)*tileSize,size[1]));
+				}
+		glEnd();
+		
+		/* Set up the integration frame buffer to add the accumulated fluxes to the quantities being advanced: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
+		glBlendFunc(GL_ONE,GL_CONSTANT_COLOR);
+		
+		/* Set up the update shader: */
+		glUseProgramObjectARB(dataItem->localUpdateShader);
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->fluxAccumulatorTextureObject);
+		glUniform1iARB(dataItem->localUpdateShaderUniformLocations[1],0);
+		
+		/* Finish the steps of all tiles whose steps end with this sub-step, attenuating partial discharges by each level's step size: */
+		for(unsigned int level=0;level<=numLevels;++level)
+			if(isTileActive(GLfloat(level),substep+1,numLevels))
+				{
+				GLfloat levelAttenuation=Math::pow(attenuation,stepSize/GLfloat(1U<<level));
+				glBlendColor(1.0f,levelAttenuation,levelAttenuation,1.0f);
+				glUniformARB(dataItem->localUpdateShaderUniformLocations[0],levelAttenuation);
+				glBegin(GL_QUADS);
+				for(GLsizei y=0;y<numTiles[1];++y)
+					for(GLsizei x=0;x<numTiles[0];++x)
+						if(tileLevels[y*numTiles[0]+x]==GLfloat(level))
+							drawRectangle(x*tileSize,y*tileSize,Math::min((x+1)*tileSize,size[0]),Math::min((y+1)*tileSize,size[1]));
+				glEnd();
+				}
+		glDisable(GL_BLEND);
+		
+		/* Reset the accumulated fluxes of all tiles that finished their steps, clearing runs of adjacent tiles at once: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->localStepFramebufferObject);
+		glEnable(GL_SCISSOR_TEST);
+		for(GLsizei y=0;y<numTiles[1];++y)
+			for(GLsizei x0=0;x0<numTiles[0];)
+				{
+				GLsizei x1=x0;
+				while(x1<numTiles[0]&&isTileActive(tileLevels[y*numTiles[0]+x1],substep+1,numLevels))
+					++x1;
+				if(x1>x0)
+					{
+					glScissor(x0*tileSize,y*tileSize,(x1-x0)*tileSize,tileSize);
+					glClear(GL_COLOR_BUFFER_BIT);
+					x0=x1;
+					}
+				else
+					++x0;
+				}
+		glDisable(GL_SCISSOR_TEST);
+		}
+	}
+
+GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& contextData) const
+	{
+	/* Get the data items: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	DataItem* patchDataItem=patch!=0?contextData.retrieveDataItem<DataItem>(patch):0;
+	PassProfiler::Timer stepTimer(profiler,PassProfiler::WATER_STEP,contextData);
+	
+	/* Save relevant OpenGL state: */
+	glPushAttrib(GL_COLOR_BUFFER_BIT|GL_VIEWPORT_BIT);
+	GLint currentFrameBuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+	
+	GLfloat stepSize=maxStepSize;
+	if(localTimeSteppingLevels>0&&patch==0)
+		{
+		/*******************************************************************
+		Steps 1 to 4: Perform the Runge-Kutta integration step as the
+		average of the most recent quantities and the result of two forward
+		Euler macro steps, each advancing every tile with its own step size.
+		*******************************************************************/
+		
+		PassProfiler::Timer localTimeStepTimer(profiler,PassProfiler::WATER_LOCAL_TIME_STEP,contextData);
+		
+		/* Assign step size levels to all tiles: */
+		unsigned int numLevels;
+		stepSize=calcTileLevels(dataItem,forceStepSize,numLevels);
+		
+		/* Set up the integration frame buffer to copy the most recent quantities into the other quantity texture: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
+		glViewport(0,0,size[0],size[1]);
+		glUseProgramObjectARB(dataItem->localUpdateShader);
+		glUniformARB(dataItem->localUpdateShaderUniformLocations[0],1.0f);
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+		glUniform1iARB(dataItem->localUpdateShaderUniformLocations[1],0);
+		glBegin(GL_QUADS);
+		drawRectangle(0,0,size[0],size[1]);
+		glEnd();
+		
+		/* Run two forward Euler macro steps on the copied quantities: */
+		localTimeStep(dataItem,stepSize,numLevels);
+		localTimeStep(dataItem,stepSize,numLevels);
+		
+		/* Average the most recent and the advanced quantities: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_CONSTANT_COLOR,GL_CONSTANT_COLOR);
+		glBlendColor(0.5f,0.5f,0.5f,0.5f);
+		glUseProgramObjectARB(dataItem->localUpdateShader);
+		glUniformARB(dataItem->localUpdateShaderUniformLocations[0],1.0f);
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+		glUniform1iARB(dataItem->localUpdateShaderUniformLocations[1],0);
+		glBegin(GL_QUADS);
+		drawRectangle(0,0,size[0],size[1]);
+		glEnd();
+		glDisable(GL_BLEND);
+		}
+	else
+		{
+		/*******************************************************************
+		Steps 1 and 2: Calculate temporal derivative of most recent
+		quantities and perform the tentative Euler integration step, in the
+		same pass if the step size is already known.
+		*******************************************************************/
+		
+		bool fuseEulerStep=fusedSteps&&forceStepSize;
+		if(!fuseEulerStep)
+			{
+			PassProfiler::Timer derivativeTimer(profiler,PassProfiler::WATER_DERIVATIVE,contextData);
+			stepSize=calcDerivative(dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity],!forceStepSize);
+			}
+		{
+		PassProfiler::Timer eulerStepTimer(profiler,PassProfiler::WATER_EULER_STEP,contextData);
+		eulerStep(dataItem,stepSize,fuseEulerStep);
+		}
+		
+		/*******************************************************************
+		Steps 3 and 4: Calculate temporal derivative of intermediate
+		quantities and perform the final Runge-Kutta integration step, in
+		the same pass if steps are fused.
+		*******************************************************************/
+		
+		{
+		PassProfiler::Timer rungeKuttaStepTimer(profiler,PassProfiler::WATER_RUNGE_KUTTA_STEP,contextData);
+		rungeKuttaStep(dataItem,stepSize);
+		}
+		
+		if(patch!=0)
+			{
+			/*****************************************************************
+			Advance the refined patch over the coarse step in sub-steps
+			satisfying the fine grid's stability limit, and couple the new
+			coarse and fine quantities.
+			*****************************************************************/
+			
+			PassProfiler::Timer patchTimer(profiler,PassProfiler::WATER_PATCH,contextData);
+			advancePatch(dataItem,patchDataItem,stepSize,forceStepSize);
+			couplePatch(dataItem,patchDataItem,stepSize);
+			}
+		}
+	
+	/* Check whether to gather water flow statistics at the end of this step: */
+	bool gatherStatistics=false;
+	if(statisticsInterval!=0&&++dataItem->numStepsSinceStatistics>=statisticsInterval)
+		{
+		gatherStatistics=true;
+		dataItem->numStepsSinceStatistics=0;
+		}
+	GLfloat statisticsSums[4]={0.0f,0.0f,0.0f,0.0f};
+	GLfloat statisticsMaxima[4]={0.0f,0.0f,0.0f,0.0f};
+	GLfloat sourceStatisticsSums[4]={0.0f,0.0f,0.0f,0.0f};
+	GLfloat sourceStatisticsMaxima[4];
+	
+	if(gatherStatistics)
+		{
+		/*******************************************************************
+		Step 4a: Gather water flow statistics of the integrated quantities
+		before the boundary condition removes water from the outermost layer
+		of cells.
+		*******************************************************************/
+		
+		PassProfiler::Timer statisticsTimer(profiler,PassProfiler::WATER_STATISTICS,contextData);
+		
+		/* Set up the statistics gathering frame buffer: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->statisticsFramebufferObjects[0]);
+		glViewport(0,0,size[0],size[1]);
+		
+		/* Set up the statistics gathering shader, using the desingularization threshold as minimum depth of wet cells: */
+		glUseProgramObjectARB(dataItem->statisticsShader);
+		glUniformARB(dataItem->statisticsShaderUniformLocations[0],GLfloat(size[0]),GLfloat(size[1]));
+		glUniformARB(dataItem->statisticsShaderUniformLocations[1],epsilon);
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+		glUniform1iARB(dataItem->statisticsShaderUniformLocations[2],0);
+		glActiveTextureARB(GL_TEXTURE1_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[1-dataItem->currentQuantity]);
+		glUniform1iARB(dataItem->statisticsShaderUniformLocations[3],1);
+		
+		/* Run the statistics gathering shader: */
+		glBegin(GL_QUADS);
+		glVertex2i(0,0);
+		glVertex2i(size[0],0);
+		glVertex2i(size[0],size[1]);
+		glVertex2i(0,size[1]);
+		glEnd();
+		
+		/* Reduce the gathered statistics: */
+		reduceStatistics(dataItem,statisticsSums,statisticsMaxima);
+		
+		/* Set up the integration frame buffer again to enforce the boundary condition: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
+		glViewport(0,0,size[0],size[1]);
+		}
+	
+	if(dryBoundary)
+		{
+		PassProfiler::Timer boundaryTimer(profiler,PassProfiler::WATER_BOUNDARY,contextData);
+		
+		/* Set up the boundary condition shader to enforce dry boundaries: */
+		glUseProgramObjectARB(dataItem->boundaryShader);
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+		glUniform1iARB(dataItem->boundaryShaderUniformLocations[0],0);
+		
+		/* Run the boundary condition shader on the outermost layer of pixels: */
+		//glColorMask(GL_TRUE,GL_FALSE,GL_FALSE,GL_FALSE);
+		glBegin(GL_LINE_LOOP);
+		glVertex2f(0.5f,0.5f);
+		glVertex2f(GLfloat(size[0])-0.5f,0.5f);
+		glVertex2f(GLfloat(size[0])-0.5f,GLfloat(size[1])-0.5f);
+		glVertex2f(0.5f,GLfloat(size[1])-0.5f);
+		glEnd();
+		//glColorMask(GL_TRUE,GL_TRUE,GL_TRUE,GL_TRUE);
+		}
+	
+	/* Update the current quantities: */
+	dataItem->currentQuantity=1-dataItem->currentQuantity;
+	
+	/* Prevent changes to the lists of render functions and water sources while water is added: */
+	Threads::Mutex::Lock renderFunctionsLock(renderFunctionsMutex);
+	Threads::Mutex::Lock waterSourcesLock(waterSourcesMutex);
+	if(waterDeposit!=0.0f||!renderFunctions.empty()||!waterSources.empty())
+		{
+		/* Add water to the conserved quantities: */
+		{
+		PassProfiler::Timer addTimer(profiler,PassProfiler::WATER_ADD,contextData);
+		addWater(dataItem,stepSize,*this,contextData);
+		}
+		
+		if(gatherStatistics)
+			{
+			PassProfiler::Timer statisticsTimer(profiler,PassProfiler::WATER_STATISTICS,contextData);
+			
+			/* Gather the amounts of water added and removed by the water update: */
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->statisticsFramebufferObjects[0]);
+			glUseProgramObjectARB(dataItem->sourceStatisticsShader);
+			glActiveTextureARB(GL_TEXTURE0_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+			glUniform1iARB(dataItem->sourceStatisticsShaderUniformLocations[0],0);
+			glActiveTextureARB(GL_TEXTURE1_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[1-dataItem->currentQuantity]);
+			glUniform1iARB(dataItem->sourceStatisticsShaderUniformLocations[1],1);
+			
+			glBegin(GL_QUADS);
+			glVertex2i(0,0);
+			glVertex2i(size[0],0);
+			glVertex2i(size[0],size[1]);
+			glVertex2i(0,size[1]);
+			glEnd();
+			
+			/* Reduce the gathered statistics: */
+			reduceStatistics(dataItem,sourceStatisticsSums,sourceStatisticsMaxima);
+			}
+		
+		/* Update the current quantities: */
+		dataItem->currentQuantity=1-dataItem->currentQuantity;
+		
+		if(patch!=0)
+			{
+			/* Add the same water to the refined patch: */
+			PassProfiler::Timer patchTimer(profiler,PassProfiler::WATER_PATCH,contextData);
+			patch->addWater(patchDataItem,stepSize,*this,contextData);
+			patchDataItem->currentQuantity=1-patchDataItem->currentQuantity;
+			}
+		}
+	
+	if(gatherStatistics)
+		{
+		/* Convert the reduced statistics to areas and volumes and publish them: */
+		double cellArea=double(cellSize[0])*double(cellSize[1]);
+		double boundaryOutflow=dryBoundary?double(statisticsSums[2]):0.0;
+		Threads::Mutex::Lock statisticsLock(statisticsMutex);
+		++statistics.version;
+		statistics.stepSize=stepSize;
+		statistics.volume=(double(statisticsSums[0])-boundaryOutflow+double(sourceStatisticsSums[0])-double(sourceStatisticsSums[1]))*cellArea;
+		statistics.wetArea=double(statisticsSums[1])*cellArea;
+		statistics.maxDepth=double(statisticsMaxima[0]);
+		statistics.maxSpeed=double(statisticsMaxima[1]);
+		statistics.boundaryOutflow=boundaryOutflow*cellArea;
+		statistics.sourceVolume=double(sourceStatisticsSums[0])*cellArea;
+		statistics.sinkVolume=double(sourceStatisticsSums[1])*cellArea;
+		}
+	
+	/* Unbind all shaders and textures: */
+	glUseProgramObjectARB(0);
+	if(patch!=0)
+		{
+		/* Unbind the additional texture used by the refined patch's coupling: */
+		glActiveTextureARB(GL_TEXTURE3_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		}
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 	glActiveTextureARB(GL_TEXTURE0_ARB);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
@@ -1084,20 +2621,42 @@ GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& context
 
 void WaterTable2::bindBathymetryTexture(GLContextData& contextData) const
 	{
-	/* Get the data item: */
-	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
-	
-	/* Bind the bathymetry texture: */
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+	if(publishSnapshots)
+		{
+		/* Make the GPU wait until the locked snapshot's copies are complete, and bind its bathymetry texture: */
+		const Snapshot& snapshot=snapshots.getLockedValue();
+		if(snapshot.fence!=0)
+			glWaitSync(snapshot.fence,0,GL_TIMEOUT_IGNORED);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,snapshot.bathymetryTextureObject);
+		}
+	else
+		{
+		/* Get the data item: */
+		DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+		
+		/* Bind the bathymetry texture: */
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+		}
 	}
 
 void WaterTable2::bindQuantityTexture(GLContextData& contextData) const
 	{
-	/* Get the data item: */
-	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
-	
-	/* Bind the conserved quantities texture: */
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	if(publishSnapshots)
+		{
+		/* Make the GPU wait until the locked snapshot's copies are complete, and bind its conserved quantities texture: */
+		const Snapshot& snapshot=snapshots.getLockedValue();
+		if(snapshot.fence!=0)
+			glWaitSync(snapshot.fence,0,GL_TIMEOUT_IGNORED);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,snapshot.quantityTextureObject);
+		}
+	else
+		{
+		/* Get the data item: */
+		DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+		
+		/* Bind the conserved quantities texture: */
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+		}
 	}
 
 void WaterTable2::uploadWaterTextureTransform(GLint location) const
@@ -1106,17 +2665,175 @@ void WaterTable2::uploadWaterTextureTransform(GLint location) const
 	glUniformMatrix4fvARB(location,1,GL_FALSE,waterTextureTransformMatrix);
 	}
 
-bool WaterTable2::requestBathymetry(GLfloat* newReadBathymetryBuffer)
+bool WaterTable2::requestReadback(WaterTable2::ReadbackGrid grid,const GridReadbackFunction* readbackFunction)
 	{
-	/* Check if the previous bathymetry request has been fulfilled: */
-	if(readBathymetryReply==readBathymetryRequest)
+	Threads::Mutex::Lock readbackLock(readbackMutex);
+	
+	/* Check if the previous request for the same grid has been fulfilled: */
+	if(readbackRequests[grid]==0)
 		{
-		/* Set up the new bathymetry request: */
-		++readBathymetryRequest;
-		readBathymetryBuffer=newReadBathymetryBuffer;
+		/* Set up the new request: */
+		readbackRequests[grid]=readbackFunction;
+		readbacksStarted[grid]=false;
 		
 		return true;
 		}
 	else
 		return false;
 	}
+
+void WaterTable2::cancelReadbacks(const GridReadbackFunction* readbackFunction)
+	{
+	Threads::Mutex::Lock readbackLock(readbackMutex);
+	
+	/* Remove all requests to the given function; read-backs already in progress will be discarded: */
+	for(int i=0;i<2;++i)
+		if(readbackRequests[i]==readbackFunction)
+			{
+			readbackRequests[i]=0;
+			readbacksStarted[i]=false;
+			}
+	}
+
+void WaterTable2::setPublishSnapshots(bool newPublishSnapshots)
+	{
+	publishSnapshots=newPublishSnapshots;
+	}
+
+void WaterTable2::initSnapshots(GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Create one bathymetry and one quantity texture for each slot of the snapshot triple buffer: */
+	glGenTextures(6,dataItem->snapshotTextureObjects);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	for(int i=0;i<6;++i)
+		{
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->snapshotTextureObjects[i]);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
+		if(i%2==0)
+			glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_R32F,size[0]-1,size[1]-1,0,GL_LUMINANCE,GL_FLOAT,0);
+		else
+			glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGB32F,size[0],size[1],0,GL_RGB,GL_FLOAT,0);
+		}
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	
+	/* Assign the texture objects to the triple buffer slots: */
+	for(int i=0;i<3;++i)
+		{
+		snapshots.getBuffer(i).bathymetryTextureObject=dataItem->snapshotTextureObjects[i*2+0];
+		snapshots.getBuffer(i).quantityTextureObject=dataItem->snapshotTextureObjects[i*2+1];
+		}
+	}
+
+void WaterTable2::releaseSnapshot(GLContextData& contextData) const
+	{
+	if(!publishSnapshots)
+		return;
+	
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	if(!dataItem->haveSync)
+		{
+		/* Wait until this context's reads from the locked snapshot are complete: */
+		glFinish();
+		return;
+		}
+	
+	/* Insert a fence after this context's reads from the locked snapshot, and submit it so that the publishing context can wait on it: */
+	GLsync fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+	glFlush();
+	
+	/* Replace this context's previous fence on the locked snapshot, which the new fence supersedes: */
+	Threads::Mutex::Lock snapshotReadFencesLock(snapshotReadFencesMutex);
+	const Snapshot& snapshot=snapshots.getLockedValue();
+	std::vector<Snapshot::ReadFence>::iterator rfIt=snapshot.readFences.begin();
+	while(rfIt!=snapshot.readFences.end()&&rfIt->contextData!=&contextData)
+		++rfIt;
+	if(rfIt!=snapshot.readFences.end())
+		{
+		glDeleteSync(rfIt->fence);
+		rfIt->fence=fence;
+		}
+	else
+		{
+		Snapshot::ReadFence newReadFence;
+		newReadFence.contextData=&contextData;
+		newReadFence.fence=fence;
+		snapshot.readFences.push_back(newReadFence);
+		}
+	}
+
+void WaterTable2::publishSnapshot(GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Start a new snapshot: */
+	Snapshot& snapshot=snapshots.startNewValue();
+	
+	/* Find the snapshot's triple buffer slot by its quantity texture object; the slot must be the last one if it is not one of the first two: */
+	int slot=0;
+	while(slot<2&&dataItem->snapshotTextureObjects[slot*2+1]!=snapshot.quantityTextureObject)
+		++slot;
+	
+	/* Release the fence of the slot's previous contents: */
+	if(dataItem->snapshotFences[slot]!=0)
+		glDeleteSync(dataItem->snapshotFences[slot]);
+	
+	{
+	/* Make the GPU wait until all rendering contexts have finished reading the slot's previous contents before overwriting them: */
+	Threads::Mutex::Lock snapshotReadFencesLock(snapshotReadFencesMutex);
+	for(std::vector<Snapshot::ReadFence>::iterator rfIt=snapshot.readFences.begin();rfIt!=snapshot.readFences.end();++rfIt)
+		{
+		glWaitSync(rfIt->fence,0,GL_TIMEOUT_IGNORED);
+		glDeleteSync(rfIt->fence);
+		}
+	snapshot.readFences.clear();
+	}
+	
+	/* Save the currently bound frame buffer: */
+	GLint currentFrameBuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	
+	/* Copy the current bathymetry grid into the snapshot: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->bathymetryFramebufferObject);
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT+dataItem->currentBathymetry);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,snapshot.bathymetryTextureObject);
+	glCopyTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,0,0,size[0]-1,size[1]-1);
+	glReadBuffer(GL_NONE);
+	
+	/* Copy the current conserved quantity grid into the snapshot: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT+dataItem->currentQuantity);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,snapshot.quantityTextureObject);
+	glCopyTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,0,0,size[0],size[1]);
+	glReadBuffer(GL_NONE);
+	
+	/* Restore OpenGL state: */
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+	
+	if(dataItem->haveSync)
+		{
+		/* Insert a fence that rendering contexts wait on so that they never see a partial snapshot, and submit it without stalling this context: */
+		dataItem->snapshotFences[slot]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+		snapshot.fence=dataItem->snapshotFences[slot];
+		glFlush();
+		}
+	else
+		{
+		/* Wait until the copies are complete so that rendering contexts never see a partial snapshot: */
+		dataItem->snapshotFences[slot]=0;
+		snapshot.fence=0;
+		glFinish();
+		}
+	
+	/* Publish the new snapshot: */
+	snapshots.postNewValue();
+	}
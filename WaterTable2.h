@@ -26,20 +26,26 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <vector>
 #include <Misc/FunctionCalls.h>
+#include <Threads/Mutex.h>
+#include <Threads/TripleBuffer.h>
 #include <Geometry/Point.h>
 #include <Geometry/Box.h>
 #include <Geometry/OrthonormalTransformation.h>
 #include <GL/gl.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
+#include <GL/Extensions/GLARBSync.h>
 #include <GL/GLObject.h>
 #include <GL/GLContextData.h>
 
 #include "Types.h"
+#include "PassProfiler.h"
 
 /* Forward declarations: */
 class DepthImageRenderer;
+class WaterStateFile;
 
 typedef Misc::FunctionCall<GLContextData&> AddWaterFunction; // Type for render functions called to locally add water to the water table
+typedef Misc::FunctionCall<const GLfloat*> GridReadbackFunction; // Type for functions receiving a grid read back from the GPU; the grid is only valid during the call
 
 class WaterTable2:public GLObject
 	{
@@ -48,6 +54,68 @@ class WaterTable2:public GLObject
 	typedef Geometry::Box<Scalar,3> Box;
 	typedef Geometry::OrthonormalTransformation<Scalar,3> ONTransform;
 	
+	enum ReadbackGrid // Enumerated type for grids that can be read back from the GPU
+		{
+		BATHYMETRY=0,QUANTITY
+		};
+	
+	struct Snapshot // Structure describing a published copy of the simulation state, for renderers running in other OpenGL contexts
+		{
+		/* Embedded classes: */
+		public:
+		struct ReadFence // Structure for a fence inserted by a rendering context after its last use of the snapshot
+			{
+			/* Elements: */
+			public:
+			const GLContextData* contextData; // Rendering context that inserted the fence
+			GLsync fence; // Fence signaling completion of the rendering context's reads from the snapshot's texture objects
+			};
+		
+		/* Elements: */
+		GLuint bathymetryTextureObject; // Texture object holding a copy of the vertex-centered bathymetry grid
+		GLuint quantityTextureObject; // Texture object holding a copy of the cell-centered conserved quantity grid
+		GLsync fence; // Fence signaling completion of the copies into the snapshot's texture objects, or null
+		mutable std::vector<ReadFence> readFences; // Fences of the rendering contexts that used the snapshot, at most one per context; protected by the water table's snapshotReadFencesMutex
+		
+		/* Constructors and destructors: */
+		Snapshot(void)
+			:bathymetryTextureObject(0),quantityTextureObject(0),fence(0)
+			{
+			}
+		};
+	
+	struct WaterSource // Structure describing a disk-shaped water source or sink
+		{
+		/* Elements: */
+		public:
+		Point center; // Disk center in camera space
+		Scalar radius; // Disk radius
+		GLfloat rate; // Amount of water added per simulation time unit; negative for sinks
+		};
+	
+	struct Statistics // Structure holding water flow statistics gathered at the end of a simulation step
+		{
+		/* Elements: */
+		public:
+		unsigned int version; // Version number of the statistics, incremented every time new statistics are gathered
+		GLfloat stepSize; // Size of the simulation step at whose end the statistics were gathered
+		double volume; // Total water volume in the water table
+		double wetArea; // Total area of cells covered by water
+		double maxDepth; // Maximum water column height
+		double maxSpeed; // Maximum flow speed
+		double boundaryOutflow; // Water volume removed by the dry boundary condition during the step
+		double sourceVolume; // Water volume added by water deposit and water sources during the step
+		double sinkVolume; // Water volume removed by negative water deposit (evaporation) and water sinks during the step
+		
+		/* Constructors and destructors: */
+		Statistics(void)
+			:version(0),stepSize(0.0f),
+			 volume(0.0),wetArea(0.0),maxDepth(0.0),maxSpeed(0.0),
+			 boundaryOutflow(0.0),sourceVolume(0.0),sinkVolume(0.0)
+			{
+			}
+		};
+	
 	private:
 	struct DataItem:public GLObject::DataItem // Structure holding per-context state
 		{
@@ -56,16 +124,25 @@ class WaterTable2:public GLObject
 		GLuint bathymetryTextureObjects[2]; // Double-buffered one-component float color texture object holding the vertex-centered bathymetry grid
 		int currentBathymetry; // Index of bathymetry texture containing the most recent bathymetry grid
 		unsigned int bathymetryVersion; // Version number of the most recent bathymetry grid
+		unsigned int previousBathymetryVersion; // Version number of the bathymetry grid in the other bathymetry texture
 		GLuint quantityTextureObjects[3]; // Double-buffered three-component color texture object holding the cell-centered conserved quantity grid (w, hu, hv)
 		int currentQuantity; // Index of quantity texture containing the most recent conserved quantity grid
 		GLuint derivativeTextureObject; // Three-component color texture object holding the cell-centered temporal derivative grid
 		GLuint maxStepSizeTextureObjects[2]; // Double-buffered one-component color texture objects to gather the maximum step size for Runge-Kutta integration steps
 		GLuint waterTextureObject; // One-component color texture object to add or remove water to/from the conserved quantity grid
+		GLuint statisticsTextureObjects[4]; // Double-buffered pairs of four-component color texture objects to gather summed and maximized water flow statistics
+		GLuint fluxAccumulatorTextureObject; // Three-component color texture object accumulating time-integrated fluxes of each cell under local time stepping, or across the refined patch's interface
+		GLuint tileLevelTextureObject; // One-component color texture object holding the step size level of each tile under local time stepping
+		std::vector<GLfloat> tileStepSizes; // Maximum step sizes of all tiles read back from the maximum step size reduction
+		std::vector<GLfloat> tileLevels; // Step size levels of all tiles; tiles of level l advance with steps of 2^-l times the macro step size
+		unsigned int numStepsSinceStatistics; // Number of simulation steps run in this context since statistics were last gathered
 		GLuint bathymetryFramebufferObject; // Frame buffer used to render the bathymetry surface into the bathymetry grid
 		GLuint derivativeFramebufferObject; // Frame buffer used for temporal derivative computation
 		GLuint maxStepSizeFramebufferObject; // Frame buffer used to calculate the maximum integration step size
 		GLuint integrationFramebufferObject; // Frame buffer used for the Euler and Runge-Kutta integration steps
 		GLuint waterFramebufferObject; // Frame buffer used for the water rendering step
+		GLuint statisticsFramebufferObjects[2]; // Frame buffers used to gather water flow statistics, each rendering into one pair of statistics textures
+		GLuint localStepFramebufferObject; // Frame buffer used to accumulate fluxes under local time stepping or across the refined patch's interface
 		GLhandleARB bathymetryShader; // Shader to update cell-centered conserved quantities after a change to the bathymetry grid
 		GLint bathymetryShaderUniformLocations[3];
 		GLhandleARB waterAdaptShader; // Shader to adapt a new conserved quantity grid to the current bathymetry grid
@@ -80,10 +157,46 @@ class WaterTable2:public GLObject
 		GLint eulerStepShaderUniformLocations[4];
 		GLhandleARB rungeKuttaStepShader; // Shader to compute a Runge-Kutta integration step
 		GLint rungeKuttaStepShaderUniformLocations[5];
+		GLhandleARB fusedEulerStepShader; // Shader to compute an Euler integration step with a fixed step size, including the temporal derivative
+		GLint fusedEulerStepShaderUniformLocations[8];
+		GLhandleARB fusedRungeKuttaStepShader; // Shader to compute a Runge-Kutta integration step, including the temporal derivative of the intermediate quantities
+		GLint fusedRungeKuttaStepShaderUniformLocations[9];
 		GLhandleARB waterAddShader; // Shader to render water adder objects
 		GLint waterAddShaderUniformLocations[3];
+		GLuint diskVertexBufferObject; // Vertex buffer object holding the unit circle vertices of the water source disk template
+		GLuint waterSourceBufferObject; // Vertex buffer object holding per-instance center, radius, and rate of all water sources
+		unsigned int waterSourcesVersion; // Version number of the water source list in the water source buffer
+		GLsizei numWaterSources; // Number of water sources in the water source buffer
+		GLhandleARB waterSourceShader; // Shader to render all water source disks in a single instanced draw
+		GLint waterSourceShaderUniformLocations[4];
+		GLint waterSourceShaderAttributeLocations[2];
+		bool haveInstancing; // Flag whether the OpenGL context supports instanced rendering; water sources are drawn one at a time otherwise
 		GLhandleARB waterShader; // Shader to add or remove water from the conserved quantities grid
 		GLint waterShaderUniformLocations[3];
+		GLhandleARB statisticsShader; // Shader to calculate per-cell water flow statistics
+		GLint statisticsShaderUniformLocations[4];
+		GLhandleARB sourceStatisticsShader; // Shader to calculate per-cell water volume changes due to water sources and sinks
+		GLint sourceStatisticsShaderUniformLocations[2];
+		GLhandleARB statisticsReduceShader; // Shader to reduce water flow statistics
+		GLint statisticsReduceShaderUniformLocations[3];
+		GLhandleARB patchProlongationShader; // Shader to copy coarse quantities into the cells of the refined patch
+		GLint patchProlongationShaderUniformLocations[7];
+		GLhandleARB patchRestrictionShader; // Shader to replace coarse quantities covered by the refined patch with averaged fine quantities
+		GLint patchRestrictionShaderUniformLocations[5];
+		GLhandleARB patchFluxShader; // Shader to accumulate the fine fluxes across the patch interface over the refined patch's sub-steps
+		GLint patchFluxShaderUniformLocations[11];
+		GLhandleARB patchRefluxShader; // Shader to correct coarse cells bordering the refined patch with the fine fluxes across the patch interface
+		GLint patchRefluxShaderUniformLocations[10];
+		GLhandleARB localFluxShader; // Shader to accumulate the fluxes across all faces active in a local time stepping sub-step
+		GLint localFluxShaderUniformLocations[11];
+		GLhandleARB localUpdateShader; // Shader to apply accumulated fluxes, or to copy quantities, under local time stepping
+		GLint localUpdateShaderUniformLocations[2];
+		GLuint snapshotTextureObjects[6]; // Texture objects backing the three published simulation state snapshots if this context is the publishing context
+		GLsync snapshotFences[3]; // Fences signaling completion of the copies into the three snapshots if this context is the publishing context
+		GLuint readbackBufferObjects[2]; // Pixel buffer objects receiving asynchronous read-backs of the bathymetry and quantity grids
+		GLsync readbackFences[2]; // Fences signaling completion of the asynchronous read-backs, or null if no read-back is in progress
+		const GridReadbackFunction* readbackFunctions[2]; // Functions to receive the read-backs in progress in this context
+		bool haveSync; // Flag whether the OpenGL context supports sync objects; grids are read back synchronously otherwise
 		
 		/* Constructors and destructors: */
 		DataItem(void);
@@ -106,21 +219,60 @@ class WaterTable2:public GLObject
 	GLfloat maxStepSize; // Maximum step size for each Runge-Kutta integration step
 	PTransform waterTextureTransform; // Projective transformation from camera space to water level texture space
 	GLfloat waterTextureTransformMatrix[16]; // Same in GLSL-compatible format
+	mutable Threads::Mutex renderFunctionsMutex; // Mutex protecting the list of render functions if the simulation runs in a background thread
 	std::vector<const AddWaterFunction*> renderFunctions; // A list of functions that are called after each water flow simulation step to locally add or remove water from the water table
+	GLfloat waterSourceAxes[2][3]; // Camera-space x and y axes of the base plane to render water source disks
+	mutable Threads::Mutex waterSourcesMutex; // Mutex protecting the water source lists if the water simulation runs in a background thread
+	std::vector<WaterSource> submittedWaterSources; // List of water sources submitted since the last time the water source list was posted
+	std::vector<WaterSource> waterSources; // List of water sources added to the water table on every simulation step
+	unsigned int waterSourcesVersion; // Version number of the posted water source list
 	GLfloat waterDeposit; // A fixed amount of water added at every iteration of the flow simulation, for evaporation etc.
 	bool dryBoundary; // Flag whether to enforce dry boundary conditions at the end of each simulation step
-	unsigned int readBathymetryRequest; // Request token to read back the current bathymetry grid from the GPU
-	mutable GLfloat* readBathymetryBuffer; // Buffer into which to read the current bathymetry grid
-	mutable unsigned int readBathymetryReply; // Reply token after reading back the current bathymetry grid
+	bool halfPrecision; // Flag whether the temporal derivative and intermediate quantity textures use half-float storage
+	bool fusedSteps; // Flag whether integration steps calculate the temporal derivatives they need in the same pass where possible
+	mutable Threads::Mutex readbackMutex; // Mutex protecting the grid read-back requests
+	mutable const GridReadbackFunction* readbackRequests[2]; // Pending bathymetry and quantity grid read-back requests, or null
+	mutable bool readbacksStarted[2]; // Flags whether the pending read-back requests have been started in some OpenGL context
+	unsigned int statisticsInterval; // Number of simulation steps between gathering water flow statistics, or 0 to disable statistics
+	mutable Threads::Mutex statisticsMutex; // Mutex protecting the most recently gathered statistics
+	mutable Statistics statistics; // The most recently gathered water flow statistics
+	mutable Threads::Mutex restoreMutex; // Mutex protecting the pending state restore request
+	mutable WaterStateFile* pendingRestore; // Water state file to be restored on the next bathymetry update, or null
+	GLsizei patchOrigin[2]; // Index of the coarse cell at the lower-left corner of the refined patch
+	GLsizei patchSize[2]; // Width and height of the refined patch in coarse cells
+	GLsizei patchRefinement; // Number of fine cells per coarse cell along each axis inside the refined patch
+	WaterTable2* patch; // Water table simulating the refined patch, including two layers of ghost cells, or null
+	unsigned int localTimeSteppingLevels; // Number of times tiles may halve the macro step size under local time stepping; 0 disables local time stepping
+	const PassProfiler* profiler; // Profiler measuring the GPU time of the simulation passes, or null
+	bool publishSnapshots; // Flag whether the simulation runs in a separate OpenGL context and publishes its state to renderers via snapshots
+	mutable Threads::TripleBuffer<Snapshot> snapshots; // Triple buffer of published simulation state snapshots
+	mutable Threads::Mutex snapshotReadFencesMutex; // Mutex protecting the read fences of all snapshots
 	
 	/* Private methods: */
 	void calcTransformations(void); // Calculates derived transformations
+	void setupDerivative(const GLint* uniformLocations,DataItem* dataItem,GLuint quantityTextureObject) const; // Uploads the temporal derivative calculation's uniform variables to the given locations of the current shader and binds the bathymetry and given quantity texture objects to texture units 0 and 1
 	GLfloat calcDerivative(DataItem* dataItem,GLuint quantityTextureObject,bool calcMaxStepSize) const; // Calculates the temporal derivative of the conserved quantities in the given texture object and returns maximum step size if flag is true
+	void deliverReadback(DataItem* dataItem,int grid) const; // Delivers the completed read-back of the given grid to its requester; must be called with the read-back mutex locked
+	void processReadbacks(DataItem* dataItem) const; // Delivers completed grid read-backs and starts pending ones
+	void reduceStatistics(DataItem* dataItem,GLfloat sums[4],GLfloat maxima[4]) const; // Reduces per-cell statistics in the first pair of statistics textures and returns the total sums and maxima
+	int reduceMaxStepSize(DataItem* dataItem,int numReductions) const; // Reduces the per-cell maximum step size texture by the given number of half-reduction steps, or down to a single pixel if negative; returns the index of the texture holding the result
+	void eulerStep(DataItem* dataItem,GLfloat stepSize,bool fused) const; // Performs the tentative Euler integration step into the intermediate quantity texture; calculates the temporal derivative in the same pass if flag is true
+	void rungeKuttaStep(DataItem* dataItem,GLfloat stepSize) const; // Performs the final Runge-Kutta integration step into the other quantity texture
+	void addWater(DataItem* dataItem,GLfloat stepSize,const WaterTable2& sourceTable,GLContextData& contextData) const; // Adds the water sources and sinks of the given water table into the other quantity texture; caller must lock the source table's lists
+	void prolongatePatch(DataItem* dataItem,DataItem* patchDataItem,GLuint quantityTextureObject,GLuint newQuantityTextureObject,GLfloat alpha,int patchQuantityIndex,bool ghostCellsOnly) const; // Copies the given coarse quantity textures, interpolated by the given weight, into the ghost cells, or all cells, of the given quantity texture of the refined patch
+	void drawPatchInterface(GLint faceNormalUniformLocation) const; // Draws the four strips of coarse cells bordering the refined patch, and uploads each strip's face normal to the given location of the current shader
+	void advancePatch(DataItem* dataItem,DataItem* patchDataItem,GLfloat stepSize,bool forceStepSize) const; // Advances the refined patch over one coarse step of the given size in sub-steps, and accumulates the fine fluxes across the patch interface
+	void couplePatch(DataItem* dataItem,DataItem* patchDataItem,GLfloat stepSize) const; // Restricts the new quantities of the refined patch to the new coarse quantities, and corrects the coarse cells bordering the patch with the accumulated fine fluxes across the patch interface
+	GLfloat calcTileLevels(DataItem* dataItem,bool forceStepSize,unsigned int& numLevels) const; // Assigns step size levels to all tiles based on their maximum step sizes; returns the macro step size and the number of levels in use
+	void localTimeStep(DataItem* dataItem,GLfloat stepSize,unsigned int numLevels) const; // Advances the quantities in the other quantity texture by one forward Euler macro step of the given size using per-tile step sizes
 	
 	/* Constructors and destructors: */
 	public:
 	WaterTable2(GLsizei width,GLsizei height,const GLfloat sCellSize[2]); // Creates water table for offline simulation
 	WaterTable2(GLsizei width,GLsizei height,const DepthImageRenderer* sDepthImageRenderer,const Point basePlaneCorners[4]); // Creates a water table of the given size in pixels, for the base plane quadrilateral defined by the depth image renderer's plane equation and four corner points
+	private:
+	WaterTable2(const WaterTable2& parent,const GLsizei sPatchOrigin[2],const GLsizei sPatchSize[2],GLsizei sPatchRefinement); // Creates a refined patch of the given parent water table
+	public:
 	virtual ~WaterTable2(void);
 	
 	/* Methods from GLObject: */
@@ -160,27 +312,77 @@ class WaterTable2:public GLObject
 		}
 	void addRenderFunction(const AddWaterFunction* newRenderFunction); // Adds a render function to the list; object remains owned by caller
 	void removeRenderFunction(const AddWaterFunction* removeRenderFunction); // Removes the given render function from the list but does not delete it
+	void addWaterSource(const Point& center,Scalar radius,GLfloat rate); // Submits a disk-shaped water source with the given center in camera space, radius, and rate (negative for sinks) for the next posted water source list
+	void postWaterSources(void); // Replaces the water sources used by subsequent simulation steps with all water sources submitted since the last call; must be called once per frame
+	std::vector<WaterSource> getWaterSources(void) const; // Returns a copy of the water source list used by subsequent simulation steps
 	GLfloat getWaterDeposit(void) const // Returns the current amount of water deposited on every simulation step
 		{
 		return waterDeposit;
 		}
 	void setWaterDeposit(GLfloat newWaterDeposit); // Sets the amount of deposited water
 	void setDryBoundary(bool newDryBoundary); // Enables or disables enforcement of dry boundaries
+	bool getHalfPrecision(void) const // Returns true if the temporal derivative and intermediate quantity textures use half-float storage
+		{
+		return halfPrecision;
+		}
+	void setHalfPrecision(bool newHalfPrecision); // Enables or disables half-float storage for the temporal derivative and intermediate quantity textures; must be called before the water table is initialized in any OpenGL context
+	bool getFusedSteps(void) const // Returns true if integration steps calculate temporal derivatives in the same pass where possible
+		{
+		return fusedSteps;
+		}
+	void setFusedSteps(bool newFusedSteps); // Enables or disables calculating temporal derivatives inside the integration step passes
+	unsigned int getStatisticsInterval(void) const // Returns the number of simulation steps between gathering water flow statistics
+		{
+		return statisticsInterval;
+		}
+	void setStatisticsInterval(unsigned int newStatisticsInterval); // Sets the number of simulation steps between gathering water flow statistics; 0 disables statistics
+	Statistics getStatistics(void) const; // Returns the most recently gathered water flow statistics
+	void setRefinedPatch(const GLsizei newPatchOrigin[2],const GLsizei newPatchSize[2],GLsizei newPatchRefinement); // Simulates the given rectangle of coarse cells on a grid refined by the given factor, in as many sub-steps per simulation step; must be called before the water table is initialized in any OpenGL context; throws exception if the rectangle does not keep two cells of distance from the grid boundary; offline water tables must upload the patch's own bathymetry grid
+	const WaterTable2* getRefinedPatch(void) const // Returns the water table simulating the refined patch, or null
+		{
+		return patch;
+		}
+	unsigned int getLocalTimeSteppingLevels(void) const // Returns the number of times tiles may halve the macro step size under local time stepping
+		{
+		return localTimeSteppingLevels;
+		}
+	void setLocalTimeSteppingLevels(unsigned int newLocalTimeSteppingLevels); // Sets the number of times tiles may halve the macro step size under local time stepping, 0 to disable; must be called before the water table is initialized in any OpenGL context; ignored if the water table has a refined patch
+	void setProfiler(const PassProfiler* newProfiler); // Sets a profiler to measure the GPU time of the simulation passes; null disables profiling
 	void updateBathymetry(GLContextData& contextData) const; // Prepares the water table for subsequent calls to the runSimulationStep() method
 	void updateBathymetry(const GLfloat* bathymetryGrid,GLContextData& contextData) const; // Updates the bathymetry directly with a vertex-centered elevation grid of grid size minus 1
-	void setWaterLevel(const GLfloat* waterGrid,GLContextData& contextData) const; // Sets the current water level to the given grid, and resets flux components to zero
+	void setWaterLevel(const GLfloat* waterGrid,GLContextData& contextData) const; // Sets the current water level to the given grid, resets flux components to zero, and re-initializes the refined patch
+	void restoreState(const GLfloat* bathymetryGrid,const GLfloat* quantityGrid,GLContextData& contextData) const; // Replaces the bathymetry and conserved quantity grids with the given vertex-centered bathymetry grid of grid size minus 1 and cell-centered conserved quantity grid of grid size
+	void restoreState(const WaterStateFile& stateFile,GLContextData& contextData) const; // Replaces the bathymetry and conserved quantity grids with those from the given water state file, which must match the water table's size
+	bool requestRestore(WaterStateFile* stateFile); // Requests restoring the given water state file on the next call to updateBathymetry(); water table takes ownership of the file object and replaces any pending request; returns false and deletes the file object if it does not match the water table
 	GLfloat runSimulationStep(bool forceStepSize,GLContextData& contextData) const; // Runs a water flow simulation step, always uses maxStepSize if flag is true (may lead to instability); returns step size taken by Runge-Kutta integration step
-	void bindBathymetryTexture(GLContextData& contextData) const; // Binds the bathymetry texture object to the active texture unit
-	void bindQuantityTexture(GLContextData& contextData) const; // Binds the most recent conserved quantities texture object to the active texture unit
+	void bindBathymetryTexture(GLContextData& contextData) const; // Binds the bathymetry texture object, or that of the locked snapshot, to the active texture unit
+	void bindQuantityTexture(GLContextData& contextData) const; // Binds the most recent conserved quantities texture object, or that of the locked snapshot, to the active texture unit
 	void uploadWaterTextureTransform(GLint location) const; // Uploads the water texture transformation into the GLSL 4x4 matrix at the given uniform location
 	GLsizei getBathymetrySize(int index) const // Returns the width or height of the bathymetry grid
 		{
 		return size[index]-1;
 		}
-	bool requestBathymetry(GLfloat* newReadBathymetryBuffer); // Requests reading back the current bathymetry grid from the GPU during the next rendering cycle; returns true if request can be granted
-	bool haveBathymetry(void) const // Returns true if the most recent bathymetry request has been fulfilled
+	bool requestReadback(ReadbackGrid grid,const GridReadbackFunction* readbackFunction); // Requests an asynchronous read-back of the given grid; the function is called from the simulation's rendering thread once the grid arrives, and must not call request or cancel methods; returns false if another read-back of the same grid is pending
+	bool requestBathymetry(const GridReadbackFunction* readbackFunction) // Requests an asynchronous read-back of the vertex-centered bathymetry grid, of size getBathymetrySize(), one component per vertex
+		{
+		return requestReadback(BATHYMETRY,readbackFunction);
+		}
+	bool requestQuantity(const GridReadbackFunction* readbackFunction) // Requests an asynchronous read-back of the cell-centered conserved quantity grid, of size getSize(), three components (w, hu, hv) per cell
+		{
+		return requestReadback(QUANTITY,readbackFunction);
+		}
+	void cancelReadbacks(const GridReadbackFunction* readbackFunction); // Cancels all pending read-backs to the given function; the function will not be called after this method returns
+	bool getPublishSnapshots(void) const // Returns true if renderers use published simulation state snapshots
+		{
+		return publishSnapshots;
+		}
+	void setPublishSnapshots(bool newPublishSnapshots); // Sets whether renderers use published simulation state snapshots; must be called before any rendering
+	void initSnapshots(GLContextData& contextData) const; // Creates the snapshot texture objects in the given publishing context, which must share texture objects with all rendering contexts
+	void publishSnapshot(GLContextData& contextData) const; // Copies the current simulation state into a new snapshot and publishes it with a fence that renderers wait on before using the snapshot
+	void releaseSnapshot(GLContextData& contextData) const; // Inserts a fence after the given rendering context's uses of the locked snapshot, which the publishing context waits on before overwriting the snapshot
+	bool lockNewSnapshot(void) const // Locks the most recently published snapshot for rendering; returns true if a new snapshot was locked
 		{
-		return readBathymetryReply==readBathymetryRequest;
+		return snapshots.lockNewValue();
 		}
 	};
 
@@ -0,0 +1,37 @@
+/***********************************************************************
+SurfaceTangentShader - Shader to calculate the tangent plane slopes of
+a surface in depth image space from central differences of the depth
+image.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform sampler2DRect depthSampler; // Sampler for the depth image-space elevation texture
+
+void main()
+	{
+	/* Calculate the x and y components of the pixel's tangent plane equation in depth image space, scaled such that the z component is 2: */
+	vec2 tangentDic;
+	tangentDic.x=texture2DRect(depthSampler,vec2(gl_FragCoord.x-1.0,gl_FragCoord.y)).r-texture2DRect(depthSampler,vec2(gl_FragCoord.x+1.0,gl_FragCoord.y)).r;
+	tangentDic.y=texture2DRect(depthSampler,vec2(gl_FragCoord.x,gl_FragCoord.y-1.0)).r-texture2DRect(depthSampler,vec2(gl_FragCoord.x,gl_FragCoord.y+1.0)).r;
+	
+	/* Write the tangent plane components into the frame buffer: */
+	gl_FragColor=vec4(tangentDic,0.0,1.0);
+	}
@@ -0,0 +1,46 @@
+/***********************************************************************
+Water2FusedRungeKuttaStepShader - Shader to compute a Runge-Kutta
+integration step, calculating the temporal derivative of the
+intermediate quantities in the same pass instead of reading it from a
+separate texture.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform float stepSize;
+uniform float attenuation;
+uniform sampler2DRect quantitySampler; // Intermediate quantities from the Euler step
+uniform sampler2DRect oldQuantitySampler; // Quantities at the beginning of the integration step
+
+vec3 calcDerivative(out float maxStepSize);
+
+void main()
+	{
+	/* Calculate the temporal derivative of the intermediate quantities: */
+	float maxStepSize;
+	vec3 qt=calcDerivative(maxStepSize);
+	
+	/* Calculate the Runge-Kutta step: */
+	vec3 q=texture2DRect(oldQuantitySampler,gl_FragCoord.xy).rgb;
+	vec3 qStar=texture2DRect(quantitySampler,gl_FragCoord.xy).rgb;
+	vec3 newQ=(q+qStar+qt*stepSize)*0.5;
+	newQ.yz*=attenuation;
+	gl_FragColor=vec4(newQ,0.0);
+	}
@@ -0,0 +1,60 @@
+/***********************************************************************
+Water2LocalFluxShader - Shader to accumulate the time-integrated fluxes
+across all faces of a cell that are active in a sub-step of local time
+stepping.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform sampler2DRect tileLevelSampler;
+uniform float tileSize;
+uniform float numLevels;
+uniform float substep;
+uniform float stepSize;
+
+vec3 calcWeightedDerivative(in vec4 faceWeights,in float sourceWeight,out float maxStepSize);
+
+float tileLevel(in vec2 cell)
+	{
+	/* Return the step size level of the tile containing the given cell: */
+	return texture2DRect(tileLevelSampler,floor(cell/tileSize)+vec2(0.5)).r;
+	}
+
+void main()
+	{
+	/* Get the step size levels of this cell and its west, east, south, and north neighbors: */
+	float level=tileLevel(gl_FragCoord.xy);
+	vec4 neighborLevels=vec4(tileLevel(vec2(gl_FragCoord.x-1.0,gl_FragCoord.y)),
+	                         tileLevel(vec2(gl_FragCoord.x+1.0,gl_FragCoord.y)),
+	                         tileLevel(vec2(gl_FragCoord.x,gl_FragCoord.y-1.0)),
+	                         tileLevel(vec2(gl_FragCoord.x,gl_FragCoord.y+1.0)));
+	
+	/* Each face is active at the rate of the finer of its two cells and integrates its flux over that cell's step: */
+	vec4 faceLevels=max(neighborLevels,vec4(level));
+	vec4 faceActive=vec4(equal(mod(vec4(substep),exp2(numLevels-faceLevels)),vec4(0.0)));
+	vec4 faceWeights=faceActive*(stepSize/exp2(faceLevels));
+	
+	/* The source terms are integrated over this cell's own step: */
+	float sourceWeight=mod(substep,exp2(numLevels-level))==0.0?stepSize/exp2(level):0.0;
+	
+	/* Return the time-integrated change of the conserved quantities: */
+	float maxStepSize;
+	gl_FragColor=vec4(calcWeightedDerivative(faceWeights,sourceWeight,maxStepSize),0.0);
+	}
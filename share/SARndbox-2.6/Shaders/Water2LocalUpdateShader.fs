@@ -0,0 +1,34 @@
+/***********************************************************************
+Water2LocalUpdateShader - Shader to apply accumulated fluxes to the
+conserved quantities, or to copy conserved quantities, under local time
+stepping.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform float attenuation;
+uniform sampler2DRect updateSampler;
+
+void main()
+	{
+	/* Attenuate the partial discharges of the update; the blending stage applies the same attenuation to the existing quantities: */
+	vec3 update=texture2DRect(updateSampler,gl_FragCoord.xy).rgb;
+	gl_FragColor=vec4(update.x,update.yz*attenuation,0.0);
+	}
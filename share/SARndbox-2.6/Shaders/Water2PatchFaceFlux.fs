@@ -0,0 +1,59 @@
+/***********************************************************************
+Water2PatchFaceFlux - Shader fragment to compute the flux across a
+single face of a water grid from the conserved quantities around it, to
+couple a refined water grid patch to its coarse grid.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+vec3 calcSlope(in vec3 q0,in vec3 q1,in vec3 q2,in float cellSize,in float b0,in float b1);
+float calcPartialFluxX(in vec3 qe,in vec3 qw,in float bew,out vec3 fluxX);
+float calcPartialFluxY(in vec3 qn,in vec3 qs,in float bns,out vec3 fluxY);
+
+float faceBathymetry(in sampler2DRect bathymetrySampler,in vec2 cell,in vec2 perp)
+	{
+	/* Average the bathymetry elevations at the ends of the face following the given cell: */
+	return (texture2DRect(bathymetrySampler,cell).r+texture2DRect(bathymetrySampler,cell-perp).r)*0.5;
+	}
+
+vec3 calcFaceFlux(in sampler2DRect bathymetrySampler,in sampler2DRect quantitySampler,in vec2 cell,in vec2 axis,in float cs)
+	{
+	/* Get the quantities and face-centered bathymetry elevations around the face between the given cell and its successor: */
+	vec2 perp=axis.yx;
+	vec3 qm=texture2DRect(quantitySampler,cell-axis).rgb;
+	vec3 q0=texture2DRect(quantitySampler,cell).rgb;
+	vec3 q1=texture2DRect(quantitySampler,cell+axis).rgb;
+	vec3 q2=texture2DRect(quantitySampler,cell+axis*2.0).rgb;
+	float bm=faceBathymetry(bathymetrySampler,cell-axis,perp);
+	float b0=faceBathymetry(bathymetrySampler,cell,perp);
+	float b1=faceBathymetry(bathymetrySampler,cell+axis,perp);
+	
+	/* Calculate the one-sided quantities on both sides of the face: */
+	vec3 q0f=q0+calcSlope(qm,q0,q1,cs,bm,b0)*(cs*0.5);
+	vec3 q1f=q1-calcSlope(q0,q1,q2,cs,b0,b1)*(cs*0.5);
+	
+	/* Calculate the flux across the face: */
+	vec3 flux;
+	if(axis.x!=0.0)
+		calcPartialFluxX(q0f,q1f,b0,flux);
+	else
+		calcPartialFluxY(q0f,q1f,b0,flux);
+	return flux;
+	}
@@ -0,0 +1,54 @@
+/***********************************************************************
+Water2PatchFluxShader - Shader to accumulate the fluxes across the fine
+faces of a refined water grid patch's interface over the sub-steps of a
+coarse simulation step.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform vec2 fineCellSize;
+uniform vec2 patchOrigin;
+uniform float refinement;
+uniform vec2 faceNormal; // Unit normal of the coarse faces, pointing from the coarse cells owning the accumulators into the patch
+uniform float stepSize; // Step size of the current fine sub-step
+uniform sampler2DRect fineBathymetrySampler;
+uniform sampler2DRect fineQuantitySampler;
+uniform sampler2DRect fineQuantityStarSampler;
+
+vec3 calcFaceFlux(in sampler2DRect bathymetrySampler,in sampler2DRect quantitySampler,in vec2 cell,in vec2 axis,in float cs);
+
+void main()
+	{
+	/* Find the coarse cell preceding the coarse face along the face's axis: */
+	vec2 axis=abs(faceNormal);
+	vec2 perp=axis.yx;
+	vec2 cell=gl_FragCoord.xy+min(faceNormal,vec2(0.0));
+	
+	/* Average the fine fluxes across the fine faces covering the coarse face, summed over both Runge-Kutta stages: */
+	float fcs=dot(fineCellSize,axis);
+	vec2 fineCell=(cell+axis*0.5-perp*0.5-patchOrigin)*refinement+2.0-axis*0.5+perp*0.5;
+	vec3 fineFlux=vec3(0.0);
+	for(float i=0.0;i<refinement;i+=1.0,fineCell+=perp)
+		fineFlux+=calcFaceFlux(fineBathymetrySampler,fineQuantitySampler,fineCell,axis,fcs)+
+		          calcFaceFlux(fineBathymetrySampler,fineQuantityStarSampler,fineCell,axis,fcs);
+	
+	/* Return the sub-step's time-integrated fine flux, to be added to the coarse face's accumulator: */
+	gl_FragColor=vec4(fineFlux*(0.5*stepSize/refinement),0.0);
+	}
@@ -0,0 +1,57 @@
+/***********************************************************************
+Water2PatchProlongationShader - Shader to initialize cells of a refined
+water grid patch from the conserved quantities of the coarse grid.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform vec2 patchOrigin;
+uniform float refinement;
+uniform sampler2DRect coarseBathymetrySampler;
+uniform sampler2DRect coarseQuantitySampler; // Coarse quantities at the beginning of the coarse step
+uniform sampler2DRect newCoarseQuantitySampler; // Coarse quantities at the end of the coarse step
+uniform float alpha; // Fraction of the coarse step at which to interpolate the coarse quantities
+uniform sampler2DRect fineBathymetrySampler;
+
+float cellBathymetry(in sampler2DRect bathymetrySampler,in vec2 cell)
+	{
+	/* Average the bathymetry elevations at the cell's four corners: */
+	return (texture2DRect(bathymetrySampler,vec2(cell.x-1.0,cell.y-1.0)).r+
+	        texture2DRect(bathymetrySampler,vec2(cell.x,cell.y-1.0)).r+
+	        texture2DRect(bathymetrySampler,vec2(cell.x-1.0,cell.y)).r+
+	        texture2DRect(bathymetrySampler,cell).r)*0.25;
+	}
+
+void main()
+	{
+	/* Find the coarse cell containing this fine cell, skipping the fine grid's two layers of ghost cells: */
+	vec2 coarseCell=floor(patchOrigin+(gl_FragCoord.xy-2.0)/refinement)+0.5;
+	
+	/* Interpolate the coarse cell's conserved quantities in time, and get its water column height: */
+	vec3 q=mix(texture2DRect(coarseQuantitySampler,coarseCell).rgb,texture2DRect(newCoarseQuantitySampler,coarseCell).rgb,alpha);
+	float coarseDepth=q.x-cellBathymetry(coarseBathymetrySampler,coarseCell);
+	
+	/* Adapt the coarse water surface to the fine bathymetry; fine cells above the coarse water surface are dry: */
+	float fineBathymetry=cellBathymetry(fineBathymetrySampler,gl_FragCoord.xy);
+	if(coarseDepth>0.0&&q.x>fineBathymetry)
+		gl_FragColor=vec4(q,0.0);
+	else
+		gl_FragColor=vec4(fineBathymetry,0.0,0.0,0.0);
+	}
@@ -0,0 +1,52 @@
+/***********************************************************************
+Water2PatchRefluxShader - Shader to correct the conserved quantities of
+coarse grid cells bordering a refined water grid patch by the difference
+between the coarse and fine fluxes across their shared faces.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform vec2 cellSize;
+uniform vec2 faceNormal; // Unit normal of the corrected faces, pointing from the corrected coarse cells into the patch
+uniform float stepSize;
+uniform sampler2DRect coarseBathymetrySampler;
+uniform sampler2DRect coarseQuantitySampler;
+uniform sampler2DRect coarseQuantityStarSampler;
+uniform sampler2DRect fineFluxSampler; // Fine fluxes across the corrected faces, integrated over all sub-steps of the coarse step
+
+vec3 calcFaceFlux(in sampler2DRect bathymetrySampler,in sampler2DRect quantitySampler,in vec2 cell,in vec2 axis,in float cs);
+
+void main()
+	{
+	/* Find the coarse cell preceding the corrected face along the face's axis: */
+	vec2 axis=abs(faceNormal);
+	vec2 cell=gl_FragCoord.xy+min(faceNormal,vec2(0.0));
+	
+	/* Calculate the coarse flux across the face, integrated over both Runge-Kutta stages: */
+	float coarseCellSize=dot(cellSize,axis);
+	vec3 coarseFlux=(calcFaceFlux(coarseBathymetrySampler,coarseQuantitySampler,cell,axis,coarseCellSize)+
+	                 calcFaceFlux(coarseBathymetrySampler,coarseQuantityStarSampler,cell,axis,coarseCellSize))*(0.5*stepSize);
+	
+	/* Get the fine flux across the face accumulated over the refined patch's sub-steps: */
+	vec3 fineFlux=texture2DRect(fineFluxSampler,gl_FragCoord.xy).rgb;
+	
+	/* Return the correction replacing the coarse flux by the fine flux in the Runge-Kutta step: */
+	gl_FragColor=vec4((coarseFlux-fineFlux)*(dot(faceNormal,axis)/coarseCellSize),0.0);
+	}
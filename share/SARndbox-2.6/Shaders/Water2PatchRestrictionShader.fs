@@ -0,0 +1,61 @@
+/***********************************************************************
+Water2PatchRestrictionShader - Shader to replace the conserved
+quantities of coarse grid cells covered by a refined water grid patch
+with the averages of the fine cells.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform vec2 patchOrigin;
+uniform float refinement;
+uniform sampler2DRect coarseBathymetrySampler;
+uniform sampler2DRect fineBathymetrySampler;
+uniform sampler2DRect fineQuantitySampler;
+
+float cellBathymetry(in sampler2DRect bathymetrySampler,in vec2 cell)
+	{
+	/* Average the bathymetry elevations at the cell's four corners: */
+	return (texture2DRect(bathymetrySampler,vec2(cell.x-1.0,cell.y-1.0)).r+
+	        texture2DRect(bathymetrySampler,vec2(cell.x,cell.y-1.0)).r+
+	        texture2DRect(bathymetrySampler,vec2(cell.x-1.0,cell.y)).r+
+	        texture2DRect(bathymetrySampler,cell).r)*0.25;
+	}
+
+void main()
+	{
+	/* Find the first fine cell covered by this coarse cell, skipping the fine grid's two layers of ghost cells: */
+	vec2 fineBase=(gl_FragCoord.xy-0.5-patchOrigin)*refinement+2.0;
+	
+	/* Average the water column heights and momenta of all covered fine cells, which conserves the fine water volume: */
+	vec3 q=vec3(0.0);
+	for(float y=0.5;y<refinement;y+=1.0)
+		for(float x=0.5;x<refinement;x+=1.0)
+			{
+			vec2 fineCell=fineBase+vec2(x,y);
+			vec3 fineQ=texture2DRect(fineQuantitySampler,fineCell).rgb;
+			fineQ.x-=cellBathymetry(fineBathymetrySampler,fineCell);
+			q+=fineQ;
+			}
+	q/=refinement*refinement;
+	
+	/* Convert the average water column height back to a water surface elevation over the coarse bathymetry: */
+	q.x+=cellBathymetry(coarseBathymetrySampler,gl_FragCoord.xy);
+	gl_FragColor=vec4(q,0.0);
+	}
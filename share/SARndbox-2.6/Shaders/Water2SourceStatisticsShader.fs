@@ -0,0 +1,38 @@
+/***********************************************************************
+Water2SourceStatisticsShader - Shader to calculate the per-cell
+water volume added or removed by water sources and sinks as input for a
+subsequent reduction.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+#extension GL_ARB_draw_buffers : enable
+
+uniform sampler2DRect oldQuantitySampler;
+uniform sampler2DRect quantitySampler;
+
+void main()
+	{
+	/* Calculate the change in water column height; the bathymetry cancels out: */
+	float dh=texture2DRect(quantitySampler,gl_FragCoord.xy).r-texture2DRect(oldQuantitySampler,gl_FragCoord.xy).r;
+	
+	/* Write added and removed water separately: */
+	gl_FragData[0]=vec4(max(dh,0.0),max(-dh,0.0),0.0,0.0);
+	gl_FragData[1]=vec4(0.0,0.0,0.0,0.0);
+	}
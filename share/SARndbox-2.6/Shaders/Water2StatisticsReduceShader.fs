@@ -0,0 +1,57 @@
+/***********************************************************************
+Water2StatisticsReduceShader - Shader to reduce water flow
+statistics by summing or maximizing 2x2 tiles of cells.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+#extension GL_ARB_draw_buffers : enable
+
+uniform vec2 fullTextureSize;
+uniform sampler2DRect sumSampler;
+uniform sampler2DRect maxSampler;
+
+void main()
+	{
+	/* Calculate the base position of a 2x2 tile of pixels: */
+	vec2 frag=gl_FragCoord.xy*2.0-vec2(0.5,0.5);
+	
+	/* Accumulate the sums and maxima of the 2x2 tile: */
+	vec4 sum=texture2DRect(sumSampler,frag);
+	vec4 maximum=texture2DRect(maxSampler,frag);
+	if(frag.x<fullTextureSize.x)
+		{
+		sum+=texture2DRect(sumSampler,vec2(frag.x+1.0,frag.y));
+		maximum=max(maximum,texture2DRect(maxSampler,vec2(frag.x+1.0,frag.y)));
+		}
+	if(frag.y<fullTextureSize.y)
+		{
+		sum+=texture2DRect(sumSampler,vec2(frag.x,frag.y+1.0));
+		maximum=max(maximum,texture2DRect(maxSampler,vec2(frag.x,frag.y+1.0)));
+		}
+	if(frag.x<fullTextureSize.x&&frag.y<fullTextureSize.y)
+		{
+		sum+=texture2DRect(sumSampler,vec2(frag.x+1.0,frag.y+1.0));
+		maximum=max(maximum,texture2DRect(maxSampler,vec2(frag.x+1.0,frag.y+1.0)));
+		}
+	
+	/* Write the reduced tile: */
+	gl_FragData[0]=sum;
+	gl_FragData[1]=maximum;
+	}
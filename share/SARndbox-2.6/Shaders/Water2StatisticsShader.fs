@@ -0,0 +1,51 @@
+/***********************************************************************
+Water2StatisticsShader - Shader to calculate per-cell water flow
+statistics as input for a subsequent reduction.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+#extension GL_ARB_draw_buffers : enable
+
+uniform vec2 gridSize;
+uniform float wetDepth;
+uniform sampler2DRect bathymetrySampler;
+uniform sampler2DRect quantitySampler;
+
+void main()
+	{
+	/* Calculate the bathymetry elevation at the center of this cell: */
+	float b=(texture2DRect(bathymetrySampler,vec2(gl_FragCoord.x-1.0,gl_FragCoord.y-1.0)).r+
+	         texture2DRect(bathymetrySampler,vec2(gl_FragCoord.x,gl_FragCoord.y-1.0)).r+
+	         texture2DRect(bathymetrySampler,vec2(gl_FragCoord.x-1.0,gl_FragCoord.y)).r+
+	         texture2DRect(bathymetrySampler,vec2(gl_FragCoord.xy)).r)*0.25;
+	
+	/* Calculate the water column height and flow speed at the cell center: */
+	vec3 q=texture2DRect(quantitySampler,gl_FragCoord.xy).rgb;
+	float h=q.x-b;
+	bool wet=h>wetDepth;
+	float speed=wet?length(q.yz)/h:0.0;
+	
+	/* Check if the cell is in the outermost layer of cells that is dried by the boundary condition: */
+	bool boundary=gl_FragCoord.x<1.0||gl_FragCoord.x>gridSize.x-1.0||gl_FragCoord.y<1.0||gl_FragCoord.y>gridSize.y-1.0;
+	
+	/* Write the summed and maximized statistics: */
+	gl_FragData[0]=vec4(h,wet?1.0:0.0,boundary?h:0.0,0.0);
+	gl_FragData[1]=vec4(h,speed,0.0,0.0);
+	}
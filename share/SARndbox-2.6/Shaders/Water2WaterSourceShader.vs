@@ -0,0 +1,43 @@
+/***********************************************************************
+Water2WaterSourceShader - Shader to render disk-shaped water sources and
+sinks as instances of a unit circle template.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+uniform mat4 pmv; // Combined transformation from camera space to clip space
+uniform float stepSize;
+uniform vec3 xAxis; // Camera-space x axis of the base plane
+uniform vec3 yAxis; // Camera-space y axis of the base plane
+
+attribute vec4 source; // Per-instance disk center in camera space and disk radius
+attribute float waterAmount; // Per-instance water amount
+
+varying float scaledWaterAmount;
+
+void main()
+	{
+	/* Use the vertex attribute and the step size uniform to calculate the amount of water to add/remove: */
+	scaledWaterAmount=waterAmount*stepSize;
+	
+	/* Place the unit circle template vertex on the disk in the base plane: */
+	vec3 vertex=source.xyz+(xAxis*gl_Vertex.x+yAxis*gl_Vertex.y)*source.w;
+	
+	/* Transform the vertex to clip space: */
+	gl_Position=pmv*vec4(vertex,1.0);
+	}
@@ -0,0 +1,53 @@
+/***********************************************************************
+WaterWetTileShader - Shader to flag square tiles of the water surface
+mesh that contain water deep enough to be rendered.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform sampler2DRect quantitySampler; // Sampler for the quantity (water level + momentum) texture
+uniform sampler2DRect bathymetrySampler; // Sampler for the bathymetry texture
+uniform float tileSize; // Number of water surface quads along each side of a tile
+
+void main()
+	{
+	/* Get the grid-space position of the tile's first template vertex: */
+	vec2 tileBaseGc=floor(gl_FragCoord.xy)*tileSize+vec2(0.5,0.5);
+	
+	/* Check all template vertices of the tile's quads for water that would not be discarded by the water rendering shader: */
+	float wet=0.0;
+	for(float y=0.0;y<=tileSize&&wet==0.0;y+=1.0)
+		for(float x=0.0;x<=tileSize;x+=1.0)
+			{
+			vec2 vertexGc=tileBaseGc+vec2(x,y);
+			float bathy=(texture2DRect(bathymetrySampler,vertexGc-vec2(1.0,1.0)).r
+			            +texture2DRect(bathymetrySampler,vertexGc-vec2(1.0,0.0)).r
+			            +texture2DRect(bathymetrySampler,vertexGc-vec2(0.0,1.0)).r
+			            +texture2DRect(bathymetrySampler,vertexGc-vec2(0.0,0.0)).r)*0.25;
+			if(texture2DRect(quantitySampler,vertexGc).r-bathy>=0.0025)
+				{
+				wet=1.0;
+				break;
+				}
+			}
+	
+	/* Write the tile's wet flag into the frame buffer: */
+	gl_FragColor=vec4(wet,0.0,0.0,1.0);
+	}